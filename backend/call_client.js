@@ -1,13 +1,67 @@
 const net = require('net');
+const ShmRingWriter = require('./shm_ring');
 
 const CALL_SOCKET_PATH = '/tmp/call_socket';
 
+// Call audio: 16-bit little-endian mono PCM at 8 kHz, one frame per 100 ms.
+// Setting the top bit of the SDR ID byte marks a timed frame, which carries a
+// sequence number and a sample clock timestamp for call_server's jitter buffer.
+// The server sends back the conference mix minus our own voice in the same
+// timed format, one 10 ms frame per tick while anyone else is talking.
+const SAMPLE_RATE = 8000;
+const FRAME_MS = 100;
+const FRAME_SAMPLES = SAMPLE_RATE * FRAME_MS / 1000;
+const TIMED_FRAME_FLAG = 0x80;
+const TIMED_HEADER_SIZE = 7;
+
+// Session hello, sent before the first frame: the codecs we can encode, most
+// preferred first. The server answers with the one it picked.
+const SESSION_MAGIC = Buffer.from([0xFF, 0x43, 0x53, 0x48]); // 0xFF 'CSH'
+const SESSION_VERSION = 1;
+const SESSION_HELLO_SIZE = 6;
+
+// A version 2 hello ends in a flags byte. With SESSION_FLAG_SHM_RING the
+// server's answer also carries the path of a shared memory ring to write
+// frames into; each is then followed on the socket by a doorbell, a frame
+// length of 0xFFFF and the ring's head, instead of going there itself.
+const SESSION_VERSION_FLAGS = 2;
+const SESSION_FLAG_SHM_RING = 0x01;
+const RING_PATH_SIZE = 64;
+const DOORBELL_MARKER = 0xFFFF;
+const CODEC_PCM = 0;
+const CODEC_ADPCM = 1;
+const CODEC_NAMES = ['pcm', 'ima-adpcm', 'opus'];
+
+// IMA-ADPCM, as in c_application/codec.c: 4 bits a sample, each frame headed
+// by the encoder state so it decodes on its own
+const ADPCM_HEADER_SIZE = 4;
+const IMA_INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8];
+const IMA_STEP_TABLE = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+];
+
 class CallClient {
-    constructor() {
+    constructor(options = {}) {
+        this.useShmRing = options.useShmRing ?? process.env.SDR_SHM_RING === '1';
+        this.ring = null;
         this.client = null;
         this.isStreaming = false;
         this.currentSdrId = 0;
         this.streamingTimer = null;
+        this.sequence = 0;
+        this.timestamp = 0;
+        this.callStart = 0;
+        this.mixedBytesReceived = 0;
+        this.codec = CODEC_PCM;
+        this.sessionReply = null;
+        this.adpcmPredictor = 0;
+        this.adpcmStepIndex = 0;
     }
 
     // Start streaming audio frames
@@ -30,11 +84,63 @@ class CallClient {
             
             this.client = net.createConnection(CALL_SOCKET_PATH, () => {
                 console.log('Connected to call server');
-                this.isStreaming = true;
-                
-                // Start streaming dummy audio frames
-                this.streamAudioFrames();
-                resolve();
+                this.sessionReply = Buffer.alloc(0);
+                const offers = [2, CODEC_ADPCM, CODEC_PCM];
+                this.client.write(Buffer.concat([
+                    SESSION_MAGIC,
+                    this.useShmRing
+                        ? Buffer.from([SESSION_VERSION_FLAGS, ...offers, SESSION_FLAG_SHM_RING])
+                        : Buffer.from([SESSION_VERSION, ...offers])
+                ]));
+            });
+
+            this.client.on('data', (chunk) => {
+                if (this.sessionReply) {
+                    this.sessionReply = Buffer.concat([this.sessionReply, chunk]);
+                    const replySize = this.useShmRing
+                        ? SESSION_HELLO_SIZE + 1 + RING_PATH_SIZE : SESSION_HELLO_SIZE;
+                    if (this.sessionReply.length < replySize) {
+                        return;
+                    }
+                    const reply = this.sessionReply;
+                    this.sessionReply = null;
+                    if (!reply.subarray(0, 4).equals(SESSION_MAGIC) ||
+                        reply[4] !== (this.useShmRing ? SESSION_VERSION_FLAGS : SESSION_VERSION) ||
+                        (reply[5] !== CODEC_PCM && reply[5] !== CODEC_ADPCM)) {
+                        console.error('Call server sent an invalid session reply');
+                        this.stopCall();
+                        return reject(new Error('Invalid session reply'));
+                    }
+                    this.codec = reply[5];
+                    console.log(`Call audio codec: ${CODEC_NAMES[this.codec]}`);
+                    if (this.useShmRing && (reply[SESSION_HELLO_SIZE] & SESSION_FLAG_SHM_RING)) {
+                        const path = reply.toString('utf8', SESSION_HELLO_SIZE + 1, replySize)
+                                          .replace(/\0.*$/s, '');
+                        try {
+                            this.ring = new ShmRingWriter(path);
+                            console.log(`Call audio goes through ${path}`);
+                        } catch (err) {
+                            console.error('Staying on the socket:', err.message);
+                        }
+                    }
+                    chunk = reply.subarray(replySize);
+
+                    this.isStreaming = true;
+                    this.sequence = 0;
+                    this.timestamp = 0;
+                    this.adpcmPredictor = 0;
+                    this.adpcmStepIndex = 0;
+                    this.callStart = Date.now();
+                    this.mixedBytesReceived = 0;
+
+                    // Start streaming dummy audio frames
+                    this.streamAudioFrames();
+                    resolve();
+                }
+
+                // Mixed audio from the other talkers; there is no playback
+                // here, but it must be read so the server's sends do not back up
+                this.mixedBytesReceived += chunk.length;
             });
 
             this.client.on('end', () => {
@@ -57,7 +163,7 @@ class CallClient {
         });
     }
 
-    // Stream dummy audio frames every 100ms
+    // Stream dummy audio frames every FRAME_MS
     streamAudioFrames() {
         if (!this.isStreaming || !this.client) {
             console.log('Streaming stopped or no client connection');
@@ -66,14 +172,20 @@ class CallClient {
 
         // Create dummy audio frame
         const audioData = this.createDummyAudioFrame();
-        
-        // Send frame with 2-byte big endian length prefix
         const frameLength = audioData.length;
-        const lengthBuffer = Buffer.alloc(2);
-        lengthBuffer.writeUInt16BE(frameLength, 0);
-        
-        // Combine length and data
-        const frame = Buffer.concat([lengthBuffer, audioData]);
+        let frame;
+
+        if (this.ring && this.ring.write(audioData)) {
+            // The frame is in the ring; the doorbell says how far to read
+            frame = Buffer.alloc(10);
+            frame.writeUInt16BE(DOORBELL_MARKER, 0);
+            frame.writeBigUInt64BE(BigInt(this.ring.head), 2);
+        } else {
+            // Send frame with 2-byte big endian length prefix
+            const lengthBuffer = Buffer.alloc(2);
+            lengthBuffer.writeUInt16BE(frameLength, 0);
+            frame = Buffer.concat([lengthBuffer, audioData]);
+        }
         
         try {
             this.client.write(frame);
@@ -84,26 +196,64 @@ class CallClient {
             return;
         }
 
-        // Schedule next frame
-        this.streamingTimer = setTimeout(() => this.streamAudioFrames(), 100);
+        // Schedule the next frame against the call's start, so timer drift
+        // does not accumulate into jitter
+        const next = this.callStart + this.sequence * FRAME_MS;
+        this.streamingTimer = setTimeout(() => this.streamAudioFrames(),
+                                         Math.max(0, next - Date.now()));
     }
 
     // Create dummy audio frame (simulated audio data)
     createDummyAudioFrame() {
-        // Optimized for 128-node network (SDR IDs 0-127)
-        const frameSize = 64; // Small frame for demo
-        const audioFrame = Buffer.alloc(frameSize);
-        
-        // Set SDR ID in first byte (7 bits used, 1 bit available for future use)
-        // Mask to ensure SDR ID is within 0-127 range
-        audioFrame[0] = this.currentSdrId & 0x7F; // Use only 7 bits (0-127)
-        
-        // Fill with dummy audio data (sine wave pattern)
-        for (let i = 1; i < frameSize; i++) {
-            audioFrame[i] = Math.floor(127 * Math.sin(2 * Math.PI * i / 32)) + 128;
+        // Dummy audio data (440 Hz sine wave)
+        const pcm = new Int16Array(FRAME_SAMPLES);
+        for (let i = 0; i < FRAME_SAMPLES; i++) {
+            const t = (this.timestamp + i) / SAMPLE_RATE;
+            pcm[i] = Math.round(8000 * Math.sin(2 * Math.PI * 440 * t));
         }
-        
-        return audioFrame;
+        const payload = this.codec === CODEC_ADPCM ? this.encodeAdpcm(pcm)
+                                                   : Buffer.from(pcm.buffer);
+
+        const header = Buffer.alloc(TIMED_HEADER_SIZE);
+        // SDR ID in the low 7 bits of the first byte (128-node network),
+        // the top bit marks the timed frame layout
+        header[0] = TIMED_FRAME_FLAG | (this.currentSdrId & 0x7F);
+        header.writeUInt16BE(this.sequence & 0xFFFF, 1);
+        header.writeUInt32BE(this.timestamp >>> 0, 3);
+
+        this.sequence++;
+        this.timestamp += FRAME_SAMPLES;
+        return Buffer.concat([header, payload]);
+    }
+
+    // IMA-ADPCM encode one frame; the predictor carries on into the next
+    encodeAdpcm(pcm) {
+        const out = Buffer.alloc(ADPCM_HEADER_SIZE + Math.ceil(pcm.length / 2));
+        out.writeInt16LE(this.adpcmPredictor, 0);
+        out[2] = this.adpcmStepIndex;
+
+        for (let i = 0; i < pcm.length; i++) {
+            let step = IMA_STEP_TABLE[this.adpcmStepIndex];
+            let diff = pcm[i] - this.adpcmPredictor;
+            let code = 0;
+            if (diff < 0) {
+                code = 8;
+                diff = -diff;
+            }
+            let delta = step >> 3;
+            if (diff >= step) { code |= 4; diff -= step; delta += step; }
+            step >>= 1;
+            if (diff >= step) { code |= 2; diff -= step; delta += step; }
+            step >>= 1;
+            if (diff >= step) { code |= 1; delta += step; }
+
+            this.adpcmPredictor += code & 8 ? -delta : delta;
+            this.adpcmPredictor = Math.max(-32768, Math.min(32767, this.adpcmPredictor));
+            this.adpcmStepIndex = Math.max(0, Math.min(88,
+                this.adpcmStepIndex + IMA_INDEX_TABLE[code & 7]));
+            out[ADPCM_HEADER_SIZE + (i >> 1)] |= i & 1 ? code << 4 : code;
+        }
+        return out;
     }
 
     // Stop the call
@@ -119,6 +269,10 @@ class CallClient {
         
         // Set streaming to false first
         this.isStreaming = false;
+        if (this.ring) {
+            this.ring.close();
+            this.ring = null;
+        }
         
         // Close the client connection
         if (this.client) {
@@ -167,7 +321,10 @@ class CallClient {
         return {
             isStreaming: this.isStreaming,
             currentSdrId: this.currentSdrId,
-            hasClient: !!this.client
+            hasClient: !!this.client,
+            codec: CODEC_NAMES[this.codec],
+            shmRing: !!this.ring,
+            mixedBytesReceived: this.mixedBytesReceived
         };
     }
 }
@@ -1,128 +1,344 @@
 const net = require('net');
 const fs = require('fs');
 const path = require('path');
+const crypto = require('crypto');
 
 const FILE_SOCKET_PATH = '/tmp/file_socket';
-const CHUNK_SIZE = 1024; // 1KB chunks
+const CHUNK_SIZE = 1024 * 1024; // 1MB chunks
 
-class FileClient {
-    constructor() {
-        this.client = null;
+// Resumable uploads: retry after failures, and split big files across
+// several connections
+const MAX_ATTEMPTS = 5;
+const RETRY_DELAY_MS = 1000;
+const PARALLEL_STREAMS = 4;
+const PARALLEL_THRESHOLD = 8 * 1024 * 1024;
+const TRANSFER_TIMEOUT_MS = 30000;
+
+// Binary transfer protocol (see file_server.c)
+const TRANSFER_MAGIC = Buffer.from([0xFF, 0x4D, 0x46, 0x54]); // 0xFF 'M' 'F' 'T'
+const TRANSFER_VERSION = 1;
+const RESUMABLE_VERSION = 2;
+const CHECKSUM_CRC32C = 1;
+
+// CRC32C (Castagnoli) lookup table, reflected polynomial 0x82F63B78
+const CRC32C_TABLE = (() => {
+    const table = new Uint32Array(256);
+    for (let i = 0; i < 256; i++) {
+        let crc = i;
+        for (let bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >>> 1) ^ 0x82F63B78 : crc >>> 1;
+        }
+        table[i] = crc >>> 0;
     }
+    return table;
+})();
 
-    // Send a file to the C server via Unix Domain Socket
-    sendFile(filePath, originalName) {
-        return new Promise((resolve, reject) => {
-            const client = net.createConnection(FILE_SOCKET_PATH, () => {
-                console.log('Connected to file server');
-                this.streamFile(client, filePath, originalName, resolve, reject);
-            });
+// Running CRC32C update; start from 0 and feed consecutive buffers
+function crc32cUpdate(crc, buffer) {
+    crc = ~crc >>> 0;
+    for (let i = 0; i < buffer.length; i++) {
+        crc = CRC32C_TABLE[(crc ^ buffer[i]) & 0xFF] ^ (crc >>> 8);
+    }
+    return ~crc >>> 0;
+}
 
-            client.on('error', (err) => {
-                console.error('File client error:', err.message);
-                reject(err);
-            });
+// Versioned header carrying filename, size and checksum. Resumable uploads
+// also carry the content ID the server keys the transfer on.
+function buildHeader(originalName, fileSize, checksum, contentId) {
+    const name = Buffer.from(originalName);
+    const header = Buffer.alloc(24);
+    TRANSFER_MAGIC.copy(header, 0);
+    header.writeUInt8(contentId ? RESUMABLE_VERSION : TRANSFER_VERSION, 4);
+    header.writeUInt8(CHECKSUM_CRC32C, 5);
+    header.writeUInt16BE(name.length, 6);
+    header.writeBigUInt64BE(BigInt(fileSize), 8);
+    header.writeBigUInt64BE(BigInt(checksum), 16);
+    return Buffer.concat(contentId ? [header, contentId, name] : [header, name]);
+}
 
-            client.on('close', () => {
-                console.log('Connection to file server closed');
-            });
+// Length-delimited chunk; a zero-length chunk marks the end of the file
+function chunkHeader(length) {
+    const header = Buffer.alloc(4);
+    header.writeUInt32BE(length, 0);
+    return header;
+}
 
-            // Set a timeout for the connection
-            client.setTimeout(30000, () => {
-                console.error('File transfer timeout');
-                client.destroy();
-                reject(new Error('File transfer timeout'));
-            });
-        });
+// Resumable chunk: length, file offset and CRC32C of the data
+function resumableChunkHeader(length, offset, crc) {
+    const header = Buffer.alloc(16);
+    header.writeUInt32BE(length, 0);
+    header.writeBigUInt64BE(BigInt(offset), 4);
+    header.writeUInt32BE(crc, 12);
+    return header;
+}
+
+// One pass over a file for its size, CRC32C and content ID. The ID covers the
+// name too, so the same bytes uploaded under two names are separate transfers.
+function fingerprintFile(filePath, originalName) {
+    return new Promise((resolve, reject) => {
+        let crc = 0;
+        let size = 0;
+        const hash = crypto.createHash('sha256').update(originalName).update('\0');
+        fs.createReadStream(filePath, { highWaterMark: CHUNK_SIZE })
+            .on('data', (chunk) => {
+                crc = crc32cUpdate(crc, chunk);
+                hash.update(chunk);
+                size += chunk.length;
+            })
+            .on('end', () => resolve({ size, checksum: crc, contentId: hash.digest().subarray(0, 16) }))
+            .on('error', reject);
+    });
+}
+
+// Byte ranges of [0, size) not covered by the server's sorted range list
+function missingRanges(held, size) {
+    const missing = [];
+    let cursor = 0;
+    for (const [start, end] of held) {
+        if (start > cursor) {
+            missing.push([cursor, start]);
+        }
+        cursor = Math.max(cursor, end);
+    }
+    if (cursor < size) {
+        missing.push([cursor, size]);
+    }
+    return missing;
+}
+
+// Split ranges into up to `count` contiguous shares of roughly equal size
+function splitRanges(ranges, count) {
+    const total = ranges.reduce((sum, [start, end]) => sum + end - start, 0);
+    const perShare = Math.max(CHUNK_SIZE, Math.ceil(total / count));
+    const shares = [];
+    let current = [];
+    let currentSize = 0;
+
+    for (let [start, end] of ranges) {
+        while (start < end) {
+            const take = Math.min(end - start, perShare - currentSize);
+            current.push([start, start + take]);
+            currentSize += take;
+            start += take;
+            if (currentSize === perShare) {
+                shares.push(current);
+                current = [];
+                currentSize = 0;
+            }
+        }
+    }
+    if (current.length) {
+        shares.push(current);
     }
+    return shares;
+}
 
-    // Stream file data in chunks
-    streamFile(client, filePath, originalName, resolve, reject) {
-        const fileStream = fs.createReadStream(filePath);
-        const stats = fs.statSync(filePath);
-        const fileSize = stats.size;
-        
-        console.log(`Starting file transfer: ${originalName} (${fileSize} bytes)`);
+// A resumable-protocol connection: sends the header, then exposes the ranges
+// the server already holds and the final one-line response as promises
+function openResumableConnection(header) {
+    const socket = net.createConnection(FILE_SOCKET_PATH, () => socket.write(header));
+    let buffer = Buffer.alloc(0);
+    let rangesDone = false;
+    let settleRanges;
+    let settleResponse;
 
-        // Send file metadata first (filename:filesize)
-        const metadata = `${originalName}:${fileSize}\n`;
-        client.write(metadata);
+    const ranges = new Promise((resolve, reject) => { settleRanges = { resolve, reject }; });
+    const response = new Promise((resolve, reject) => { settleResponse = { resolve, reject }; });
+    ranges.catch(() => {});
+    response.catch(() => {});
 
-        let bytesSent = 0;
-        let responseReceived = false;
-        let transferComplete = false;
+    const fail = (err) => {
+        settleRanges.reject(err);
+        settleResponse.reject(err);
+        socket.destroy();
+    };
 
-        // Handle server response
-        client.on('data', (data) => {
-            if (!responseReceived) {
-                responseReceived = true;
-                const response = data.toString().trim();
+    socket.on('data', (data) => {
+        buffer = Buffer.concat([buffer, data]);
+        if (!rangesDone) {
+            // An early text reply means the header was refused
+            if (buffer.length >= 4 && buffer.toString('latin1', 0, 4) === 'ERRO') {
+                rangesDone = true;
+                settleRanges.reject(new Error(buffer.toString().trim()));
+                return;
+            }
+            if (buffer.length < 4) {
+                return;
+            }
+            const count = buffer.readUInt32BE(0);
+            if (buffer.length < 4 + count * 16) {
+                return;
+            }
+            const held = [];
+            for (let i = 0; i < count; i++) {
+                held.push([
+                    Number(buffer.readBigUInt64BE(4 + i * 16)),
+                    Number(buffer.readBigUInt64BE(12 + i * 16))
+                ]);
+            }
+            buffer = buffer.subarray(4 + count * 16);
+            rangesDone = true;
+            settleRanges.resolve(held);
+        }
+        const text = buffer.toString();
+        if (text.endsWith('\n')) {
+            settleResponse.resolve(text.trim());
+            socket.end();
+        }
+    });
+
+    socket.on('error', fail);
+    socket.on('close', () => fail(new Error('Connection closed without server response')));
+    socket.setTimeout(TRANSFER_TIMEOUT_MS, () => fail(new Error('File transfer timeout')));
+
+    return { socket, ranges, response };
+}
+
+// Write data, waiting for the socket to drain when its buffer is full
+function writeWithBackpressure(socket, data) {
+    if (socket.write(data)) {
+        return Promise.resolve();
+    }
+    return new Promise((resolve, reject) => {
+        const onDrain = () => { socket.off('close', onClose); resolve(); };
+        const onClose = () => { socket.off('drain', onDrain); reject(new Error('Connection closed')); };
+        socket.once('drain', onDrain);
+        socket.once('close', onClose);
+    });
+}
+
+// Stream the given file ranges over a connection, then end the transfer
+async function sendRanges(socket, filePath, ranges, progress) {
+    for (const [start, end] of ranges) {
+        const stream = fs.createReadStream(filePath, { start, end: end - 1, highWaterMark: CHUNK_SIZE });
+        let offset = start;
+        for await (const chunk of stream) {
+            await writeWithBackpressure(socket,
+                Buffer.concat([resumableChunkHeader(chunk.length, offset, crc32cUpdate(0, chunk)), chunk]));
+            offset += chunk.length;
+            progress(chunk.length);
+        }
+    }
+    await writeWithBackpressure(socket, chunkHeader(0));
+}
+
+// The server echoes the CRC32C it computed while receiving; a SUCCESS whose
+// digest disagrees with ours means the bytes on disk are not the bytes we sent
+function digestMatches(response, checksum) {
+    const match = /\(crc32c ([0-9a-f]{8})\)/.exec(response);
+    return !match || parseInt(match[1], 16) === checksum;
+}
+
+const sleep = (ms) => new Promise(resolve => setTimeout(resolve, ms));
+
+class FileClient {
+    constructor() {
+        this.client = null;
+    }
+
+    // Send a file to the C server via Unix Domain Socket. The upload is
+    // resumable: after a dropped connection only the missing bytes are resent.
+    async sendFile(filePath, originalName) {
+        const { size, checksum, contentId } = await fingerprintFile(filePath, originalName);
+        const header = buildHeader(originalName, size, checksum, contentId);
+        let lastError = null;
+
+        console.log(`Starting file transfer: ${originalName} (${size} bytes, id ${contentId.toString('hex')})`);
+
+        for (let attempt = 1; attempt <= MAX_ATTEMPTS; attempt++) {
+            try {
+                const response = await this.uploadMissing(filePath, header, size);
                 console.log('File server response:', response);
-                
-                client.end(); // Properly close the connection
-                
-                if (response.includes('SUCCESS')) {
-                    resolve({
+                if (response.startsWith('SUCCESS') && !digestMatches(response, checksum)) {
+                    lastError = new Error(`Server digest does not match ${checksum.toString(16).padStart(8, '0')}`);
+                    break;
+                }
+                if (response.startsWith('SUCCESS')) {
+                    return {
                         success: true,
                         message: `File ${originalName} transferred successfully`,
-                        size: fileSize
-                    });
-                } else {
-                    reject(new Error(`File transfer failed: ${response}`));
+                        size: size
+                    };
                 }
-            }
-        });
-
-        fileStream.on('data', (chunk) => {
-            if (!client.destroyed) {
-                client.write(chunk);
-                bytesSent += chunk.length;
-                
-                // Log progress every 10%
-                const progress = ((bytesSent / fileSize) * 100).toFixed(1);
-                if (bytesSent % Math.max(1, Math.floor(fileSize / 10)) < chunk.length) {
-                    console.log(`File transfer progress: ${progress}% (${bytesSent}/${fileSize} bytes)`);
+                lastError = new Error(response);
+                if (!response.startsWith('PARTIAL')) {
+                    break;
                 }
+            } catch (err) {
+                console.error(`File transfer attempt ${attempt} failed:`, err.message);
+                lastError = err;
             }
-        });
-
-        fileStream.on('end', () => {
-            console.log(`File transfer data completed: ${originalName}`);
-            transferComplete = true;
-            
-            // Send end-of-file marker
-            if (!client.destroyed) {
-                client.write('EOF\n');
-                console.log('EOF marker sent');
+            if (attempt < MAX_ATTEMPTS) {
+                await sleep(RETRY_DELAY_MS);
             }
-        });
+        }
 
-        fileStream.on('error', (err) => {
-            console.error('File read error:', err.message);
-            if (!client.destroyed) {
-                client.destroy();
-            }
-            if (!responseReceived) {
-                reject(err);
+        throw new Error(`File transfer failed: ${lastError.message}`);
+    }
+
+    // Ask the server what it already has and upload the rest, in parallel for
+    // big files. Resolves with the most complete server response.
+    async uploadMissing(filePath, header, size) {
+        const first = openResumableConnection(header);
+        const missing = missingRanges(await first.ranges, size);
+        const shares = splitRanges(missing, size >= PARALLEL_THRESHOLD ? PARALLEL_STREAMS : 1);
+        if (missing.length) {
+            console.log(`Uploading ${missing.reduce((n, [s, e]) => n + e - s, 0)} of ${size} bytes over ${shares.length} connection(s)`);
+        }
+
+        let bytesSent = size - missing.reduce((n, [s, e]) => n + e - s, 0);
+        let lastLogged = 0;
+        const progress = (bytes) => {
+            bytesSent += bytes;
+            const percent = Math.floor((bytesSent / Math.max(1, size)) * 100);
+            if (percent - lastLogged >= 10 || bytesSent === size) {
+                console.log(`File transfer progress: ${percent}% (${bytesSent}/${size} bytes)`);
+                lastLogged = percent;
             }
-        });
+        };
 
-        // Handle client errors during streaming
-        client.on('error', (err) => {
-            if (!responseReceived) {
-                console.error('Client error during streaming:', err.message);
-                reject(err);
+        const connections = [first];
+        for (let i = 1; i < shares.length; i++) {
+            connections.push(openResumableConnection(header));
+        }
+
+        const responses = await Promise.all(connections.map(async (conn, i) => {
+            await conn.ranges;
+            await sendRanges(conn.socket, filePath, shares[i] || [], progress);
+            return conn.response;
+        }));
+
+        return responses.find(r => r.startsWith('ERROR')) ||
+            responses.find(r => r.startsWith('SUCCESS')) ||
+            responses[0];
+    }
+
+    // Settle the transfer promise from the server's one-line response
+    handleResponse(client, originalName, fileSize, checksum, resolve, reject) {
+        let responseReceived = false;
+
+        client.on('data', (data) => {
+            if (responseReceived) {
+                return;
             }
-        });
+            responseReceived = true;
+            const response = data.toString().trim();
+            console.log('File server response:', response);
 
-        // Handle connection close
-        client.on('close', () => {
-            console.log('Connection closed');
-            if (!responseReceived && transferComplete) {
-                // Connection closed without response - this shouldn't happen
-                reject(new Error('Connection closed without server response'));
+            client.end(); // Properly close the connection
+
+            if (response.includes('SUCCESS') && digestMatches(response, checksum)) {
+                resolve({
+                    success: true,
+                    message: `File ${originalName} transferred successfully`,
+                    size: fileSize
+                });
+            } else {
+                reject(new Error(`File transfer failed: ${response}`));
             }
         });
+
+        return () => responseReceived;
     }
 
     // Send buffer data directly (for in-memory files)
@@ -143,54 +359,41 @@ class FileClient {
     // Stream buffer data in chunks
     streamBuffer(client, buffer, originalName, resolve, reject) {
         const fileSize = buffer.length;
-        
+        const checksum = crc32cUpdate(0, buffer);
+
         console.log(`Starting buffer transfer: ${originalName} (${fileSize} bytes)`);
 
-        // Send file metadata first (filename:filesize)
-        const metadata = `${originalName}:${fileSize}\n`;
-        client.write(metadata);
+        // Wait for acknowledgment from C server
+        this.handleResponse(client, originalName, fileSize, checksum, resolve, reject);
+
+        // Send file metadata first
+        client.write(buildHeader(originalName, fileSize, checksum));
 
         let bytesSent = 0;
 
         // Send buffer in chunks
         for (let i = 0; i < buffer.length; i += CHUNK_SIZE) {
-            const chunk = buffer.slice(i, i + CHUNK_SIZE);
+            const chunk = buffer.subarray(i, i + CHUNK_SIZE);
+            client.write(chunkHeader(chunk.length));
             client.write(chunk);
             bytesSent += chunk.length;
-            
+
             // Log progress
             const progress = ((bytesSent / fileSize) * 100).toFixed(1);
             console.log(`Buffer transfer progress: ${progress}% (${bytesSent}/${fileSize} bytes)`);
         }
 
         console.log(`Buffer transfer completed: ${originalName}`);
-        
-        // Send end-of-file marker
-        client.write('EOF\n');
-        
-        // Wait for acknowledgment from C server
-        client.on('data', (data) => {
-            const response = data.toString().trim();
-            console.log('File server response:', response);
-            client.end();
-            
-            if (response.includes('SUCCESS')) {
-                resolve({
-                    success: true,
-                    message: `File ${originalName} transferred successfully`,
-                    size: fileSize
-                });
-            } else {
-                reject(new Error(`File transfer failed: ${response}`));
-            }
-        });
+
+        // Send end-of-file chunk
+        client.write(chunkHeader(0));
     }
 }
 
 // Example usage when run directly
 if (require.main === module) {
     const client = new FileClient();
-    
+
     // Test with a sample file
     const testFile = path.join(__dirname, 'package.json');
     client.sendFile(testFile, 'test-package.json')
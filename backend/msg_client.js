@@ -2,33 +2,124 @@ const net = require('net');
 
 const MSG_SOCKET_PATH = '/tmp/msg_socket';
 
+// Framed protocol (see msg_server.c): a 2-byte preface opts in, then each
+// request is [len:2 BE][request_id:4 BE][payload] and each ack is
+// [len:2 BE][request_id:4 BE][status:1][text]
+const FRAME_PREFACE = Buffer.from([0xFF, 0x01]);
+const MAX_PAYLOAD_SIZE = 65535 - 4;
+
 class MessageClient {
     constructor() {
         this.client = null;
+        this.connecting = null;
+        this.nextRequestId = 1;
+        this.pending = new Map();
+        this.recvBuffer = Buffer.alloc(0);
     }
 
-    // Send a regular text message
-    sendMessage(message) {
-        return new Promise((resolve, reject) => {
+    // Open (or reuse) the persistent framed connection
+    connect() {
+        if (this.client) {
+            return Promise.resolve(this.client);
+        }
+        if (this.connecting) {
+            return this.connecting;
+        }
+
+        this.connecting = new Promise((resolve, reject) => {
             const client = net.createConnection(MSG_SOCKET_PATH, () => {
                 console.log('Connected to message server');
-                client.write(message);
+                client.write(FRAME_PREFACE);
+                this.client = client;
+                this.connecting = null;
+                resolve(client);
             });
 
-            client.on('data', (data) => {
-                console.log('Received from message server:', data.toString());
-                client.end();
-                resolve(data.toString());
-            });
+            client.on('data', (data) => this.handleData(data));
 
-            client.on('end', () => {
+            client.on('close', () => {
                 console.log('Disconnected from message server');
+                this.reset(client, new Error('Message server connection closed'));
             });
 
             client.on('error', (err) => {
                 console.error('Message client error:', err.message);
-                reject(err);
+                if (this.connecting) {
+                    this.connecting = null;
+                    reject(err);
+                }
+                this.reset(client, err);
+            });
+        });
+
+        return this.connecting;
+    }
+
+    // Fail every outstanding request so callers never hang on a dead socket
+    reset(client, err) {
+        if (this.client !== client) {
+            return;  // A newer connection has already replaced this one
+        }
+        client.destroy();
+        this.client = null;
+        this.recvBuffer = Buffer.alloc(0);
+        for (const { reject } of this.pending.values()) {
+            reject(err);
+        }
+        this.pending.clear();
+    }
+
+    // Split the ack stream into frames and settle the matching requests
+    handleData(data) {
+        this.recvBuffer = this.recvBuffer.length
+            ? Buffer.concat([this.recvBuffer, data])
+            : data;
+
+        let offset = 0;
+        while (this.recvBuffer.length - offset >= 2) {
+            const frameLength = this.recvBuffer.readUInt16BE(offset);
+            if (this.recvBuffer.length - offset < 2 + frameLength) {
+                break;
+            }
+
+            const requestId = this.recvBuffer.readUInt32BE(offset + 2);
+            const text = this.recvBuffer.toString('utf8', offset + 7, offset + 2 + frameLength);
+            offset += 2 + frameLength;
+
+            const request = this.pending.get(requestId);
+            if (request) {
+                this.pending.delete(requestId);
+                request.resolve(text);
+            }
+        }
+
+        this.recvBuffer = this.recvBuffer.subarray(offset);
+    }
+
+    // Send a regular text message; many may be in flight on one connection
+    async sendMessage(message) {
+        const payload = Buffer.from(message);
+        if (payload.length > MAX_PAYLOAD_SIZE) {
+            throw new Error(`Message too large (${payload.length} > ${MAX_PAYLOAD_SIZE} bytes)`);
+        }
+
+        const client = await this.connect();
+        const requestId = this.nextRequestId;
+        this.nextRequestId = (this.nextRequestId % 0xFFFFFFFF) + 1;
+
+        const header = Buffer.alloc(6);
+        header.writeUInt16BE(payload.length + 4, 0);
+        header.writeUInt32BE(requestId, 2);
+
+        return new Promise((resolve, reject) => {
+            this.pending.set(requestId, {
+                resolve: (response) => {
+                    console.log('Received from message server:', response);
+                    resolve(response);
+                },
+                reject
             });
+            client.write(Buffer.concat([header, payload]));
         });
     }
 
@@ -38,28 +129,36 @@ class MessageClient {
             command: "start_call",
             destination_id: destinationId
         };
-        
+
         const jsonCommand = JSON.stringify(command);
         console.log('Sending call command:', jsonCommand);
-        
+
         return this.sendMessage(jsonCommand);
     }
+
+    // Close the persistent connection
+    close() {
+        if (this.client) {
+            this.client.end();
+        }
+    }
 }
 
 // Example usage when run directly
 if (require.main === module) {
     const client = new MessageClient();
-    
+
     // Test with a message
     client.sendMessage("Hello from Node.js client!")
         .then(response => console.log('Message response:', response))
         .catch(err => console.error('Error:', err));
-    
+
     // Test with a call command
     setTimeout(() => {
         client.sendCallCommand(2)
             .then(response => console.log('Call response:', response))
-            .catch(err => console.error('Call error:', err));
+            .catch(err => console.error('Call error:', err))
+            .finally(() => client.close());
     }, 2000);
 }
 
@@ -185,7 +185,8 @@ app.get('/api/files', (req, res) => {
             fs.mkdirSync(uploadsDir, { recursive: true });
         }
         
-        const files = fs.readdirSync(uploadsDir).map(filename => {
+        // Dotfiles are uploads still in progress on the file server
+        const files = fs.readdirSync(uploadsDir).filter(filename => !filename.startsWith('.')).map(filename => {
             const filepath = path.join(uploadsDir, filename);
             const stats = fs.statSync(filepath);
             return {
@@ -218,7 +219,8 @@ app.delete('/api/files/clear', (req, res) => {
             });
         }
         
-        const files = fs.readdirSync(uploadsDir);
+        // Leave dotfiles alone: they belong to transfers still in progress
+        const files = fs.readdirSync(uploadsDir).filter(filename => !filename.startsWith('.'));
         let deletedCount = 0;
         
         files.forEach(filename => {
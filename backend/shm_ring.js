@@ -0,0 +1,80 @@
+const fs = require('fs');
+
+// Producer side of the shared memory ring in c_application/shm_ring.h. The
+// server creates the ring and sends its path; frames written here are
+// announced with a doorbell on the socket carrying the new head. Node cannot
+// map memory, so records go into the ring file with positioned writes and
+// the server's tail is read back the same way.
+const RING_MAGIC = 0x52524453; // "SDRR"
+const RING_VERSION = 1;
+const HEADER_SIZE = 4096;
+const TAIL_OFFSET = 64;
+const RECORD_HEADER = 4;
+const WRAP_MARKER = Buffer.from([0xFF, 0xFF, 0xFF, 0xFF]);
+
+class ShmRingWriter {
+    constructor(path) {
+        this.path = path;
+        this.fd = fs.openSync(path, 'r+');
+        const header = Buffer.alloc(16);
+        fs.readSync(this.fd, header, 0, header.length, 0);
+        if (header.readUInt32LE(0) !== RING_MAGIC || header.readUInt32LE(4) !== RING_VERSION) {
+            fs.closeSync(this.fd);
+            throw new Error(`${path} is not a shared memory ring`);
+        }
+        this.capacity = Number(header.readBigUInt64LE(8));
+        this.head = 0;
+        this.tail = 0;
+        this.lengthBuffer = Buffer.alloc(RECORD_HEADER);
+        this.tailReads = [Buffer.alloc(8), Buffer.alloc(8)];
+    }
+
+    // The server may be storing its tail while we read it, so a value only
+    // counts once two reads in a row agree
+    readTail() {
+        const [first, second] = this.tailReads;
+        do {
+            fs.readSync(this.fd, first, 0, 8, TAIL_OFFSET);
+            fs.readSync(this.fd, second, 0, 8, TAIL_OFFSET);
+        } while (!first.equals(second));
+        this.tail = Number(first.readBigUInt64LE(0));
+    }
+
+    // Append one record. Returns false when it does not fit until the server
+    // has read further; the caller then sends it on the socket instead.
+    write(payload) {
+        const size = Math.ceil((RECORD_HEADER + payload.length) / 8) * 8;
+        let offset = this.head % this.capacity;
+        const skip = offset + size > this.capacity ? this.capacity - offset : 0;
+        if (skip + size > this.capacity) {
+            return false;
+        }
+        if (this.head + skip + size - this.tail > this.capacity) {
+            this.readTail();
+            if (this.head + skip + size - this.tail > this.capacity) {
+                return false;
+            }
+        }
+
+        if (skip) {
+            fs.writeSync(this.fd, WRAP_MARKER, 0, WRAP_MARKER.length, HEADER_SIZE + offset);
+            offset = 0;
+        }
+        this.lengthBuffer.writeUInt32LE(payload.length, 0);
+        const written = fs.writevSync(this.fd, [this.lengthBuffer, payload], HEADER_SIZE + offset);
+        if (written !== RECORD_HEADER + payload.length) {
+            throw new Error(`Short write to ${this.path}`);
+        }
+        this.head += skip + size;
+        return true;
+    }
+
+    close() {
+        if (this.fd !== null) {
+            fs.closeSync(this.fd);
+            this.fd = null;
+        }
+    }
+}
+
+module.exports = ShmRingWriter;
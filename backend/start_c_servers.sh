@@ -2,6 +2,7 @@
 
 # MANET Application Startup Script for npm start
 # This script is called by npm start to open each C server in a separate terminal
+# With --daemon it opens one terminal running all of them in sdr_daemon instead
 
 # Colors for output
 RED='\033[0;31m'
@@ -105,6 +106,14 @@ main() {
     # Go back to backend directory
     cd ../backend
     
+    if [ "$1" = "--daemon" ]; then
+        start_server_terminal "sdr_daemon" "$TERMINAL"
+        sleep 1
+        print_success "All C servers started in sdr_daemon"
+        print_status "Starting Node.js backend server..."
+        return 0
+    fi
+
     # Start each server in a separate terminal
     start_server_terminal "msg_server" "$TERMINAL"
     sleep 1
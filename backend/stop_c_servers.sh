@@ -1,7 +1,7 @@
 #!/bin/bash
 
 # Stop C servers only
-# This script stops msg_server, call_server, and file_server
+# This script stops msg_server, call_server, file_server, video_server and sdr_daemon
 
 # Colors for output
 RED='\033[0;31m'
@@ -52,7 +52,7 @@ stop_processes_by_name() {
 # Function to cleanup socket files
 cleanup_sockets() {
     print_status "Cleaning up socket files..."
-    rm -f /tmp/msg_socket /tmp/call_socket /tmp/file_socket /tmp/video_socket
+    rm -f /tmp/msg_socket /tmp/call_socket /tmp/call_socket.seq /tmp/file_socket /tmp/video_socket
     print_success "Socket files cleaned up"
 }
 
@@ -65,6 +65,7 @@ main() {
     stop_processes_by_name "call_server"
     stop_processes_by_name "file_server"
     stop_processes_by_name "video_server"
+    stop_processes_by_name "sdr_daemon"
     
     # Cleanup sockets
     cleanup_sockets
@@ -1,7 +1,25 @@
 const net = require('net');
+const ShmRingWriter = require('./shm_ring');
+
+// Session header: magic, version, flags, stream ID (big endian).
+// video_server keeps a separate live stream and recording per stream ID.
+const SESSION_MAGIC = Buffer.from([0xFF, 0x56, 0x53, 0x48]);
+const SESSION_VERSION = 1;
+
+// With this flag the server answers the header with the path of a shared
+// memory ring to write frames into, and each frame is followed on the socket
+// by a doorbell instead: a frame length of 0xFFFFFFFF and the ring's head.
+// Frames the ring has no room for still go on the socket.
+const SESSION_FLAG_SHM_RING = 0x01;
+const SESSION_HEADER_SIZE = 8;
+const SESSION_REPLY_SIZE = SESSION_HEADER_SIZE + 64;
+const DOORBELL_MARKER = 0xFFFFFFFF;
 
 class VideoClient {
-    constructor() {
+    constructor(streamId = 0, options = {}) {
+        this.streamId = streamId;
+        this.useShmRing = options.useShmRing ?? process.env.SDR_SHM_RING === '1';
+        this.ring = null;
         this.socket = null;
         this.connected = false;
         this.reconnectAttempts = 0;
@@ -17,12 +35,49 @@ class VideoClient {
             }
 
             this.socket = new net.Socket();
+            let connectTimer = null;
 
-            this.socket.connect('/tmp/video_socket', () => {
-                console.log('[VideoClient] Connected to video server');
+            const ready = () => {
+                clearTimeout(connectTimer);
+                console.log(`[VideoClient] Connected to video server as stream ${this.streamId}` +
+                            (this.ring ? ` through ${this.ring.path}` : ''));
                 this.connected = true;
                 this.reconnectAttempts = 0;
                 resolve();
+            };
+
+            this.socket.connect('/tmp/video_socket', () => {
+                const header = Buffer.alloc(SESSION_HEADER_SIZE);
+                SESSION_MAGIC.copy(header, 0);
+                header.writeUInt8(SESSION_VERSION, 4);
+                header.writeUInt8(this.useShmRing ? SESSION_FLAG_SHM_RING : 0, 5);
+                header.writeUInt16BE(this.streamId, 6);
+                this.socket.write(header);
+                if (!this.useShmRing) {
+                    ready();
+                }
+            });
+
+            // The server's answer to a ring request
+            let reply = Buffer.alloc(0);
+            this.socket.on('data', (chunk) => {
+                if (!this.useShmRing || this.connected) {
+                    return;
+                }
+                reply = Buffer.concat([reply, chunk]);
+                if (reply.length < SESSION_REPLY_SIZE) {
+                    return;
+                }
+                if (reply[5] & SESSION_FLAG_SHM_RING) {
+                    const path = reply.toString('utf8', SESSION_HEADER_SIZE, SESSION_REPLY_SIZE)
+                                      .replace(/\0.*$/s, '');
+                    try {
+                        this.ring = new ShmRingWriter(path);
+                    } catch (error) {
+                        console.error('[VideoClient] Staying on the socket:', error.message);
+                    }
+                }
+                ready();
             });
 
             this.socket.on('error', (error) => {
@@ -40,10 +95,14 @@ class VideoClient {
                 console.log('[VideoClient] Connection closed');
                 this.connected = false;
                 this.socket = null;
+                if (this.ring) {
+                    this.ring.close();
+                    this.ring = null;
+                }
             });
 
             // Set timeout for connection
-            setTimeout(() => {
+            connectTimer = setTimeout(() => {
                 if (!this.connected) {
                     this.socket.destroy();
                     reject(new Error('Connection timeout to video server'));
@@ -57,6 +116,22 @@ class VideoClient {
             throw new Error('Not connected to video server');
         }
 
+        if (this.ring && this.ring.write(frameData)) {
+            return new Promise((resolve, reject) => {
+                const doorbell = Buffer.allocUnsafe(12);
+                doorbell.writeUInt32BE(DOORBELL_MARKER, 0);
+                doorbell.writeBigUInt64BE(BigInt(this.ring.head), 4);
+                this.socket.write(doorbell, (error) => {
+                    if (error) {
+                        reject(new Error('Failed to send frame doorbell: ' + error.message));
+                        return;
+                    }
+                    console.log(`[VideoClient] Sent video frame: ${frameData.length} bytes (shared memory)`);
+                    resolve();
+                });
+            });
+        }
+
         return new Promise((resolve, reject) => {
             try {
                 // Create frame length header (4 bytes, big endian)
@@ -87,6 +162,10 @@ class VideoClient {
     }
 
     disconnect() {
+        if (this.ring) {
+            this.ring.close();
+            this.ring = null;
+        }
         if (this.socket) {
             this.connected = false;
             console.log('[VideoClient] Disconnecting from video server');
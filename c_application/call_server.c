@@ -1,137 +1,1136 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <signal.h>
 #include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include "mixer.h"
+#include "codec.h"
+#include "sdr_loop.h"
+#include "shm_ring.h"
 
 #define CALL_SOCKET_PATH "/tmp/call_socket"
-#define BUFFER_SIZE 1024
+#define CALL_SEQPACKET_PATH "/tmp/call_socket.seq"  // One frame per packet, no length prefix
+#define MAX_FRAME_SIZE 4096       // Largest frame accepted, header included
+#define MAX_SDR_ID 127            // SDR IDs are the low 7 bits of a frame's first byte
+#define MAX_CALL_CLIENTS 128      // One per SDR ID the 7-bit mask allows
+#define RX_BUFFER_SIZE 32768      // Per stream client; one recv can carry many frames
+#define RECV_BATCH 32             // Packets taken per recvmmsg from a SOCK_SEQPACKET client
 
-int server_fd = -1;
-int current_sdr_id = 0;
+// Call audio is mono at 8 kHz, 16-bit little-endian PCM unless the client
+// negotiated a codec. Frames whose first byte has TIMED_FRAME_FLAG set carry
+// a sequence number and a timestamp in sample clock units; older clients send
+// the SDR ID and audio only.
+#define SAMPLE_RATE CODEC_SAMPLE_RATE
+#define TIMED_FRAME_FLAG 0x80
+#define TIMED_HEADER_SIZE 7       // SDR ID, sequence (u16 BE), timestamp (u32 BE)
+#define MAX_FRAME_SAMPLES ((MAX_FRAME_SIZE - 1) / 2)
 
-// Signal handler for clean shutdown
-void signal_handler(int sig) {
-    printf("\nShutting down Call Server...\n");
-    if (server_fd != -1) {
-        close(server_fd);
+// Playout runs on a 10 ms clock; each active SDR ID gets one block per tick
+#define PLAYOUT_TICK_MS 10
+#define TICK_SAMPLES (SAMPLE_RATE * PLAYOUT_TICK_MS / 1000)
+#define MAX_CATCHUP_TICKS 10      // Ticks replayed after the loop was held up
+
+// Jitter buffer, all depths in samples
+#define JB_SLOTS 64               // Frames held per SDR ID
+#define JB_MIN_DELAY (2 * TICK_SAMPLES)
+#define JB_MAX_DELAY (SAMPLE_RATE / 2)
+#define JB_ADAPT_TICKS 100        // Ticks between depth adjustments
+#define CONCEAL_FADE_TICKS 5      // Repeat the last block, halving it each tick, then silence
+#define STREAM_IDLE_MS 2000       // A stream ends after this long without frames
+#define STATS_INTERVAL 5          // Seconds between jitter buffer statistics lines
+#define RECORD_FILE "/tmp/call_sdr_%d.raw"
+#define MIX_FRAME_SIZE (2 + TIMED_HEADER_SIZE + TICK_SAMPLES * 2)
+
+// A client may open with a session hello before its first frame:
+// [0xFF 'C' 'S' 'H'][version 1][count][codec IDs, most preferred first].
+// No frame length starts with 0xFF, so older clients are never mistaken for
+// one; on the packet socket the hello is a packet of exactly that length. The
+// server answers [0xFF 'C' 'S' 'H'][version 1][codec ID], raw on a stream or
+// as one packet, and both directions use that codec from then on. Clients
+// that send no hello use PCM.
+// A version 2 hello ends in one more byte of flags, and so does its answer.
+// With SESSION_FLAG_SHM_RING a stream client asks to send its frames through
+// a shared memory ring. The answer is then SHM_RING_PATH_MAX bytes longer:
+// the ring's path, NUL padded, or all zeros with the flag cleared to keep
+// the client on the socket.
+// A ring client follows the frames it writes with a doorbell in place of a
+// frame length: [0xFF 0xFF][ring head, u64 big endian].
+#define SESSION_MAGIC "\xFF" "CSH"
+#define SESSION_VERSION 1
+#define SESSION_VERSION_FLAGS 2
+#define SESSION_HELLO_SIZE 6      // Magic, version, codec count or chosen codec
+#define SESSION_FLAG_SHM_RING 0x01
+#define RING_DOORBELL 0xFFFF
+#define DOORBELL_SIZE 10
+#define CALL_RING_SIZE (256 * 1024)
+
+int call_server_fd = -1;
+int seqpacket_fd = -1;
+int call_timer_fd = -1;
+struct sdr_handler call_listener;
+struct sdr_handler seqpacket_listener;
+struct sdr_handler playout_timer;
+int record_calls = 0;  // --record: write each SDR ID's playout to RECORD_FILE
+
+// One received frame, waiting for its turn in the playout
+struct jb_frame {
+    int present;
+    uint64_t seq;             // Extended past 16-bit wraparound
+    uint64_t ts;              // Extended past 32-bit wraparound
+    int samples;
+    uint64_t arrival;         // Local sample clock when it arrived
+    int16_t pcm[MAX_FRAME_SAMPLES];
+};
+
+// Adaptive jitter buffer and playout state for one SDR ID. Frames are slotted
+// by sequence number and played by timestamp, so reordering costs nothing and
+// gaps are concealed for exactly as long as audio is missing.
+struct call_stream {
+    int sdr_id;
+    int active;
+    struct jb_frame slots[JB_SLOTS];
+
+    // Newest frame seen, for extending sequence numbers and timestamps
+    uint64_t last_seq;
+    uint64_t last_ts;
+    uint64_t highest_end;     // Timestamp just past the newest audio received
+    uint16_t legacy_seq;      // Assigned to frames that carry no sequence number
+
+    // Interarrival jitter as in RFC 3550, in samples scaled by 16
+    int64_t last_transit;
+    int64_t jitter_q4;
+
+    // Playout
+    int playing;              // Prebuffering is over
+    uint64_t play_seq;        // Next frame to play
+    uint64_t play_ts;         // Timestamp of the next sample to play
+    int target;               // Depth the buffer steers towards
+    int min_depth;            // Shallowest depth in this adaptation window
+    int adapt_ticks;
+    int16_t last_block[TICK_SAMPLES];  // Last real audio, repeated to conceal loss
+    int16_t block[TICK_SAMPLES];       // This tick's playout, fed to the mixer
+    int talking;              // block holds audio this tick
+    int conceal_run;          // Consecutive ticks concealed
+    int tick_concealed;
+    uint64_t last_arrival;
+    int record_fd;
+
+    // Statistics
+    uint64_t frames_received;
+    uint64_t frames_late;     // Arrived after their audio was played or concealed
+    uint64_t frames_lost;     // Never arrived before playout passed them
+    uint64_t duplicates;
+    uint64_t ticks_played;
+    uint64_t ticks_concealed;
+    uint64_t samples_skipped; // Dropped to bring the delay back down to target
+    uint64_t latency_sum;     // Sample clock time frames waited before playout
+    uint64_t latency_count;
+    time_t last_stats;
+};
+
+// A connected call client, read without blocking. Once its frames name an
+// SDR ID it is also a listener: every tick it is sent the conference mix
+// without its own voice.
+struct call_conn {
+    struct sdr_handler handler;
+    int fd;
+    int seqpacket;            // Connected on CALL_SEQPACKET_PATH
+    unsigned char rx[RX_BUFFER_SIZE];  // Stream clients: bytes not yet parsed
+    size_t rx_start;          // First byte of the oldest incomplete frame
+    size_t rx_end;
+    uint64_t frames;
+    uint64_t reads;           // recv/recvmmsg calls that returned data
+    int negotiated;           // Past the point where a session hello may come
+    int codec;
+    struct codec_state* codec_state;
+    uint64_t audio_bytes;     // Coded audio received, for the compression ratio
+    uint64_t audio_samples;
+    int sdr_id;               // -1 until its first frame
+    uint16_t mix_seq;
+    uint32_t mix_ts;
+    unsigned char pending[MIX_FRAME_SIZE];  // Rest of a partly sent mix frame
+    size_t pending_len;
+    size_t pending_sent;
+    uint64_t mix_dropped;     // Mix frames the listener was too slow to take
+    struct shm_ring ring;     // Frames from the client, if it asked for a ring
+    int ring_open;
+    struct call_conn* next;
+};
+
+struct call_stream* call_streams[MAX_SDR_ID + 1];
+struct call_conn* conns = NULL;
+int conn_count = 0;
+uint64_t call_frames_received = 0;
+uint64_t call_mix_frames_sent = 0;
+uint64_t call_mix_frames_dropped = 0;
+uint64_t call_ring_frames = 0;
+uint64_t call_frames_rejected = 0;
+struct sdr_histogram* call_accept_time;
+struct sdr_histogram* call_recv_time;
+struct sdr_histogram* call_parse_time;  // Decoding a frame into its jitter buffer
+struct sdr_histogram* call_write_time;
+int32_t mix_acc[TICK_SAMPLES];
+
+// SOCK_SEQPACKET clients are read in batches into these; handle_frame copies
+// what it keeps, so one set serves every connection
+unsigned char batch_buffers[RECV_BATCH][MAX_FRAME_SIZE];
+struct iovec batch_iov[RECV_BATCH];
+struct mmsghdr batch_msgs[RECV_BATCH];
+
+// Parse 2-byte big endian length
+uint16_t parse_frame_length(const unsigned char* buffer) {
+    return (uint16_t)(buffer[0] << 8 | buffer[1]);
+}
+
+// Monotonic clock in audio samples, the unit every timestamp here uses
+uint64_t now_samples(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * SAMPLE_RATE + (uint64_t)ts.tv_nsec * SAMPLE_RATE / 1000000000;
+}
+
+int samples_to_ms(int64_t samples) {
+    return (int)(samples * 1000 / SAMPLE_RATE);
+}
+
+void stream_reset(struct call_stream* stream) {
+    for (int i = 0; i < JB_SLOTS; i++) {
+        stream->slots[i].present = 0;
     }
-    unlink(CALL_SOCKET_PATH);
-    exit(0);
+    stream->playing = 0;
+    stream->conceal_run = 0;
+    stream->jitter_q4 = 0;
+    stream->target = JB_MIN_DELAY;
+    stream->min_depth = JB_MAX_DELAY;
+    stream->adapt_ticks = 0;
+    memset(stream->last_block, 0, sizeof(stream->last_block));
 }
 
-// Parse 2-byte big endian length
-uint16_t parse_frame_length(const char* buffer) {
-    return ntohs(*(uint16_t*)buffer);
+void print_call_stream_stats(struct call_stream* stream) {
+    printf("SDR ID %d: %llu frames, jitter %d ms, target %d ms, depth %d ms, "
+           "buffer latency %d ms; late %llu, lost %llu, duplicate %llu; "
+           "concealed %llu ms, skipped %d ms\n",
+           stream->sdr_id, (unsigned long long)stream->frames_received,
+           samples_to_ms(stream->jitter_q4 >> 4), samples_to_ms(stream->target),
+           samples_to_ms((int64_t)(stream->highest_end - stream->play_ts)),
+           stream->latency_count ? samples_to_ms(stream->latency_sum / stream->latency_count) : 0,
+           (unsigned long long)stream->frames_late, (unsigned long long)stream->frames_lost,
+           (unsigned long long)stream->duplicates,
+           (unsigned long long)stream->ticks_concealed * PLAYOUT_TICK_MS,
+           samples_to_ms(stream->samples_skipped));
+    fflush(stdout);
+}
+
+// Jitter buffer for an SDR ID, set up the first time it talks
+struct call_stream* call_stream_get(int sdr_id) {
+    if (!call_streams[sdr_id]) {
+        call_streams[sdr_id] = calloc(1, sizeof(struct call_stream));
+        if (!call_streams[sdr_id]) {
+            perror("calloc");
+            return NULL;
+        }
+        call_streams[sdr_id]->sdr_id = sdr_id;
+        call_streams[sdr_id]->record_fd = -1;
+    }
+    return call_streams[sdr_id];
+}
+
+// First frame of a talk session: start prebuffering from it
+void stream_start(struct call_stream* stream, uint64_t seq, uint64_t ts) {
+    stream_reset(stream);
+    stream->active = 1;
+    stream->last_seq = seq;
+    stream->last_ts = ts;
+    stream->highest_end = ts;
+    stream->play_seq = seq;
+    stream->play_ts = ts;
+    stream->last_stats = time(NULL);
+    stream->frames_received = 0;
+    stream->frames_late = 0;
+    stream->frames_lost = 0;
+    stream->duplicates = 0;
+    stream->ticks_played = 0;
+    stream->ticks_concealed = 0;
+    stream->samples_skipped = 0;
+    stream->latency_sum = 0;
+    stream->latency_count = 0;
+
+    if (record_calls) {
+        char path[64];
+        snprintf(path, sizeof(path), RECORD_FILE, stream->sdr_id);
+        stream->record_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (stream->record_fd == -1) {
+            perror("open recording");
+        }
+    }
+    printf("SDR ID %d: call audio started\n", stream->sdr_id);
+    fflush(stdout);
+}
+
+void stream_end(struct call_stream* stream) {
+    print_call_stream_stats(stream);
+    printf("SDR ID %d: call audio ended\n", stream->sdr_id);
+    fflush(stdout);
+    stream->active = 0;
+    stream_reset(stream);
+    if (stream->record_fd != -1) {
+        close(stream->record_fd);
+        stream->record_fd = -1;
+    }
+}
+
+// File a received frame by sequence number
+void jb_insert(struct call_stream* stream, uint16_t seq16, uint32_t ts32,
+               const int16_t* pcm, int samples, uint64_t arrival) {
+    if (!stream->active) {
+        // Start well clear of zero so earlier frames still extend cleanly
+        stream_start(stream, (uint64_t)1 << 32 | seq16, (uint64_t)1 << 40 | ts32);
+    }
+
+    uint64_t seq = stream->last_seq + (int16_t)(seq16 - (uint16_t)stream->last_seq);
+    uint64_t ts = stream->last_ts + (int32_t)(ts32 - (uint32_t)stream->last_ts);
+    stream->frames_received++;
+    stream->last_arrival = arrival;
+
+    // Jitter: how much the transit time changes from one frame to the next
+    int64_t transit = (int64_t)(arrival - ts);
+    if (stream->frames_received > 1) {
+        int64_t d = transit - stream->last_transit;
+        stream->jitter_q4 += (d < 0 ? -d : d) - ((stream->jitter_q4 + 8) >> 4);
+    }
+    stream->last_transit = transit;
+
+    if (seq > stream->last_seq) {
+        stream->last_seq = seq;
+        stream->last_ts = ts;
+    }
+
+    if (seq < stream->play_seq || ts + samples <= stream->play_ts) {
+        if (!stream->playing && ts + samples > stream->play_ts - JB_MAX_DELAY &&
+            stream->play_seq - seq < JB_SLOTS / 2) {
+            // Still prebuffering: an earlier frame overtook the first one
+            stream->play_seq = seq;
+            stream->play_ts = ts;
+        } else {
+            stream->frames_late++;
+            return;
+        }
+    }
+    if (stream->highest_end <= stream->play_ts && ts > stream->play_ts + TICK_SAMPLES) {
+        // First frame of a new talkspurt after silence: prebuffer again
+        // rather than play the silence out and carry its length as delay
+        stream->frames_lost += seq - stream->play_seq;
+        stream->playing = 0;
+        stream->play_seq = seq;
+        stream->play_ts = ts;
+    }
+    if (seq - stream->play_seq >= JB_SLOTS) {
+        // The sender restarted or skipped far ahead; start over from here
+        printf("SDR ID %d: sequence jumped, resynchronizing\n", stream->sdr_id);
+        fflush(stdout);
+        stream->frames_lost += seq - stream->play_seq;
+        stream_reset(stream);
+        stream->play_seq = seq;
+        stream->play_ts = ts;
+        stream->highest_end = ts;
+    }
+
+    struct jb_frame* slot = &stream->slots[seq % JB_SLOTS];
+    if (slot->present && slot->seq == seq) {
+        stream->duplicates++;
+        return;
+    }
+    slot->present = 1;
+    slot->seq = seq;
+    slot->ts = ts;
+    slot->samples = samples;
+    slot->arrival = arrival;
+    memcpy(slot->pcm, pcm, samples * sizeof(int16_t));
+    if (ts + samples > stream->highest_end) {
+        stream->highest_end = ts + samples;
+    }
+}
+
+// Fill a gap with the last real audio, halving it every tick of a run of
+// concealment so a lost frame fades out instead of buzzing or clicking
+void conceal(struct call_stream* stream, int16_t* out, int offset, int count) {
+    stream->tick_concealed = 1;
+    if (!out) {
+        return;
+    }
+    int shift = stream->conceal_run < CONCEAL_FADE_TICKS ? stream->conceal_run + 1 : 16;
+    for (int i = 0; i < count; i++) {
+        out[offset + i] = shift < 16 ? stream->last_block[(offset + i) % TICK_SAMPLES] >> shift : 0;
+    }
+}
+
+// Play up to count samples from the buffer into out (NULL to discard them).
+// Returns how many samples the buffer could provide; it stops short only
+// when it has run dry.
+int jb_read(struct call_stream* stream, int16_t* out, int count, uint64_t now) {
+    int filled = 0;
+
+    while (filled < count) {
+        struct jb_frame* frame = &stream->slots[stream->play_seq % JB_SLOTS];
+
+        if (frame->present && frame->seq == stream->play_seq) {
+            if (stream->play_ts < frame->ts) {
+                // Audio before this frame never came: lost, or the sender paused
+                int n = frame->ts - stream->play_ts < (uint64_t)(count - filled)
+                            ? (int)(frame->ts - stream->play_ts) : count - filled;
+                conceal(stream, out, filled, n);
+                stream->play_ts += n;
+                filled += n;
+                continue;
+            }
+            uint64_t offset = stream->play_ts - frame->ts;
+            if (offset >= (uint64_t)frame->samples) {
+                frame->present = 0;  // Overlapped by audio already played
+                stream->play_seq++;
+                continue;
+            }
+            if (offset == 0) {
+                stream->latency_sum += now - frame->arrival;
+                stream->latency_count++;
+            }
+            int n = frame->samples - (int)offset < count - filled ? frame->samples - (int)offset
+                                                                  : count - filled;
+            if (out) {
+                memcpy(out + filled, frame->pcm + offset, n * sizeof(int16_t));
+            }
+            stream->play_ts += n;
+            filled += n;
+            if (offset + n == (uint64_t)frame->samples) {
+                frame->present = 0;
+                stream->play_seq++;
+            }
+        } else if (stream->play_seq < stream->last_seq) {
+            // Later frames are here, so this one is lost. The next frame's
+            // timestamp tells how much audio to conceal for it.
+            stream->frames_lost++;
+            stream->play_seq++;
+        } else {
+            break;
+        }
+    }
+    return filled;
+}
+
+// One playout clock tick for an SDR ID: emit TICK_SAMPLES of audio and steer
+// the buffer depth towards the target for the jitter measured
+void playout_tick(struct call_stream* stream, uint64_t now) {
+    int16_t* block = stream->block;
+    int depth = (int)(int64_t)(stream->highest_end - stream->play_ts);
+
+    stream->talking = 0;
+
+    if (!stream->playing) {
+        // Prebuffer to the target depth, or play what there is once the
+        // talker has gone quiet
+        if (depth < stream->target && now - stream->last_arrival < (uint64_t)stream->target) {
+            return;
+        }
+        stream->playing = 1;
+    }
+
+    stream->tick_concealed = 0;
+    int got = jb_read(stream, block, TICK_SAMPLES, now);
+    if (got == 0 && stream->conceal_run >= CONCEAL_FADE_TICKS) {
+        // The talker has gone quiet and the fade is over: wait for the next
+        // talkspurt and prebuffer it
+        stream->playing = 0;
+        return;
+    }
+    if (got < TICK_SAMPLES) {
+        // Underrun: conceal without advancing the playout point, which
+        // lets the buffer deepen when frames come later than expected
+        conceal(stream, block, got, TICK_SAMPLES - got);
+    }
+    if (stream->tick_concealed) {
+        stream->ticks_concealed++;
+        stream->conceal_run++;
+    } else {
+        stream->conceal_run = 0;
+        memcpy(stream->last_block, block, sizeof(stream->last_block));
+    }
+    stream->talking = 1;
+    stream->ticks_played++;
+    if (stream->record_fd != -1 && write(stream->record_fd, block, sizeof(stream->block)) == -1) {
+        perror("write recording");
+        close(stream->record_fd);
+        stream->record_fd = -1;
+    }
+
+    // The shallowest depth over a window is slack the jitter never used.
+    // Skip audio to give it back, and deepen only through underruns.
+    depth = (int)(int64_t)(stream->highest_end - stream->play_ts);
+    if (depth < stream->min_depth) {
+        stream->min_depth = depth;
+    }
+    if (++stream->adapt_ticks >= JB_ADAPT_TICKS) {
+        int target = (int)(3 * (stream->jitter_q4 >> 4)) + TICK_SAMPLES;
+        stream->target = target < JB_MIN_DELAY ? JB_MIN_DELAY
+                         : target > JB_MAX_DELAY ? JB_MAX_DELAY : target;
+        if (stream->min_depth > stream->target + TICK_SAMPLES) {
+            int excess = stream->min_depth - stream->target;
+            stream->samples_skipped += jb_read(stream, NULL, excess, now);
+        }
+        stream->min_depth = JB_MAX_DELAY;
+        stream->adapt_ticks = 0;
+    }
+}
+
+// Push out what is left of a listener's mix frame. Returns 0 once it is all
+// sent, -1 while the socket is still full.
+int mix_flush(struct call_conn* conn) {
+    while (conn->pending_sent < conn->pending_len) {
+        uint64_t start = sdr_now_ns();
+        ssize_t n = send(conn->fd, conn->pending + conn->pending_sent,
+                         conn->pending_len - conn->pending_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        sdr_histogram_since(call_write_time, start);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                conn->pending_len = 0;  // The read side notices the broken connection
+                conn->pending_sent = 0;
+                return 0;
+            }
+            return -1;
+        }
+        conn->pending_sent += n;
+    }
+    return 0;
+}
+
+// Send a listener this tick's mix as a timed frame in its codec. A listener whose socket is
+// full loses the tick rather than holding up the playout clock. Packet
+// listeners get the frame without its length prefix, in a single send.
+void mix_send(struct call_conn* conn, const int16_t* mix) {
+    if (mix_flush(conn) == -1) {
+        conn->mix_dropped++;
+        call_mix_frames_dropped++;
+        return;
+    }
+
+    unsigned char* frame = conn->pending;
+    int payload = codec_encode(conn->codec_state, mix, TICK_SAMPLES, frame + 9,
+                               sizeof(conn->pending) - 9);
+    if (payload < 0) {
+        conn->mix_dropped++;
+        call_mix_frames_dropped++;
+        return;
+    }
+    int frame_length = TIMED_HEADER_SIZE + payload;
+    frame[0] = frame_length >> 8;
+    frame[1] = frame_length & 0xFF;
+    frame[2] = TIMED_FRAME_FLAG | conn->sdr_id;
+    frame[3] = conn->mix_seq >> 8;
+    frame[4] = conn->mix_seq & 0xFF;
+    frame[5] = conn->mix_ts >> 24;
+    frame[6] = (conn->mix_ts >> 16) & 0xFF;
+    frame[7] = (conn->mix_ts >> 8) & 0xFF;
+    frame[8] = conn->mix_ts & 0xFF;
+    conn->mix_seq++;
+    conn->pending_len = 2 + frame_length;
+    conn->pending_sent = conn->seqpacket ? 2 : 0;
+    size_t start = conn->pending_sent;
+    if (mix_flush(conn) == -1 && conn->pending_sent == start) {
+        conn->pending_len = 0;  // Nothing went out; drop it whole
+        conn->mix_dropped++;
+        call_mix_frames_dropped++;
+        return;
+    }
+    call_mix_frames_sent++;
+}
+
+// Sum this tick's talkers once, then send every listener that sum minus
+// their own voice. Listeners get nothing while nobody else is talking; their
+// timestamps keep running, so the gap reads as silence.
+void mix_tick(void) {
+    int talkers = 0;
+
+    mix_clear(mix_acc, TICK_SAMPLES);
+    for (int id = 0; id <= MAX_SDR_ID; id++) {
+        if (call_streams[id] && call_streams[id]->active && call_streams[id]->talking) {
+            mix_accumulate(mix_acc, call_streams[id]->block, TICK_SAMPLES);
+            talkers++;
+        }
+    }
+
+    for (struct call_conn* conn = conns; conn; conn = conn->next) {
+        if (conn->sdr_id < 0) {
+            continue;
+        }
+        struct call_stream* own = call_streams[conn->sdr_id];
+        int own_talking = own && own->active && own->talking;
+        if (talkers > own_talking) {
+            int16_t mix[TICK_SAMPLES];
+            mix_output(mix, mix_acc, own_talking ? own->block : NULL, TICK_SAMPLES);
+            mix_send(conn, mix);
+        }
+        conn->mix_ts += TICK_SAMPLES;
+    }
+}
+
+void playout_all(uint64_t ticks) {
+    uint64_t now = now_samples();
+    time_t wall = time(NULL);
+
+    for (uint64_t t = 0; t < ticks; t++) {
+        for (int id = 0; id <= MAX_SDR_ID; id++) {
+            if (call_streams[id] && call_streams[id]->active) {
+                playout_tick(call_streams[id], now);
+            }
+        }
+        mix_tick();
+    }
+
+    for (int id = 0; id <= MAX_SDR_ID; id++) {
+        struct call_stream* stream = call_streams[id];
+        if (!stream || !stream->active) {
+            continue;
+        }
+        if (now - stream->last_arrival > (uint64_t)STREAM_IDLE_MS * SAMPLE_RATE / 1000 &&
+            (int64_t)(stream->highest_end - stream->play_ts) <= 0) {
+            stream_end(stream);
+        } else if (wall - stream->last_stats >= STATS_INTERVAL) {
+            print_call_stream_stats(stream);
+            stream->last_stats = wall;
+        }
+    }
+}
+
+// A complete frame: the first byte names the talker, who from now on also
+// hears the conference on this connection
+void handle_frame(struct call_conn* conn, const unsigned char* frame, uint16_t frame_length) {
+    int sdr_id = frame[0] & 0x7F;  // 128-node MANET: SDR ID masked to 0-127
+    uint64_t arrival = now_samples();
+    struct call_stream* stream = call_stream_get(sdr_id);
+    if (!stream) {
+        return;
+    }
+    if (conn->sdr_id != sdr_id && stream->active) {
+        // A new sender numbers its frames afresh; end what the last one left
+        // rather than time the new frames against it
+        stream_end(stream);
+    }
+    conn->sdr_id = sdr_id;
+
+    int header_size = frame[0] & TIMED_FRAME_FLAG ? TIMED_HEADER_SIZE : 1;
+    if (frame_length < header_size) {
+        call_frames_rejected++;
+        SDR_TRACE("Invalid timed frame of length %d for SDR ID %d\n", frame_length, sdr_id);
+        return;
+    }
+    int16_t pcm[MAX_FRAME_SAMPLES];
+    int samples = codec_decode(conn->codec_state, frame + header_size, frame_length - header_size,
+                               pcm, MAX_FRAME_SAMPLES);
+    if (samples < 0) {
+        call_frames_rejected++;
+        SDR_TRACE("Undecodable %s frame of length %d for SDR ID %d\n", codec_name(conn->codec),
+                  frame_length, sdr_id);
+        return;
+    }
+    conn->audio_bytes += frame_length - header_size;
+    conn->audio_samples += samples;
+
+    if (frame[0] & TIMED_FRAME_FLAG) {
+        uint16_t seq = (uint16_t)(frame[1] << 8 | frame[2]);
+        uint32_t ts = (uint32_t)frame[3] << 24 | (uint32_t)frame[4] << 16 |
+                      (uint32_t)frame[5] << 8 | frame[6];
+        jb_insert(stream, seq, ts, pcm, samples, arrival);
+    } else {
+        // No timing from the sender: number frames in arrival order and
+        // time them by the arrival clock
+        jb_insert(stream, stream->legacy_seq++, (uint32_t)arrival, pcm, samples, arrival);
+    }
+}
+
+// Settle a client's session hello: take the first codec it offers that this
+// build has, or PCM, and tell it which. Returns -1 when the connection should
+// close.
+int negotiate(struct call_conn* conn, const unsigned char* offers, int count, int version,
+              int flags) {
+    int codec = CODEC_PCM;
+    for (int i = 0; i < count; i++) {
+        if (codec_supported(offers[i])) {
+            codec = offers[i];
+            break;
+        }
+    }
+    struct codec_state* state = codec_open(codec);
+    if (!state) {
+        printf("Could not start the %s codec\n", codec_name(codec));
+        return -1;
+    }
+    codec_close(conn->codec_state);
+    conn->codec_state = state;
+    conn->codec = codec;
+    conn->negotiated = 1;
+
+    unsigned char reply[SESSION_HELLO_SIZE + 1 + SHM_RING_PATH_MAX] = {0};
+    size_t reply_len = SESSION_HELLO_SIZE;
+    memcpy(reply, SESSION_MAGIC, 4);
+    reply[4] = version;
+    reply[5] = codec;
+    if (version == SESSION_VERSION_FLAGS) {
+        reply_len++;
+        if ((flags & SESSION_FLAG_SHM_RING) && !conn->seqpacket && !conn->ring_open) {
+            if (shm_ring_create(&conn->ring, "call", CALL_RING_SIZE) == 0) {
+                conn->ring_open = 1;
+                reply[SESSION_HELLO_SIZE] = SESSION_FLAG_SHM_RING;
+                memcpy(reply + reply_len, conn->ring.path, strlen(conn->ring.path));
+            }
+            reply_len += SHM_RING_PATH_MAX;
+        }
+    }
+    if (send(conn->fd, reply, reply_len, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)reply_len) {
+        perror("send");
+        return -1;
+    }
+    printf("Call client negotiated %s%s\n", codec_name(codec),
+           conn->ring_open ? " over a shared memory ring" : "");
+    return 0;
+}
+
+// handle_frame, timed and counted
+void receive_frame(struct call_conn* conn, const unsigned char* frame, uint16_t frame_length) {
+    uint64_t start = sdr_now_ns();
+    handle_frame(conn, frame, frame_length);
+    sdr_histogram_since(call_parse_time, start);
+    conn->frames++;
+    call_frames_received++;
+}
+
+// A doorbell: the client has written frames into its ring up to head. They
+// are decoded straight out of the shared mapping. Returns -1 when the
+// connection should close.
+int drain_ring(struct call_conn* conn, uint64_t head) {
+    const unsigned char* frame;
+    uint32_t frame_length;
+    int got;
+
+    if (!shm_ring_valid_head(&conn->ring, head)) {
+        printf("Doorbell beyond the end of the shared memory ring\n");
+        return -1;
+    }
+    // The client has the ring open by now, so nothing else needs the name
+    shm_ring_unlink(&conn->ring);
+
+    while ((got = shm_ring_read(&conn->ring, head, &frame, &frame_length)) == 1) {
+        if (frame_length == 0 || frame_length > MAX_FRAME_SIZE) {
+            printf("Invalid frame length: %u\n", frame_length);
+            return -1;
+        }
+        receive_frame(conn, frame, frame_length);
+        call_ring_frames++;
+    }
+    shm_ring_publish_tail(&conn->ring);
+    if (got == -1) {
+        printf("Malformed record in shared memory ring\n");
+        return -1;
+    }
+    return 0;
+}
+
+// 1 if a hello header, -1 if it claims to be one but is not a version we
+// speak
+int is_session_hello(const unsigned char* data) {
+    if (memcmp(data, SESSION_MAGIC, 4) != 0) {
+        return 0;
+    }
+    return data[4] == SESSION_VERSION || data[4] == SESSION_VERSION_FLAGS ? 1 : -1;
+}
+
+// Bytes in a hello, given at least its first SESSION_HELLO_SIZE
+size_t session_hello_size(const unsigned char* hello) {
+    return SESSION_HELLO_SIZE + hello[5] + (hello[4] == SESSION_VERSION_FLAGS ? 1 : 0);
+}
+
+void print_disconnect(struct call_conn* conn) {
+    printf("Call client disconnected after %llu frames in %llu reads",
+           (unsigned long long)conn->frames, (unsigned long long)conn->reads);
+    if (conn->audio_bytes > 0) {
+        printf("; %s audio %.1fx smaller than PCM",
+               codec_name(conn->codec), conn->audio_samples * 2.0 / conn->audio_bytes);
+    }
+    printf("\n");
+}
+
+// Read as much as a stream client has sent and hand every complete frame to
+// handle_frame straight out of the receive buffer. A frame cut off by the end
+// of a read stays where it is and the next read completes it; the partial
+// frame is only moved to the front once too little room is left behind it
+// for a whole one. Returns -1 when the connection should close.
+int read_frames(struct call_conn* conn) {
+    while (1) {
+        if (RX_BUFFER_SIZE - conn->rx_end < 2 + MAX_FRAME_SIZE) {
+            memmove(conn->rx, conn->rx + conn->rx_start, conn->rx_end - conn->rx_start);
+            conn->rx_end -= conn->rx_start;
+            conn->rx_start = 0;
+        }
+
+        size_t room = RX_BUFFER_SIZE - conn->rx_end;
+        uint64_t start = sdr_now_ns();
+        ssize_t bytes_received = recv(conn->fd, conn->rx + conn->rx_end, room, 0);
+        if (bytes_received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_received == -1 && errno == EAGAIN) {
+            return 0;
+        }
+        if (bytes_received <= 0) {
+            if (bytes_received == 0) {
+                print_disconnect(conn);
+            } else {
+                perror("recv");
+            }
+            return -1;
+        }
+        sdr_histogram_since(call_recv_time, start);
+        conn->reads++;
+        conn->rx_end += bytes_received;
+
+        while (!conn->negotiated && conn->rx_end > conn->rx_start) {
+            unsigned char* hello = conn->rx + conn->rx_start;
+            size_t available = conn->rx_end - conn->rx_start;
+            if (hello[0] != 0xFF) {
+                conn->negotiated = 1;  // Straight into frames: PCM
+                break;
+            }
+            if (available < SESSION_HELLO_SIZE || available < session_hello_size(hello)) {
+                break;
+            }
+            if (is_session_hello(hello) != 1) {
+                printf("Invalid session hello\n");
+                return -1;
+            }
+            size_t hello_size = session_hello_size(hello);
+            if (negotiate(conn, hello + SESSION_HELLO_SIZE, hello[5], hello[4],
+                          hello[4] == SESSION_VERSION_FLAGS ? hello[hello_size - 1] : 0) == -1) {
+                return -1;
+            }
+            conn->rx_start += hello_size;
+        }
+
+        while (conn->negotiated && conn->rx_end - conn->rx_start >= 2) {
+            unsigned char* frame = conn->rx + conn->rx_start;
+            uint16_t frame_length = parse_frame_length(frame);
+            if (frame_length == RING_DOORBELL && conn->ring_open) {
+                if (conn->rx_end - conn->rx_start < DOORBELL_SIZE) {
+                    break;
+                }
+                uint64_t head = 0;
+                for (int i = 2; i < DOORBELL_SIZE; i++) {
+                    head = head << 8 | frame[i];
+                }
+                conn->rx_start += DOORBELL_SIZE;
+                if (drain_ring(conn, head) == -1) {
+                    return -1;
+                }
+                continue;
+            }
+            if (frame_length == 0 || frame_length > MAX_FRAME_SIZE) {
+                printf("Invalid frame length: %d\n", frame_length);
+                return -1;
+            }
+            if (conn->rx_end - conn->rx_start < 2 + (size_t)frame_length) {
+                break;
+            }
+            receive_frame(conn, frame + 2, frame_length);
+            conn->rx_start += 2 + frame_length;
+        }
+        if (conn->rx_start == conn->rx_end) {
+            conn->rx_start = 0;
+            conn->rx_end = 0;
+        }
+
+        // A short read drained the socket; skip the recv that would only
+        // say EAGAIN
+        if ((size_t)bytes_received < room) {
+            return 0;
+        }
+    }
 }
 
-int main() {
+// SOCK_SEQPACKET clients send one frame per packet, so a single recvmmsg
+// returns up to RECV_BATCH frames. Returns -1 when the connection should close.
+int read_packets(struct call_conn* conn) {
+    while (1) {
+        for (int i = 0; i < RECV_BATCH; i++) {
+            batch_iov[i].iov_base = batch_buffers[i];
+            batch_iov[i].iov_len = MAX_FRAME_SIZE;
+            memset(&batch_msgs[i].msg_hdr, 0, sizeof(batch_msgs[i].msg_hdr));
+            batch_msgs[i].msg_hdr.msg_iov = &batch_iov[i];
+            batch_msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        uint64_t start = sdr_now_ns();
+        int count = recvmmsg(conn->fd, batch_msgs, RECV_BATCH, 0, NULL);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count == -1 && errno == EAGAIN) {
+            return 0;
+        }
+        if (count == -1) {
+            perror("recvmmsg");
+            return -1;
+        }
+        sdr_histogram_since(call_recv_time, start);
+        conn->reads++;
+
+        for (int i = 0; i < count; i++) {
+            unsigned int frame_length = batch_msgs[i].msg_len;
+            if (frame_length == 0) {
+                print_disconnect(conn);
+                return -1;
+            }
+            if (batch_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                printf("Invalid frame length: more than %d\n", MAX_FRAME_SIZE);
+                return -1;
+            }
+            unsigned char* packet = batch_buffers[i];
+            if (!conn->negotiated && frame_length >= SESSION_HELLO_SIZE &&
+                is_session_hello(packet) == 1 && frame_length == session_hello_size(packet)) {
+                // Packet clients are not offered a ring, so their flags go unused
+                if (negotiate(conn, packet + SESSION_HELLO_SIZE, packet[5], packet[4], 0) == -1) {
+                    return -1;
+                }
+                continue;
+            }
+            conn->negotiated = 1;
+            receive_frame(conn, packet, frame_length);
+        }
+        if (count == 0) {
+            print_disconnect(conn);
+            return -1;
+        }
+        if (count < RECV_BATCH) {
+            return 0;
+        }
+    }
+}
+
+void close_client(struct call_conn* conn) {
+    if (conn->sdr_id >= 0 && conn->mix_dropped) {
+        printf("SDR ID %d: listener missed %llu mix frames\n", conn->sdr_id,
+               (unsigned long long)conn->mix_dropped);
+    }
+    sdr_loop_remove(conn->fd);
+    close(conn->fd);
+    codec_close(conn->codec_state);
+    if (conn->ring_open) {
+        shm_ring_close(&conn->ring);
+    }
+    for (struct call_conn** p = &conns; *p; p = &(*p)->next) {
+        if (*p == conn) {
+            *p = conn->next;
+            break;
+        }
+    }
+    conn_count--;
+    free(conn);
+}
+
+void call_conn_event(struct sdr_handler* handler, uint32_t events) {
+    struct call_conn* conn = (struct call_conn*)handler;
+    (void)events;
+    if ((conn->seqpacket ? read_packets(conn) : read_frames(conn)) == -1) {
+        close_client(conn);
+    }
+}
+
+void accept_call_clients(int listen_fd) {
+    while (1) {
+        uint64_t start = sdr_now_ns();
+        int client_fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno != EAGAIN && errno != EINTR) {
+                perror("accept");
+            }
+            return;
+        }
+        if (conn_count >= MAX_CALL_CLIENTS) {
+            printf("Too many call clients; connection refused\n");
+            close(client_fd);
+            continue;
+        }
+        struct call_conn* conn = calloc(1, sizeof(*conn));
+        if (!conn) {
+            close(client_fd);
+            continue;
+        }
+        conn->handler.on_event = call_conn_event;
+        conn->handler.qos_class = SDR_CLASS_VOICE;
+        conn->fd = client_fd;
+        conn->seqpacket = listen_fd == seqpacket_fd;
+        conn->sdr_id = -1;
+        conn->codec = CODEC_PCM;
+        conn->codec_state = codec_open(CODEC_PCM);
+        if (!conn->codec_state) {
+            close(client_fd);
+            free(conn);
+            continue;
+        }
+        if (sdr_loop_add(client_fd, EPOLLIN, &conn->handler) == -1) {
+            perror("epoll_ctl");
+            close(client_fd);
+            codec_close(conn->codec_state);
+            free(conn);
+            continue;
+        }
+        conn->next = conns;
+        conns = conn;
+        conn_count++;
+        sdr_histogram_since(call_accept_time, start);
+        printf("Call client connected%s\n", conn->seqpacket ? " (packets)" : "");
+    }
+}
+
+// Create, bind and listen on a nonblocking Unix socket of the given type
+int listen_unix(const char* path, int type) {
     struct sockaddr_un addr;
-    int client_fd;
-    char buffer[BUFFER_SIZE];
-    ssize_t bytes_received;
-    
-    // Set up signal handler
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    
-    printf("Starting Call Server...\n");
-    
+
     // Create socket
-    server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (server_fd == -1) {
+    int fd = socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
         perror("socket");
-        exit(EXIT_FAILURE);
+        return -1;
     }
-    
+
     // Remove any existing socket file
-    unlink(CALL_SOCKET_PATH);
-    
+    unlink(path);
+
     // Set up address structure
     memset(&addr, 0, sizeof(addr));
     addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, CALL_SOCKET_PATH, sizeof(addr.sun_path) - 1);
-    
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
     // Bind socket
-    if (bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
         perror("bind");
-        close(server_fd);
-        exit(EXIT_FAILURE);
+        close(fd);
+        return -1;
     }
-    
+
     // Listen for connections
-    if (listen(server_fd, 5) == -1) {
+    if (listen(fd, 5) == -1) {
         perror("listen");
-        close(server_fd);
-        unlink(CALL_SOCKET_PATH);
-        exit(EXIT_FAILURE);
+        close(fd);
+        unlink(path);
+        return -1;
     }
-    
-    printf("Call Server listening on %s\n", CALL_SOCKET_PATH);
-    printf("Waiting for audio streams...\n\n");
-    
-    while (1) {
-        // Accept connection
-        client_fd = accept(server_fd, NULL, NULL);
-        if (client_fd == -1) {
-            perror("accept");
-            continue;
+    return fd;
+}
+
+void call_listener_event(struct sdr_handler* handler, uint32_t events) {
+    (void)events;
+    accept_call_clients(handler == &seqpacket_listener ? seqpacket_fd : call_server_fd);
+}
+
+void playout_timer_event(struct sdr_handler* handler, uint32_t events) {
+    uint64_t expirations = 0;
+    (void)handler;
+    (void)events;
+    if (read(call_timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+        playout_all(expirations < MAX_CATCHUP_TICKS ? expirations : MAX_CATCHUP_TICKS);
+    }
+}
+
+int call_service_start(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0) {
+            record_calls = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [--record]\n", argv[0]);
+            return -1;
         }
-        
-        printf("Call client connected\n");
-        
-        // Read audio frames continuously
-        while (1) {
-            // Read frame length (2 bytes)
-            bytes_received = recv(client_fd, buffer, 2, MSG_WAITALL);
-            if (bytes_received != 2) {
-                if (bytes_received == 0) {
-                    printf("Call client disconnected\n");
-                } else {
-                    perror("recv length");
-                }
-                break;
-            }
-            
-            // Parse frame length
-            uint16_t frame_length = parse_frame_length(buffer);
-            
-            // Read the actual frame data
-            if (frame_length > 0 && frame_length <= BUFFER_SIZE - 2) {
-                bytes_received = recv(client_fd, buffer + 2, frame_length, MSG_WAITALL);
-                if (bytes_received != frame_length) {
-                    if (bytes_received == 0) {
-                        printf("Call client disconnected\n");
-                    } else {
-                        perror("recv frame");
-                    }
-                    break;
-                }
-                
-                // For 128-node MANET: SDR ID is in the first byte, masked to 7 bits
-                if (frame_length > 0) {
-                    current_sdr_id = (unsigned char)buffer[2] & 0x7F; // Mask to 0-127 range
-                    
-                    // Validate SDR ID range for 128-node network
-                    if (current_sdr_id > 127) {
-                        printf("Warning: Invalid SDR ID %d (should be 0-127)\n", current_sdr_id);
-                        current_sdr_id = 127; // Cap at maximum valid ID
-                    }
-                }
-                
-                printf("Received audio frame of length %d for SDR ID %d\n", 
-                       frame_length, current_sdr_id);
-            } else {
-                printf("Invalid frame length: %d\n", frame_length);
-                break;
-            }
+    }
+
+    printf("Starting Call Server...\n");
+
+    // Length-prefixed frames on a stream socket, as the backend sends them,
+    // or one frame per packet for clients that can batch
+    call_server_fd = listen_unix(CALL_SOCKET_PATH, SOCK_STREAM);
+    seqpacket_fd = listen_unix(CALL_SEQPACKET_PATH, SOCK_SEQPACKET);
+    if (call_server_fd == -1 || seqpacket_fd == -1) {
+        return -1;
+    }
+
+    // The playout clock
+    call_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec tick = {0};
+    tick.it_interval.tv_nsec = PLAYOUT_TICK_MS * 1000000L;
+    tick.it_value = tick.it_interval;
+    if (call_timer_fd == -1 || timerfd_settime(call_timer_fd, 0, &tick, NULL) == -1) {
+        perror("timerfd");
+        return -1;
+    }
+
+    call_listener.on_event = call_listener_event;
+    seqpacket_listener.on_event = call_listener_event;
+    playout_timer.on_event = playout_timer_event;
+    call_listener.qos_class = SDR_CLASS_VOICE;
+    seqpacket_listener.qos_class = SDR_CLASS_VOICE;
+    playout_timer.qos_class = SDR_CLASS_VOICE;
+    if (sdr_loop_add(call_server_fd, EPOLLIN, &call_listener) == -1 ||
+        sdr_loop_add(seqpacket_fd, EPOLLIN, &seqpacket_listener) == -1 ||
+        sdr_loop_add(call_timer_fd, EPOLLIN, &playout_timer) == -1) {
+        perror("epoll_ctl");
+        return -1;
+    }
+
+    sdr_stat_register("call", "frames_received", &call_frames_received);
+    sdr_stat_register("call", "mix_frames_sent", &call_mix_frames_sent);
+    sdr_stat_register("call", "mix_frames_dropped", &call_mix_frames_dropped);
+    sdr_stat_register("call", "ring_frames", &call_ring_frames);
+    sdr_stat_register("call", "frames_rejected", &call_frames_rejected);
+    call_accept_time = sdr_histogram_register("call", "accept");
+    call_recv_time = sdr_histogram_register("call", "recv");
+    call_parse_time = sdr_histogram_register("call", "parse");
+    call_write_time = sdr_histogram_register("call", "write");
+
+    mixer_init();
+    printf("Call Server listening on %s (packets on %s)\n", CALL_SOCKET_PATH, CALL_SEQPACKET_PATH);
+    printf("Conference mixer kernels: %s\n", mixer_implementation());
+    printf("Codecs:");
+    for (int codec = 0; codec < CODEC_COUNT; codec++) {
+        if (codec_supported(codec)) {
+            printf(" %s", codec_name(codec));
         }
-        
-        close(client_fd);
     }
-    
+    printf("\n");
+    if (record_calls) {
+        printf("Recording playout to /tmp/call_sdr_<id>.raw (8 kHz 16-bit PCM)\n");
+    }
+    printf("Waiting for audio streams...\n\n");
     return 0;
 }
+
+void call_service_stop(void) {
+    printf("\nShutting down Call Server...\n");
+    close(call_server_fd);
+    close(seqpacket_fd);
+    unlink(CALL_SOCKET_PATH);
+    unlink(CALL_SEQPACKET_PATH);
+}
+
+struct sdr_service call_service = {"call", call_service_start, NULL, call_service_stop};
+
+#ifndef SDR_DAEMON
+int main(int argc, char* argv[]) {
+    return sdr_service_main(&call_service, argc, argv);
+}
+#endif
@@ -0,0 +1,326 @@
+#include <string.h>
+#include "checksum.h"
+
+#if defined(HAVE_CRC32C_SSE42)
+#include <nmmintrin.h>
+#endif
+
+// CRC32C (Castagnoli), reflected polynomial 0x82F63B78
+#define CRC32C_POLY 0x82F63B78
+// The hardware kernel runs three independent CRCs over adjacent stripes of
+// this many bytes and stitches them together, hiding the crc32 instruction's
+// three-cycle latency
+#define CRC32C_STRIPE 8192
+
+uint32_t crc32c_table[8][256];
+uint32_t crc32c_stripe_shift[32];  // Appends CRC32C_STRIPE zero bytes
+uint32_t (*crc32c_kernel)(uint32_t, const void*, size_t) = crc32c_update_slice8;
+const char* crc32c_kernel_name = "slice-by-8";
+
+uint64_t read_le64(const unsigned char* p) {
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+           (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+           (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+uint32_t read_le32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// GF(2) helpers for crc32c_combine, after zlib's crc32_combine
+uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1) {
+            sum ^= *mat;
+        }
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+void gf2_matrix_square(uint32_t* square, const uint32_t* mat) {
+    for (int n = 0; n < 32; n++) {
+        square[n] = gf2_matrix_times(mat, mat[n]);
+    }
+}
+
+void checksum_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for (int k = 1; k < 8; k++) {
+        for (int i = 0; i < 256; i++) {
+            uint32_t prev = crc32c_table[k - 1][i];
+            crc32c_table[k][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+        }
+    }
+
+    // Column n is where bit n of the register ends up after a stripe of zeros
+    for (int n = 0; n < 32; n++) {
+        uint32_t crc = (uint32_t)1 << n;
+        for (int i = 0; i < CRC32C_STRIPE; i++) {
+            crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+        }
+        crc32c_stripe_shift[n] = crc;
+    }
+
+#if defined(HAVE_CRC32C_SSE42)
+    if (crc32c_sse42_supported()) {
+        crc32c_kernel = crc32c_update_sse42;
+        crc32c_kernel_name = "sse4.2";
+    }
+#endif
+}
+
+uint32_t crc32c_update(uint32_t crc, const void* data, size_t len) {
+    return crc32c_kernel(crc, data, len);
+}
+
+const char* crc32c_implementation(void) {
+    return crc32c_kernel_name;
+}
+
+// One table lookup per byte; the baseline the other kernels are measured against
+uint32_t crc32c_update_bytewise(uint32_t crc, const void* data, size_t len) {
+    const unsigned char* p = data;
+    crc = ~crc;
+    while (len--) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Portable fallback: eight table lookups fold in eight bytes at a time
+uint32_t crc32c_update_slice8(uint32_t crc, const void* data, size_t len) {
+    const unsigned char* p = data;
+    crc = ~crc;
+    while (len >= 8) {
+        uint64_t word = read_le64(p) ^ crc;
+        crc = crc32c_table[7][word & 0xFF] ^
+              crc32c_table[6][(word >> 8) & 0xFF] ^
+              crc32c_table[5][(word >> 16) & 0xFF] ^
+              crc32c_table[4][(word >> 24) & 0xFF] ^
+              crc32c_table[3][(word >> 32) & 0xFF] ^
+              crc32c_table[2][(word >> 40) & 0xFF] ^
+              crc32c_table[1][(word >> 48) & 0xFF] ^
+              crc32c_table[0][word >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if defined(HAVE_CRC32C_SSE42)
+int crc32c_sse42_supported(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+
+__attribute__((target("sse4.2")))
+uint32_t crc32c_update_sse42(uint32_t crc, const void* data, size_t len) {
+    const unsigned char* p = data;
+    uint32_t state = ~crc;
+
+    while (len >= 3 * CRC32C_STRIPE) {
+        // The register is linear in its input, so the second and third
+        // stripes can start from zero and be shifted into place afterwards
+        uint64_t a = state;
+        uint64_t b = 0;
+        uint64_t c = 0;
+        for (size_t i = 0; i < CRC32C_STRIPE; i += 8) {
+            uint64_t wa, wb, wc;
+            memcpy(&wa, p + i, 8);
+            memcpy(&wb, p + CRC32C_STRIPE + i, 8);
+            memcpy(&wc, p + 2 * CRC32C_STRIPE + i, 8);
+            a = _mm_crc32_u64(a, wa);
+            b = _mm_crc32_u64(b, wb);
+            c = _mm_crc32_u64(c, wc);
+        }
+        state = gf2_matrix_times(crc32c_stripe_shift, (uint32_t)a) ^ (uint32_t)b;
+        state = gf2_matrix_times(crc32c_stripe_shift, state) ^ (uint32_t)c;
+        p += 3 * CRC32C_STRIPE;
+        len -= 3 * CRC32C_STRIPE;
+    }
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        state = (uint32_t)_mm_crc32_u64(state, word);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        state = _mm_crc32_u8(state, *p++);
+    }
+    return ~state;
+}
+#endif
+
+// CRC32C of A followed by B, given crc(A), crc(B) and the length of B
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, long len2) {
+    uint32_t even[32];
+    uint32_t odd[32];
+
+    if (len2 <= 0) {
+        return crc1;
+    }
+
+    // Operator for one zero bit
+    odd[0] = CRC32C_POLY;
+    uint32_t row = 1;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2_matrix_square(even, odd);  // Two zero bits
+    gf2_matrix_square(odd, even);  // Four zero bits
+
+    // Apply len2 zero bytes to crc1, one bit of len2 at a time
+    do {
+        gf2_matrix_square(even, odd);
+        if (len2 & 1) {
+            crc1 = gf2_matrix_times(even, crc1);
+        }
+        len2 >>= 1;
+        if (len2 == 0) {
+            break;
+        }
+        gf2_matrix_square(odd, even);
+        if (len2 & 1) {
+            crc1 = gf2_matrix_times(odd, crc1);
+        }
+        len2 >>= 1;
+    } while (len2 != 0);
+
+    return crc1 ^ crc2;
+}
+
+// XXH64, as specified at https://github.com/Cyan4973/xxHash
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+uint64_t xxh64_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME64_2;
+    acc = xxh64_rotl(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+uint64_t xxh64_merge_round(uint64_t acc, uint64_t val) {
+    acc ^= xxh64_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+void xxh64_reset(struct xxh64_state* state, uint64_t seed) {
+    memset(state, 0, sizeof(*state));
+    state->seed = seed;
+    state->v[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    state->v[1] = seed + XXH_PRIME64_2;
+    state->v[2] = seed;
+    state->v[3] = seed - XXH_PRIME64_1;
+}
+
+void xxh64_update(struct xxh64_state* state, const void* data, size_t len) {
+    const unsigned char* p = data;
+    state->total_len += len;
+
+    // Top up a partial stripe left over from the previous call
+    if (state->memsize > 0) {
+        size_t take = 32 - state->memsize;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(state->mem + state->memsize, p, take);
+        state->memsize += take;
+        p += take;
+        len -= take;
+        if (state->memsize < 32) {
+            return;
+        }
+        for (int i = 0; i < 4; i++) {
+            state->v[i] = xxh64_round(state->v[i], read_le64(state->mem + i * 8));
+        }
+        state->memsize = 0;
+    }
+
+    uint64_t v0 = state->v[0];
+    uint64_t v1 = state->v[1];
+    uint64_t v2 = state->v[2];
+    uint64_t v3 = state->v[3];
+    while (len >= 32) {
+        v0 = xxh64_round(v0, read_le64(p));
+        v1 = xxh64_round(v1, read_le64(p + 8));
+        v2 = xxh64_round(v2, read_le64(p + 16));
+        v3 = xxh64_round(v3, read_le64(p + 24));
+        p += 32;
+        len -= 32;
+    }
+    state->v[0] = v0;
+    state->v[1] = v1;
+    state->v[2] = v2;
+    state->v[3] = v3;
+
+    memcpy(state->mem, p, len);
+    state->memsize = len;
+}
+
+uint64_t xxh64_digest(const struct xxh64_state* state) {
+    uint64_t h;
+    if (state->total_len >= 32) {
+        h = xxh64_rotl(state->v[0], 1) + xxh64_rotl(state->v[1], 7) +
+            xxh64_rotl(state->v[2], 12) + xxh64_rotl(state->v[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = xxh64_merge_round(h, state->v[i]);
+        }
+    } else {
+        h = state->seed + XXH_PRIME64_5;
+    }
+    h += state->total_len;
+
+    const unsigned char* p = state->mem;
+    size_t len = state->memsize;
+    while (len >= 8) {
+        h ^= xxh64_round(0, read_le64(p));
+        h = xxh64_rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        h ^= (uint64_t)read_le32(p) * XXH_PRIME64_1;
+        h = xxh64_rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+        len -= 4;
+    }
+    while (len--) {
+        h ^= *p++ * XXH_PRIME64_5;
+        h = xxh64_rotl(h, 11) * XXH_PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t xxh64(const void* data, size_t len, uint64_t seed) {
+    struct xxh64_state state;
+    xxh64_reset(&state, seed);
+    xxh64_update(&state, data, len);
+    return xxh64_digest(&state);
+}
@@ -0,0 +1,46 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Integrity checksums computed inline while payload streams through a server.
+// Call checksum_init() once before any other function; it builds the tables
+// and picks the fastest CRC32C kernel this CPU supports.
+void checksum_init(void);
+
+// CRC32C (Castagnoli). Running update: start from 0 and feed consecutive
+// buffers. Dispatches to the hardware kernel when available.
+uint32_t crc32c_update(uint32_t crc, const void* data, size_t len);
+
+// CRC32C of A followed by B, given crc(A), crc(B) and the length of B
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, long len2);
+
+// Name of the kernel crc32c_update() dispatches to, for startup logs
+const char* crc32c_implementation(void);
+
+// Individual kernels, exposed for checksum_bench
+uint32_t crc32c_update_bytewise(uint32_t crc, const void* data, size_t len);
+uint32_t crc32c_update_slice8(uint32_t crc, const void* data, size_t len);
+#if defined(__x86_64__)
+#define HAVE_CRC32C_SSE42 1
+int crc32c_sse42_supported(void);
+uint32_t crc32c_update_sse42(uint32_t crc, const void* data, size_t len);
+#endif
+
+// XXH64 streaming state; the four lanes are independent, so the compiler can
+// keep them in flight together
+struct xxh64_state {
+    uint64_t total_len;
+    uint64_t seed;
+    uint64_t v[4];
+    unsigned char mem[32];
+    size_t memsize;
+};
+
+void xxh64_reset(struct xxh64_state* state, uint64_t seed);
+void xxh64_update(struct xxh64_state* state, const void* data, size_t len);
+uint64_t xxh64_digest(const struct xxh64_state* state);
+uint64_t xxh64(const void* data, size_t len, uint64_t seed);
+
+#endif
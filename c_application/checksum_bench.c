@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "checksum.h"
+
+// Microbenchmark for the file_server checksum kernels.
+// Usage: ./checksum_bench [buffer_mb] [rounds]
+
+#define DEFAULT_BUFFER_MB 64
+#define DEFAULT_ROUNDS 5
+
+struct kernel {
+    const char* name;
+    uint32_t (*crc)(uint32_t, const void*, size_t);  // NULL for xxh64
+};
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Hash the buffer in update_size pieces, the way data arrives off a socket.
+// Returns the best of rounds in GB/s.
+double run_kernel(const struct kernel* k, const unsigned char* buf, size_t len,
+                  size_t update_size, int rounds, uint64_t* digest) {
+    double best = 0;
+    for (int r = 0; r < rounds; r++) {
+        double start = now_seconds();
+        uint32_t crc = 0;
+        struct xxh64_state state;
+        xxh64_reset(&state, 0);
+        for (size_t off = 0; off < len; off += update_size) {
+            size_t n = len - off < update_size ? len - off : update_size;
+            if (k->crc) {
+                crc = k->crc(crc, buf + off, n);
+            } else {
+                xxh64_update(&state, buf + off, n);
+            }
+        }
+        *digest = k->crc ? crc : xxh64_digest(&state);
+        double rate = len / (now_seconds() - start) / 1e9;
+        if (rate > best) {
+            best = rate;
+        }
+    }
+    return best;
+}
+
+// Known answers, so a fast but wrong kernel never posts a number
+int self_test(void) {
+    const char* check = "123456789";
+    int ok = 1;
+
+    ok &= crc32c_update_bytewise(0, check, 9) == 0xE3069283;
+    ok &= crc32c_update_slice8(0, check, 9) == 0xE3069283;
+#if defined(HAVE_CRC32C_SSE42)
+    if (crc32c_sse42_supported()) {
+        ok &= crc32c_update_sse42(0, check, 9) == 0xE3069283;
+    }
+#endif
+    ok &= xxh64("", 0, 0) == 0xEF46DB3751D8E999ULL;
+    ok &= xxh64("abc", 3, 0) == 0x44BC2CF5AD770999ULL;
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    size_t buffer_mb = argc > 1 ? (size_t)atoi(argv[1]) : DEFAULT_BUFFER_MB;
+    int rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+    if (buffer_mb == 0 || rounds < 1) {
+        fprintf(stderr, "Usage: %s [buffer_mb] [rounds]\n", argv[0]);
+        exit(1);
+    }
+
+    checksum_init();
+    if (!self_test()) {
+        fprintf(stderr, "Checksum self-test failed\n");
+        exit(1);
+    }
+
+    size_t len = buffer_mb * 1024 * 1024;
+    unsigned char* buf = malloc(len);
+    if (!buf) {
+        perror("malloc");
+        exit(1);
+    }
+    srand(1);
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (unsigned char)rand();
+    }
+
+    struct kernel kernels[] = {
+        {"crc32c bytewise", crc32c_update_bytewise},
+        {"crc32c slice-by-8", crc32c_update_slice8},
+#if defined(HAVE_CRC32C_SSE42)
+        {"crc32c sse4.2", crc32c_sse42_supported() ? crc32c_update_sse42 : NULL},
+#endif
+        {"xxh64", NULL},
+    };
+    // Stream buffer size, copy buffer size and splice chunk size in file_server
+    size_t update_sizes[] = {1024, 256 * 1024, 1024 * 1024};
+    int kernel_count = sizeof(kernels) / sizeof(kernels[0]);
+    int size_count = sizeof(update_sizes) / sizeof(update_sizes[0]);
+
+    printf("Hashing %zu MB, best of %d rounds; file_server uses %s\n",
+           buffer_mb, rounds, crc32c_implementation());
+    printf("%-20s", "kernel (GB/s)");
+    for (int s = 0; s < size_count; s++) {
+        printf("%10zuK", update_sizes[s] / 1024);
+    }
+    printf("%20s\n", "digest");
+
+    uint32_t reference = crc32c_update_slice8(0, buf, len);
+    for (int k = 0; k < kernel_count; k++) {
+#if defined(HAVE_CRC32C_SSE42)
+        if (strcmp(kernels[k].name, "crc32c sse4.2") == 0 && !kernels[k].crc) {
+            printf("%-20s%s\n", kernels[k].name, "   not supported by this CPU");
+            continue;
+        }
+#endif
+        uint64_t digest = 0;
+        printf("%-20s", kernels[k].name);
+        for (int s = 0; s < size_count; s++) {
+            printf("%11.2f", run_kernel(&kernels[k], buf, len, update_sizes[s], rounds, &digest));
+            fflush(stdout);
+        }
+        printf("%20llx", (unsigned long long)digest);
+        if (kernels[k].crc && digest != reference) {
+            printf("  MISMATCH");
+        }
+        printf("\n");
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include "codec.h"
+
+#if defined(HAVE_OPUS)
+#include <opus.h>
+#endif
+
+struct codec_state {
+    int codec;
+    // IMA-ADPCM encoder: predicted sample and step size index
+    int predictor;
+    int step_index;
+#if defined(HAVE_OPUS)
+    OpusEncoder* encoder;
+    OpusDecoder* decoder;
+#endif
+};
+
+const char* codec_names[CODEC_COUNT] = {"pcm", "ima-adpcm", "opus"};
+
+const int ima_index_table[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+const int ima_step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+
+int codec_supported(int codec) {
+    if (codec == CODEC_PCM || codec == CODEC_ADPCM) {
+        return 1;
+    }
+#if defined(HAVE_OPUS)
+    if (codec == CODEC_OPUS) {
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+const char* codec_name(int codec) {
+    return codec >= 0 && codec < CODEC_COUNT ? codec_names[codec] : "unknown";
+}
+
+struct codec_state* codec_open(int codec) {
+    if (!codec_supported(codec)) {
+        return NULL;
+    }
+    struct codec_state* state = calloc(1, sizeof(*state));
+    if (!state) {
+        return NULL;
+    }
+    state->codec = codec;
+#if defined(HAVE_OPUS)
+    if (codec == CODEC_OPUS) {
+        int error;
+        state->encoder = opus_encoder_create(CODEC_SAMPLE_RATE, 1, OPUS_APPLICATION_VOIP, &error);
+        state->decoder = opus_decoder_create(CODEC_SAMPLE_RATE, 1, &error);
+        if (!state->encoder || !state->decoder) {
+            codec_close(state);
+            return NULL;
+        }
+        opus_encoder_ctl(state->encoder, OPUS_SET_BITRATE(CODEC_OPUS_BITRATE));
+        opus_encoder_ctl(state->encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+    }
+#endif
+    return state;
+}
+
+void codec_close(struct codec_state* state) {
+    if (!state) {
+        return;
+    }
+#if defined(HAVE_OPUS)
+    if (state->encoder) {
+        opus_encoder_destroy(state->encoder);
+    }
+    if (state->decoder) {
+        opus_decoder_destroy(state->decoder);
+    }
+#endif
+    free(state);
+}
+
+int codec_max_payload(int codec, int count) {
+    if (codec == CODEC_ADPCM) {
+        return ADPCM_HEADER_SIZE + (count + 1) / 2;
+    }
+    // Opus at CODEC_OPUS_BITRATE stays far below this; PCM is exactly it
+    return count * 2;
+}
+
+// One sample through the IMA-ADPCM quantizer; updates the predictor and step
+// exactly as the decoder will, so the two never drift apart
+int adpcm_encode_sample(int* predictor, int* step_index, int sample) {
+    int step = ima_step_table[*step_index];
+    int diff = sample - *predictor;
+    int code = 0;
+    if (diff < 0) {
+        code = 8;
+        diff = -diff;
+    }
+
+    int delta = step >> 3;
+    if (diff >= step) {
+        code |= 4;
+        diff -= step;
+        delta += step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        code |= 2;
+        diff -= step;
+        delta += step;
+    }
+    step >>= 1;
+    if (diff >= step) {
+        code |= 1;
+        delta += step;
+    }
+
+    *predictor += code & 8 ? -delta : delta;
+    *predictor = *predictor > INT16_MAX ? INT16_MAX : *predictor < INT16_MIN ? INT16_MIN : *predictor;
+    *step_index += ima_index_table[code & 7];
+    *step_index = *step_index < 0 ? 0 : *step_index > 88 ? 88 : *step_index;
+    return code;
+}
+
+int adpcm_decode_sample(int* predictor, int* step_index, int code) {
+    int step = ima_step_table[*step_index];
+    int delta = step >> 3;
+    if (code & 4) {
+        delta += step;
+    }
+    if (code & 2) {
+        delta += step >> 1;
+    }
+    if (code & 1) {
+        delta += step >> 2;
+    }
+
+    *predictor += code & 8 ? -delta : delta;
+    *predictor = *predictor > INT16_MAX ? INT16_MAX : *predictor < INT16_MIN ? INT16_MIN : *predictor;
+    *step_index += ima_index_table[code & 7];
+    *step_index = *step_index < 0 ? 0 : *step_index > 88 ? 88 : *step_index;
+    return *predictor;
+}
+
+int adpcm_encode(struct codec_state* state, const int16_t* pcm, int count,
+                 unsigned char* out, int out_size) {
+    int length = ADPCM_HEADER_SIZE + (count + 1) / 2;
+    if (length > out_size) {
+        return -1;
+    }
+
+    // The header is the state the first sample is coded against
+    out[0] = (uint16_t)state->predictor & 0xFF;
+    out[1] = (uint16_t)state->predictor >> 8;
+    out[2] = state->step_index;
+    out[3] = 0;
+    for (int i = 0; i < count; i += 2) {
+        int low = adpcm_encode_sample(&state->predictor, &state->step_index, pcm[i]);
+        int high = adpcm_encode_sample(&state->predictor, &state->step_index,
+                                       i + 1 < count ? pcm[i + 1] : 0);
+        out[ADPCM_HEADER_SIZE + i / 2] = low | high << 4;
+    }
+    return length;
+}
+
+int adpcm_decode(const unsigned char* in, int len, int16_t* pcm, int max_samples) {
+    if (len < ADPCM_HEADER_SIZE || in[2] > 88) {
+        return -1;
+    }
+    int count = (len - ADPCM_HEADER_SIZE) * 2;
+    if (count > max_samples) {
+        return -1;
+    }
+
+    int predictor = (int16_t)(in[0] | in[1] << 8);
+    int step_index = in[2];
+    for (int i = 0; i < count; i += 2) {
+        unsigned char codes = in[ADPCM_HEADER_SIZE + i / 2];
+        pcm[i] = adpcm_decode_sample(&predictor, &step_index, codes & 0x0F);
+        pcm[i + 1] = adpcm_decode_sample(&predictor, &step_index, codes >> 4);
+    }
+    return count;
+}
+
+int codec_encode(struct codec_state* state, const int16_t* pcm, int count,
+                 unsigned char* out, int out_size) {
+    switch (state->codec) {
+    case CODEC_PCM:
+        if (count * 2 > out_size) {
+            return -1;
+        }
+        for (int i = 0; i < count; i++) {
+            out[2 * i] = (uint16_t)pcm[i] & 0xFF;
+            out[2 * i + 1] = (uint16_t)pcm[i] >> 8;
+        }
+        return count * 2;
+    case CODEC_ADPCM:
+        return adpcm_encode(state, pcm, count, out, out_size);
+#if defined(HAVE_OPUS)
+    case CODEC_OPUS: {
+        int length = opus_encode(state->encoder, pcm, count, out, out_size);
+        return length < 0 ? -1 : length;
+    }
+#endif
+    }
+    return -1;
+}
+
+int codec_decode(struct codec_state* state, const unsigned char* in, int len,
+                 int16_t* pcm, int max_samples) {
+    switch (state->codec) {
+    case CODEC_PCM:
+        if (len / 2 > max_samples) {
+            return -1;
+        }
+        for (int i = 0; i < len / 2; i++) {
+            pcm[i] = (int16_t)(in[2 * i] | in[2 * i + 1] << 8);
+        }
+        return len / 2;
+    case CODEC_ADPCM:
+        return adpcm_decode(in, len, pcm, max_samples);
+#if defined(HAVE_OPUS)
+    case CODEC_OPUS: {
+        int count = opus_decode(state->decoder, in, len, pcm, max_samples, 0);
+        return count < 0 ? -1 : count;
+    }
+#endif
+    }
+    return -1;
+}
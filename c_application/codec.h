@@ -0,0 +1,47 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdint.h>
+
+// Audio codecs for call_server frames. Calls are 8 kHz mono; a codec turns a
+// block of 16-bit samples into one frame payload and back. Each client picks
+// one when it connects and uses it in both directions.
+#define CODEC_PCM 0    // 16-bit little-endian samples, what every client spoke before codecs
+#define CODEC_ADPCM 1  // IMA-ADPCM, 4 bits per sample, always built in
+#define CODEC_OPUS 2   // Opus, when call_server was built against libopus
+#define CODEC_COUNT 3
+
+#define CODEC_SAMPLE_RATE 8000
+#define CODEC_OPUS_BITRATE 12000   // Bits per second
+#define ADPCM_HEADER_SIZE 4        // Predictor (s16le), step index, reserved
+
+// One client's encoder and decoder. Opus keeps history on both sides; IMA-ADPCM
+// carries its predictor from frame to frame in the encoder but writes it into
+// every frame header, so frames decode on their own and a lost one costs
+// nothing after it.
+struct codec_state;
+
+// 1 if this build can encode and decode the codec
+int codec_supported(int codec);
+const char* codec_name(int codec);
+
+// NULL if the codec is unsupported or out of memory
+struct codec_state* codec_open(int codec);
+void codec_close(struct codec_state* state);
+
+// Encode count samples into out. Returns the payload length, or -1 if it does
+// not fit in out_size or the codec cannot take that many samples at once
+// (Opus takes 2.5 to 60 ms). IMA-ADPCM packs two samples a byte, so an odd
+// count gains a silent sample.
+int codec_encode(struct codec_state* state, const int16_t* pcm, int count,
+                 unsigned char* out, int out_size);
+
+// Decode one payload into pcm. Returns the number of samples, or -1 if the
+// payload is malformed or would decode to more than max_samples.
+int codec_decode(struct codec_state* state, const unsigned char* in, int len,
+                 int16_t* pcm, int max_samples);
+
+// Largest payload codec_encode produces for count samples
+int codec_max_payload(int codec, int count);
+
+#endif
@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "codec.h"
+
+// Microbenchmark for the call_server codecs: encode and decode cost per
+// frame, payload size against 16-bit PCM, and signal-to-noise ratio of the
+// round trip. The signal is a voiced tone with a syllable-rate envelope and
+// a little noise, closer to speech than a pure sine.
+// Usage: ./codec_bench [seconds of audio per run]
+
+#define DEFAULT_SECONDS 20
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void make_signal(int16_t* pcm, int count) {
+    double phase = 0;
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        double t = (double)i / CODEC_SAMPLE_RATE;
+        // Pitch wanders around 120 Hz; harmonics fall off like a voice's do
+        phase += 2 * M_PI * (120 + 20 * sin(2 * M_PI * 0.7 * t)) / CODEC_SAMPLE_RATE;
+        double voice = 0;
+        for (int h = 1; h <= 12; h++) {
+            voice += sin(h * phase) / (h * h);
+        }
+        double envelope = 0.5 + 0.5 * sin(2 * M_PI * 4 * t);
+        double noise = (rand() % 2001 - 1000) / 1000.0;
+        pcm[i] = (int16_t)(9000 * envelope * voice + 100 * noise);
+    }
+}
+
+// Signal-to-noise ratio of the decoded audio, in dB
+double snr_db(const int16_t* reference, const int16_t* decoded, int count) {
+    double signal = 0, noise = 0;
+    for (int i = 0; i < count; i++) {
+        double e = reference[i] - decoded[i];
+        signal += (double)reference[i] * reference[i];
+        noise += e * e;
+    }
+    return noise > 0 ? 10 * log10(signal / noise) : 99;
+}
+
+int main(int argc, char* argv[]) {
+    int seconds = argc > 1 ? atoi(argv[1]) : DEFAULT_SECONDS;
+    if (seconds < 1) {
+        fprintf(stderr, "Usage: %s [seconds]\n", argv[0]);
+        exit(1);
+    }
+
+    int total = seconds * CODEC_SAMPLE_RATE;
+    int16_t* input = malloc(total * sizeof(int16_t));
+    int16_t* output = malloc(total * sizeof(int16_t));
+    unsigned char* coded = malloc(total * 2);
+    int* lengths = malloc((total / 80 + 1) * sizeof(int));  // Frames are 10 ms at the least
+    if (!input || !output || !coded || !lengths) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    make_signal(input, total);
+
+    int frame_ms[] = {10, 20, 60, 100};
+    int frame_ms_count = sizeof(frame_ms) / sizeof(frame_ms[0]);
+
+    printf("%d s of 8 kHz audio per run, best of 3\n", seconds);
+    printf("%-10s %6s %12s %12s %10s %8s %8s\n", "codec", "frame", "encode ns", "decode ns",
+           "bytes", "vs PCM", "SNR dB");
+    for (int codec = 0; codec < CODEC_COUNT; codec++) {
+        if (!codec_supported(codec)) {
+            printf("%-10s not built in\n", codec_name(codec));
+            continue;
+        }
+        for (int f = 0; f < frame_ms_count; f++) {
+            int samples = CODEC_SAMPLE_RATE * frame_ms[f] / 1000;
+            int frames = total / samples;
+            int max_payload = codec_max_payload(codec, samples);
+            double best_encode = 1e30, best_decode = 1e30;
+            long coded_bytes = 0;
+            int decoded_samples = 0;
+            int failed = 0;
+
+            for (int run = 0; run < 3 && !failed; run++) {
+                struct codec_state* encoder = codec_open(codec);
+                struct codec_state* decoder = codec_open(codec);
+
+                // Encode everything first, then decode it, so each loop is timed alone
+                double start = now_seconds();
+                coded_bytes = 0;
+                for (int n = 0; n < frames; n++) {
+                    lengths[n] = codec_encode(encoder, input + n * samples, samples,
+                                              coded + coded_bytes, max_payload);
+                    if (lengths[n] < 0) {
+                        failed = 1;
+                        break;
+                    }
+                    coded_bytes += lengths[n];
+                }
+                double encode = (now_seconds() - start) * 1e9 / frames;
+
+                start = now_seconds();
+                long offset = 0;
+                decoded_samples = 0;
+                for (int n = 0; n < frames && !failed; n++) {
+                    int count = codec_decode(decoder, coded + offset, lengths[n],
+                                             output + decoded_samples, total - decoded_samples);
+                    if (count < 0) {
+                        failed = 1;
+                        break;
+                    }
+                    offset += lengths[n];
+                    decoded_samples += count;
+                }
+                double decode = (now_seconds() - start) * 1e9 / frames;
+
+                codec_close(encoder);
+                codec_close(decoder);
+                best_encode = encode < best_encode ? encode : best_encode;
+                best_decode = decode < best_decode ? decode : best_decode;
+            }
+
+            if (failed) {
+                printf("%-10s %4d ms   does not take this frame size\n", codec_name(codec), frame_ms[f]);
+                continue;
+            }
+            double bytes = (double)coded_bytes / frames;
+            printf("%-10s %4d ms %12.0f %12.0f %10.1f %7.2fx", codec_name(codec), frame_ms[f],
+                   best_encode, best_decode, bytes, samples * 2 / bytes);
+            if (codec == CODEC_OPUS) {
+                // Opus delays its output, so a sample-by-sample SNR means nothing
+                printf(" %8s\n", "-");
+            } else {
+                printf(" %8.1f\n", snr_db(input, output, decoded_samples));
+            }
+        }
+    }
+
+    free(input);
+    free(output);
+    free(coded);
+    free(lengths);
+    return 0;
+}
@@ -1,29 +1,211 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <signal.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "checksum.h"
+#include "sdr_loop.h"
+#include "sdr_uring.h"
 
 #define SOCKET_PATH "/tmp/file_socket"
 #define BUFFER_SIZE 1024
 #define UPLOADS_DIR "../uploads"
+#define SPLICE_CHUNK (1024 * 1024)          // Bytes moved per splice() call
+#define COPY_BUFFER_SIZE (256 * 1024)       // Fallback read()/write() buffer
+#define DIRECT_IO_THRESHOLD (8L * 1024 * 1024)
+#define DIRECT_IO_ALIGN 4096
+#define DIRECT_IO_BUFFER_SIZE (1024 * 1024)
+#define DEFAULT_WORKERS 4
+#define MAX_WORKERS 64
+#define QUEUE_CAPACITY 64                   // Accepted clients waiting for a worker
+#define URING_BUFFERS 4                     // Registered receive buffers per worker
+#define URING_BUFFER_SIZE (256 * 1024)
+#define URING_DEPTH (2 * URING_BUFFERS + 2)  // A recv and write per buffer, and a slots update
+#define URING_CLIENT_SLOT 0                 // Fixed file slots of a worker's ring
+#define URING_FILE_SLOT 1
+#define URING_SLOTS_UPDATED UINT64_MAX      // user_data of IORING_OP_FILES_UPDATE
 
-int server_fd = -1;
+/*
+ * Binary transfer protocol (version 1)
+ *
+ * Header, all integers big endian:
+ *   magic[4]        0xFF 'M' 'F' 'T' (a legacy filename never starts with 0xFF)
+ *   version:1       TRANSFER_VERSION
+ *   checksum_type:1 CHECKSUM_NONE, CHECKSUM_CRC32C or CHECKSUM_XXH64
+ *   name_len:2      length of the filename that follows the header
+ *   file_size:8
+ *   checksum:8      digest of the whole file, right-aligned
+ *   name[name_len]
+ *
+ * Followed by chunks of [len:4][data:len]; a zero-length chunk ends the file.
+ * The payload is never scanned, so files may contain any bytes. When a
+ * checksum is requested it is computed as the data streams through, never by
+ * reading the file back, and the SUCCESS reply carries the server's digest,
+ * e.g. "SUCCESS: File received successfully (crc32c 1a2b3c4d)".
+ *
+ * Version 2 makes transfers resumable and lets several connections upload
+ * disjoint parts of the same file at once. The header is followed by a
+ * content_id[16] before the name, and the transfer is keyed by that ID rather
+ * than by connection. The server answers the header with the ranges it already
+ * holds, [count:4]([start:8][end:8] * count), and the client sends only what
+ * is missing as [len:4][offset:8][crc32c:4][data:len] chunks, again ending
+ * with a zero length. Each chunk is verified on arrival; the whole-file CRC32C
+ * is derived by combining chunk CRCs, so nothing is read back, and version 2
+ * therefore only accepts CHECKSUM_NONE or CHECKSUM_CRC32C. Received ranges
+ * are kept in UPLOADS_DIR/.transfers/<id>.idx, next to the <id>.part data.
+ * The reply is SUCCESS once the file is complete, otherwise
+ * "PARTIAL: <stored>/<size> bytes stored".
+ *
+ * Clients that start with anything else use the legacy "name:size\n" header,
+ * raw payload and "EOF\n" trailer.
+ */
+#define TRANSFER_MAGIC "\xFF" "MFT"
+#define TRANSFER_VERSION 1
+#define RESUMABLE_VERSION 2
+#define TRANSFER_HEADER_SIZE 24
+#define CHUNK_HEADER_SIZE 4
+#define RESUMABLE_CHUNK_HEADER_SIZE 16
+#define CONTENT_ID_SIZE 16
+#define MAX_FILENAME_LEN 255
+#define TRANSFERS_DIR UPLOADS_DIR "/.transfers"
+#define INDEX_MAGIC "MFTI"
+#define INDEX_VERSION 1
+#define MAX_RANGES 1024
+#define INDEX_FLUSH_BYTES (8L * 1024 * 1024)  // Persist progress this often
 
-// Signal handler for clean shutdown
-void signal_handler(int sig) {
-    printf("\nShutting down File Server...\n");
-    if (server_fd != -1) {
-        close(server_fd);
-    }
-    unlink(SOCKET_PATH);
-    exit(0);
-}
+enum checksum_type {
+    CHECKSUM_NONE = 0,
+    CHECKSUM_CRC32C = 1,
+    CHECKSUM_XXH64 = 2
+};
+
+int file_server_fd = -1;
+int queue_wake_fd = -1;   // Signalled when a worker makes room in a full queue
+int accept_paused = 0;
+struct sdr_handler file_listener;
+struct sdr_handler queue_waker;
+uint64_t file_connections_accepted = 0;
+// Bumped by every worker
+struct sdr_counter file_transfers_handled;
+struct sdr_counter file_bytes_received;
+// Stage latencies. recv and write are per socket read and file write (per
+// buffer under io_uring, from submission to completion); ack runs from the
+// last payload byte to the reply, so it covers fdatasync and the rename.
+struct sdr_histogram* file_accept_time;
+struct sdr_histogram* file_recv_time;
+struct sdr_histogram* file_write_time;
+struct sdr_histogram* file_ack_time;
+int use_direct_io = 0;  // --direct-io: bypass the page cache for big files
+int worker_count = DEFAULT_WORKERS;
+unsigned long next_transfer_id = 0;
+
+// Accepted client sockets handed from the event loop to the worker pool. The
+// loop never waits on it: while it is full, clients stay in the listen
+// backlog until a worker makes room.
+struct work_queue {
+    int fds[QUEUE_CAPACITY];
+    uint64_t queued_at[QUEUE_CAPACITY];  // For the file class's wait
+    int head;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+};
+
+struct work_queue queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER
+};
+
+// Parsed binary transfer header
+struct transfer_header {
+    int version;
+    int checksum_type;
+    uint64_t checksum;
+    long file_size;
+    unsigned char content_id[CONTENT_ID_SIZE];
+    char filename[MAX_FILENAME_LEN + 1];
+};
+
+// Byte range [start, end) of a resumable transfer, with the CRC32C of its data
+struct byte_range {
+    long start;
+    long end;
+    uint32_t crc;
+};
+
+// A resumable transfer, shared by every connection uploading the same content
+struct resumable_transfer {
+    unsigned char content_id[CONTENT_ID_SIZE];
+    char hex_id[CONTENT_ID_SIZE * 2 + 1];
+    char filename[MAX_FILENAME_LEN + 1];
+    long file_size;
+    int checksum_type;
+    uint32_t checksum;
+    int fd;                  // <id>.part, written with pwrite by every connection
+    int refcount;            // Protected by transfers_lock
+    pthread_mutex_t lock;    // Protects everything below
+    struct byte_range ranges[MAX_RANGES];
+    int range_count;
+    // Chunks being written now; nothing else may write over them, and they
+    // only join ranges once their CRC has matched
+    struct byte_range claims[MAX_WORKERS];
+    int claim_count;
+    long stored;
+    long unflushed;          // Bytes received since the index was last written
+    int saving;              // A connection is writing the index
+    unsigned int generation; // Bumped whenever the part file is published or replaced
+    int finished;
+    struct resumable_transfer* next;
+};
+
+struct resumable_transfer* transfers = NULL;
+pthread_mutex_t transfers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// A worker's io_uring, when the event loop runs on one. The receive buffers
+// are registered once; the client socket and the file fill the two fixed
+// file slots from a transfer's first payload until it ends.
+struct transfer_uring {
+    struct sdr_uring ring;
+    char* buffers[URING_BUFFERS];
+    int slots[2];  // Descriptors the fixed file slots hold, or -1
+};
+
+// Bytes already read from the client but not yet consumed
+struct transfer_stream {
+    int fd;
+    struct transfer_uring* uring;  // NULL unless SDR_IO=uring
+    char buf[BUFFER_SIZE];
+    size_t pos;
+    size_t len;
+};
+
+// Destination file and the I/O strategy used to fill it
+struct file_sink {
+    int fd;
+    int direct;          // Opened with O_DIRECT; writes go through staging
+    char* staging;       // Aligned staging buffer (direct) or copy buffer
+    size_t fill;         // Direct only: staged bytes not yet written
+    long stored;         // Bytes written to the file
+    long received;       // Bytes accepted from the client
+    long file_size;
+    int shared;          // fd belongs to a resumable transfer, not the sink
+    int checksum;        // checksum_type run over every byte; rules out splice()
+    uint32_t crc;
+    struct xxh64_state xxh;
+    unsigned long id;    // Transfer number, used to tag log lines
+    long last_progress_logged;
+};
 
 // Create uploads directory if it doesn't exist
 void ensure_uploads_dir() {
@@ -37,182 +219,1610 @@ void ensure_uploads_dir() {
     }
 }
 
+void write_be64(unsigned char* p, uint64_t value) {
+    for (int i = 7; i >= 0; i--) {
+        p[i] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+void write_be32(unsigned char* p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+uint64_t read_be64(const unsigned char* p) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+uint32_t read_be32(const unsigned char* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Log progress every 10%
+void log_progress(struct file_sink* sink) {
+    if (sink->file_size <= 0) {
+        return;
+    }
+    long current_progress = ((double)sink->received / sink->file_size) * 100.0;
+    if (current_progress - sink->last_progress_logged >= 10 ||
+        sink->received == sink->file_size) {
+        SDR_TRACE("[transfer %lu] File transfer progress: %ld%% (%ld/%ld bytes)\n",
+                  sink->id, current_progress, sink->received, sink->file_size);
+        sink->last_progress_logged = current_progress;
+    }
+}
+
+// Write a whole buffer at the given file offset
+int write_fully(int fd, const char* data, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+// Write at the end of what the sink has stored
+int sink_store(struct file_sink* sink, const char* data, size_t len) {
+    uint64_t start = sdr_now_ns();
+    if (write_fully(sink->fd, data, len, sink->stored) == -1) {
+        return -1;
+    }
+    sdr_histogram_since(file_write_time, start);
+    sink->stored += len;
+    return 0;
+}
+
+// Read into the stream buffer. Returns bytes read, 0 on EOF, -1 on error.
+ssize_t stream_fill(struct transfer_stream* stream) {
+    if (stream->pos == stream->len) {
+        stream->pos = stream->len = 0;
+    }
+    while (1) {
+        ssize_t n = read(stream->fd, stream->buf + stream->len,
+                         sizeof(stream->buf) - stream->len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n > 0) {
+            stream->len += n;
+        }
+        return n;
+    }
+}
+
+// Read exactly len protocol bytes. Returns 0 on success, -1 on EOF or error.
+int stream_read_exact(struct transfer_stream* stream, void* dst, size_t len) {
+    char* out = dst;
+    while (len > 0) {
+        if (stream->pos == stream->len) {
+            if (stream_fill(stream) <= 0) {
+                return -1;
+            }
+        }
+        size_t take = stream->len - stream->pos;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(out, stream->buf + stream->pos, take);
+        stream->pos += take;
+        out += take;
+        len -= take;
+    }
+    return 0;
+}
+
+// Read and drop count payload bytes, such as a chunk already held.
+// Returns 0 on success, -1 on EOF or error.
+int stream_discard(struct transfer_stream* stream, long count) {
+    char scratch[4096];
+    while (count > 0) {
+        size_t take = count < (long)sizeof(scratch) ? (size_t)count : sizeof(scratch);
+        if (stream_read_exact(stream, scratch, take) == -1) {
+            return -1;
+        }
+        count -= take;
+    }
+    return 0;
+}
+
+// Open the destination file, pre-sized so the filesystem can lay it out
+// contiguously. Returns 0 on success, -1 with errno set on failure.
+int sink_open(struct file_sink* sink, const char* filepath, long file_size,
+              int checksum, unsigned long id) {
+    memset(sink, 0, sizeof(*sink));
+    sink->fd = -1;
+    sink->id = id;
+    sink->file_size = file_size;
+    sink->checksum = checksum;
+    if (checksum == CHECKSUM_XXH64) {
+        xxh64_reset(&sink->xxh, 0);
+    }
+
+    if (use_direct_io && file_size >= DIRECT_IO_THRESHOLD) {
+        sink->fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+        if (sink->fd != -1) {
+            sink->direct = 1;
+        }
+        // Filesystems such as tmpfs refuse O_DIRECT; use the normal path
+    }
+    if (sink->fd == -1) {
+        sink->fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (sink->fd == -1) {
+        return -1;
+    }
+
+    size_t staging_size = sink->direct ? DIRECT_IO_BUFFER_SIZE : COPY_BUFFER_SIZE;
+    if (posix_memalign((void**)&sink->staging, DIRECT_IO_ALIGN, staging_size) != 0) {
+        close(sink->fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (file_size > 0 && fallocate(sink->fd, 0, 0, file_size) == -1 &&
+        errno != EOPNOTSUPP && errno != ENOSYS) {
+        printf("Warning: could not preallocate %ld bytes: %s\n", file_size, strerror(errno));
+    }
+    return 0;
+}
+
+// Write out whole aligned blocks from the O_DIRECT staging buffer
+int sink_flush_direct(struct file_sink* sink) {
+    size_t aligned = sink->fill & ~((size_t)DIRECT_IO_ALIGN - 1);
+    if (aligned == 0) {
+        return 0;
+    }
+    if (sink_store(sink, sink->staging, aligned) == -1) {
+        return -1;
+    }
+    sink->fill -= aligned;
+    memmove(sink->staging, sink->staging + aligned, sink->fill);
+    return 0;
+}
+
+// Account for len bytes that are now in the staging buffer (direct) or were
+// just written (buffered)
+void sink_account(struct file_sink* sink, const char* data, size_t len) {
+    if (sink->checksum == CHECKSUM_CRC32C) {
+        sink->crc = crc32c_update(sink->crc, data, len);
+    } else if (sink->checksum == CHECKSUM_XXH64) {
+        xxh64_update(&sink->xxh, data, len);
+    }
+    sink->received += len;
+    sdr_counter_add(&file_bytes_received, len);
+    sdr_qos_throttle(SDR_CLASS_FILE, len);
+    log_progress(sink);
+}
+
+// Hand payload bytes held in userspace to the file
+int sink_write(struct file_sink* sink, const char* data, size_t len) {
+    if (!sink->direct) {
+        if (sink_store(sink, data, len) == -1) {
+            return -1;
+        }
+        sink_account(sink, data, len);
+        return 0;
+    }
+
+    while (len > 0) {
+        size_t take = DIRECT_IO_BUFFER_SIZE - sink->fill;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(sink->staging + sink->fill, data, take);
+        sink->fill += take;
+        sink_account(sink, data, take);
+        data += take;
+        len -= take;
+        if (sink->fill == DIRECT_IO_BUFFER_SIZE && sink_flush_direct(sink) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Flush the unaligned O_DIRECT tail through the page cache
+int sink_finish(struct file_sink* sink) {
+    if (!sink->direct) {
+        return 0;
+    }
+    if (sink_flush_direct(sink) == -1) {
+        return -1;
+    }
+    if (sink->fill > 0) {
+        int flags = fcntl(sink->fd, F_GETFL);
+        fcntl(sink->fd, F_SETFL, flags & ~O_DIRECT);
+        if (sink_store(sink, sink->staging, sink->fill) == -1) {
+            return -1;
+        }
+        sink->fill = 0;
+    }
+    return 0;
+}
+
+// Write into a resumable transfer's shared part file. The caller positions
+// each chunk by setting stored to its offset and resetting crc.
+int sink_attach(struct file_sink* sink, int fd, unsigned long id) {
+    memset(sink, 0, sizeof(*sink));
+    sink->fd = fd;
+    sink->shared = 1;
+    sink->checksum = CHECKSUM_CRC32C;
+    sink->id = id;
+    if (posix_memalign((void**)&sink->staging, DIRECT_IO_ALIGN, COPY_BUFFER_SIZE) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+void sink_close(struct file_sink* sink) {
+    if (sink->fd != -1 && !sink->shared) {
+        close(sink->fd);
+    }
+    sink->fd = -1;
+    free(sink->staging);
+    sink->staging = NULL;
+}
+
+// Move socket data straight into the file through a pipe, never touching
+// userspace. Returns bytes moved, or -1 if splice() is not supported for this
+// socket/file pair before any data was moved.
+long splice_to_sink(int client_fd, struct file_sink* sink, long count) {
+    int pipefd[2];
+    long moved = 0;
+
+    if (pipe2(pipefd, O_CLOEXEC) == -1) {
+        printf("Error creating splice pipe: %s\n", strerror(errno));
+        return -1;
+    }
+    // Bigger pipes mean fewer splice() round trips; failure just costs speed
+    fcntl(pipefd[1], F_SETPIPE_SZ, SPLICE_CHUNK);
+
+    while (moved < count) {
+        size_t want = count - moved;
+        if (want > SPLICE_CHUNK) {
+            want = SPLICE_CHUNK;
+        }
+
+        uint64_t start = sdr_now_ns();
+        ssize_t in = splice(client_fd, NULL, pipefd[1], NULL, want,
+                            SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (in > 0) {
+            sdr_histogram_since(file_recv_time, start);
+        }
+        if (in == 0) {
+            printf("Connection closed by client\n");
+            break;
+        }
+        if (in == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL && moved == 0) {
+                moved = -1;  // Caller falls back to read()/write()
+            } else {
+                printf("Error reading file data: %s\n", strerror(errno));
+            }
+            break;
+        }
+
+        loff_t file_offset = sink->stored;
+        sdr_counter_add(&file_bytes_received, in);
+        sdr_qos_throttle(SDR_CLASS_FILE, in);
+        start = sdr_now_ns();
+        while (in > 0) {
+            ssize_t out = splice(pipefd[0], NULL, sink->fd, &file_offset, in,
+                                 SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out == -1 && errno == EINTR) {
+                continue;
+            }
+            if (out <= 0) {
+                printf("Error writing to file: %s\n", strerror(errno));
+                close(pipefd[0]);
+                close(pipefd[1]);
+                return moved;
+            }
+            in -= out;
+            moved += out;
+            sink->stored += out;
+            sink->received += out;
+        }
+        sdr_histogram_since(file_write_time, start);
+
+        log_progress(sink);
+    }
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return moved;
+}
+
+// The next submission entry of the worker ring, with at least count free
+// counting it. What is queued is submitted first if there is less room, so
+// a linked chain asks for its whole length up front and never has its link
+// cut by a submit in the middle.
+struct io_uring_sqe* uring_sqe(struct transfer_uring* io, unsigned count) {
+    struct sdr_uring* ring = &io->ring;
+    while (ring->sq_entries - (ring->sq_queued - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) < count) {
+        if (sdr_uring_submit(ring, 0) == -1 && errno != EINTR && errno != EBUSY) {
+            perror("io_uring_enter");
+            abort();
+        }
+    }
+    return sdr_uring_sqe(ring);
+}
+
+// Queue an update of the worker ring's fixed file slots to io->slots. With
+// link set it goes ahead of a recv and write queued right after it.
+void uring_set_slots(struct transfer_uring* io, int link) {
+    struct io_uring_sqe* sqe = uring_sqe(io, link ? 3 : 1);
+    sqe->opcode = IORING_OP_FILES_UPDATE;
+    sqe->addr = (uint64_t)(uintptr_t)io->slots;
+    sqe->len = 2;
+    sqe->off = URING_CLIENT_SLOT;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+    sqe->user_data = URING_SLOTS_UPDATED;
+}
+
+// Empty the fixed file slots at the end of a transfer, or the ring would
+// keep the socket and file open after the worker closes them
+void uring_release_slots(struct transfer_uring* io) {
+    if (io->slots[0] == -1) {
+        return;
+    }
+    io->slots[0] = io->slots[1] = -1;
+    uring_set_slots(io, 0);
+    if (sdr_uring_wait(&io->ring)) {
+        sdr_uring_seen(&io->ring);
+    }
+}
+
+// Receive count payload bytes through the worker's io_uring. Each buffer
+// gets a recv linked to a fixed-buffer write of the same bytes, so the
+// kernel starts the write as soon as the data is in without coming back to
+// this thread, and the next recv goes out while earlier writes are still
+// running. Only one recv is ever in flight, which keeps the stream in order.
+// Checksums are taken from a buffer while its write and the next recv are
+// under way.
+// Returns 0 once all count bytes are stored, -1 otherwise.
+int uring_receive(struct transfer_stream* stream, struct file_sink* sink, long count) {
+    struct transfer_uring* io = stream->uring;
+    size_t lengths[URING_BUFFERS];
+    uint64_t submitted[URING_BUFFERS];
+    int busy[URING_BUFFERS] = {0};
+    long offset = sink->stored;
+    long requested = 0;
+    int receiving = 0;
+    int in_flight = 0;
+    int next = 0;
+    int received = -1;  // Buffer whose data is in but not yet checksummed
+    int failed = 0;
+
+    // The first payload of a transfer installs its socket and file; the
+    // update is linked ahead of the first recv, so it costs no extra call
+    if (io->slots[0] != stream->fd || io->slots[1] != sink->fd) {
+        io->slots[0] = stream->fd;
+        io->slots[1] = sink->fd;
+        uring_set_slots(io, 1);
+        in_flight++;
+    }
+    while (in_flight > 0 || (!failed && requested < count)) {
+        if (!failed && !receiving && requested < count && !busy[next]) {
+            size_t len = count - requested < URING_BUFFER_SIZE ? (size_t)(count - requested)
+                                                               : URING_BUFFER_SIZE;
+            struct io_uring_sqe* recv_sqe = uring_sqe(io, 2);
+            struct io_uring_sqe* write_sqe = uring_sqe(io, 1);
+            recv_sqe->opcode = IORING_OP_RECV;
+            recv_sqe->fd = URING_CLIENT_SLOT;
+            recv_sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+            recv_sqe->addr = (uint64_t)(uintptr_t)io->buffers[next];
+            recv_sqe->len = len;
+            recv_sqe->msg_flags = MSG_WAITALL;
+            recv_sqe->user_data = (uint64_t)next << 1;
+            write_sqe->opcode = IORING_OP_WRITE_FIXED;
+            write_sqe->fd = URING_FILE_SLOT;
+            write_sqe->flags = IOSQE_FIXED_FILE;
+            write_sqe->addr = (uint64_t)(uintptr_t)io->buffers[next];
+            write_sqe->len = len;
+            write_sqe->off = offset + requested;
+            write_sqe->buf_index = next;
+            write_sqe->user_data = (uint64_t)next << 1 | 1;
+            lengths[next] = len;
+            submitted[next] = sdr_now_ns();
+            busy[next] = 1;
+            receiving = 1;
+            in_flight += 2;
+            requested += len;
+            next = (next + 1) % URING_BUFFERS;
+        }
+        if (received != -1) {
+            // Get the next recv going before spending time on the last one
+            sdr_uring_submit(&io->ring, 0);
+            sink_account(sink, io->buffers[received], lengths[received]);
+            received = -1;
+        }
+
+        struct io_uring_cqe* cqe = sdr_uring_wait(&io->ring);
+        if (!cqe) {
+            // The kernel may still be using the buffers, so there is no safe
+            // way to carry on
+            perror("io_uring_enter");
+            abort();
+        }
+        uint64_t tag = cqe->user_data;
+        int res = cqe->res;
+        sdr_uring_seen(&io->ring);
+        in_flight--;
+
+        if (tag == URING_SLOTS_UPDATED) {
+            if (res < 0 && !failed) {
+                printf("Error setting up io_uring files: %s\n", strerror(-res));
+                io->slots[0] = io->slots[1] = -1;
+                failed = 1;
+            }
+            continue;
+        }
+        int buffer = (int)(tag >> 1);
+        if (!(tag & 1)) {
+            receiving = 0;
+            if (res == (int)lengths[buffer]) {
+                sdr_histogram_since(file_recv_time, submitted[buffer]);
+                received = buffer;
+            } else if (!failed) {
+                if (res >= 0) {
+                    printf("Connection closed by client\n");
+                } else {
+                    printf("Error reading file data: %s\n", strerror(-res));
+                }
+                failed = 1;
+            }
+        } else {
+            busy[buffer] = 0;
+            if (res == (int)lengths[buffer]) {
+                sdr_histogram_since(file_write_time, submitted[buffer]);
+            }
+            if (res != (int)lengths[buffer] && res != -ECANCELED && !failed) {
+                printf("Error writing to file: %s\n", res < 0 ? strerror(-res) : "short write");
+                failed = 1;
+            }
+        }
+    }
+
+    if (failed) {
+        return -1;
+    }
+    sink->stored = offset + count;
+    return 0;
+}
+
+// Move count payload bytes from the client into the sink. Buffered bytes go
+// first; the rest is spliced when possible, otherwise read in large blocks
+// (straight into the aligned staging buffer for O_DIRECT).
+// Returns 0 once all count bytes are stored, -1 otherwise.
+int receive_payload(struct transfer_stream* stream, struct file_sink* sink, long count) {
+    size_t buffered = stream->len - stream->pos;
+    if ((long)buffered > count) {
+        buffered = count;
+    }
+    if (buffered > 0) {
+        if (sink_write(sink, stream->buf + stream->pos, buffered) == -1) {
+            printf("Error writing to file: %s\n", strerror(errno));
+            return -1;
+        }
+        stream->pos += buffered;
+        count -= buffered;
+    }
+
+    // O_DIRECT needs aligned writes, which chunks of any length are not
+    if (count > 0 && stream->uring && !sink->direct) {
+        return uring_receive(stream, sink, count);
+    }
+    if (count > 0 && !sink->direct && !sink->checksum) {
+        long moved = splice_to_sink(stream->fd, sink, count);
+        if (moved != -1) {
+            return moved == count ? 0 : -1;
+        }
+    }
+
+    while (count > 0) {
+        char* dst;
+        size_t want;
+        if (sink->direct) {
+            dst = sink->staging + sink->fill;
+            want = DIRECT_IO_BUFFER_SIZE - sink->fill;
+        } else {
+            dst = sink->staging;
+            want = COPY_BUFFER_SIZE;
+        }
+        if ((long)want > count) {
+            want = count;
+        }
+
+        uint64_t start = sdr_now_ns();
+        ssize_t n = read(stream->fd, dst, want);
+        if (n > 0) {
+            sdr_histogram_since(file_recv_time, start);
+        }
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n == 0) {
+                printf("Connection closed by client\n");
+            } else {
+                printf("Error reading file data: %s\n", strerror(errno));
+            }
+            return -1;
+        }
+
+        int failed;
+        if (sink->direct) {
+            sink->fill += n;
+            sink_account(sink, dst, n);
+            failed = sink->fill == DIRECT_IO_BUFFER_SIZE && sink_flush_direct(sink) == -1;
+        } else {
+            failed = sink_write(sink, dst, n) == -1;
+        }
+        if (failed) {
+            printf("Error writing to file: %s\n", strerror(errno));
+            return -1;
+        }
+        count -= n;
+    }
+    return 0;
+}
+
+// Consume the "EOF\n" trailer a legacy client sends after the payload, so
+// closing the socket does not leave unread data (which resets the peer)
+void consume_eof_marker(struct transfer_stream* stream) {
+    char trailer[4];
+    struct timeval timeout = { 1, 0 };
+
+    setsockopt(stream->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (stream_read_exact(stream, trailer, sizeof(trailer)) == 0 &&
+        memcmp(trailer, "EOF\n", 4) == 0) {
+        printf("EOF marker received\n");
+    }
+}
+
+// Legacy metadata: "filename:filesize\n" followed by raw payload and "EOF\n".
+// Returns 0 and fills filename/file_size, or -1 after replying with an error.
+int parse_legacy_header(struct transfer_stream* stream, char* filename,
+                        size_t filename_size, long* file_size) {
+    char* newline;
+    while (!(newline = memchr(stream->buf, '\n', stream->len))) {
+        if (stream->len == sizeof(stream->buf) || stream_fill(stream) <= 0) {
+            printf("Metadata missing newline\n");
+            write(stream->fd, "ERROR: Metadata missing newline\n", 32);
+            return -1;
+        }
+    }
+    *newline = '\0';
+    stream->pos = newline + 1 - stream->buf;
+
+    char *colon = strchr(stream->buf, ':');
+    if (!colon) {
+        printf("Invalid metadata format\n");
+        write(stream->fd, "ERROR: Invalid metadata format\n", 31);
+        return -1;
+    }
+    *colon = '\0';
+    strncpy(filename, stream->buf, filename_size - 1);
+    filename[filename_size - 1] = '\0';
+    *file_size = atol(colon + 1);
+    return 0;
+}
+
+// Binary header, see the protocol description at the top of this file.
+// Returns 0 and fills the out parameters, or -1 after replying with an error.
+int parse_binary_header(struct transfer_stream* stream, struct transfer_header* hdr) {
+    unsigned char header[TRANSFER_HEADER_SIZE];
+    char* filename = hdr->filename;
+    if (stream_read_exact(stream, header, sizeof(header)) == -1) {
+        printf("Error reading file metadata\n");
+        write(stream->fd, "ERROR: Failed to read metadata\n", 31);
+        return -1;
+    }
+
+    hdr->version = header[4];
+    if (hdr->version != TRANSFER_VERSION && hdr->version != RESUMABLE_VERSION) {
+        printf("Unsupported transfer protocol version: %u\n", header[4]);
+        write(stream->fd, "ERROR: Unsupported protocol version\n", 36);
+        return -1;
+    }
+
+    hdr->checksum_type = header[5];
+    uint16_t name_len = (uint16_t)((header[6] << 8) | header[7]);
+    uint64_t size = read_be64(header + 8);
+    hdr->checksum = read_be64(header + 16);
+
+    if (hdr->checksum_type != CHECKSUM_NONE && hdr->checksum_type != CHECKSUM_CRC32C &&
+        (hdr->checksum_type != CHECKSUM_XXH64 || hdr->version == RESUMABLE_VERSION)) {
+        printf("Unsupported checksum type: %d\n", hdr->checksum_type);
+        write(stream->fd, "ERROR: Unsupported checksum type\n", 33);
+        return -1;
+    }
+    if (size > (uint64_t)LONG_MAX) {
+        printf("Invalid file size\n");
+        write(stream->fd, "ERROR: Invalid metadata format\n", 31);
+        return -1;
+    }
+    if (hdr->version == RESUMABLE_VERSION &&
+        stream_read_exact(stream, hdr->content_id, CONTENT_ID_SIZE) == -1) {
+        printf("Error reading file metadata\n");
+        write(stream->fd, "ERROR: Failed to read metadata\n", 31);
+        return -1;
+    }
+    if (name_len == 0 || name_len > MAX_FILENAME_LEN ||
+        stream_read_exact(stream, filename, name_len) == -1) {
+        printf("Invalid filename\n");
+        write(stream->fd, "ERROR: Invalid filename\n", 24);
+        return -1;
+    }
+    filename[name_len] = '\0';
+
+    // Names come straight from the client; never let them leave UPLOADS_DIR
+    if (memchr(filename, '\0', name_len) || strchr(filename, '/') ||
+        strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0) {
+        printf("Invalid filename\n");
+        write(stream->fd, "ERROR: Invalid filename\n", 24);
+        return -1;
+    }
+
+    hdr->file_size = (long)size;
+    return 0;
+}
+
+// Receive length-delimited chunks until the zero-length terminator.
+// Returns 0 when exactly file_size bytes arrived, -1 otherwise.
+int receive_chunks(struct transfer_stream* stream, struct file_sink* sink) {
+    while (1) {
+        unsigned char chunk_header[CHUNK_HEADER_SIZE];
+        if (stream_read_exact(stream, chunk_header, sizeof(chunk_header)) == -1) {
+            printf("Connection closed before end of file\n");
+            return -1;
+        }
+
+        long chunk_len = read_be32(chunk_header);
+        if (chunk_len == 0) {
+            return sink->received == sink->file_size ? 0 : -1;
+        }
+        if (chunk_len > sink->file_size - sink->received) {
+            printf("Chunk exceeds declared file size\n");
+            return -1;
+        }
+        if (receive_payload(stream, sink, chunk_len) == -1) {
+            return -1;
+        }
+    }
+}
+
+// Make the rename of a finished upload survive a crash
+int sync_uploads_dir(void) {
+    int dir_fd = open(UPLOADS_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) {
+        return -1;
+    }
+    int result = fsync(dir_fd);
+    close(dir_fd);
+    return result;
+}
+
+// Send a whole buffer to the client
+int send_all(int fd, const void* data, size_t len) {
+    const char* p = data;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Hex digits in a digest of this checksum type
+int digest_width(int checksum_type) {
+    return checksum_type == CHECKSUM_XXH64 ? 16 : 8;
+}
+
+// Report success, echoing the server-side digest so the client can compare
+void send_success(int fd, int checksum_type, uint64_t digest) {
+    char reply[96];
+    int len;
+    if (checksum_type == CHECKSUM_CRC32C || checksum_type == CHECKSUM_XXH64) {
+        len = snprintf(reply, sizeof(reply), "SUCCESS: File received successfully (%s %0*llx)\n",
+                       checksum_type == CHECKSUM_XXH64 ? "xxh64" : "crc32c",
+                       digest_width(checksum_type), (unsigned long long)digest);
+    } else {
+        len = snprintf(reply, sizeof(reply), "SUCCESS: File received successfully\n");
+    }
+    send_all(fd, reply, len);
+}
+
+void transfer_path(const struct resumable_transfer* t, const char* suffix,
+                   char* path, size_t path_size) {
+    snprintf(path, path_size, "%s/%s%s", TRANSFERS_DIR, t->hex_id, suffix);
+}
+
+// Restore received ranges from the on-disk index. Returns 0 if an index for
+// exactly this file was found, -1 if the transfer must start from scratch.
+int index_load(struct resumable_transfer* t) {
+    char path[512];
+    unsigned char buf[TRANSFER_HEADER_SIZE + MAX_FILENAME_LEN + MAX_RANGES * 20];
+
+    transfer_path(t, ".idx", path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t len = read(fd, buf, sizeof(buf));
+    close(fd);
+
+    if (len < TRANSFER_HEADER_SIZE || memcmp(buf, INDEX_MAGIC, 4) != 0 ||
+        buf[4] != INDEX_VERSION) {
+        return -1;
+    }
+    size_t name_len = (size_t)((buf[6] << 8) | buf[7]);
+    long file_size = (long)read_be64(buf + 8);
+    uint32_t checksum = read_be32(buf + 16);
+    int range_count = (int)read_be32(buf + 20);
+
+    if (buf[5] != t->checksum_type || file_size != t->file_size || checksum != t->checksum ||
+        range_count < 0 || range_count > MAX_RANGES ||
+        (size_t)len != TRANSFER_HEADER_SIZE + name_len + (size_t)range_count * 20 ||
+        name_len != strlen(t->filename) ||
+        memcmp(buf + TRANSFER_HEADER_SIZE, t->filename, name_len) != 0) {
+        return -1;
+    }
+
+    const unsigned char* p = buf + TRANSFER_HEADER_SIZE + name_len;
+    t->stored = 0;
+    for (int i = 0; i < range_count; i++, p += 20) {
+        t->ranges[i].start = (long)read_be64(p);
+        t->ranges[i].end = (long)read_be64(p + 8);
+        t->ranges[i].crc = read_be32(p + 16);
+        if (t->ranges[i].start < 0 || t->ranges[i].end > file_size ||
+            t->ranges[i].start >= t->ranges[i].end ||
+            (i > 0 && t->ranges[i].start < t->ranges[i - 1].end)) {
+            return -1;
+        }
+        t->stored += t->ranges[i].end - t->ranges[i].start;
+    }
+    t->range_count = range_count;
+    return 0;
+}
+
+// The index as it stood at one moment, to be written without the lock
+struct index_snapshot {
+    unsigned char buf[TRANSFER_HEADER_SIZE + MAX_FILENAME_LEN + MAX_RANGES * 20];
+    size_t len;
+    long flushed;    // The unflushed bytes it covers
+    long stored;
+    unsigned int generation;
+};
+
+// Encode the received ranges for index_write and mark the transfer as being
+// saved. Called with t->lock held.
+void index_snapshot(struct resumable_transfer* t, struct index_snapshot* snap) {
+    size_t name_len = strlen(t->filename);
+    unsigned char* buf = snap->buf;
+
+    memcpy(buf, INDEX_MAGIC, 4);
+    buf[4] = INDEX_VERSION;
+    buf[5] = (unsigned char)t->checksum_type;
+    buf[6] = (unsigned char)(name_len >> 8);
+    buf[7] = (unsigned char)name_len;
+    write_be64(buf + 8, (uint64_t)t->file_size);
+    write_be32(buf + 16, t->checksum);
+    write_be32(buf + 20, (uint32_t)t->range_count);
+    memcpy(buf + TRANSFER_HEADER_SIZE, t->filename, name_len);
+    unsigned char* p = buf + TRANSFER_HEADER_SIZE + name_len;
+    for (int i = 0; i < t->range_count; i++, p += 20) {
+        write_be64(p, (uint64_t)t->ranges[i].start);
+        write_be64(p + 8, (uint64_t)t->ranges[i].end);
+        write_be32(p + 16, t->ranges[i].crc);
+    }
+    snap->len = TRANSFER_HEADER_SIZE + name_len + (size_t)t->range_count * 20;
+    snap->flushed = t->unflushed;
+    snap->stored = t->stored;
+    snap->generation = t->generation;
+    t->unflushed = 0;
+    t->saving = 1;
+}
+
+// Persist a snapshot of the received ranges. The part file is synced first
+// so the index never claims data that could be lost in a crash. The syncs
+// run without t->lock, so other connections keep storing chunks meanwhile;
+// the index only replaces the old one if the part file is still the one it
+// describes. Called without t->lock held.
+int index_write(struct resumable_transfer* t, struct index_snapshot* snap) {
+    char path[512];
+    char tmp_path[520];
+
+    transfer_path(t, ".idx", path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int result = -1;
+    if (fdatasync(t->fd) == 0) {
+        int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd != -1) {
+            result = write_fully(fd, (const char*)snap->buf, snap->len, 0) == 0 && fdatasync(fd) == 0 ? 0 : -1;
+            close(fd);
+        }
+    }
+    int saved_errno = errno;
+
+    pthread_mutex_lock(&t->lock);
+    if (result == 0 && (t->finished || t->generation != snap->generation)) {
+        unlink(tmp_path);  // Published or started over while this was written
+    } else if (result == 0) {
+        result = rename(tmp_path, path);
+        saved_errno = errno;
+    }
+    if (result == -1) {
+        t->unflushed += snap->flushed;
+    }
+    t->saving = 0;
+    pthread_mutex_unlock(&t->lock);
+
+    if (result == 0) {
+        printf("[transfer %s] Progress saved: %ld/%ld bytes stored\n",
+               t->hex_id, snap->stored, t->file_size);
+    }
+    errno = saved_errno;
+    return result;
+}
+
+// Reserve [start, end) for a chunk about to be written, so that nothing held
+// or being written by another connection is written over. Returns 0 if
+// claimed, 1 if the range is already held, -1 if it partly overlaps held
+// data or overlaps another claim. Called with t->lock held.
+int range_claim(struct resumable_transfer* t, long start, long end) {
+    int i = 0;
+    while (i < t->range_count && t->ranges[i].end <= start) {
+        i++;
+    }
+    if (i < t->range_count && t->ranges[i].start < end) {
+        if (t->ranges[i].start <= start && end <= t->ranges[i].end) {
+            return 1;
+        }
+        return -1;
+    }
+    for (i = 0; i < t->claim_count; i++) {
+        if (t->claims[i].start < end && start < t->claims[i].end) {
+            return -1;
+        }
+    }
+    if (t->claim_count == MAX_WORKERS) {
+        return -1;
+    }
+    t->claims[t->claim_count].start = start;
+    t->claims[t->claim_count].end = end;
+    t->claim_count++;
+    return 0;
+}
+
+// Drop the claim range_claim made at start. Called with t->lock held.
+void range_unclaim(struct resumable_transfer* t, long start) {
+    for (int i = 0; i < t->claim_count; i++) {
+        if (t->claims[i].start == start) {
+            t->claims[i] = t->claims[--t->claim_count];
+            return;
+        }
+    }
+}
+
+// Record a verified chunk, merging it with its neighbours and combining
+// their CRCs. The range must be claimed, so it overlaps nothing held.
+// Returns 0 if added, -1 if the range table is full. Called with t->lock held.
+int range_insert(struct resumable_transfer* t, long start, long end, uint32_t crc) {
+    int i = 0;
+    while (i < t->range_count && t->ranges[i].end <= start) {
+        i++;
+    }
+
+    int merge_left = i > 0 && t->ranges[i - 1].end == start;
+    int merge_right = i < t->range_count && t->ranges[i].start == end;
+
+    if (merge_left) {
+        struct byte_range* left = &t->ranges[i - 1];
+        left->crc = crc32c_combine(left->crc, crc, end - start);
+        left->end = end;
+        if (merge_right) {
+            struct byte_range* right = &t->ranges[i];
+            left->crc = crc32c_combine(left->crc, right->crc, right->end - right->start);
+            left->end = right->end;
+            memmove(right, right + 1, (t->range_count - i - 1) * sizeof(*right));
+            t->range_count--;
+        }
+    } else if (merge_right) {
+        struct byte_range* right = &t->ranges[i];
+        right->crc = crc32c_combine(crc, right->crc, right->end - right->start);
+        right->start = start;
+    } else {
+        if (t->range_count == MAX_RANGES) {
+            return -1;
+        }
+        memmove(&t->ranges[i + 1], &t->ranges[i], (t->range_count - i) * sizeof(t->ranges[0]));
+        t->ranges[i].start = start;
+        t->ranges[i].end = end;
+        t->ranges[i].crc = crc;
+        t->range_count++;
+    }
+
+    t->stored += end - start;
+    return 0;
+}
+
+int transfer_complete(const struct resumable_transfer* t) {
+    return t->file_size == 0 ||
+           (t->range_count == 1 && t->ranges[0].start == 0 && t->ranges[0].end == t->file_size);
+}
+
+// Find the shared state for this content ID, loading or creating it on first
+// use. Returns NULL if the part file cannot be opened or the ID is already in
+// use for a different file.
+struct resumable_transfer* transfer_acquire(const struct transfer_header* hdr) {
+    pthread_mutex_lock(&transfers_lock);
+
+    struct resumable_transfer* t = transfers;
+    while (t && memcmp(t->content_id, hdr->content_id, CONTENT_ID_SIZE) != 0) {
+        t = t->next;
+    }
+    if (t) {
+        if (t->file_size != hdr->file_size || strcmp(t->filename, hdr->filename) != 0) {
+            t = NULL;
+        } else {
+            t->refcount++;
+        }
+        pthread_mutex_unlock(&transfers_lock);
+        return t;
+    }
+
+    t = calloc(1, sizeof(*t));
+    if (!t) {
+        pthread_mutex_unlock(&transfers_lock);
+        return NULL;
+    }
+    memcpy(t->content_id, hdr->content_id, CONTENT_ID_SIZE);
+    for (int i = 0; i < CONTENT_ID_SIZE; i++) {
+        snprintf(t->hex_id + i * 2, 3, "%02x", hdr->content_id[i]);
+    }
+    strcpy(t->filename, hdr->filename);
+    t->file_size = hdr->file_size;
+    t->checksum_type = hdr->checksum_type;
+    t->checksum = (uint32_t)hdr->checksum;
+
+    char path[512];
+    mkdir(TRANSFERS_DIR, 0755);
+    transfer_path(t, ".part", path, sizeof(path));
+    t->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (t->fd == -1) {
+        printf("Error opening %s: %s\n", path, strerror(errno));
+        free(t);
+        pthread_mutex_unlock(&transfers_lock);
+        return NULL;
+    }
+
+    if (index_load(t) == 0) {
+        printf("[transfer %s] Resuming %s: %ld/%ld bytes already stored\n",
+               t->hex_id, t->filename, t->stored, t->file_size);
+    } else {
+        t->range_count = 0;
+        t->stored = 0;
+        if (ftruncate(t->fd, 0) == -1 ||
+            (t->file_size > 0 && fallocate(t->fd, 0, 0, t->file_size) == -1 &&
+             errno != EOPNOTSUPP && errno != ENOSYS)) {
+            printf("Warning: could not preallocate %ld bytes: %s\n", t->file_size, strerror(errno));
+        }
+    }
+
+    pthread_mutex_init(&t->lock, NULL);
+    t->refcount = 1;
+    t->next = transfers;
+    transfers = t;
+    pthread_mutex_unlock(&transfers_lock);
+    return t;
+}
+
+// Drop a connection's reference; the last one out saves progress and frees it
+void transfer_release(struct resumable_transfer* t) {
+    pthread_mutex_lock(&transfers_lock);
+    if (--t->refcount > 0) {
+        pthread_mutex_unlock(&transfers_lock);
+        return;
+    }
+    struct resumable_transfer** link = &transfers;
+    while (*link != t) {
+        link = &(*link)->next;
+    }
+    *link = t->next;
+    pthread_mutex_unlock(&transfers_lock);
+
+    if (!t->finished && t->unflushed > 0) {
+        struct index_snapshot* snap = malloc(sizeof(*snap));
+        if (snap) {
+            index_snapshot(t, snap);
+        }
+        if (!snap || index_write(t, snap) == -1) {
+            printf("[transfer %s] Error saving progress: %s\n", t->hex_id, strerror(errno));
+        }
+        free(snap);
+    }
+    close(t->fd);
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+}
+
+// Verify and publish a completed transfer. Called with t->lock held.
+// Returns 0 on success; on failure the data is discarded and the transfer
+// starts over in a fresh part file.
+int transfer_finish(struct resumable_transfer* t, const char** error) {
+    char part_path[512];
+    char index_path[512];
+    char filepath[512];
+    uint32_t crc = t->file_size > 0 ? t->ranges[0].crc : 0;
+
+    transfer_path(t, ".part", part_path, sizeof(part_path));
+    transfer_path(t, ".idx", index_path, sizeof(index_path));
+    snprintf(filepath, sizeof(filepath), "%s/%s", UPLOADS_DIR, t->filename);
+
+    t->finished = 1;
+    t->generation++;
+    if (t->checksum_type == CHECKSUM_CRC32C && crc != t->checksum) {
+        printf("[transfer %s] Checksum mismatch for %s: expected %08x, got %08x\n",
+               t->hex_id, t->filename, t->checksum, crc);
+        *error = "ERROR: Checksum mismatch\n";
+    } else if (fdatasync(t->fd) == -1 || rename(part_path, filepath) == -1 ||
+               sync_uploads_dir() == -1) {
+        printf("[transfer %s] Error committing %s: %s\n", t->hex_id, t->filename, strerror(errno));
+        *error = "ERROR: Failed to save file\n";
+    } else {
+        unlink(index_path);
+        printf("[transfer %s] File transfer completed successfully: %s (%ld bytes)\n",
+               t->hex_id, t->filename, t->file_size);
+        return 0;
+    }
+
+    unlink(index_path);
+    // Swap a fresh file in under the same descriptor, which other connections
+    // may still be writing through
+    int fd = open(part_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd != -1) {
+        dup3(fd, t->fd, O_CLOEXEC);
+        close(fd);
+    }
+    t->range_count = 0;
+    t->stored = 0;
+    t->finished = 0;
+    return -1;
+}
+
+// Version 2: resumable, possibly parallel upload keyed by content ID
+void handle_resumable_transfer(struct transfer_stream* stream,
+                               const struct transfer_header* hdr, unsigned long id) {
+    struct file_sink sink;
+    const char* error = NULL;
+    unsigned char reply[4 + MAX_RANGES * 16];
+    struct index_snapshot snap;
+
+    struct resumable_transfer* t = transfer_acquire(hdr);
+    if (!t) {
+        write(stream->fd, "ERROR: Failed to create file\n", 29);
+        return;
+    }
+    if (sink_attach(&sink, t->fd, id) == -1) {
+        transfer_release(t);
+        write(stream->fd, "ERROR: Failed to create file\n", 29);
+        return;
+    }
+
+    // Tell the client which ranges it can skip
+    pthread_mutex_lock(&t->lock);
+    int count = t->finished ? (t->file_size > 0) : t->range_count;
+    write_be32(reply, (uint32_t)count);
+    for (int i = 0; i < count; i++) {
+        long start = t->finished ? 0 : t->ranges[i].start;
+        long end = t->finished ? t->file_size : t->ranges[i].end;
+        write_be64(reply + 4 + i * 16, (uint64_t)start);
+        write_be64(reply + 12 + i * 16, (uint64_t)end);
+    }
+    pthread_mutex_unlock(&t->lock);
+
+    if (send_all(stream->fd, reply, 4 + (size_t)count * 16) == -1) {
+        error = "";
+    }
+
+    while (!error) {
+        unsigned char chunk_header[RESUMABLE_CHUNK_HEADER_SIZE];
+        if (stream_read_exact(stream, chunk_header, CHUNK_HEADER_SIZE) == -1) {
+            printf("[transfer %lu] Connection closed before end of file\n", id);
+            error = "";
+            break;
+        }
+        long chunk_len = read_be32(chunk_header);
+        if (chunk_len == 0) {
+            break;
+        }
+        if (stream_read_exact(stream, chunk_header + CHUNK_HEADER_SIZE,
+                              RESUMABLE_CHUNK_HEADER_SIZE - CHUNK_HEADER_SIZE) == -1) {
+            error = "";
+            break;
+        }
+        uint64_t offset = read_be64(chunk_header + 4);
+        uint32_t chunk_crc = read_be32(chunk_header + 12);
+        if (offset > (uint64_t)hdr->file_size || chunk_len > hdr->file_size - (long)offset) {
+            printf("[transfer %lu] Chunk exceeds declared file size\n", id);
+            error = "ERROR: Chunk exceeds declared size\n";
+            break;
+        }
+
+        // Decide before writing anything: held data is never written over,
+        // and a chunk only becomes held once its CRC has matched
+        pthread_mutex_lock(&t->lock);
+        int claimed = range_claim(t, (long)offset, (long)offset + chunk_len);
+        pthread_mutex_unlock(&t->lock);
+        if (claimed == -1) {
+            printf("[transfer %lu] Chunk at offset %ld overlaps stored data\n", id, (long)offset);
+            error = "ERROR: Overlapping chunk\n";
+            break;
+        }
+        if (claimed == 1) {
+            if (stream_discard(stream, chunk_len) == -1) {
+                error = "";
+            }
+            continue;
+        }
+
+        sink.stored = (long)offset;
+        sink.crc = 0;
+        int received = receive_payload(stream, &sink, chunk_len);
+        int inserted = -1;
+        int save = 0;
+        pthread_mutex_lock(&t->lock);
+        range_unclaim(t, (long)offset);
+        if (received == 0 && sink.crc == chunk_crc) {
+            inserted = range_insert(t, (long)offset, (long)offset + chunk_len, chunk_crc);
+        }
+        if (inserted == 0) {
+            t->unflushed += chunk_len;
+            if (t->unflushed >= INDEX_FLUSH_BYTES && !t->saving) {
+                index_snapshot(t, &snap);
+                save = 1;
+            }
+        }
+        pthread_mutex_unlock(&t->lock);
+        if (save && index_write(t, &snap) == -1) {
+            printf("[transfer %s] Error saving progress: %s\n", t->hex_id, strerror(errno));
+        }
+
+        if (received == -1) {
+            error = "";
+        } else if (sink.crc != chunk_crc) {
+            printf("[transfer %lu] Chunk checksum mismatch at offset %ld\n", id, (long)offset);
+            error = "ERROR: Chunk checksum mismatch\n";
+        } else if (inserted == -1) {
+            printf("[transfer %lu] Too many separate ranges at offset %ld\n", id, (long)offset);
+            error = "ERROR: Too many ranges\n";
+        }
+    }
+
+    // Whoever delivers the last missing byte publishes the file
+    uint64_t ack_start = sdr_now_ns();
+    char partial[96];
+    uint32_t file_crc = 0;
+    if (!error) {
+        pthread_mutex_lock(&t->lock);
+        if (!t->finished && transfer_complete(t)) {
+            transfer_finish(t, &error);
+        } else if (!t->finished) {
+            snprintf(partial, sizeof(partial), "PARTIAL: %ld/%ld bytes stored\n",
+                     t->stored, t->file_size);
+            error = partial;
+        }
+        if (t->file_size > 0) {
+            file_crc = t->ranges[0].crc;
+        }
+        pthread_mutex_unlock(&t->lock);
+    }
+
+    sink_close(&sink);
+    transfer_release(t);
+
+    if (!error) {
+        send_success(stream->fd, CHECKSUM_CRC32C, file_crc);
+    } else if (*error) {
+        write(stream->fd, error, strlen(error));
+    }
+    sdr_histogram_since(file_ack_time, ack_start);
+}
+
 // Handle file reception from client
-void handle_file_transfer(int client_fd) {
-    char buffer[BUFFER_SIZE];
-    char filename[256];
-    long file_size = 0;
+void handle_file_transfer(int client_fd, struct transfer_uring* uring) {
+    struct transfer_stream stream;
+    struct file_sink sink;
+    struct transfer_header hdr;
     char filepath[512];
-    FILE *file = NULL;
-    long bytes_received = 0;
-    
-    printf("Starting file transfer from client...\n");
-    
-    // Read metadata (filename:filesize)
-    ssize_t bytes_read = read(client_fd, buffer, sizeof(buffer) - 1);
-    if (bytes_read <= 0) {
+    char partpath[600];
+    int binary = 0;
+    int ok;
+
+    unsigned long id = __sync_add_and_fetch(&next_transfer_id, 1);
+
+    printf("[transfer %lu] Starting file transfer from client...\n", id);
+
+    memset(&stream, 0, sizeof(stream));
+    stream.fd = client_fd;
+    stream.uring = uring;
+
+    // Read enough to tell the two protocols apart
+    while (stream.len < 4) {
+        if (stream_fill(&stream) <= 0) {
+            break;
+        }
+        if ((unsigned char)stream.buf[0] != 0xFF) {
+            break;  // Legacy text metadata
+        }
+    }
+    if (stream.len == 0) {
         printf("Error reading file metadata\n");
         write(client_fd, "ERROR: Failed to read metadata\n", 31);
         return;
     }
-    
-    buffer[bytes_read] = '\0';
-    
-    // Parse metadata
-    char *newline = strchr(buffer, '\n');
-    if (newline) {
-        *newline = '\0';
-        
-        char *colon = strchr(buffer, ':');
-        if (colon) {
-            *colon = '\0';
-            strncpy(filename, buffer, sizeof(filename) - 1);
-            filename[sizeof(filename) - 1] = '\0';
-            file_size = atol(colon + 1);
-            
-            printf("Receiving file: %s (%ld bytes)\n", filename, file_size);
-        } else {
-            printf("Invalid metadata format\n");
-            write(client_fd, "ERROR: Invalid metadata format\n", 31);
+    binary = stream.len >= 4 && memcmp(stream.buf, TRANSFER_MAGIC, 4) == 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    if (binary) {
+        if (parse_binary_header(&stream, &hdr) == -1) {
             return;
         }
-    } else {
-        printf("Metadata missing newline\n");
-        write(client_fd, "ERROR: Metadata missing newline\n", 32);
+    } else if (parse_legacy_header(&stream, hdr.filename, sizeof(hdr.filename),
+                                   &hdr.file_size) == -1) {
+        return;
+    }
+
+    const char* filename = hdr.filename;
+    long file_size = hdr.file_size;
+    int checksum_type = hdr.checksum_type;
+    uint64_t expected_digest = hdr.checksum;
+
+    printf("[transfer %lu] Receiving file: %s (%ld bytes%s)\n", id, filename, file_size,
+           binary ? (hdr.version == RESUMABLE_VERSION ? ", resumable" : ", binary protocol") : "");
+
+    if (binary && hdr.version == RESUMABLE_VERSION) {
+        handle_resumable_transfer(&stream, &hdr, id);
         return;
     }
-    
-    // Create full file path
+
+    // Create full file path. Data lands in a per-transfer part file that is
+    // renamed into place once durable, so concurrent uploads of the same name
+    // never interleave and readers never see a half-written file.
     snprintf(filepath, sizeof(filepath), "%s/%s", UPLOADS_DIR, filename);
-    
+    snprintf(partpath, sizeof(partpath), "%s/.%s.part%lu", UPLOADS_DIR, filename, id);
+
     // Open file for writing
-    file = fopen(filepath, "wb");
-    if (!file) {
+    if (sink_open(&sink, partpath, file_size, checksum_type, id) == -1) {
         printf("Error creating file: %s\n", strerror(errno));
         write(client_fd, "ERROR: Failed to create file\n", 29);
         return;
     }
-    
+
     // Receive file data
-    while (bytes_received < file_size) {
-        bytes_read = read(client_fd, buffer, sizeof(buffer));
-        if (bytes_read <= 0) {
-            if (bytes_read == 0) {
-                printf("Connection closed by client\n");
-            } else {
-                printf("Error reading file data: %s\n", strerror(errno));
-            }
+    if (binary) {
+        ok = receive_chunks(&stream, &sink) == 0;
+    } else {
+        ok = receive_payload(&stream, &sink, file_size) == 0;
+        if (ok) {
+            consume_eof_marker(&stream);
+        }
+    }
+    uint64_t ack_start = sdr_now_ns();
+    if (ok && sink_finish(&sink) == -1) {
+        printf("[transfer %lu] Error writing to file: %s\n", id, strerror(errno));
+        ok = 0;
+    }
+    long bytes_received = sink.received;
+    uint64_t actual_digest = checksum_type == CHECKSUM_XXH64 ? xxh64_digest(&sink.xxh) : sink.crc;
+    int checksum_ok = checksum_type == CHECKSUM_NONE || actual_digest == expected_digest;
+
+    // SUCCESS promises the data is on stable storage
+    int durable = ok && checksum_ok && fdatasync(sink.fd) == 0;
+    sink_close(&sink);
+    if (durable && (rename(partpath, filepath) == -1 || sync_uploads_dir() == -1)) {
+        durable = 0;
+    }
+
+    if (ok && !checksum_ok) {
+        printf("[transfer %lu] Checksum mismatch for %s: expected %0*llx, got %0*llx\n",
+               id, filename, digest_width(checksum_type), (unsigned long long)expected_digest,
+               digest_width(checksum_type), (unsigned long long)actual_digest);
+        write(client_fd, "ERROR: Checksum mismatch\n", 25);
+        unlink(partpath);
+    } else if (ok && !durable) {
+        printf("[transfer %lu] Error committing %s: %s\n", id, filename, strerror(errno));
+        write(client_fd, "ERROR: Failed to save file\n", 27);
+        unlink(partpath);
+    } else if (ok) {
+        printf("[transfer %lu] File transfer completed successfully: %s (%ld bytes)\n",
+               id, filename, bytes_received);
+        send_success(client_fd, checksum_type, actual_digest);
+    } else {
+        printf("[transfer %lu] File transfer incomplete: %ld/%ld bytes\n",
+               id, bytes_received, file_size);
+        write(client_fd, "ERROR: File transfer incomplete\n", 32);
+        // Remove incomplete file
+        unlink(partpath);
+    }
+    sdr_histogram_since(file_ack_time, ack_start);
+}
+
+// Returns -1 if the queue is full
+int queue_push(int client_fd) {
+    pthread_mutex_lock(&queue.lock);
+    if (queue.count == QUEUE_CAPACITY) {
+        pthread_mutex_unlock(&queue.lock);
+        return -1;
+    }
+    queue.fds[(queue.head + queue.count) % QUEUE_CAPACITY] = client_fd;
+    queue.queued_at[(queue.head + queue.count) % QUEUE_CAPACITY] = sdr_now_ns();
+    queue.count++;
+    pthread_cond_signal(&queue.not_empty);
+    pthread_mutex_unlock(&queue.lock);
+    return 0;
+}
+
+int queue_full(void) {
+    pthread_mutex_lock(&queue.lock);
+    int full = queue.count == QUEUE_CAPACITY;
+    pthread_mutex_unlock(&queue.lock);
+    return full;
+}
+
+int queue_pop(void) {
+    pthread_mutex_lock(&queue.lock);
+    while (queue.count == 0) {
+        pthread_cond_wait(&queue.not_empty, &queue.lock);
+    }
+    int client_fd = queue.fds[queue.head];
+    sdr_qos_waited(SDR_CLASS_FILE, queue.queued_at[queue.head]);
+    int was_full = queue.count == QUEUE_CAPACITY;
+    queue.head = (queue.head + 1) % QUEUE_CAPACITY;
+    queue.count--;
+    pthread_mutex_unlock(&queue.lock);
+    if (was_full) {
+        uint64_t one = 1;
+        write(queue_wake_fd, &one, sizeof(one));
+    }
+    return client_fd;
+}
+
+// Set up a worker's own io_uring, with its receive buffers registered and
+// two empty fixed file slots. Returns NULL, having said why, if it cannot;
+// the worker then uses the splice() and read() paths.
+struct transfer_uring* transfer_uring_start(void) {
+    struct transfer_uring* io = calloc(1, sizeof(*io));
+    struct iovec buffers[URING_BUFFERS];
+
+    if (!io || sdr_uring_init(&io->ring, URING_DEPTH, 0) == -1) {
+        printf("Worker io_uring unavailable: %s\n", strerror(errno));
+        free(io);
+        return NULL;
+    }
+    io->slots[0] = io->slots[1] = -1;
+    for (int i = 0; i < URING_BUFFERS; i++) {
+        if (posix_memalign((void**)&io->buffers[i], DIRECT_IO_ALIGN, URING_BUFFER_SIZE) != 0) {
+            io->buffers[i] = NULL;
+            errno = ENOMEM;
             break;
         }
-        
-        // Check for EOF marker in the data
-        char *eof_pos = strstr(buffer, "EOF\n");
-        if (eof_pos) {
-            // Write only the data before EOF marker
-            size_t data_before_eof = eof_pos - buffer;
-            if (data_before_eof > 0) {
-                size_t written = fwrite(buffer, 1, data_before_eof, file);
-                if (written != data_before_eof) {
-                    printf("Error writing final data to file: %s\n", strerror(errno));
-                    break;
-                }
-                bytes_received += data_before_eof;
+        buffers[i].iov_base = io->buffers[i];
+        buffers[i].iov_len = URING_BUFFER_SIZE;
+    }
+    if (!io->buffers[URING_BUFFERS - 1] ||
+        sdr_uring_register_buffers(&io->ring, buffers, URING_BUFFERS) == -1 ||
+        sdr_uring_register_files(&io->ring, io->slots, 2) == -1) {
+        printf("Worker io_uring unavailable: %s\n", strerror(errno));
+        sdr_uring_exit(&io->ring);
+        for (int i = 0; i < URING_BUFFERS; i++) {
+            free(io->buffers[i]);
+        }
+        free(io);
+        return NULL;
+    }
+    return io;
+}
+
+// Each worker runs one transfer at a time; all state lives on its stack
+void* transfer_worker(void* arg) {
+    (void)arg;
+    struct transfer_uring* uring = sdr_io_uring_enabled() ? transfer_uring_start() : NULL;
+    sdr_qos_thread(SDR_CLASS_FILE);
+    while (1) {
+        int client_fd = queue_pop();
+        handle_file_transfer(client_fd, uring);
+        if (uring) {
+            uring_release_slots(uring);
+        }
+        sdr_counter_add(&file_transfers_handled, 1);
+        close(client_fd);
+        printf("Client disconnected\n");
+    }
+    return NULL;
+}
+
+// Hand clients to the workers while the queue has room. Accepted sockets are
+// blocking, as the workers expect.
+void accept_transfers(void) {
+    while (1) {
+        if (queue_full()) {
+            // Stop watching the listener until a worker frees a slot
+            if (!accept_paused) {
+                sdr_loop_modify(file_server_fd, 0, &file_listener);
+                accept_paused = 1;
             }
-            printf("EOF marker received\n");
-            break;
+            return;
         }
-        
-        // Write data to file
-        size_t written = fwrite(buffer, 1, bytes_read, file);
-        if (written != bytes_read) {
-            printf("Error writing to file: %s\n", strerror(errno));
-            break;
+        uint64_t start = sdr_now_ns();
+        int client_fd = accept4(file_server_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno != EAGAIN && errno != EINTR) {
+                perror("accept");
+            }
+            return;
         }
-        
-        bytes_received += bytes_read;
-        
-        // Log progress every 10%
-        static long last_progress_logged = 0;
-        long current_progress = ((double)bytes_received / file_size) * 100.0;
-        if (current_progress - last_progress_logged >= 10 || bytes_received == file_size) {
-            printf("File transfer progress: %ld%% (%ld/%ld bytes)\n", 
-                   current_progress, bytes_received, file_size);
-            last_progress_logged = current_progress;
-        }
-    }
-    
-    fclose(file);
-    
-    // Small delay to ensure all data is written
-    sleep(1); // 1 second delay
-    
-    if (bytes_received >= file_size) {
-        printf("File transfer completed successfully: %s (%ld bytes)\n", filename, bytes_received);
-        write(client_fd, "SUCCESS: File received successfully\n", 36);
-    } else {
-        printf("File transfer incomplete: %ld/%ld bytes\n", bytes_received, file_size);
-        write(client_fd, "ERROR: File transfer incomplete\n", 32);
-        // Remove incomplete file
-        unlink(filepath);
+
+        printf("Client connected for file transfer\n");
+        file_connections_accepted++;
+        queue_push(client_fd);  // Only this thread adds, so there is room
+        sdr_histogram_since(file_accept_time, start);
     }
 }
 
-int main() {
+void file_listener_event(struct sdr_handler* handler, uint32_t events) {
+    (void)handler;
+    (void)events;
+    accept_transfers();
+}
+
+void queue_waker_event(struct sdr_handler* handler, uint32_t events) {
+    uint64_t count;
+    (void)handler;
+    (void)events;
+    read(queue_wake_fd, &count, sizeof(count));
+    if (accept_paused) {
+        accept_paused = 0;
+        sdr_loop_modify(file_server_fd, EPOLLIN, &file_listener);
+        accept_transfers();
+    }
+}
+
+int file_service_start(int argc, char* argv[]) {
     struct sockaddr_un addr;
-    int client_fd;
-    
-    // Set up signal handlers
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--direct-io") == 0) {
+            use_direct_io = 1;
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            worker_count = atoi(argv[++i]);
+            if (worker_count < 1 || worker_count > MAX_WORKERS) {
+                fprintf(stderr, "--workers must be between 1 and %d\n", MAX_WORKERS);
+                return -1;
+            }
+        } else {
+            fprintf(stderr, "Usage: %s [--direct-io] [--workers N]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    checksum_init();
+
     // Ensure uploads directory exists
     ensure_uploads_dir();
-    
+
     // Create socket
-    server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (server_fd == -1) {
+    file_server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (file_server_fd == -1) {
         perror("socket");
-        exit(1);
+        return -1;
     }
-    
+
     // Remove existing socket file
     unlink(SOCKET_PATH);
-    
+
     // Bind socket
     memset(&addr, 0, sizeof(addr));
     addr.sun_family = AF_UNIX;
     strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
-    
-    if (bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+
+    if (bind(file_server_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
         perror("bind");
-        close(server_fd);
-        exit(1);
+        close(file_server_fd);
+        return -1;
     }
-    
+
     // Listen for connections
-    if (listen(server_fd, 5) == -1) {
+    if (listen(file_server_fd, SOMAXCONN) == -1) {
         perror("listen");
-        close(server_fd);
+        close(file_server_fd);
         unlink(SOCKET_PATH);
-        exit(1);
+        return -1;
     }
-    
+
+    queue_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    file_listener.on_event = file_listener_event;
+    queue_waker.on_event = queue_waker_event;
+    file_listener.qos_class = SDR_CLASS_FILE;
+    queue_waker.qos_class = SDR_CLASS_FILE;
+    if (queue_wake_fd == -1 ||
+        sdr_loop_add(file_server_fd, EPOLLIN, &file_listener) == -1 ||
+        sdr_loop_add(queue_wake_fd, EPOLLIN, &queue_waker) == -1) {
+        perror("event loop");
+        close(file_server_fd);
+        unlink(SOCKET_PATH);
+        return -1;
+    }
+
     printf("File Server listening on %s\n", SOCKET_PATH);
     printf("Files will be saved to: %s\n", UPLOADS_DIR);
-    printf("Press Ctrl+C to stop the server\n");
-    
-    while (1) {
-        client_fd = accept(server_fd, NULL, NULL);
-        if (client_fd == -1) {
-            perror("accept");
-            continue;
+    if (use_direct_io) {
+        printf("O_DIRECT enabled for files >= %ld bytes\n", DIRECT_IO_THRESHOLD);
+    }
+    printf("CRC32C kernel: %s\n", crc32c_implementation());
+    // Workers record into these from their first transfer
+    file_accept_time = sdr_histogram_register("file", "accept");
+    file_recv_time = sdr_histogram_register("file", "recv");
+    file_write_time = sdr_histogram_register("file", "write");
+    file_ack_time = sdr_histogram_register("file", "ack");
+    // Start the transfer workers
+    for (int i = 0; i < worker_count; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, transfer_worker, NULL) != 0) {
+            perror("pthread_create");
+            return -1;
         }
-        
-        printf("Client connected for file transfer\n");
-        handle_file_transfer(client_fd);
-        close(client_fd);
-        printf("Client disconnected\n");
+        pthread_detach(thread);
     }
-    
+
+    sdr_stat_register("file", "connections_accepted", &file_connections_accepted);
+    sdr_counter_register("file", "transfers_handled", &file_transfers_handled);
+    sdr_counter_register("file", "bytes_received", &file_bytes_received);
+
+    printf("Running %d transfer workers\n", worker_count);
+    printf("Press Ctrl+C to stop the server\n");
     return 0;
 }
+
+// Transfers in progress end with the process, as they always have
+void file_service_stop(void) {
+    printf("\nShutting down File Server...\n");
+    close(file_server_fd);
+    unlink(SOCKET_PATH);
+}
+
+struct sdr_service file_service = {"file", file_service_start, NULL, file_service_stop};
+
+#ifndef SDR_DAEMON
+int main(int argc, char* argv[]) {
+    return sdr_service_main(&file_service, argc, argv);
+}
+#endif
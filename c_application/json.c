@@ -0,0 +1,239 @@
+#include <string.h>
+#include <limits.h>
+#include "json.h"
+
+#if defined(HAVE_JSON_SIMD)
+#include <emmintrin.h>
+const char* (*json_string_scan)(const char*, const char*) = json_string_scan_sse2;
+#else
+const char* (*json_string_scan)(const char*, const char*) = json_string_scan_scalar;
+#endif
+
+// What the tokenizer expects next
+enum json_want {
+    WANT_VALUE,
+    WANT_KEY,
+    WANT_COLON,
+    WANT_COMMA,  // Or the end of the container
+    WANT_DONE    // The top-level value is complete
+};
+
+// What may follow the first character of a number
+const unsigned char json_number_chars[256] = {
+    ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1, ['5'] = 1, ['6'] = 1, ['7'] = 1,
+    ['8'] = 1, ['9'] = 1, ['.'] = 1, ['e'] = 1, ['E'] = 1, ['+'] = 1, ['-'] = 1,
+};
+
+const char* json_string_scan_scalar(const char* p, const char* end) {
+    while (p < end && *p != '"' && *p != '\\') {
+        p++;
+    }
+    return p;
+}
+
+#if defined(HAVE_JSON_SIMD)
+const char* json_string_scan_sse2(const char* p, const char* end) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    // Long bodies 64 bytes a step, with one test for the lot
+    while (end - p >= 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)p);
+        __m128i b = _mm_loadu_si128((const __m128i*)(p + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(p + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(p + 48));
+        __m128i hits = _mm_or_si128(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(a, quote), _mm_cmpeq_epi8(a, backslash)),
+                         _mm_or_si128(_mm_cmpeq_epi8(b, quote), _mm_cmpeq_epi8(b, backslash))),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, quote), _mm_cmpeq_epi8(c, backslash)),
+                         _mm_or_si128(_mm_cmpeq_epi8(d, quote), _mm_cmpeq_epi8(d, backslash))));
+        if (_mm_movemask_epi8(hits)) {
+            break;  // Somewhere in these 64; the loop below finds it
+        }
+        p += 64;
+    }
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                                  _mm_cmpeq_epi8(chunk, backslash)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return json_string_scan_scalar(p, end);
+}
+#endif
+
+// The next token, for a key or value that starts here; NULL with error set
+// if one may not, or there is no room
+struct json_token* json_begin(struct json_token* tokens, int count, int max_tokens, int allowed,
+                              int* error) {
+    if (!allowed) {
+        *error = JSON_ERROR;
+        return NULL;
+    }
+    if (count == max_tokens) {
+        *error = JSON_TOO_LARGE;
+        return NULL;
+    }
+    return &tokens[count];
+}
+
+int json_tokenize(const char* text, size_t len, struct json_token* tokens, int max_tokens) {
+    const char* p = text;
+    const char* end = text + len;
+    int open[JSON_MAX_DEPTH];  // Containers not closed yet
+    int depth = 0;
+    int count = 0;
+    int want = WANT_VALUE;
+    int empty = 0;  // A container was just opened, so it may close at once
+    int error = JSON_ERROR;
+    struct json_token* token;
+
+    for (; p < end; p++) {
+        switch (*p) {
+        case ' ': case '\t': case '\n': case '\r':
+            continue;
+
+        case '{': case '[':
+            if (!(token = json_begin(tokens, count, max_tokens, want == WANT_VALUE, &error))) {
+                return error;
+            }
+            if (depth == JSON_MAX_DEPTH) {
+                return JSON_TOO_LARGE;
+            }
+            token->type = *p == '{' ? JSON_OBJECT : JSON_ARRAY;
+            token->start = p - text;
+            open[depth++] = count++;
+            want = *p == '{' ? WANT_KEY : WANT_VALUE;
+            empty = 1;
+            continue;
+
+        case '}': case ']':
+            if (depth == 0 || (want != WANT_COMMA && !empty)) {
+                return JSON_ERROR;
+            }
+            token = &tokens[open[--depth]];
+            if (token->type != (*p == '}' ? JSON_OBJECT : JSON_ARRAY)) {
+                return JSON_ERROR;
+            }
+            token->len = p + 1 - text - token->start;
+            token->next = count;
+            empty = 0;
+            want = depth ? WANT_COMMA : WANT_DONE;
+            continue;
+
+        case ',':
+            if (want != WANT_COMMA) {
+                return JSON_ERROR;
+            }
+            want = tokens[open[depth - 1]].type == JSON_OBJECT ? WANT_KEY : WANT_VALUE;
+            continue;
+
+        case ':':
+            if (want != WANT_COLON) {
+                return JSON_ERROR;
+            }
+            want = WANT_VALUE;
+            continue;
+
+        case '"': {
+            if (!(token = json_begin(tokens, count, max_tokens,
+                                     want == WANT_KEY || want == WANT_VALUE, &error))) {
+                return error;
+            }
+            const char* q = p + 1;
+            for (;;) {
+                q = json_string_scan(q, end);
+                if (q == end) {
+                    return JSON_ERROR;
+                }
+                if (*q == '"') {
+                    break;
+                }
+                q += 2;  // The backslash and the character it escapes
+                if (q > end) {
+                    return JSON_ERROR;
+                }
+            }
+            token->type = JSON_STRING;
+            token->start = p + 1 - text;
+            token->len = q - p - 1;
+            p = q;
+            want = want == WANT_KEY ? WANT_COLON : depth ? WANT_COMMA : WANT_DONE;
+            break;
+        }
+
+        default:
+            if (!(token = json_begin(tokens, count, max_tokens, want == WANT_VALUE, &error))) {
+                return error;
+            }
+            token->start = p - text;
+            if (*p == '-' || (*p >= '0' && *p <= '9')) {
+                const char* q = p + 1;
+                while (q < end && json_number_chars[(unsigned char)*q]) {
+                    q++;
+                }
+                token->type = JSON_NUMBER;
+                token->len = q - p;
+            } else if ((end - p >= 4 && (memcmp(p, "true", 4) == 0 || memcmp(p, "null", 4) == 0)) ||
+                       (end - p >= 5 && memcmp(p, "false", 5) == 0)) {
+                token->type = JSON_LITERAL;
+                token->len = *p == 'f' ? 5 : 4;
+            } else {
+                return JSON_ERROR;
+            }
+            p += token->len - 1;
+            want = depth ? WANT_COMMA : WANT_DONE;
+            break;
+        }
+        empty = 0;
+        token->next = ++count;
+    }
+    return want == WANT_DONE ? count : JSON_ERROR;
+}
+
+int json_equals(const char* text, const struct json_token* token, const char* s) {
+    size_t len = strlen(s);
+    return token->type == JSON_STRING && token->len == len && memcmp(text + token->start, s, len) == 0;
+}
+
+int json_get(const char* text, const struct json_token* tokens, int object, const char* key) {
+    size_t len = strlen(key);
+    if (tokens[object].type != JSON_OBJECT) {
+        return -1;
+    }
+    // Keys and values alternate; a value may have children of its own
+    for (int i = object + 1; i < (int)tokens[object].next; i = tokens[i + 1].next) {
+        if (tokens[i].len == len && memcmp(text + tokens[i].start, key, len) == 0) {
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+int json_int(const char* text, const struct json_token* token, long long* value) {
+    const char* p = text + token->start;
+    const char* end = p + token->len;
+    int negative = 0;
+    long long result = 0;
+
+    if (token->type != JSON_NUMBER) {
+        return -1;
+    }
+    if (*p == '-') {
+        negative = 1;
+        p++;
+    }
+    if (p == end) {
+        return -1;
+    }
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9' || result > (LLONG_MAX - (*p - '0')) / 10) {
+            return -1;
+        }
+        result = result * 10 + (*p - '0');
+    }
+    *value = negative ? -result : result;
+    return 0;
+}
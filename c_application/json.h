@@ -0,0 +1,57 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Single-pass JSON tokenizer for msg_server commands. It fills a token
+// array the caller provides and allocates nothing: every token is a slice
+// of the text, so strings keep their escapes exactly as received. Tokens
+// come in document order, each container followed by its children (an
+// object's alternate key, value, key, value...), and next skips a token
+// together with its children.
+//
+// String bodies, the bulk of most messages, are scanned 16 bytes at a time
+// where SSE2 is available.
+
+#define JSON_MAX_DEPTH 16
+
+enum json_type {
+    JSON_OBJECT,
+    JSON_ARRAY,
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_LITERAL  // true, false or null
+};
+
+struct json_token {
+    uint8_t type;
+    uint32_t start;  // Offset in the text; strings start after the quote
+    uint32_t len;    // Strings without their quotes
+    uint32_t next;   // Index of the first token after this one's children
+};
+
+#define JSON_ERROR -1       // Not valid JSON
+#define JSON_TOO_LARGE -2   // More tokens or nesting than there is room for
+
+// Returns the number of tokens, or JSON_ERROR or JSON_TOO_LARGE
+int json_tokenize(const char* text, size_t len, struct json_token* tokens, int max_tokens);
+
+// The value of key in the object at tokens[object], or -1 if it has none
+int json_get(const char* text, const struct json_token* tokens, int object, const char* key);
+// Whether a string token is exactly s
+int json_equals(const char* text, const struct json_token* token, const char* s);
+// A number token as an integer; -1 if it is not one or does not fit
+int json_int(const char* text, const struct json_token* token, long long* value);
+
+// Where the string body starting at p ends: the first '"' or '\\' before
+// end, or end. json_tokenize goes through json_string_scan, the widest
+// kernel there is; json_bench switches it.
+extern const char* (*json_string_scan)(const char* p, const char* end);
+const char* json_string_scan_scalar(const char* p, const char* end);
+#if defined(__x86_64__)
+#define HAVE_JSON_SIMD 1
+const char* json_string_scan_sse2(const char* p, const char* end);
+#endif
+
+#endif
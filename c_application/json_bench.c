@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "json.h"
+
+// Microbenchmark for msg_server's command parsing: the strstr-based
+// parse_json_command it used to have against json_tokenize with lookups of
+// the same keys, over messages the way clients send them. For neighbors
+// both also read the list into a node set, as msg_server does.
+// Usage: ./json_bench [rounds]
+
+#define DEFAULT_ROUNDS 200000
+#define MAX_TOKENS 256
+
+struct sample {
+    const char* name;
+    char* text;
+};
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// msg_server's parser before json_tokenize, kept as the baseline
+void parse_json_command(const char* json_str, char* command, int* destination_id) {
+    char* cmd_start = strstr(json_str, "\"command\"");
+    char* dest_start = strstr(json_str, "\"destination_id\"");
+
+    strcpy(command, "");
+    *destination_id = 0;
+
+    if (cmd_start) {
+        cmd_start = strchr(cmd_start, ':');
+        if (cmd_start) {
+            cmd_start++;
+            while (*cmd_start == ' ' || *cmd_start == '\t') cmd_start++;
+            if (*cmd_start == '"') {
+                cmd_start++;
+                char* cmd_end = strchr(cmd_start, '"');
+                if (cmd_end) {
+                    int len = cmd_end - cmd_start;
+                    if (len < 63) {
+                        strncpy(command, cmd_start, len);
+                        command[len] = '\0';
+                    }
+                }
+            }
+        }
+    }
+
+    if (dest_start) {
+        dest_start = strchr(dest_start, ':');
+        if (dest_start) {
+            dest_start++;
+            while (*dest_start == ' ' || *dest_start == '\t') dest_start++;
+            *destination_id = atoi(dest_start);
+        }
+    }
+}
+
+// And the neighbors list parser that went with it
+int parse_json_neighbors(const char* json_str, uint64_t* neighbors) {
+    char* list = strstr(json_str, "\"neighbors\"");
+    neighbors[0] = neighbors[1] = 0;
+    if (!list || !(list = strchr(list, '['))) {
+        return -1;
+    }
+    char* p = list + 1;
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (*p == ']') {
+            return 0;
+        }
+        char* end;
+        long neighbor = strtol(p, &end, 10);
+        if (end == p || neighbor < 0 || neighbor >= 128) {
+            return -1;
+        }
+        neighbors[neighbor >> 6] |= 1ULL << (neighbor & 63);
+        p = end;
+    }
+}
+
+void parse_old(const char* text, char* command, int* destination_id, uint64_t* neighbors) {
+    parse_json_command(text, command, destination_id);
+    if (strcmp(command, "neighbors") == 0) {
+        parse_json_neighbors(text, neighbors);
+    }
+}
+
+// What msg_server does with a command before dispatching it
+int tokenize_command(const char* text, size_t len, char* command, int* destination_id,
+                     uint64_t* neighbors) {
+    struct json_token tokens[MAX_TOKENS];
+    long long value = 0;
+
+    if (json_tokenize(text, len, tokens, MAX_TOKENS) < 0) {
+        return -1;
+    }
+    int name = json_get(text, tokens, 0, "command");
+    int destination = json_get(text, tokens, 0, "destination_id");
+    if (name == -1 || (destination != -1 && json_int(text, &tokens[destination], &value) == -1)) {
+        return -1;
+    }
+    memcpy(command, text + tokens[name].start, tokens[name].len);
+    command[tokens[name].len] = '\0';
+    *destination_id = (int)value;
+
+    int list = json_get(text, tokens, 0, "neighbors");
+    if (list != -1) {
+        neighbors[0] = neighbors[1] = 0;
+        for (int i = list + 1; i < (int)tokens[list].next; i = tokens[i].next) {
+            long long neighbor;
+            if (json_int(text, &tokens[i], &neighbor) == -1 || neighbor < 0 || neighbor >= 128) {
+                return -1;
+            }
+            neighbors[neighbor >> 6] |= 1ULL << (neighbor & 63);
+        }
+    }
+    return 0;
+}
+
+char* make_send(int text_len) {
+    char* text = malloc(text_len + 64);
+    int n = sprintf(text, "{\"command\":\"send\",\"text\":\"");
+    for (int i = 0; i < text_len; i++) {
+        text[n++] = 'a' + i % 26;
+    }
+    sprintf(text + n, "\",\"destination_id\":9}");
+    return text;
+}
+
+char* make_neighbors(int count) {
+    char* text = malloc(64 + count * 5);
+    int n = sprintf(text, "{\"command\":\"neighbors\",\"node_id\":4,\"neighbors\":[");
+    for (int i = 0; i < count; i++) {
+        n += sprintf(text + n, "%s%d", i ? "," : "", i);
+    }
+    sprintf(text + n, "]}");
+    return text;
+}
+
+// Nanoseconds per message, best of three
+double run(const struct sample* sample, int rounds, int tokenizer) {
+    char command[64];
+    int destination_id;
+    uint64_t neighbors[2];
+    double best = 1e30;
+    for (int r = 0; r < 3; r++) {
+        double start = now_seconds();
+        for (int i = 0; i < rounds; i++) {
+            if (tokenizer) {
+                // msg_server has only the terminated text, so it measures it first
+                tokenize_command(sample->text, strlen(sample->text), command, &destination_id, neighbors);
+            } else {
+                parse_old(sample->text, command, &destination_id, neighbors);
+            }
+            __asm__ __volatile__("" : : "r"(command), "r"(destination_id), "r"(neighbors) : "memory");
+        }
+        double ns = (now_seconds() - start) * 1e9 / rounds;
+        best = ns < best ? ns : best;
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    if (rounds < 1) {
+        fprintf(stderr, "Usage: %s [rounds]\n", argv[0]);
+        exit(1);
+    }
+
+    struct sample samples[] = {
+        {"start_call", strdup("{\"command\":\"start_call\",\"destination_id\":42}")},
+        {"send 200 B", make_send(200)},
+        {"send 4 KiB", make_send(4096)},
+        {"neighbors 32", make_neighbors(32)},
+    };
+    int sample_count = sizeof(samples) / sizeof(samples[0]);
+
+    // Both must read the same command, destination and neighbors out of every sample
+    for (int s = 0; s < sample_count; s++) {
+        char old_command[64], new_command[64];
+        int old_destination, new_destination;
+        uint64_t old_neighbors[2] = {0, 0}, new_neighbors[2] = {0, 0};
+        parse_old(samples[s].text, old_command, &old_destination, old_neighbors);
+        if (tokenize_command(samples[s].text, strlen(samples[s].text), new_command, &new_destination,
+                             new_neighbors) == -1 ||
+            strcmp(old_command, new_command) != 0 || old_destination != new_destination ||
+            memcmp(old_neighbors, new_neighbors, sizeof(old_neighbors)) != 0) {
+            fprintf(stderr, "%s: parsers disagree\n", samples[s].name);
+            exit(1);
+        }
+    }
+
+    printf("ns per message, best of 3 x %d\n", rounds);
+    printf("%-14s %10s %10s", "", "strstr", "tokenize");
+#if defined(HAVE_JSON_SIMD)
+    printf(" %10s", "tok scalar");
+#endif
+    printf("\n");
+    for (int s = 0; s < sample_count; s++) {
+        printf("%-14s %10.1f", samples[s].name, run(&samples[s], rounds, 0));
+        printf(" %10.1f", run(&samples[s], rounds, 1));
+#if defined(HAVE_JSON_SIMD)
+        json_string_scan = json_string_scan_scalar;
+        printf(" %10.1f", run(&samples[s], rounds, 1));
+        json_string_scan = json_string_scan_sse2;
+#endif
+        printf("\n");
+    }
+    for (int s = 0; s < sample_count; s++) {
+        free(samples[s].text);
+    }
+    return 0;
+}
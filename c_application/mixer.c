@@ -0,0 +1,125 @@
+#include <string.h>
+#include "mixer.h"
+
+#if defined(HAVE_MIXER_SIMD)
+#include <immintrin.h>
+#endif
+
+void (*mix_accumulate_kernel)(int32_t*, const int16_t*, int) = mix_accumulate_scalar;
+void (*mix_output_kernel)(int16_t*, const int32_t*, const int16_t*, int) = mix_output_scalar;
+const char* mixer_kernel_name = "scalar";
+
+void mixer_init(void) {
+#if defined(HAVE_MIXER_SIMD)
+    // SSE2 is part of x86-64, so it is the floor there
+    mix_accumulate_kernel = mix_accumulate_sse2;
+    mix_output_kernel = mix_output_sse2;
+    mixer_kernel_name = "sse2";
+    if (mixer_avx2_supported()) {
+        mix_accumulate_kernel = mix_accumulate_avx2;
+        mix_output_kernel = mix_output_avx2;
+        mixer_kernel_name = "avx2";
+    }
+#endif
+}
+
+const char* mixer_implementation(void) {
+    return mixer_kernel_name;
+}
+
+void mix_clear(int32_t* acc, int count) {
+    memset(acc, 0, count * sizeof(int32_t));
+}
+
+void mix_accumulate(int32_t* acc, const int16_t* in, int count) {
+    mix_accumulate_kernel(acc, in, count);
+}
+
+void mix_output(int16_t* out, const int32_t* acc, const int16_t* own, int count) {
+    mix_output_kernel(out, acc, own, count);
+}
+
+int16_t saturate16(int32_t x) {
+    return x > INT16_MAX ? INT16_MAX : x < INT16_MIN ? INT16_MIN : (int16_t)x;
+}
+
+void mix_accumulate_scalar(int32_t* acc, const int16_t* in, int count) {
+    for (int i = 0; i < count; i++) {
+        acc[i] += in[i];
+    }
+}
+
+void mix_output_scalar(int16_t* out, const int32_t* acc, const int16_t* own, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = saturate16(own ? acc[i] - own[i] : acc[i]);
+    }
+}
+
+#if defined(HAVE_MIXER_SIMD)
+// Eight samples at a time: sign-extend to two vectors of 32-bit lanes
+void mix_accumulate_sse2(int32_t* acc, const int16_t* in, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i samples = _mm_loadu_si128((const __m128i*)(in + i));
+        // Interleaving with itself and shifting right arithmetically
+        // sign-extends without SSE4.1's cvtepi16
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+        __m128i* a = (__m128i*)(acc + i);
+        _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), lo));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), hi));
+    }
+    mix_accumulate_scalar(acc + i, in + i, count - i);
+}
+
+// packs_epi32 saturates each 32-bit lane to 16 bits
+void mix_output_sse2(int16_t* out, const int32_t* acc, const int16_t* own, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(acc + i));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(acc + i + 4));
+        if (own) {
+            __m128i samples = _mm_loadu_si128((const __m128i*)(own + i));
+            lo = _mm_sub_epi32(lo, _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16));
+            hi = _mm_sub_epi32(hi, _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16));
+        }
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(lo, hi));
+    }
+    mix_output_scalar(out + i, acc + i, own ? own + i : NULL, count - i);
+}
+
+int mixer_avx2_supported(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+void mix_accumulate_avx2(int32_t* acc, const int16_t* in, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i + 8)));
+        __m256i* a = (__m256i*)(acc + i);
+        _mm256_storeu_si256(a, _mm256_add_epi32(_mm256_loadu_si256(a), lo));
+        _mm256_storeu_si256(a + 1, _mm256_add_epi32(_mm256_loadu_si256(a + 1), hi));
+    }
+    mix_accumulate_sse2(acc + i, in + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void mix_output_avx2(int16_t* out, const int32_t* acc, const int16_t* own, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i lo = _mm256_loadu_si256((const __m256i*)(acc + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(acc + i + 8));
+        if (own) {
+            lo = _mm256_sub_epi32(lo, _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(own + i))));
+            hi = _mm256_sub_epi32(hi, _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(own + i + 8))));
+        }
+        // packs works within 128-bit lanes; put the quarters back in order
+        __m256i packed = _mm256_packs_epi32(lo, hi);
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    mix_output_sse2(out + i, acc + i, own ? own + i : NULL, count - i);
+}
+#endif
@@ -0,0 +1,40 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <stdint.h>
+
+// PCM mixing for call_server conferences. Talkers are summed once into a
+// 32-bit accumulator, and each listener's output is that sum minus their own
+// voice, saturated back to 16 bits. Mixing n talkers for n listeners is then
+// O(n) per block instead of O(n^2), and clipping happens once, at the end,
+// instead of depending on the order talkers were added in.
+// Call mixer_init() once before mixing; it picks the widest kernels this CPU
+// supports.
+void mixer_init(void);
+
+// acc[i] = 0
+void mix_clear(int32_t* acc, int count);
+
+// acc[i] += in[i]
+void mix_accumulate(int32_t* acc, const int16_t* in, int count);
+
+// out[i] = saturate16(acc[i] - own[i]); own may be NULL for a listener who
+// is not talking
+void mix_output(int16_t* out, const int32_t* acc, const int16_t* own, int count);
+
+// Name of the kernels the mix_* functions dispatch to, for startup logs
+const char* mixer_implementation(void);
+
+// Individual kernels, exposed for mixer_bench
+void mix_accumulate_scalar(int32_t* acc, const int16_t* in, int count);
+void mix_output_scalar(int16_t* out, const int32_t* acc, const int16_t* own, int count);
+#if defined(__x86_64__)
+#define HAVE_MIXER_SIMD 1
+void mix_accumulate_sse2(int32_t* acc, const int16_t* in, int count);
+void mix_output_sse2(int16_t* out, const int32_t* acc, const int16_t* own, int count);
+int mixer_avx2_supported(void);
+void mix_accumulate_avx2(int32_t* acc, const int16_t* in, int count);
+void mix_output_avx2(int16_t* out, const int32_t* acc, const int16_t* own, int count);
+#endif
+
+#endif
@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mixer.h"
+
+// Microbenchmark for the call_server conference mixer: every talker is also
+// a listener and hears everyone but themselves, one 10 ms block per tick.
+// Usage: ./mixer_bench [ticks]
+
+#define BLOCK_SAMPLES 80  // 10 ms at 8 kHz, call_server's playout tick
+#define MAX_TALKERS 128
+#define DEFAULT_TICKS 20000
+
+struct kernel {
+    const char* name;
+    void (*accumulate)(int32_t*, const int16_t*, int);
+    void (*output)(int16_t*, const int32_t*, const int16_t*, int);
+};
+
+int16_t input[MAX_TALKERS][BLOCK_SAMPLES];
+int16_t output[MAX_TALKERS][BLOCK_SAMPLES];
+int32_t acc[BLOCK_SAMPLES];
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// What a mixer without the shared accumulator does: each listener adds up
+// every other talker with saturating 16-bit adds, O(n^2) per tick
+void mix_naive(int talkers) {
+    for (int l = 0; l < talkers; l++) {
+        for (int i = 0; i < BLOCK_SAMPLES; i++) {
+            int32_t sum = 0;
+            for (int t = 0; t < talkers; t++) {
+                if (t != l) {
+                    sum += input[t][i];
+                    sum = sum > INT16_MAX ? INT16_MAX : sum < INT16_MIN ? INT16_MIN : sum;
+                }
+            }
+            output[l][i] = (int16_t)sum;
+        }
+    }
+}
+
+void mix_tick(const struct kernel* k, int talkers) {
+    mix_clear(acc, BLOCK_SAMPLES);
+    for (int t = 0; t < talkers; t++) {
+        k->accumulate(acc, input[t], BLOCK_SAMPLES);
+    }
+    for (int l = 0; l < talkers; l++) {
+        k->output(output[l], acc, input[l], BLOCK_SAMPLES);
+    }
+}
+
+// Best of three runs, in nanoseconds per tick
+double run(const struct kernel* k, int talkers, int ticks) {
+    double best = 1e30;
+    for (int r = 0; r < 3; r++) {
+        double start = now_seconds();
+        for (int n = 0; n < ticks; n++) {
+            if (k) {
+                mix_tick(k, talkers);
+            } else {
+                mix_naive(talkers);
+            }
+            // Keep the compiler from hoisting the work out of the loop
+            __asm__ __volatile__("" : : "r"(output) : "memory");
+        }
+        double ns = (now_seconds() - start) * 1e9 / ticks;
+        if (ns < best) {
+            best = ns;
+        }
+    }
+    return best;
+}
+
+// Every kernel must match the scalar one, including where the mix clips
+int self_test(const struct kernel* kernels, int count) {
+    int16_t expected[MAX_TALKERS][BLOCK_SAMPLES];
+    int talkers = 40;  // Loud enough to saturate
+    struct kernel scalar = {"scalar", mix_accumulate_scalar, mix_output_scalar};
+
+    mix_tick(&scalar, talkers);
+    memcpy(expected, output, sizeof(expected));
+    for (int k = 0; k < count; k++) {
+        if (!kernels[k].accumulate) {
+            continue;
+        }
+        memset(output, 0, sizeof(output));
+        mix_tick(&kernels[k], talkers);
+        if (memcmp(expected, output, talkers * sizeof(output[0])) != 0) {
+            fprintf(stderr, "%s kernel disagrees with scalar\n", kernels[k].name);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    int ticks = argc > 1 ? atoi(argv[1]) : DEFAULT_TICKS;
+    if (ticks < 1) {
+        fprintf(stderr, "Usage: %s [ticks]\n", argv[0]);
+        exit(1);
+    }
+
+    mixer_init();
+    srand(1);
+    for (int t = 0; t < MAX_TALKERS; t++) {
+        for (int i = 0; i < BLOCK_SAMPLES; i++) {
+            input[t][i] = (int16_t)(rand() % 24000 - 12000);
+        }
+    }
+
+    struct kernel kernels[] = {
+        {"scalar", mix_accumulate_scalar, mix_output_scalar},
+#if defined(HAVE_MIXER_SIMD)
+        {"sse2", mix_accumulate_sse2, mix_output_sse2},
+        {"avx2", mixer_avx2_supported() ? mix_accumulate_avx2 : NULL, mix_output_avx2},
+#endif
+    };
+    int kernel_count = sizeof(kernels) / sizeof(kernels[0]);
+    int talker_counts[] = {2, 4, 8, 16, 32, 64, 128};
+    int talker_count = sizeof(talker_counts) / sizeof(talker_counts[0]);
+
+    if (!self_test(kernels, kernel_count)) {
+        exit(1);
+    }
+
+    printf("Mixing %d-sample (10 ms) blocks, best of 3 x %d ticks; call_server uses %s\n",
+           BLOCK_SAMPLES, ticks, mixer_implementation());
+    printf("%-14s", "ns per tick");
+    for (int c = 0; c < talker_count; c++) {
+        printf("%10d", talker_counts[c]);
+    }
+    printf("  talkers\n");
+
+    printf("%-14s", "naive n^2");
+    for (int c = 0; c < talker_count; c++) {
+        // The quadratic mix gets slow; fewer ticks keep the run short
+        printf("%10.0f", run(NULL, talker_counts[c], ticks / 10 > 0 ? ticks / 10 : 1));
+        fflush(stdout);
+    }
+    printf("\n");
+    for (int k = 0; k < kernel_count; k++) {
+        printf("%-14s", kernels[k].name);
+        if (!kernels[k].accumulate) {
+            printf("   not supported by this CPU\n");
+            continue;
+        }
+        for (int c = 0; c < talker_count; c++) {
+            printf("%10.0f", run(&kernels[k], talker_counts[c], ticks));
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    // The figure that matters for call_server: share of the 10 ms tick spent mixing
+    struct kernel* best = &kernels[kernel_count - 1];
+    while (!best->accumulate) {
+        best--;
+    }
+    double ns = run(best, MAX_TALKERS, ticks);
+    printf("%d talkers with %s: %.3f%% of each 10 ms tick\n", MAX_TALKERS, best->name,
+           ns / 1e7 * 100);
+    return 0;
+}
@@ -1,160 +1,1195 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "sdr_loop.h"
+#include "topology.h"
+#include "msg_store.h"
+#include "checksum.h"
+#include "json.h"
 
 #define SOCKET_PATH "/tmp/msg_socket"
+#define FORWARD_SOCKET_PATH "/tmp/msg_forward_socket"
+#define STORE_DIR "/tmp/msg_store"
 #define BUFFER_SIZE 1024
 
-int server_fd = -1;
+/*
+ * Framed protocol
+ *
+ * A client opts in by sending the 2-byte preface {FRAME_MAGIC, FRAME_VERSION}
+ * right after connecting. Anything else is treated as a legacy client where
+ * each readable burst is one message and acks are plain text.
+ *
+ * Request frame:  [len:2 BE][request_id:4 BE][payload:len-4]
+ * Ack frame:      [len:2 BE][request_id:4 BE][status:1][text:len-5]
+ *
+ * Requests may be pipelined; acks are returned in request order and all acks
+ * produced during one event-loop iteration go out in a single writev().
+ *
+ * Store and forward
+ *
+ * {"command":"send","destination_id":D,...} is kept in the message store
+ * until D acknowledges it, and is acked only once the store has been synced.
+ * While D has a route the message is handed to the radio as a datagram on
+ * FORWARD_SOCKET_PATH:
+ *
+ *   [destination:1][next_hop:1][origin:1][seq:8 BE][flood_seq:8 BE][message]
+ *
+ * and {"command":"delivered","destination_id":D,"seq":N} reports that D has
+ * everything up to N. Messages handed on but not acknowledged are sent again
+ * whenever a neighbors update brings D back into reach.
+ *
+ * Groups and broadcast
+ *
+ * A send may name a set of destinations instead: "destinations":[D,...],
+ * "destinations":"all" (every SDR a neighbors update has named),
+ * "group":"name" (defined with {"command":"group","name":"name",
+ * "members":[D,...]}; no members removes it) or "mask":"hex", bit D of the
+ * 128-bit number set for SDR D. Any of these together mean their union.
+ * The message is stored once, one datagram per member is made from that
+ * copy, and the ack reports how the members fared.
+ *
+ * Every datagram carries the SDR the message came from and, for one sent
+ * to a set (a flood), its flood number there; 0 for any other. The radio
+ * hands a flooded message it receives back as a send with "origin" and
+ * "seq" (the flood number) added; one already seen from that origin is
+ * acked "Duplicate suppressed" and goes no further, and any other is
+ * relayed to the members other than this SDR and its origin.
+ */
+#define FRAME_MAGIC 0xFF      // Never the first byte of a UTF-8 text message
+#define FRAME_VERSION 0x01
+#define FRAME_HEADER_SIZE 6   // length + request id
+#define ACK_HEADER_SIZE 7     // length + request id + status
+#define MAX_FRAME_SIZE (2 + 65535)
+#define MAX_PENDING_ACKS 256
+// Room for the longest ack a handler formats: the fan-out report with
+// every count at its widest
+#define ACK_TEXT_SIZE 96
 
-// Signal handler for clean shutdown
-void signal_handler(int sig) {
-    printf("\nShutting down SDR application...\n");
-    if (server_fd != -1) {
-        close(server_fd);
+enum ack_status {
+    ACK_OK = 0,
+    ACK_UNKNOWN_COMMAND = 1,
+    ACK_ERROR = 2
+};
+
+enum conn_mode {
+    MODE_UNKNOWN = 0,  // Nothing received yet
+    MODE_LEGACY,
+    MODE_FRAMED
+};
+
+int msg_server_fd = -1;
+struct sdr_handler msg_listener;
+
+// Per-client connection state, kept alive across requests
+struct connection {
+    struct sdr_handler handler;
+    int fd;
+    enum conn_mode mode;
+
+    char* rbuf;        // Grows up to MAX_FRAME_SIZE for large framed messages
+    size_t rcap;
+    size_t rlen;
+
+    // Pending acks: headers live in ack_hdr, text points at static strings
+    // or at the slot's ack_text, for acks made per message
+    unsigned char ack_hdr[MAX_PENDING_ACKS][ACK_HEADER_SIZE];
+    char ack_text[MAX_PENDING_ACKS][ACK_TEXT_SIZE];
+    struct iovec iov[MAX_PENDING_ACKS * 2];
+    int iov_count;
+    int iov_sent;      // Index of the first iovec not yet fully written
+    int ack_count;
+    uint64_t first_ack_at;  // When the oldest pending ack was queued
+
+    int closing;       // Peer sent EOF; close once pending acks are flushed
+    int dead;          // Fatal error; close at the end of this iteration
+    int touched;       // Already on this iteration's flush list
+    struct connection* next_touched;
+};
+
+int active_connections = 0;
+struct connection* touched_list = NULL;
+uint64_t messages_handled = 0;
+uint64_t connections_accepted = 0;
+
+// Stage latencies; ack runs from queueing a connection's oldest pending ack
+// to the writev that finishes the batch
+struct sdr_histogram* msg_accept_time;
+struct sdr_histogram* msg_recv_time;
+struct sdr_histogram* msg_parse_time;
+struct sdr_histogram* msg_write_time;
+struct sdr_histogram* msg_ack_time;
+
+// Routes from this node (--node-id), fed by neighbors commands. Acks point
+// at static strings, so the ones naming a next hop are made up front.
+struct topology msg_topology;
+uint64_t topology_updates = 0;
+char route_acks[TOPOLOGY_NODES][32];
+char call_via_acks[TOPOLOGY_NODES][56];
+char file_via_acks[TOPOLOGY_NODES][56];
+char status_ack[32];
+
+// JSON commands are tokenized once, in place, and looked up by name in a
+// perfect hash table built at startup
+#define MAX_JSON_TOKENS 256  // A neighbors list naming every node fits
+#define COMMAND_SLOTS 32     // A power of two, well above the command count
+
+struct command_request {
+    char* text;
+    struct json_token tokens[MAX_JSON_TOKENS];
+    int count;
+    int destination_id;  // -1 if it is not a valid ID
+    char* ack_text;      // ACK_TEXT_SIZE bytes that last until the ack is sent
+};
+
+struct msg_command {
+    const char* name;
+    size_t len;
+    const char* (*handler)(struct command_request* request, enum ack_status* status);
+};
+
+struct msg_command* command_slots[COMMAND_SLOTS];
+uint32_t command_seed;
+
+// Store-and-forward queues (--store DIR) and the radio they drain into
+struct msg_store msg_store;
+const char* msg_store_dir = STORE_DIR;
+int forward_fd = -1;
+struct sockaddr_un forward_addr;
+uint64_t messages_forwarded = 0;
+struct sdr_histogram* msg_commit_time;
+
+// Named destination sets, and per origin the flooded messages seen lately
+#define MAX_GROUPS 32
+#define GROUP_NAME_SIZE 32
+#define FLOOD_WINDOW 64
+
+struct msg_group {
+    char name[GROUP_NAME_SIZE];  // Empty for a free slot
+    struct node_set members;
+};
+
+// The highest seq seen from an origin and, bit i, whether highest - i was
+struct flood_window {
+    uint64_t highest;
+    uint64_t seen;
+};
+
+struct msg_group msg_groups[MAX_GROUPS];
+struct flood_window flood_windows[TOPOLOGY_NODES];
+uint64_t fanouts = 0;
+uint64_t floods_suppressed = 0;
+
+// Numbers in a command; -1 if key is missing or not an integer in range
+int command_int(const struct command_request* request, const char* key, long long low, long long high) {
+    long long value;
+    int token = json_get(request->text, request->tokens, 0, key);
+    if (token == -1 || json_int(request->text, &request->tokens[token], &value) == -1 ||
+        value < low || value > high) {
+        return -1;
     }
-    unlink(SOCKET_PATH);
-    exit(0);
-}
-
-// Simple JSON parser for extracting command and destination_id
-void parse_json_command(const char* json_str, char* command, int* destination_id) {
-    char* cmd_start = strstr(json_str, "\"command\"");
-    char* dest_start = strstr(json_str, "\"destination_id\"");
-    
-    // Initialize defaults
-    strcpy(command, "");
-    *destination_id = 0;
-    
-    if (cmd_start) {
-        // Find the value after "command":
-        cmd_start = strchr(cmd_start, ':');
-        if (cmd_start) {
-            cmd_start++;
-            // Skip whitespace and quotes
-            while (*cmd_start == ' ' || *cmd_start == '\t') cmd_start++;
-            if (*cmd_start == '"') {
-                cmd_start++;
-                char* cmd_end = strchr(cmd_start, '"');
-                if (cmd_end) {
-                    int len = cmd_end - cmd_start;
-                    if (len < 63) {  // Ensure we don't overflow
-                        strncpy(command, cmd_start, len);
-                        command[len] = '\0';
-                    }
-                }
+    return (int)value;
+}
+
+// Add the SDR IDs in the array at tokens[list] to set. Returns -1 if it is
+// not an array of IDs.
+int parse_node_list(const struct command_request* request, int list, struct node_set* set) {
+    const struct json_token* tokens = request->tokens;
+    if (list == -1 || tokens[list].type != JSON_ARRAY) {
+        return -1;
+    }
+    for (int i = list + 1; i < (int)tokens[list].next; i = tokens[i].next) {
+        long long node;
+        if (json_int(request->text, &tokens[i], &node) == -1 || node < 0 || node >= TOPOLOGY_NODES) {
+            return -1;
+        }
+        node_set_add(set, (int)node);
+    }
+    return 0;
+}
+
+// The node_id and neighbors list of a neighbors command. Returns -1 if
+// either is missing or out of range.
+int parse_neighbors(const struct command_request* request, int* node_id, struct node_set* neighbors) {
+    memset(neighbors, 0, sizeof(*neighbors));
+    *node_id = command_int(request, "node_id", 0, TOPOLOGY_NODES - 1);
+    if (*node_id == -1) {
+        return -1;
+    }
+    return parse_node_list(request, json_get(request->text, request->tokens, 0, "neighbors"), neighbors);
+}
+
+struct msg_group* find_group(const char* name, size_t len) {
+    for (int i = 0; i < MAX_GROUPS; i++) {
+        if (strlen(msg_groups[i].name) == len && memcmp(msg_groups[i].name, name, len) == 0) {
+            return &msg_groups[i];
+        }
+    }
+    return NULL;
+}
+
+// A "mask" value: up to 32 hex digits, the last one holding SDRs 0 to 3
+int parse_mask(const char* text, const struct json_token* token, struct node_set* set) {
+    if (token->type != JSON_STRING || token->len == 0 || token->len > TOPOLOGY_NODES / 4) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < token->len; i++) {
+        char c = text[token->start + token->len - 1 - i];
+        int digit = c >= '0' && c <= '9' ? c - '0'
+                  : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                  : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit == -1) {
+            return -1;
+        }
+        set->bits[i / 16] |= (uint64_t)digit << (i % 16 * 4);
+    }
+    return 0;
+}
+
+// The destination set of a send, the union of any "destinations", "group"
+// and "mask" it has; empty if it has none. Returns NULL, or the ack text
+// saying what is wrong.
+const char* parse_destinations(const struct command_request* request, struct node_set* set) {
+    const char* text = request->text;
+    const struct json_token* tokens = request->tokens;
+    int list = json_get(text, tokens, 0, "destinations");
+    int group = json_get(text, tokens, 0, "group");
+    int mask = json_get(text, tokens, 0, "mask");
+
+    memset(set, 0, sizeof(*set));
+    if (list != -1) {
+        if (json_equals(text, &tokens[list], "all")) {
+            // Only SDRs known to exist: the message stays stored until every
+            // destination acks it, and an ID no SDR has would never ack
+            set->bits[0] |= msg_topology.seen.bits[0];
+            set->bits[1] |= msg_topology.seen.bits[1];
+            if (!set->bits[0] && !set->bits[1]) {
+                return "No known SDRs";
+            }
+        } else if (parse_node_list(request, list, set) == -1) {
+            return "Bad destinations";
+        }
+    }
+    if (group != -1) {
+        struct msg_group* found = NULL;
+        if (tokens[group].type == JSON_STRING) {
+            found = find_group(text + tokens[group].start, tokens[group].len);
+        }
+        if (!found) {
+            return "Unknown group";
+        }
+        set->bits[0] |= found->members.bits[0];
+        set->bits[1] |= found->members.bits[1];
+    }
+    if (mask != -1 && parse_mask(text, &tokens[mask], set) == -1) {
+        return "Bad destination mask";
+    }
+    return NULL;
+}
+
+// Whether flood number seq from origin is new, recording it if it is.
+// Anything more than FLOOD_WINDOW behind the newest seen counts as seen.
+// Floods are numbered apart from the origin's other messages, so only a
+// flood overtaken by 64 later floods from the same origin is lost.
+int flood_accept(int origin, uint64_t seq) {
+    struct flood_window* window = &flood_windows[origin];
+    if (seq > window->highest) {
+        uint64_t shift = seq - window->highest;
+        window->seen = shift >= FLOOD_WINDOW ? 1 : (window->seen << shift) | 1;
+        window->highest = seq;
+        return 1;
+    }
+    uint64_t age = window->highest - seq;
+    if (age >= FLOOD_WINDOW || ((window->seen >> age) & 1)) {
+        return 0;
+    }
+    window->seen |= 1ULL << age;
+    return 1;
+}
+
+// Hand destination's waiting messages to the radio while it has a route;
+// what the radio does not take waits for the next message or link-up
+void forward_pending(int destination) {
+    int next_hop = topology_next_hop(&msg_topology, destination);
+    struct msg_stored message;
+
+    if (next_hop == -1 || forward_fd == -1) {
+        return;
+    }
+    while (msg_store_peek(&msg_store, destination, &message)) {
+        unsigned char header[19];
+        header[0] = destination;
+        header[1] = next_hop;
+        header[2] = message.origin;
+        for (int i = 0; i < 8; i++) {
+            header[3 + i] = (unsigned char)(message.seq >> (56 - 8 * i));
+            header[11 + i] = (unsigned char)(message.origin_seq >> (56 - 8 * i));
+        }
+        // The message itself goes straight from the log, however many
+        // destinations share it
+        struct iovec iov[2] = {{header, sizeof(header)}, {(void*)message.data, message.len}};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &forward_addr;
+        msg.msg_namelen = sizeof(forward_addr);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        if (sendmsg(forward_fd, &msg, MSG_DONTWAIT) == -1) {
+            SDR_TRACE("Forwarding to SDR %d held: %s\n", destination, strerror(errno));
+            break;
+        }
+        msg_store_delivered(&msg_store, destination);
+        messages_forwarded++;
+    }
+}
+
+// A message for destination_id: stored first, then handed on if it can be
+const char* send_message(char* message, int destination_id, enum ack_status* status) {
+    struct node_set destination = {{0, 0}};
+    struct msg_stored waiting;
+
+    if (destination_id < 0 || destination_id >= MSG_STORE_DESTINATIONS) {
+        *status = ACK_ERROR;
+        return "No route to SDR";
+    }
+    node_set_add(&destination, destination_id);
+    if (msg_store_append(&msg_store, destination.bits, msg_topology.self, 0, message, strlen(message)) == 0) {
+        perror("msg_store_append");
+        *status = ACK_ERROR;
+        return "Message not stored";
+    }
+    forward_pending(destination_id);
+
+    // Queued behind others, or no route or radio for it yet
+    if (msg_store_peek(&msg_store, destination_id, &waiting)) {
+        return "Message queued for SDR";
+    }
+    return "Message received by SDR";
+}
+
+// A message for every SDR in members but this one: stored once, then handed
+// on to each that can take it. The ack is a report on all of them, made in
+// ack_text.
+const char* send_fanout(char* message, struct node_set* members, int origin, uint64_t origin_seq,
+                        char* ack_text, enum ack_status* status) {
+    struct msg_stored waiting;
+    int count = 0, forwarded = 0, queued = 0, unreachable = 0;
+
+    node_set_remove(members, msg_topology.self);
+    if (!members->bits[0] && !members->bits[1]) {
+        return "Message received by SDR";
+    }
+    if (msg_store_append(&msg_store, members->bits, origin, origin_seq, message, strlen(message)) == 0) {
+        perror("msg_store_append");
+        *status = ACK_ERROR;
+        return "Message not stored";
+    }
+    fanouts++;
+    for (int d = 0; d < MSG_STORE_DESTINATIONS; d++) {
+        if (!node_set_has(members, d)) {
+            continue;
+        }
+        count++;
+        if (topology_next_hop(&msg_topology, d) == -1) {
+            unreachable++;
+            continue;
+        }
+        forward_pending(d);
+        if (msg_store_peek(&msg_store, d, &waiting)) {
+            queued++;
+        } else {
+            forwarded++;
+        }
+    }
+    snprintf(ack_text, ACK_TEXT_SIZE, "Sent to %d SDRs: %d forwarded, %d queued, %d no route",
+             count, forwarded, queued, unreachable);
+    return ack_text;
+}
+
+// A neighbors update came in: retry every destination it brought back into
+// reach, and keep going with any that were already reachable
+void update_neighbors(int node_id, const struct node_set* neighbors) {
+    struct node_set reachable = {{0, 0}};
+    for (int d = 0; d < MSG_STORE_DESTINATIONS; d++) {
+        if (topology_next_hop(&msg_topology, d) != -1) {
+            node_set_add(&reachable, d);
+        }
+    }
+    if (topology_set_neighbors(&msg_topology, node_id, neighbors) == 1) {
+        SDR_TRACE("Routes recomputed after neighbors of SDR %d changed\n", node_id);
+    }
+    for (int d = 0; d < MSG_STORE_DESTINATIONS; d++) {
+        if (msg_store_pending(&msg_store, d) == 0 || topology_next_hop(&msg_topology, d) == -1) {
+            continue;
+        }
+        if (!node_set_has(&reachable, d)) {
+            msg_store_rewind(&msg_store, d);
+        }
+        forward_pending(d);
+    }
+}
+
+// Ack for a call or file transfer to destination_id: the plain one if the
+// destination is a neighbor, otherwise the one naming the neighbor it goes
+// through
+const char* route_ack(int destination_id, const char* direct, char (*via)[56], enum ack_status* status) {
+    int next_hop = topology_next_hop(&msg_topology, destination_id);
+    if (next_hop == -1) {
+        *status = ACK_ERROR;
+        return "No route to SDR";
+    }
+    if (next_hop == destination_id) {
+        return direct;
+    }
+    return via[next_hop];
+}
+
+const char* command_start_call(struct command_request* request, enum ack_status* status) {
+    SDR_TRACE("Starting call to SDR with ID: %d\n", request->destination_id);
+    return route_ack(request->destination_id, "Call command received", call_via_acks, status);
+}
+
+const char* command_stop_call(struct command_request* request, enum ack_status* status) {
+    (void)status;
+    SDR_TRACE("Stopping call to SDR with ID: %d\n", request->destination_id);
+    return "Call stop received";
+}
+
+const char* command_send_file(struct command_request* request, enum ack_status* status) {
+    SDR_TRACE("Sending file to SDR with ID: %d\n", request->destination_id);
+    return route_ack(request->destination_id, "File transfer command received", file_via_acks, status);
+}
+
+const char* command_status(struct command_request* request, enum ack_status* status) {
+    (void)request;
+    (void)status;
+    return status_ack;
+}
+
+const char* command_route(struct command_request* request, enum ack_status* status) {
+    int next_hop = topology_next_hop(&msg_topology, request->destination_id);
+    if (next_hop == -1) {
+        *status = ACK_ERROR;
+        return "No route to SDR";
+    }
+    return route_acks[next_hop];
+}
+
+const char* command_neighbors(struct command_request* request, enum ack_status* status) {
+    int node_id;
+    struct node_set neighbors;
+    if (parse_neighbors(request, &node_id, &neighbors) == -1) {
+        *status = ACK_ERROR;
+        return "Bad neighbors list";
+    }
+    topology_updates++;
+    update_neighbors(node_id, &neighbors);
+    return "Topology updated";
+}
+
+const char* command_send(struct command_request* request, enum ack_status* status) {
+    struct node_set members;
+    const char* error = parse_destinations(request, &members);
+    if (error) {
+        *status = ACK_ERROR;
+        return error;
+    }
+
+    // Relayed by the radio from another SDR's flood
+    if (json_get(request->text, request->tokens, 0, "origin") != -1) {
+        int origin = command_int(request, "origin", 0, TOPOLOGY_NODES - 1);
+        long long seq;
+        int token = json_get(request->text, request->tokens, 0, "seq");
+        if (origin == -1 || token == -1 || json_int(request->text, &request->tokens[token], &seq) == -1 ||
+            seq < 1) {
+            *status = ACK_ERROR;
+            return "Bad flood header";
+        }
+        if (origin == msg_topology.self || !flood_accept(origin, (uint64_t)seq)) {
+            floods_suppressed++;
+            return "Duplicate suppressed";
+        }
+        if (!members.bits[0] && !members.bits[1] && request->destination_id >= 0 &&
+            request->destination_id < MSG_STORE_DESTINATIONS) {
+            node_set_add(&members, request->destination_id);
+        }
+        node_set_remove(&members, origin);
+        return send_fanout(request->text, &members, origin, (uint64_t)seq, request->ack_text, status);
+    }
+
+    if (!members.bits[0] && !members.bits[1]) {
+        return send_message(request->text, request->destination_id, status);
+    }
+    uint64_t flood_seq = msg_store_flood_seq(&msg_store);
+    if (flood_seq == 0) {
+        perror("msg_store_flood_seq");
+        *status = ACK_ERROR;
+        return "Message not stored";
+    }
+    return send_fanout(request->text, &members, msg_topology.self, flood_seq, request->ack_text, status);
+}
+
+// Define a named destination set, or remove it if it has no members
+const char* command_group(struct command_request* request, enum ack_status* status) {
+    const struct json_token* tokens = request->tokens;
+    int name = json_get(request->text, tokens, 0, "name");
+    struct node_set members = {{0, 0}};
+
+    if (name == -1 || tokens[name].type != JSON_STRING || tokens[name].len == 0 ||
+        tokens[name].len >= GROUP_NAME_SIZE || json_equals(request->text, &tokens[name], "all") ||
+        parse_node_list(request, json_get(request->text, tokens, 0, "members"), &members) == -1) {
+        *status = ACK_ERROR;
+        return "Bad group";
+    }
+    const char* text = request->text + tokens[name].start;
+    struct msg_group* group = find_group(text, tokens[name].len);
+    if (!members.bits[0] && !members.bits[1]) {
+        if (group) {
+            group->name[0] = '\0';
+        }
+        return "Group removed";
+    }
+    if (!group && !(group = find_group("", 0))) {
+        *status = ACK_ERROR;
+        return "Too many groups";
+    }
+    memcpy(group->name, text, tokens[name].len);
+    group->name[tokens[name].len] = '\0';
+    group->members = members;
+    return "Group updated";
+}
+
+const char* command_delivered(struct command_request* request, enum ack_status* status) {
+    long long seq;
+    int token = json_get(request->text, request->tokens, 0, "seq");
+    if (token == -1 || json_int(request->text, &request->tokens[token], &seq) == -1 || seq < 0 ||
+        request->destination_id < 0 || request->destination_id >= MSG_STORE_DESTINATIONS ||
+        msg_store_acked(&msg_store, request->destination_id, (uint64_t)seq) == -1) {
+        *status = ACK_ERROR;
+        return "Bad delivery report";
+    }
+    return "Delivery recorded";
+}
+
+struct msg_command msg_commands[] = {
+    {"start_call", 0, command_start_call},
+    {"stop_call", 0, command_stop_call},
+    {"send_file", 0, command_send_file},
+    {"status", 0, command_status},
+    {"route", 0, command_route},
+    {"neighbors", 0, command_neighbors},
+    {"send", 0, command_send},
+    {"delivered", 0, command_delivered},
+    {"group", 0, command_group},
+};
+#define COMMAND_COUNT ((int)(sizeof(msg_commands) / sizeof(msg_commands[0])))
+
+uint32_t command_hash(const char* name, size_t len, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;  // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash & (COMMAND_SLOTS - 1);
+}
+
+// Pick a seed that gives every command a slot of its own, so finding one is
+// a hash and a single compare. Returns -1 if no seed does.
+int build_command_table(void) {
+    for (uint32_t seed = 0; seed < 1000; seed++) {
+        int clash = 0;
+        memset(command_slots, 0, sizeof(command_slots));
+        for (int i = 0; i < COMMAND_COUNT && !clash; i++) {
+            struct msg_command* command = &msg_commands[i];
+            command->len = strlen(command->name);
+            uint32_t slot = command_hash(command->name, command->len, seed);
+            clash = command_slots[slot] != NULL;
+            command_slots[slot] = command;
+        }
+        if (!clash) {
+            command_seed = seed;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+struct msg_command* find_command(const char* name, size_t len) {
+    struct msg_command* command = command_slots[command_hash(name, len, command_seed)];
+    if (command && command->len == len && memcmp(command->name, name, len) == 0) {
+        return command;
+    }
+    return NULL;
+}
+
+// Decide how to acknowledge a message. Returns the ack text and sets status;
+// text made for this message goes in ack_text, ACK_TEXT_SIZE bytes.
+const char* process_message(char* message, char* ack_text, enum ack_status* status) {
+    SDR_TRACE("Message received: %s\n", message);
+    *status = ACK_OK;
+    messages_handled++;
+
+    // Check if it's a JSON command
+    if (message[0] == '{') {
+        struct command_request request;
+        request.text = message;
+        request.ack_text = ack_text;
+        request.count = json_tokenize(message, strlen(message), request.tokens, MAX_JSON_TOKENS);
+        if (request.count < 0) {
+            *status = ACK_ERROR;
+            return request.count == JSON_TOO_LARGE ? "Command too large" : "Bad JSON";
+        }
+
+        int name = json_get(message, request.tokens, 0, "command");
+        struct msg_command* command = NULL;
+        if (name != -1 && request.tokens[name].type == JSON_STRING) {
+            command = find_command(message + request.tokens[name].start, request.tokens[name].len);
+        }
+        if (!command) {
+            *status = ACK_UNKNOWN_COMMAND;
+            return "Unknown command";
+        }
+        // Commands without a destination mean SDR 0, as they always have
+        request.destination_id = 0;
+        if (json_get(message, request.tokens, 0, "destination_id") != -1) {
+            request.destination_id = command_int(&request, "destination_id", 0, INT_MAX);
+        }
+        return command->handler(&request, status);
+    }
+
+    // Regular text message
+    return "Message received by SDR";
+}
+
+void mark_touched(struct connection* conn) {
+    if (!conn->touched) {
+        conn->touched = 1;
+        conn->next_touched = touched_list;
+        touched_list = conn;
+    }
+}
+
+int ack_queue_full(const struct connection* conn) {
+    return conn->ack_count == MAX_PENDING_ACKS;
+}
+
+// Queue an ack for the next writev. Ack text must outlive the flush.
+void queue_ack(struct connection* conn, uint32_t request_id,
+               enum ack_status status, const char* text) {
+    size_t text_len = strlen(text);
+
+    if (conn->ack_count == 0) {
+        conn->first_ack_at = sdr_now_ns();
+    }
+    if (conn->mode == MODE_FRAMED) {
+        unsigned char* hdr = conn->ack_hdr[conn->ack_count];
+        uint16_t len = htons((uint16_t)(4 + 1 + text_len));
+        uint32_t id = htonl(request_id);
+        memcpy(hdr, &len, 2);
+        memcpy(hdr + 2, &id, 4);
+        hdr[6] = (unsigned char)status;
+        conn->iov[conn->iov_count].iov_base = hdr;
+        conn->iov[conn->iov_count].iov_len = ACK_HEADER_SIZE;
+        conn->iov_count++;
+    }
+    conn->iov[conn->iov_count].iov_base = (void*)text;
+    conn->iov[conn->iov_count].iov_len = text_len;
+    conn->iov_count++;
+    conn->ack_count++;
+}
+
+int ensure_read_capacity(struct connection* conn, size_t needed) {
+    if (needed <= conn->rcap) {
+        return 0;
+    }
+    size_t cap = conn->rcap;
+    while (cap < needed) {
+        cap *= 2;
+    }
+    if (cap > MAX_FRAME_SIZE + 1) {
+        cap = MAX_FRAME_SIZE + 1;
+    }
+    char* buf = realloc(conn->rbuf, cap);
+    if (!buf) {
+        perror("realloc");
+        return -1;
+    }
+    conn->rbuf = buf;
+    conn->rcap = cap;
+    return 0;
+}
+
+// Parse every complete frame in the read buffer, stopping early if the ack
+// queue fills up so a fast sender is throttled by its own unread acks.
+// Returns -1 on a protocol error.
+int parse_frames(struct connection* conn) {
+    size_t offset = 0;
+    uint64_t mark = sdr_now_ns();  // Each message's parse ends where the next starts
+
+    while (!ack_queue_full(conn) && conn->rlen - offset >= 2) {
+        unsigned char* p = (unsigned char*)conn->rbuf + offset;
+        uint16_t frame_len = (uint16_t)((p[0] << 8) | p[1]);
+
+        if (frame_len < 4) {
+            printf("Invalid frame length: %u\n", frame_len);
+            return -1;
+        }
+        if (conn->rlen - offset < (size_t)2 + frame_len) {
+            // Incomplete frame; make sure the buffer can hold all of it
+            if (ensure_read_capacity(conn, (size_t)2 + frame_len + 1) == -1) {
+                return -1;
+            }
+            break;
+        }
+
+        uint32_t request_id = ((uint32_t)p[2] << 24) | ((uint32_t)p[3] << 16) |
+                              ((uint32_t)p[4] << 8) | p[5];
+        char* payload = (char*)p + FRAME_HEADER_SIZE;
+        size_t payload_len = frame_len - 4;
+
+        // Terminate the payload in place; the byte belongs to the next frame,
+        // so save and restore it
+        char saved = payload[payload_len];
+        payload[payload_len] = '\0';
+        enum ack_status status;
+        const char* ack = process_message(payload, conn->ack_text[conn->ack_count], &status);
+        payload[payload_len] = saved;
+
+        queue_ack(conn, request_id, status, ack);
+        offset += 2 + frame_len;
+        uint64_t now = sdr_now_ns();
+        sdr_histogram_record(msg_parse_time, now - mark);
+        mark = now;
+    }
+
+    if (offset > 0) {
+        memmove(conn->rbuf, conn->rbuf + offset, conn->rlen - offset);
+        conn->rlen -= offset;
+    }
+    return 0;
+}
+
+// Legacy clients: the whole buffered burst is one message
+void parse_legacy(struct connection* conn) {
+    if (conn->rlen == 0 || ack_queue_full(conn)) {
+        return;
+    }
+    uint64_t start = sdr_now_ns();
+    conn->rbuf[conn->rlen] = '\0';
+    enum ack_status status;
+    const char* ack = process_message(conn->rbuf, conn->ack_text[conn->ack_count], &status);
+    queue_ack(conn, 0, status, ack);
+    conn->rlen = 0;
+    sdr_histogram_since(msg_parse_time, start);
+}
+
+// Consume the optional framing preface once the first bytes arrive.
+// Returns -1 on an unsupported protocol version.
+int detect_mode(struct connection* conn) {
+    if (conn->mode != MODE_UNKNOWN || conn->rlen == 0) {
+        return 0;
+    }
+    if ((unsigned char)conn->rbuf[0] != FRAME_MAGIC) {
+        conn->mode = MODE_LEGACY;
+        return 0;
+    }
+    if (conn->rlen < 2) {
+        return 0;  // Wait for the version byte
+    }
+    if ((unsigned char)conn->rbuf[1] != FRAME_VERSION) {
+        printf("Unsupported protocol version: %u\n", (unsigned char)conn->rbuf[1]);
+        return -1;
+    }
+    conn->mode = MODE_FRAMED;
+    memmove(conn->rbuf, conn->rbuf + 2, conn->rlen - 2);
+    conn->rlen -= 2;
+    return 0;
+}
+
+int parse_input(struct connection* conn) {
+    if (detect_mode(conn) == -1) {
+        return -1;
+    }
+    if (conn->mode == MODE_FRAMED) {
+        return parse_frames(conn);
+    }
+    if (conn->mode == MODE_LEGACY) {
+        parse_legacy(conn);
+    }
+    return 0;
+}
+
+// Drain what the client has sent, as far as the control class's quantum for
+// this loop iteration goes, and parse it.
+// Returns -1 if the connection should be closed.
+int read_connection(struct connection* conn) {
+    while (!ack_queue_full(conn) && sdr_qos_budget(SDR_CLASS_CONTROL)) {
+        if (conn->rlen == conn->rcap - 1) {
+            if (conn->mode == MODE_LEGACY) {
+                // Buffer full: hand what we have over as a message
+                parse_legacy(conn);
+                continue;
+            }
+            // A framed buffer only fills up while acks are backed up
+            break;
+        }
+
+        uint64_t start = sdr_now_ns();
+        ssize_t n = recv(conn->fd, conn->rbuf + conn->rlen,
+                         conn->rcap - 1 - conn->rlen, 0);
+        if (n > 0) {
+            sdr_histogram_since(msg_recv_time, start);
+            sdr_qos_charge(SDR_CLASS_CONTROL, n);
+            conn->rlen += n;
+            if (detect_mode(conn) == -1) {
+                return -1;
+            }
+            // Framed input is parsed as it arrives so the buffer only ever
+            // holds a partial frame; legacy input waits for the whole burst
+            if (conn->mode == MODE_FRAMED && parse_frames(conn) == -1) {
+                return -1;
+            }
+        } else if (n == 0) {
+            conn->closing = 1;
+            break;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else {
+            perror("recv");
+            return -1;
+        }
+    }
+
+    return parse_input(conn);
+}
+
+// Write all pending acks with one writev, keeping any unsent tail queued.
+// Returns -1 if the connection failed and must be closed.
+int flush_connection(struct connection* conn) {
+    while (conn->iov_sent < conn->iov_count) {
+        int count = conn->iov_count - conn->iov_sent;
+        uint64_t start = sdr_now_ns();
+        ssize_t n = writev(conn->fd, conn->iov + conn->iov_sent, count);
+        sdr_histogram_since(msg_write_time, start);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            perror("writev");
+            return -1;
+        }
+
+        // Advance past fully written iovecs and trim a partial one
+        while (n > 0) {
+            struct iovec* v = &conn->iov[conn->iov_sent];
+            if ((size_t)n >= v->iov_len) {
+                n -= v->iov_len;
+                conn->iov_sent++;
+            } else {
+                v->iov_base = (char*)v->iov_base + n;
+                v->iov_len -= n;
+                n = 0;
+            }
+        }
+    }
+
+    if (conn->ack_count > 0) {
+        sdr_histogram_since(msg_ack_time, conn->first_ack_at);
+    }
+    conn->iov_count = 0;
+    conn->iov_sent = 0;
+    conn->ack_count = 0;
+    return 0;
+}
+
+void close_connection(struct connection* conn) {
+    sdr_loop_remove(conn->fd);
+    close(conn->fd);
+    free(conn->rbuf);
+    free(conn);
+    active_connections--;
+    SDR_TRACE("Client disconnected (%d active)\n", active_connections);
+}
+
+// Listen for input only while there is room for more acks, and for
+// writability only while acks are pending
+void update_interest(struct connection* conn) {
+    uint32_t events = 0;
+    if (!ack_queue_full(conn) && !conn->closing) {
+        events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (conn->iov_sent < conn->iov_count) {
+        events |= EPOLLOUT;
+    }
+    sdr_loop_modify(conn->fd, events, &conn->handler);
+}
+
+// Flush the acks gathered this iteration and settle each connection's state
+// Group commit: one sync covers everything stored this iteration, and goes
+// before any of its acks
+void commit_store(void) {
+    if (!msg_store.dirty) {
+        return;
+    }
+    uint64_t start = sdr_now_ns();
+    if (msg_store_commit(&msg_store) == -1) {
+        perror("msync");
+    }
+    sdr_histogram_since(msg_commit_time, start);
+}
+
+void flush_touched(void) {
+    commit_store();
+    while (touched_list) {
+        struct connection* conn = touched_list;
+        touched_list = conn->next_touched;
+        conn->touched = 0;
+
+        if (!conn->dead && flush_connection(conn) == -1) {
+            conn->dead = 1;
+        }
+
+        // Acks were drained; resume parsing frames that were held back
+        while (!conn->dead && conn->iov_count == 0 && conn->rlen > 0) {
+            size_t before = conn->rlen;
+            if (parse_input(conn) == -1) {
+                conn->dead = 1;
+                break;
+            }
+            commit_store();
+            if (flush_connection(conn) == -1) {
+                conn->dead = 1;
+            }
+            if (conn->rlen == before) {
+                break;  // Only a partial frame is left
             }
         }
+
+        // A partial frame left behind by a closed peer is discarded
+        if (conn->dead || (conn->closing && conn->iov_count == 0)) {
+            close_connection(conn);
+            continue;
+        }
+        update_interest(conn);
+    }
+}
+
+void handle_connection_event(struct sdr_handler* handler, uint32_t events) {
+    struct connection* conn = (struct connection*)handler;
+    mark_touched(conn);
+
+    if (events & EPOLLERR) {
+        conn->dead = 1;
+        return;
     }
-    
-    if (dest_start) {
-        // Find the value after "destination_id":
-        dest_start = strchr(dest_start, ':');
-        if (dest_start) {
-            dest_start++;
-            while (*dest_start == ' ' || *dest_start == '\t') dest_start++;
-            *destination_id = atoi(dest_start);
+
+    if (!conn->closing && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) {
+        if (read_connection(conn) == -1) {
+            conn->dead = 1;
         }
     }
 }
 
-int main() {
+void accept_clients(void) {
+    while (1) {
+        uint64_t start = sdr_now_ns();
+        int client_fd = accept4(msg_server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+
+        struct connection* conn = calloc(1, sizeof(*conn));
+        if (conn) {
+            conn->rbuf = malloc(BUFFER_SIZE);
+            conn->rcap = BUFFER_SIZE;
+        }
+        if (!conn || !conn->rbuf) {
+            perror("malloc");
+            if (conn) {
+                free(conn);
+            }
+            close(client_fd);
+            continue;
+        }
+        conn->handler.on_event = handle_connection_event;
+        conn->handler.qos_class = SDR_CLASS_CONTROL;
+        conn->fd = client_fd;
+
+        if (sdr_loop_add(client_fd, EPOLLIN | EPOLLRDHUP, &conn->handler) == -1) {
+            perror("epoll_ctl");
+            close(client_fd);
+            free(conn->rbuf);
+            free(conn);
+            continue;
+        }
+
+        active_connections++;
+        connections_accepted++;
+        sdr_histogram_since(msg_accept_time, start);
+        SDR_TRACE("Client connected (%d active)\n", active_connections);
+    }
+}
+
+void msg_listener_event(struct sdr_handler* handler, uint32_t events) {
+    (void)handler;
+    (void)events;
+    accept_clients();
+}
+
+int msg_service_start(int argc, char* argv[]) {
     struct sockaddr_un addr;
-    int client_fd;
-    char buffer[BUFFER_SIZE];
-    ssize_t bytes_received;
-    
-    // Set up signal handler
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    
+
+    int node_id = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--node-id") == 0 && i + 1 < argc) {
+            node_id = atoi(argv[++i]);
+            if (node_id < 0 || node_id >= TOPOLOGY_NODES) {
+                fprintf(stderr, "Node id must be 0 to %d\n", TOPOLOGY_NODES - 1);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--store") == 0 && i + 1 < argc) {
+            msg_store_dir = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--node-id N] [--store DIR]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    topology_init(&msg_topology, node_id);
+    for (int n = 0; n < TOPOLOGY_NODES; n++) {
+        snprintf(route_acks[n], sizeof(route_acks[n]), "Route via SDR %d", n);
+        snprintf(call_via_acks[n], sizeof(call_via_acks[n]), "Call command received via SDR %d", n);
+        snprintf(file_via_acks[n], sizeof(file_via_acks[n]), "File transfer command received via SDR %d", n);
+    }
+    snprintf(status_ack, sizeof(status_ack), "SDR %d ready", node_id);
+    if (build_command_table() == -1) {
+        fprintf(stderr, "No perfect hash for the command names; raise COMMAND_SLOTS\n");
+        return -1;
+    }
+
     printf("Starting SDR Application...\n");
-    
+
     // Create socket
-    server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (server_fd == -1) {
+    msg_server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (msg_server_fd == -1) {
         perror("socket");
-        exit(EXIT_FAILURE);
+        return -1;
     }
-    
+
     // Remove any existing socket file
     unlink(SOCKET_PATH);
-    
+
     // Set up address structure
     memset(&addr, 0, sizeof(addr));
     addr.sun_family = AF_UNIX;
     strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
-    
+
     // Bind socket
-    if (bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    if (bind(msg_server_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
         perror("bind");
-        close(server_fd);
-        exit(EXIT_FAILURE);
+        close(msg_server_fd);
+        return -1;
     }
-    
+
     // Listen for connections
-    if (listen(server_fd, 5) == -1) {
+    if (listen(msg_server_fd, SOMAXCONN) == -1) {
         perror("listen");
-        close(server_fd);
+        close(msg_server_fd);
         unlink(SOCKET_PATH);
-        exit(EXIT_FAILURE);
+        return -1;
     }
-    
-    printf("Message Server listening on %s\n", SOCKET_PATH);
-    printf("Waiting for messages...\n\n");
-    
-    while (1) {
-        // Accept connection
-        client_fd = accept(server_fd, NULL, NULL);
-        if (client_fd == -1) {
-            perror("accept");
-            continue;
-        }
-        
-        printf("Client connected\n");
-        
-        // Receive message
-        bytes_received = recv(client_fd, buffer, BUFFER_SIZE - 1, 0);
-        if (bytes_received > 0) {
-            buffer[bytes_received] = '\0';
-            printf("Message received: %s\n", buffer);
-            
-            // Check if it's a JSON command
-            if (buffer[0] == '{') {
-                char command[64];
-                int destination_id;
-                parse_json_command(buffer, command, &destination_id);
-                
-                if (strcmp(command, "start_call") == 0) {
-                    printf("Starting call to SDR with ID: %d\n", destination_id);
-                    
-                    // Send acknowledgment for call command
-                    const char* ack = "Call command received";
-                    send(client_fd, ack, strlen(ack), 0);
-                } else {
-                    // Unknown command
-                    const char* ack = "Unknown command";
-                    send(client_fd, ack, strlen(ack), 0);
-                }
-            } else {
-                // Regular text message
-                const char* ack = "Message received by SDR";
-                send(client_fd, ack, strlen(ack), 0);
-            }
-            
-            printf("Acknowledgment sent\n\n");
-        } else if (bytes_received == 0) {
-            printf("Client disconnected\n");
-        } else {
-            perror("recv");
-        }
-        
-        close(client_fd);
+
+    msg_listener.on_event = msg_listener_event;
+    msg_listener.qos_class = SDR_CLASS_CONTROL;
+    if (sdr_loop_add(msg_server_fd, EPOLLIN, &msg_listener) == -1) {
+        perror("epoll_ctl");
+        close(msg_server_fd);
+        unlink(SOCKET_PATH);
+        return -1;
+    }
+
+    checksum_init();
+    if (msg_store_open(&msg_store, msg_store_dir, MSG_STORE_SEGMENT_SIZE) == -1) {
+        fprintf(stderr, "Message store %s: %s\n", msg_store_dir, strerror(errno));
+        sdr_loop_remove(msg_server_fd);
+        close(msg_server_fd);
+        unlink(SOCKET_PATH);
+        return -1;
+    }
+    forward_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (forward_fd == -1) {
+        perror("socket");
+    }
+    memset(&forward_addr, 0, sizeof(forward_addr));
+    forward_addr.sun_family = AF_UNIX;
+    strncpy(forward_addr.sun_path, FORWARD_SOCKET_PATH, sizeof(forward_addr.sun_path) - 1);
+    if (msg_store.recovered > 0) {
+        printf("Message store %s: %llu messages waiting\n", msg_store_dir,
+               (unsigned long long)msg_store.recovered);
+    }
+    for (int d = 0; d < MSG_STORE_DESTINATIONS; d++) {
+        forward_pending(d);
     }
-    
+
+    sdr_stat_register("msg", "messages", &messages_handled);
+    sdr_stat_register("msg", "connections_accepted", &connections_accepted);
+    sdr_stat_register("msg", "topology_updates", &topology_updates);
+    sdr_stat_register("msg", "link_changes", &msg_topology.changes);
+    sdr_stat_register("msg", "route_recomputes", &msg_topology.recomputes);
+    sdr_stat_register("msg", "store_appends", &msg_store.appends);
+    sdr_stat_register("msg", "store_commits", &msg_store.commits);
+    sdr_stat_register("msg", "forwarded", &messages_forwarded);
+    sdr_stat_register("msg", "fanouts", &fanouts);
+    sdr_stat_register("msg", "floods_suppressed", &floods_suppressed);
+    msg_accept_time = sdr_histogram_register("msg", "accept");
+    msg_recv_time = sdr_histogram_register("msg", "recv");
+    msg_parse_time = sdr_histogram_register("msg", "parse");
+    msg_write_time = sdr_histogram_register("msg", "write");
+    msg_ack_time = sdr_histogram_register("msg", "ack");
+    msg_commit_time = sdr_histogram_register("msg", "commit");
+
+    printf("Message Server listening on %s as SDR %d\n", SOCKET_PATH, node_id);
+    printf("Waiting for messages...\n\n");
     return 0;
 }
+
+void msg_service_stop(void) {
+    printf("\nShutting down SDR application...\n");
+    close(msg_server_fd);
+    unlink(SOCKET_PATH);
+    msg_store_close(&msg_store);
+    if (forward_fd != -1) {
+        close(forward_fd);
+    }
+}
+
+// One writev per connection per loop iteration happens in flush_touched
+struct sdr_service msg_service = {"msg", msg_service_start, flush_touched, msg_service_stop};
+
+#ifndef SDR_DAEMON
+int main(int argc, char* argv[]) {
+    return sdr_service_main(&msg_service, argc, argv);
+}
+#endif
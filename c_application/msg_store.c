@@ -0,0 +1,623 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "msg_store.h"
+#include "checksum.h"
+
+#define MSG_SEGMENT_MAGIC 0x32474553524453ULL  // "SDRSEG2"
+#define MSG_CURSOR_MAGIC 0x31525543524453ULL   // "SDRCUR1"
+#define MSG_SEGMENT_HEADER_SIZE 4096
+#define MSG_RECORD_ALIGN 8
+#define MSG_FLOOD_BLOCK 1024  // Flood numbers reserved per cursor sync
+
+struct msg_segment_header {
+    uint64_t magic;
+    uint64_t number;
+    // Records below this offset are known to be on disk; past it they are
+    // checked against their CRC on open. Lags the log by one commit.
+    uint64_t committed;
+    // The last message for each destination in this segment, 0 for none
+    uint64_t last_seq[MSG_STORE_DESTINATIONS];
+};
+
+struct msg_record {
+    uint32_t crc;  // CRC32C of the rest of this header and the data
+    uint32_t len;
+    uint64_t seq;
+    uint64_t destinations[2];  // Bit d for SDR d
+    uint64_t origin_seq;
+    uint32_t origin;
+    uint32_t reserved;
+};
+
+struct msg_segment {
+    uint32_t number;
+    int fd;
+    unsigned char* map;
+    size_t size;
+    size_t tail;    // End of the records
+    size_t synced;  // Everything before this has been synced
+};
+
+struct msg_store_cursors {
+    uint64_t magic;
+    uint64_t delivered[MSG_STORE_DESTINATIONS];
+    uint64_t acked[MSG_STORE_DESTINATIONS];
+    // Flood numbers up to this may have been used. Added after the rest, so
+    // a cursor file from before reads it as 0.
+    uint64_t floods_reserved;
+};
+
+struct msg_segment_header* segment_header(const struct msg_segment* segment) {
+    return (struct msg_segment_header*)segment->map;
+}
+
+size_t record_size(size_t len) {
+    size_t size = sizeof(struct msg_record) + len;
+    return (size + MSG_RECORD_ALIGN - 1) & ~(size_t)(MSG_RECORD_ALIGN - 1);
+}
+
+uint32_t record_crc(const struct msg_record* record) {
+    uint32_t crc = crc32c_update(0, &record->len, sizeof(*record) - sizeof(record->crc));
+    return crc32c_update(crc, record + 1, record->len);
+}
+
+void segment_path(const struct msg_store* store, uint32_t number, char* path, size_t size) {
+    snprintf(path, size, "%s/seg-%08u.log", store->dir, number);
+}
+
+int store_sync_dir(const struct msg_store* store) {
+    int fd = open(store->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+// Map segment number, creating it if create is set; -1 with errno set on failure
+int segment_map(struct msg_store* store, uint32_t number, int create, struct msg_segment* segment) {
+    char path[300];
+    struct stat st;
+
+    segment_path(store, number, path, sizeof(path));
+    segment->number = number;
+    segment->fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+    if (segment->fd == -1) {
+        return -1;
+    }
+    if (create && ftruncate(segment->fd, store->segment_size) == -1) {
+        goto fail;
+    }
+    if (fstat(segment->fd, &st) == -1) {
+        goto fail;
+    }
+    if ((size_t)st.st_size < MSG_SEGMENT_HEADER_SIZE + sizeof(struct msg_record)) {
+        errno = EINVAL;
+        goto fail;
+    }
+    segment->size = st.st_size;
+    segment->map = mmap(NULL, segment->size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+    if (segment->map == MAP_FAILED) {
+        goto fail;
+    }
+
+    struct msg_segment_header* header = segment_header(segment);
+    if (create) {
+        header->magic = MSG_SEGMENT_MAGIC;
+        header->number = number;
+        header->committed = MSG_SEGMENT_HEADER_SIZE;
+        // A segment must be recognisable on open before anything in it is
+        // acked, so its header and its directory entry go to disk now
+        if (msync(segment->map, MSG_SEGMENT_HEADER_SIZE, MS_SYNC) == -1 || store_sync_dir(store) == -1) {
+            munmap(segment->map, segment->size);
+            goto fail;
+        }
+    } else if (header->magic != MSG_SEGMENT_MAGIC || header->number != number) {
+        munmap(segment->map, segment->size);
+        errno = EINVAL;
+        goto fail;
+    }
+    segment->tail = MSG_SEGMENT_HEADER_SIZE;
+    segment->synced = MSG_SEGMENT_HEADER_SIZE;
+    return 0;
+
+fail:
+    {
+        int saved = errno;
+        close(segment->fd);
+        if (create) {
+            unlink(path);
+        }
+        errno = saved;
+    }
+    return -1;
+}
+
+// Sync the whole segment, header included, so its index can be trusted
+int segment_sync(struct msg_segment* segment) {
+    segment_header(segment)->committed = segment->tail;
+    if (msync(segment->map, segment->tail, MS_SYNC) == -1) {
+        return -1;
+    }
+    segment->synced = segment->tail;
+    return 0;
+}
+
+void segment_unmap(struct msg_segment* segment) {
+    munmap(segment->map, segment->size);
+    close(segment->fd);
+}
+
+int segment_push(struct msg_store* store, const struct msg_segment* segment) {
+    if (store->segment_count == store->segment_capacity) {
+        int capacity = store->segment_capacity ? store->segment_capacity * 2 : 8;
+        struct msg_segment* segments = realloc(store->segments, capacity * sizeof(*segments));
+        if (!segments) {
+            return -1;
+        }
+        store->segments = segments;
+        store->segment_capacity = capacity;
+    }
+    store->segments[store->segment_count++] = *segment;
+    return 0;
+}
+
+struct msg_segment* segment_find(const struct msg_store* store, uint32_t number) {
+    int low = 0, high = store->segment_count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (store->segments[mid].number == number) {
+            return &store->segments[mid];
+        }
+        if (store->segments[mid].number < number) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return NULL;
+}
+
+// Nothing in the segment is waiting for its destination any more
+int segment_done(const struct msg_store* store, const struct msg_segment* segment) {
+    const struct msg_segment_header* header = segment_header(segment);
+    for (int d = 0; d < MSG_STORE_DESTINATIONS; d++) {
+        if (header->last_seq[d] > store->cursors->acked[d]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void segment_remove(struct msg_store* store, int index) {
+    char path[300];
+    segment_path(store, store->segments[index].number, path, sizeof(path));
+    segment_unmap(&store->segments[index]);
+    unlink(path);
+    memmove(&store->segments[index], &store->segments[index + 1],
+            (store->segment_count - index - 1) * sizeof(*store->segments));
+    store->segment_count--;
+}
+
+// Room for one more entry; -1 if there is no memory for it
+int queue_reserve(struct msg_store_queue* queue) {
+    if (queue->count < queue->capacity) {
+        return 0;
+    }
+    if (queue->head > 0) {
+        // Acked entries at the front make room
+        memmove(queue->entries, queue->entries + queue->head,
+                (queue->count - queue->head) * sizeof(*queue->entries));
+        queue->count -= queue->head;
+        queue->next -= queue->head;
+        queue->head = 0;
+        if (queue->count < queue->capacity) {
+            return 0;
+        }
+    }
+    size_t capacity = queue->capacity ? queue->capacity * 2 : 64;
+    struct msg_store_entry* entries = realloc(queue->entries, capacity * sizeof(*entries));
+    if (!entries) {
+        return -1;
+    }
+    queue->entries = entries;
+    queue->capacity = capacity;
+    return 0;
+}
+
+int record_has(const struct msg_record* record, int destination) {
+    return (record->destinations[destination >> 6] >> (destination & 63)) & 1;
+}
+
+void queue_append(struct msg_store_queue* queue, uint64_t seq, uint32_t segment, uint32_t offset) {
+    struct msg_store_entry* entry = &queue->entries[queue->count++];
+    entry->seq = seq;
+    entry->segment = segment;
+    entry->offset = offset;
+}
+
+// Walk a segment's records to where they end, queueing each for every
+// destination that has not acked it
+int segment_scan(struct msg_store* store, struct msg_segment* segment, uint64_t* last_seq) {
+    struct msg_segment_header* header = segment_header(segment);
+    size_t offset = MSG_SEGMENT_HEADER_SIZE;
+
+    while (offset + sizeof(struct msg_record) <= segment->size) {
+        const struct msg_record* record = (const struct msg_record*)(segment->map + offset);
+        if (record->seq <= *last_seq || record->len > segment->size - offset - sizeof(*record)) {
+            break;
+        }
+        if (offset >= header->committed && record_crc(record) != record->crc) {
+            break;  // Torn by a crash before its commit finished
+        }
+        int waiting = 0;
+        for (int d = 0; d < MSG_STORE_DESTINATIONS; d++) {
+            if (!record_has(record, d)) {
+                continue;
+            }
+            // A crash can leave the index behind the records it covers
+            if (header->last_seq[d] < record->seq) {
+                header->last_seq[d] = record->seq;
+            }
+            if (record->seq <= store->cursors->acked[d]) {
+                continue;
+            }
+            struct msg_store_queue* queue = &store->queues[d];
+            if (queue_reserve(queue) == -1) {
+                return -1;
+            }
+            queue_append(queue, record->seq, segment->number, offset);
+            if (record->seq <= store->cursors->delivered[d]) {
+                queue->next = queue->count;
+            }
+            waiting = 1;
+        }
+        store->recovered += waiting;
+        *last_seq = record->seq;
+        offset += record_size(record->len);
+    }
+    segment->tail = offset;
+    segment->synced = offset;
+    return 0;
+}
+
+int compare_numbers(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Every segment file in the directory, oldest first; the caller frees it
+uint32_t* list_segments(const char* dir, int* count) {
+    DIR* d = opendir(dir);
+    uint32_t* numbers = NULL;
+    int capacity = 0;
+    struct dirent* entry;
+    *count = -1;
+    if (!d) {
+        return NULL;
+    }
+    *count = 0;
+    while ((entry = readdir(d))) {
+        unsigned int number;
+        char tail[8];
+        if (sscanf(entry->d_name, "seg-%8u.%7s", &number, tail) != 2 || strcmp(tail, "log") != 0) {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            uint32_t* grown = realloc(numbers, capacity * sizeof(*numbers));
+            if (!grown) {
+                free(numbers);
+                closedir(d);
+                *count = -1;
+                errno = ENOMEM;
+                return NULL;
+            }
+            numbers = grown;
+        }
+        numbers[(*count)++] = number;
+    }
+    closedir(d);
+    qsort(numbers, *count, sizeof(*numbers), compare_numbers);
+    return numbers;
+}
+
+int open_cursors(struct msg_store* store) {
+    char path[300];
+    snprintf(path, sizeof(path), "%s/cursors", store->dir);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(struct msg_store_cursors)) == -1) {
+        close(fd);
+        return -1;
+    }
+    void* map = mmap(NULL, sizeof(struct msg_store_cursors), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    store->cursors = map;
+    if (store->cursors->magic != MSG_CURSOR_MAGIC) {
+        memset(store->cursors, 0, sizeof(*store->cursors));
+        store->cursors->magic = MSG_CURSOR_MAGIC;
+        store->cursors_dirty = 1;
+    }
+    return 0;
+}
+
+int msg_store_open(struct msg_store* store, const char* dir, size_t segment_size) {
+    memset(store, 0, sizeof(*store));
+    snprintf(store->dir, sizeof(store->dir), "%s", dir);
+    store->segment_size = segment_size;
+    if (segment_size < MSG_SEGMENT_HEADER_SIZE * 2) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        return -1;
+    }
+    if (open_cursors(store) == -1) {
+        return -1;
+    }
+
+    int count;
+    uint32_t* numbers = list_segments(dir, &count);
+    if (count == -1) {
+        return -1;
+    }
+    uint64_t last_seq = 0;
+    uint64_t scanned = 0;  // Records are in sequence order across segments
+    for (int d = 0; d < MSG_STORE_DESTINATIONS; d++) {
+        last_seq = store->cursors->acked[d] > last_seq ? store->cursors->acked[d] : last_seq;
+    }
+    for (int i = 0; i < count; i++) {
+        struct msg_segment segment;
+        if (segment_map(store, numbers[i], 0, &segment) == -1) {
+            fprintf(stderr, "Message store segment %u unreadable: %s\n", numbers[i], strerror(errno));
+            continue;
+        }
+        const struct msg_segment_header* header = segment_header(&segment);
+        for (int d = 0; d < MSG_STORE_DESTINATIONS; d++) {
+            last_seq = header->last_seq[d] > last_seq ? header->last_seq[d] : last_seq;
+        }
+
+        // The index in the header says whether there is anything to read.
+        // The newest segment's header may be behind it, so it is always read.
+        int newest = i == count - 1;
+        if (!newest && segment_done(store, &segment)) {
+            if (store->segment_count == 0) {
+                char path[300];
+                segment_path(store, segment.number, path, sizeof(path));
+                segment_unmap(&segment);
+                unlink(path);
+                continue;
+            }
+            segment.tail = segment.size;
+        } else {
+            if (segment_scan(store, &segment, &scanned) == -1) {
+                segment_unmap(&segment);
+                free(numbers);
+                errno = ENOMEM;
+                return -1;
+            }
+            if (newest) {
+                // Nothing past the end may pass for a record later
+                memset(segment.map + segment.tail, 0, segment.size - segment.tail);
+            }
+        }
+        if (segment_push(store, &segment) == -1) {
+            segment_unmap(&segment);
+            free(numbers);
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    // Past any segment left unread too, so none is ever overwritten
+    store->next_segment = count > 0 ? numbers[count - 1] + 1 : 1;
+    free(numbers);
+    // Records found by the scan may be newer than any index says
+    store->next_seq = (scanned > last_seq ? scanned : last_seq) + 1;
+    // Numbers in the last block may have gone out before a crash
+    store->flood_seq = store->cursors->floods_reserved;
+    return 0;
+}
+
+void msg_store_close(struct msg_store* store) {
+    msg_store_commit(store);
+    if (store->segment_count > 0) {
+        segment_sync(&store->segments[store->segment_count - 1]);
+    }
+    for (int i = 0; i < store->segment_count; i++) {
+        segment_unmap(&store->segments[i]);
+    }
+    free(store->segments);
+    for (int d = 0; d < MSG_STORE_DESTINATIONS; d++) {
+        free(store->queues[d].entries);
+    }
+    if (store->cursors) {
+        munmap(store->cursors, sizeof(*store->cursors));
+    }
+    memset(store, 0, sizeof(*store));
+}
+
+uint64_t msg_store_append(struct msg_store* store, const uint64_t destinations[2], int origin,
+                          uint64_t origin_seq, const void* data, size_t len) {
+    size_t need = record_size(len);
+    if (!destinations[0] && !destinations[1]) {
+        errno = EINVAL;
+        return 0;
+    }
+    if (need > store->segment_size - MSG_SEGMENT_HEADER_SIZE) {
+        errno = EMSGSIZE;
+        return 0;
+    }
+    // Every queue gets its entry or none does
+    for (int d = 0; d < MSG_STORE_DESTINATIONS; d++) {
+        if (((destinations[d >> 6] >> (d & 63)) & 1) && queue_reserve(&store->queues[d]) == -1) {
+            errno = ENOMEM;
+            return 0;
+        }
+    }
+
+    struct msg_segment* segment = store->segment_count ? &store->segments[store->segment_count - 1] : NULL;
+    if (!segment || segment->tail + need > segment->size) {
+        // Rotate. The old segment is synced whole, so its header can be
+        // trusted when the log is next opened.
+        struct msg_segment next;
+        if (segment && segment_sync(segment) == -1) {
+            return 0;
+        }
+        if (segment_map(store, store->next_segment, 1, &next) == -1) {
+            return 0;
+        }
+        if (segment_push(store, &next) == -1) {
+            segment_unmap(&next);
+            errno = ENOMEM;
+            return 0;
+        }
+        segment = &store->segments[store->segment_count - 1];
+        store->next_segment++;
+    }
+
+    struct msg_record* record = (struct msg_record*)(segment->map + segment->tail);
+    record->len = len;
+    record->seq = store->next_seq++;
+    record->destinations[0] = destinations[0];
+    record->destinations[1] = destinations[1];
+    record->origin_seq = origin_seq;
+    record->origin = origin;
+    record->reserved = 0;
+    memcpy(record + 1, data, len);
+    record->crc = record_crc(record);
+
+    // One copy in the log; each destination's queue points at it, and the
+    // segment stays until the last of them has acked it
+    for (int d = 0; d < MSG_STORE_DESTINATIONS; d++) {
+        if (record_has(record, d)) {
+            segment_header(segment)->last_seq[d] = record->seq;
+            queue_append(&store->queues[d], record->seq, segment->number, segment->tail);
+        }
+    }
+    segment->tail += need;
+    store->dirty = 1;
+    store->appends++;
+    return record->seq;
+}
+
+uint64_t msg_store_flood_seq(struct msg_store* store) {
+    if (store->flood_seq == store->cursors->floods_reserved) {
+        // Synced at once: a number may be on the air before the next commit
+        store->cursors->floods_reserved += MSG_FLOOD_BLOCK;
+        if (msync(store->cursors, sizeof(*store->cursors), MS_SYNC) == -1) {
+            store->cursors->floods_reserved -= MSG_FLOOD_BLOCK;
+            return 0;
+        }
+    }
+    return ++store->flood_seq;
+}
+
+int msg_store_commit(struct msg_store* store) {
+    if (!store->dirty) {
+        return 0;
+    }
+
+    if (store->segment_count > 0) {
+        struct msg_segment* segment = &store->segments[store->segment_count - 1];
+        if (segment->tail > segment->synced) {
+            // From the start, so the header page with its index goes too.
+            // Only dirty pages are written, so the clean ones between cost
+            // nothing.
+            if (msync(segment->map, segment->tail, MS_SYNC) == -1) {
+                return -1;
+            }
+            // The committed mark goes to disk with the next sync; until then
+            // the records past its old value are checked by CRC on open
+            segment_header(segment)->committed = segment->tail;
+            segment->synced = segment->tail;
+        }
+    }
+    if (store->cursors_dirty) {
+        if (msync(store->cursors, sizeof(*store->cursors), MS_SYNC) == -1) {
+            return -1;
+        }
+        store->cursors_dirty = 0;
+    }
+    store->dirty = 0;
+    store->commits++;
+
+    // Only after the cursors saying so are on disk
+    while (store->segment_count > 1 && segment_done(store, &store->segments[0])) {
+        segment_remove(store, 0);
+    }
+    return 0;
+}
+
+int msg_store_peek(const struct msg_store* store, int destination, struct msg_stored* message) {
+    const struct msg_store_queue* queue = &store->queues[destination];
+    if (queue->next >= queue->count) {
+        return 0;
+    }
+    const struct msg_store_entry* entry = &queue->entries[queue->next];
+    const struct msg_segment* segment = segment_find(store, entry->segment);
+    const struct msg_record* record = (const struct msg_record*)(segment->map + entry->offset);
+    message->data = record + 1;
+    message->len = record->len;
+    message->seq = entry->seq;
+    message->origin = record->origin;
+    message->origin_seq = record->origin_seq;
+    return 1;
+}
+
+void msg_store_delivered(struct msg_store* store, int destination) {
+    struct msg_store_queue* queue = &store->queues[destination];
+    if (queue->next < queue->count) {
+        store->cursors->delivered[destination] = queue->entries[queue->next++].seq;
+        store->cursors_dirty = 1;
+        store->dirty = 1;
+    }
+}
+
+int msg_store_acked(struct msg_store* store, int destination, uint64_t seq) {
+    struct msg_store_queue* queue = &store->queues[destination];
+    if (seq <= store->cursors->acked[destination]) {
+        return 0;
+    }
+    // Never past the newest message stored for it, or that one and every
+    // later one would count as acked
+    if (queue->count == 0 || seq > queue->entries[queue->count - 1].seq) {
+        return -1;
+    }
+    while (queue->head < queue->count && queue->entries[queue->head].seq <= seq) {
+        queue->head++;
+    }
+    if (queue->next < queue->head) {
+        queue->next = queue->head;
+    }
+    if (queue->head == queue->count) {
+        queue->head = queue->next = queue->count = 0;
+    }
+    store->cursors->acked[destination] = seq;
+    store->cursors_dirty = 1;
+    store->dirty = 1;
+    return 0;
+}
+
+void msg_store_rewind(struct msg_store* store, int destination) {
+    store->queues[destination].next = store->queues[destination].head;
+}
+
+size_t msg_store_pending(const struct msg_store* store, int destination) {
+    return store->queues[destination].count - store->queues[destination].head;
+}
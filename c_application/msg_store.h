@@ -0,0 +1,117 @@
+#ifndef MSG_STORE_H
+#define MSG_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Store-and-forward queue for msg_server: messages for SDRs that cannot be
+// reached yet wait here, one queue per destination, until a route appears.
+//
+// Messages go into an append-only log of fixed-size segment files that are
+// memory mapped, so an append is a copy. Nothing is synced per message:
+// msg_store_commit() syncs everything appended since the last commit with
+// one msync, and msg_server calls it once per loop iteration, before the
+// acks of that iteration go out. Every message has a sequence number; each
+// destination has a delivered cursor (handed to the next hop) and an acked
+// cursor (confirmed by the destination), both kept in a mapped file and
+// synced with the same commit. Segments whose messages are all acked are
+// deleted.
+//
+// A message for several destinations, a group or a broadcast, is stored
+// once: each of their queues points at the same record, and its segment
+// stays until the last of them has acked it.
+//
+// Each segment starts with a header holding, per destination, the last
+// message in it, so on open whole segments with nothing left to deliver are
+// skipped without reading their records. The records of the rest are walked
+// to rebuild the queues; ones past the last synced point are checked against
+// their CRC32C and the log ends at the first that fails.
+//
+// Not thread safe; msg_server uses it from the event loop. Call
+// checksum_init() before msg_store_open().
+
+#define MSG_STORE_DESTINATIONS 128
+#define MSG_STORE_SEGMENT_SIZE (4 * 1024 * 1024)
+
+struct msg_segment;
+
+// Where a message waiting for its destination is in the log
+struct msg_store_entry {
+    uint64_t seq;
+    uint32_t segment;  // Segment number
+    uint32_t offset;
+};
+
+struct msg_store_queue {
+    struct msg_store_entry* entries;
+    size_t head;       // First one not acked
+    size_t next;       // First one not delivered
+    size_t count;
+    size_t capacity;
+};
+
+struct msg_store_cursors;
+
+// A waiting message as msg_store_peek finds it. data points into the log
+// and stays valid until the message is acked.
+struct msg_stored {
+    const void* data;
+    size_t len;
+    uint64_t seq;
+    int origin;           // The SDR it came from
+    uint64_t origin_seq;  // Its flood number there, 0 if it is not a flood
+};
+
+struct msg_store {
+    char dir[256];
+    size_t segment_size;
+    struct msg_segment* segments;  // Oldest first; the last one takes appends
+    int segment_count;
+    int segment_capacity;
+    uint32_t next_segment;  // Number for the next one created
+    uint64_t next_seq;
+    uint64_t flood_seq;  // Last flood number handed out
+    struct msg_store_cursors* cursors;
+    struct msg_store_queue queues[MSG_STORE_DESTINATIONS];
+    int dirty;          // Appended to or moved a cursor since the last commit
+    int cursors_dirty;
+
+    uint64_t appends;
+    uint64_t commits;
+    uint64_t recovered;  // Messages waiting in the log when it was opened
+};
+
+// Open or create the log in dir. Returns -1 with errno set on failure.
+int msg_store_open(struct msg_store* store, const char* dir, size_t segment_size);
+void msg_store_close(struct msg_store* store);
+
+// Queue a message for every destination whose bit is set, d in
+// destinations[d / 64], with origin_seq from msg_store_flood_seq (or the
+// origin's, for a relayed flood) or 0. Returns the sequence number, or 0
+// with errno set if it could not be stored. It is only durable after the
+// next commit.
+uint64_t msg_store_append(struct msg_store* store, const uint64_t destinations[2], int origin,
+                          uint64_t origin_seq, const void* data, size_t len);
+// The next number for a flood from this SDR: numbered apart from other
+// messages, so only floods move the duplicate windows of the SDRs they
+// reach. Numbers are reserved on disk in blocks and never handed out twice,
+// restarts included. Returns 0 with errno set if a block could not be
+// reserved.
+uint64_t msg_store_flood_seq(struct msg_store* store);
+// Sync everything appended and every cursor moved since the last commit.
+// Returns -1 if the sync failed.
+int msg_store_commit(struct msg_store* store);
+
+// The oldest message for destination not yet delivered; 0 if there is none
+int msg_store_peek(const struct msg_store* store, int destination, struct msg_stored* message);
+// The message msg_store_peek returned has been handed on
+void msg_store_delivered(struct msg_store* store, int destination);
+// Destination has every message up to seq. Returns -1, changing nothing,
+// if seq is past the newest message stored for it.
+int msg_store_acked(struct msg_store* store, int destination, uint64_t seq);
+// Deliver everything not acked again, as after a link comes back
+void msg_store_rewind(struct msg_store* store, int destination);
+// Messages not yet acked
+size_t msg_store_pending(const struct msg_store* store, int destination);
+
+#endif
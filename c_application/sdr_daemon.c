@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdr_loop.h"
+
+// The message, call, file and video servers in one process, sharing one
+// event loop, one signal handler and one stats registry. Each keeps its own
+// socket path, so clients cannot tell it from the separate binaries.
+//
+// Usage: ./sdr_daemon [service [options]]...
+// With no arguments all four services run with their defaults. Otherwise only
+// the named ones run, each followed by the options its own binary takes:
+//   ./sdr_daemon msg call --record file --workers 8 video --live-port 8091
+// kill -USR1 prints every service's counters, and /tmp/sdr_stats_socket
+// serves them with the stage latency histograms in Prometheus text format.
+
+extern struct sdr_service msg_service;
+extern struct sdr_service call_service;
+extern struct sdr_service file_service;
+extern struct sdr_service video_service;
+
+struct sdr_service* known_services[] = {&msg_service, &call_service, &file_service, &video_service};
+#define SERVICE_COUNT ((int)(sizeof(known_services) / sizeof(known_services[0])))
+
+struct sdr_service* find_service(const char* name) {
+    for (int i = 0; i < SERVICE_COUNT; i++) {
+        if (strcmp(known_services[i]->name, name) == 0) {
+            return known_services[i];
+        }
+    }
+    return NULL;
+}
+
+void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [service [options]]...\n", program);
+    fprintf(stderr, "Services: msg, call, file, video (all of them if none are named)\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    struct sdr_service* services[SERVICE_COUNT];
+    int first_arg[SERVICE_COUNT];  // Where each service's name is in argv
+    int count = 0;
+
+    // Split the command line at service names
+    for (int i = 1; i < argc; i++) {
+        struct sdr_service* service = find_service(argv[i]);
+        if (!service) {
+            if (count == 0) {
+                usage(argv[0]);
+            }
+            continue;  // An option for the service named before it
+        }
+        for (int s = 0; s < count; s++) {
+            if (services[s] == service) {
+                fprintf(stderr, "%s is named twice\n", service->name);
+                exit(1);
+            }
+        }
+        services[count] = service;
+        first_arg[count] = i;
+        count++;
+    }
+    if (count == 0) {
+        for (int s = 0; s < SERVICE_COUNT; s++) {
+            services[s] = known_services[s];
+            first_arg[s] = -1;
+        }
+        count = SERVICE_COUNT;
+    }
+
+    if (sdr_loop_init() == -1) {
+        return 1;
+    }
+    for (int s = 0; s < count; s++) {
+        // Each service sees its own name as argv[0] and its options after it
+        char* service_argv[argc + 1];
+        int service_argc = 0;
+        service_argv[service_argc++] = (char*)services[s]->name;
+        if (first_arg[s] != -1) {
+            for (int i = first_arg[s] + 1; i < argc && !find_service(argv[i]); i++) {
+                service_argv[service_argc++] = argv[i];
+            }
+        }
+        service_argv[service_argc] = NULL;
+
+        if (services[s]->start(service_argc, service_argv) == -1) {
+            fprintf(stderr, "%s service failed to start\n", services[s]->name);
+            // Undo the ones already listening, so no stale sockets are left
+            for (int r = s - 1; r >= 0; r--) {
+                if (services[r]->stop) {
+                    services[r]->stop();
+                }
+            }
+            return 1;
+        }
+    }
+
+    sdr_stats_serve("/tmp/sdr_stats_socket");
+    printf("SDR daemon running %d service%s on one event loop\n", count, count == 1 ? "" : "s");
+    fflush(stdout);
+    return sdr_loop_run(services, count);
+}
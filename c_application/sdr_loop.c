@@ -0,0 +1,385 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include "sdr_loop.h"
+#include "sdr_uring.h"
+
+#define SDR_MAX_EVENTS 256
+#define SDR_URING_CQ_ENTRIES 4096
+#define SDR_URING_IGNORE UINT64_MAX  // user_data of requests whose completion means nothing
+// Readiness bits a poll request takes; the epoll-only flags are left out
+#define SDR_POLL_EVENTS (EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLERR | EPOLLHUP | EPOLLRDHUP)
+
+// What the loop watches for one descriptor under io_uring. Each armed watch
+// has one poll request in flight, tagged with the descriptor and generation;
+// the generation changes whenever the watch does, so completions of a poll
+// that was removed or replaced are dropped rather than handed to a handler
+// that may be gone.
+struct sdr_watch {
+    struct sdr_handler* handler;
+    uint32_t events;
+    uint32_t generation;
+    int registered;
+    int armed;
+};
+
+int sdr_epoll_fd = -1;
+int sdr_signal_fd = -1;
+int sdr_io_uring = 0;  // SDR_IO=uring: the loop polls through sdr_ring
+struct sdr_uring sdr_ring;
+struct sdr_watch* sdr_watches = NULL;
+int sdr_watch_count = 0;
+
+int sdr_io_uring_enabled(void) {
+    return sdr_io_uring;
+}
+
+// The watch for fd, growing the table to hold it
+struct sdr_watch* sdr_watch_get(int fd) {
+    if (fd >= sdr_watch_count) {
+        int count = sdr_watch_count ? sdr_watch_count : 64;
+        while (count <= fd) {
+            count *= 2;
+        }
+        struct sdr_watch* watches = realloc(sdr_watches, count * sizeof(*watches));
+        if (!watches) {
+            return NULL;
+        }
+        memset(watches + sdr_watch_count, 0, (count - sdr_watch_count) * sizeof(*watches));
+        sdr_watches = watches;
+        sdr_watch_count = count;
+    }
+    return &sdr_watches[fd];
+}
+
+uint64_t sdr_watch_tag(int fd) {
+    return (uint64_t)sdr_watches[fd].generation << 32 | (uint32_t)fd;
+}
+
+// The next submission entry, submitting what is queued if the ring is full
+struct io_uring_sqe* sdr_loop_sqe(void) {
+    struct io_uring_sqe* sqe = sdr_uring_sqe(&sdr_ring);
+    while (!sqe) {
+        if (sdr_uring_submit(&sdr_ring, 0) == -1 && errno != EINTR && errno != EBUSY) {
+            perror("io_uring_enter");
+            abort();
+        }
+        sqe = sdr_uring_sqe(&sdr_ring);
+    }
+    return sqe;
+}
+
+// Queue a one-shot poll for fd. One-shot and re-armed after every event
+// gives level-triggered behaviour, which handlers that read only a budget's
+// worth per event rely on.
+void sdr_watch_arm(int fd) {
+    struct io_uring_sqe* sqe = sdr_loop_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = sdr_watches[fd].events & SDR_POLL_EVENTS;
+    sqe->user_data = sdr_watch_tag(fd);
+    sdr_watches[fd].armed = 1;
+}
+
+// Cancel the poll in flight for fd and retire its generation
+void sdr_watch_disarm(int fd) {
+    struct sdr_watch* watch = &sdr_watches[fd];
+    if (watch->armed) {
+        struct io_uring_sqe* sqe = sdr_loop_sqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->addr = sdr_watch_tag(fd);
+        sqe->user_data = SDR_URING_IGNORE;
+        watch->armed = 0;
+    }
+    watch->generation++;
+}
+
+int sdr_watch_set(int fd, uint32_t events, struct sdr_handler* handler) {
+    struct sdr_watch* watch = sdr_watch_get(fd);
+    if (!watch) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (watch->armed && events != watch->events) {
+        sdr_watch_disarm(fd);
+    }
+    watch->handler = handler;
+    watch->events = events;
+    watch->registered = 1;
+    if (!watch->armed && events) {
+        sdr_watch_arm(fd);
+    }
+    return 0;
+}
+
+// Start the loop on io_uring if SDR_IO asks for it and the kernel allows
+void sdr_loop_pick_backend(void) {
+    const char* io = getenv("SDR_IO");
+    if (!io || strcmp(io, "epoll") == 0) {
+        return;
+    }
+    if (strcmp(io, "uring") != 0) {
+        fprintf(stderr, "SDR_IO=%s not known; using epoll\n", io);
+        return;
+    }
+    if (sdr_uring_init(&sdr_ring, SDR_MAX_EVENTS, SDR_URING_CQ_ENTRIES) == -1) {
+        fprintf(stderr, "io_uring unavailable (%s); using epoll\n", strerror(errno));
+        return;
+    }
+    sdr_io_uring = 1;
+}
+
+int sdr_loop_init(void) {
+    sigset_t signals;
+
+    // Blocked before any service starts a thread, so every thread inherits
+    // the mask and none of them can take a signal meant for the loop
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    sdr_signal_fd = signalfd(-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (sdr_signal_fd == -1) {
+        perror("event loop");
+        return -1;
+    }
+    sdr_trace_init();
+    sdr_qos_init();
+    sdr_loop_pick_backend();
+    if (sdr_io_uring) {
+        // A watch without a handler marks the signalfd
+        return sdr_watch_set(sdr_signal_fd, EPOLLIN, NULL);
+    }
+
+    sdr_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (sdr_epoll_fd == -1) {
+        perror("event loop");
+        return -1;
+    }
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;  // NULL marks the signalfd
+    if (epoll_ctl(sdr_epoll_fd, EPOLL_CTL_ADD, sdr_signal_fd, &ev) == -1) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+int sdr_loop_add(int fd, uint32_t events, struct sdr_handler* handler) {
+    if (sdr_io_uring) {
+        return sdr_watch_set(fd, events, handler);
+    }
+    struct epoll_event ev = {0};
+    ev.events = events;
+    ev.data.ptr = handler;
+    return epoll_ctl(sdr_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int sdr_loop_modify(int fd, uint32_t events, struct sdr_handler* handler) {
+    if (sdr_io_uring) {
+        return sdr_watch_set(fd, events, handler);
+    }
+    struct epoll_event ev = {0};
+    ev.events = events;
+    ev.data.ptr = handler;
+    return epoll_ctl(sdr_epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void sdr_loop_remove(int fd) {
+    if (sdr_io_uring) {
+        if (fd < sdr_watch_count && sdr_watches[fd].registered) {
+            sdr_watch_disarm(fd);
+            sdr_watches[fd].registered = 0;
+            sdr_watches[fd].handler = NULL;
+        }
+        return;
+    }
+    epoll_ctl(sdr_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+// Returns 0 once a shutdown signal has arrived
+int read_signals(void) {
+    struct signalfd_siginfo info;
+    while (read(sdr_signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGUSR1) {
+            sdr_stats_print();
+        } else if (info.ssi_signo == SIGUSR2) {
+            sdr_trace_toggle();
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Hand one poll completion to its handler, then re-arm the watch unless the
+// handler changed it. Returns 0 once a shutdown signal has arrived.
+int sdr_uring_dispatch(const struct io_uring_cqe* cqe) {
+    if (cqe->user_data == SDR_URING_IGNORE) {
+        return 1;
+    }
+    int fd = (int)(uint32_t)cqe->user_data;
+    uint32_t generation = (uint32_t)(cqe->user_data >> 32);
+    if (fd >= sdr_watch_count || !sdr_watches[fd].registered ||
+        sdr_watches[fd].generation != generation) {
+        return 1;
+    }
+    sdr_watches[fd].armed = 0;
+    uint32_t events = cqe->res < 0 ? EPOLLERR : (uint32_t)cqe->res;
+
+    int running = 1;
+    struct sdr_handler* handler = sdr_watches[fd].handler;
+    if (!handler) {
+        running = read_signals();
+    } else {
+        handler->on_event(handler, events);
+    }
+    // The table may have grown while the handler ran
+    struct sdr_watch* watch = &sdr_watches[fd];
+    if (watch->registered && watch->generation == generation && !watch->armed && watch->events) {
+        sdr_watch_arm(fd);
+    }
+    return running;
+}
+
+// The class a poll completion's handler is in. Stale completions, which
+// sdr_uring_dispatch() drops, and the signalfd count as voice.
+int sdr_uring_class(const struct io_uring_cqe* cqe) {
+    int fd = (int)(uint32_t)cqe->user_data;
+    if (cqe->user_data == SDR_URING_IGNORE || fd >= sdr_watch_count ||
+        !sdr_watches[fd].handler) {
+        return SDR_CLASS_VOICE;
+    }
+    return sdr_watches[fd].handler->qos_class;
+}
+
+// The io_uring loop: one io_uring_enter() submits every re-arm, removal and
+// change queued since the last one and waits for the next events
+int sdr_loop_run_uring(struct sdr_service** services, int count) {
+    struct io_uring_cqe done[SDR_MAX_EVENTS];
+    int classes[SDR_MAX_EVENTS];
+    int running = 1;
+
+    while (running) {
+        if (sdr_uring_submit(&sdr_ring, 1) == -1 && errno != EINTR && errno != EBUSY) {
+            perror("io_uring_enter");
+            break;
+        }
+        struct io_uring_cqe* cqe;
+        int n = 0;
+        while (n < SDR_MAX_EVENTS && (cqe = sdr_uring_peek(&sdr_ring))) {
+            done[n] = *cqe;
+            sdr_uring_seen(&sdr_ring);
+            classes[n] = sdr_uring_class(&done[n]);
+            n++;
+        }
+        uint64_t ready = sdr_now_ns();
+        sdr_qos_refill();
+        for (int c = 0; c < SDR_CLASSES; c++) {
+            for (int i = 0; i < n; i++) {
+                if (classes[i] == c) {
+                    sdr_qos_waited(c, ready);
+                    running = sdr_uring_dispatch(&done[i]) && running;
+                }
+            }
+        }
+        for (int s = 0; s < count; s++) {
+            if (services[s]->after_events) {
+                services[s]->after_events();
+            }
+        }
+    }
+
+    for (int s = count - 1; s >= 0; s--) {
+        if (services[s]->stop) {
+            services[s]->stop();
+        }
+    }
+    sdr_stats_stop();
+    sdr_uring_exit(&sdr_ring);
+    free(sdr_watches);
+    close(sdr_signal_fd);
+    return 0;
+}
+
+int sdr_loop_run(struct sdr_service** services, int count) {
+    struct epoll_event events[SDR_MAX_EVENTS];
+    int classes[SDR_MAX_EVENTS];
+    int running = 1;
+
+    if (sdr_io_uring) {
+        return sdr_loop_run_uring(services, count);
+    }
+    while (running) {
+        int n = epoll_wait(sdr_epoll_fd, events, SDR_MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        // Classes are read up front: a handler may free its connection,
+        // and the passes after its own still look at every event
+        for (int i = 0; i < n; i++) {
+            struct sdr_handler* handler = events[i].data.ptr;
+            classes[i] = handler ? handler->qos_class : SDR_CLASS_VOICE;
+        }
+        uint64_t ready = sdr_now_ns();
+        sdr_qos_refill();
+        for (int c = 0; c < SDR_CLASSES; c++) {
+            for (int i = 0; i < n; i++) {
+                if (classes[i] != c) {
+                    continue;
+                }
+                struct sdr_handler* handler = events[i].data.ptr;
+                if (!handler) {
+                    running = read_signals();
+                } else {
+                    sdr_qos_waited(c, ready);
+                    handler->on_event(handler, events[i].events);
+                }
+            }
+        }
+        for (int s = 0; s < count; s++) {
+            if (services[s]->after_events) {
+                services[s]->after_events();
+            }
+        }
+    }
+
+    for (int s = count - 1; s >= 0; s--) {
+        if (services[s]->stop) {
+            services[s]->stop();
+        }
+    }
+    sdr_stats_stop();
+    close(sdr_epoll_fd);
+    close(sdr_signal_fd);
+    return 0;
+}
+
+int sdr_service_main(struct sdr_service* service, int argc, char* argv[]) {
+    char stats_path[108];
+
+    if (sdr_loop_init() == -1 || service->start(argc, argv) == -1) {
+        return 1;
+    }
+    // The service runs without it if the socket cannot be had
+    snprintf(stats_path, sizeof(stats_path), "/tmp/%s_stats_socket", service->name);
+    sdr_stats_serve(stats_path);
+    return sdr_loop_run(&service, 1);
+}
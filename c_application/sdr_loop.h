@@ -0,0 +1,59 @@
+#ifndef SDR_LOOP_H
+#define SDR_LOOP_H
+
+#include <stdint.h>
+#include "sdr_metrics.h"
+#include "sdr_qos.h"
+
+// The event loop the SDR servers run on. Each server is a service: start()
+// opens its listeners and adds them to the loop, and the loop calls back
+// whatever becomes ready. A server binary run on its own is the only service
+// on its loop; sdr_daemon runs all of them on one.
+//
+// Shutdown is the loop's job too. SIGINT and SIGTERM are blocked in every
+// thread and read through a signalfd, after which each service's stop() runs.
+// SIGUSR1 prints the stats registry and SIGUSR2 turns tracing on or off.
+//
+// The loop waits with epoll unless SDR_IO=uring is set in the environment, in
+// which case it polls through io_uring (falling back to epoll if the kernel
+// refuses one), so the two can be compared on the same machine.
+
+// Everything the loop watches is a handler, normally the first member of a
+// service's own listener or connection struct so on_event can cast back.
+// Each batch of ready handlers runs in order of qos_class (see sdr_qos.h).
+struct sdr_handler {
+    void (*on_event)(struct sdr_handler* handler, uint32_t events);
+    int qos_class;
+};
+
+struct sdr_service {
+    const char* name;
+    // Parse options (argv[0] is the program or service name), open listeners
+    // and add them to the loop. Returns -1 on failure, having said why.
+    int (*start)(int argc, char* argv[]);
+    // Runs once all handlers for a batch of events have; may be NULL
+    void (*after_events)(void);
+    // Closes listeners and removes socket files at shutdown; may be NULL
+    void (*stop)(void);
+};
+
+// Call before starting any service, and so before any service thread exists
+int sdr_loop_init(void);
+
+int sdr_loop_add(int fd, uint32_t events, struct sdr_handler* handler);
+int sdr_loop_modify(int fd, uint32_t events, struct sdr_handler* handler);
+void sdr_loop_remove(int fd);
+
+// Run the started services until a shutdown signal, then stop them in
+// reverse order
+int sdr_loop_run(struct sdr_service** services, int count);
+
+// Whether the loop runs on io_uring; services then use it for their own I/O
+// too
+int sdr_io_uring_enabled(void);
+
+// main() of a server binary: one service on its own loop, with its stats on
+// /tmp/<name>_stats_socket
+int sdr_service_main(struct sdr_service* service, int argc, char* argv[]);
+
+#endif
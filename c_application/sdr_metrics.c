@@ -0,0 +1,433 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include "sdr_loop.h"
+
+#define SDR_MAX_STATS 128
+#define SDR_MAX_HISTOGRAMS 32
+// Histogram layout: values below 8 get a bucket each, then each power of two
+// from 2^3 to 2^39 is split into 8
+#define SDR_SUB_BUCKET_BITS 3
+#define SDR_SUB_BUCKETS (1 << SDR_SUB_BUCKET_BITS)
+#define SDR_TOP_BIT 39
+#define SDR_BUCKETS ((SDR_TOP_BIT - SDR_SUB_BUCKET_BITS + 2) * SDR_SUB_BUCKETS)
+// Prometheus buckets, at powers of two from about 1 us to 34 s
+#define SDR_EXPORT_LOW_BIT 10
+#define SDR_EXPORT_HIGH_BIT 35
+// Tracing: at most SDR_TRACE_BURST lines at once, refilled at
+// SDR_TRACE_RATE per second
+#define SDR_TRACE_RATE 100
+#define SDR_TRACE_BURST 100
+
+enum { STAT_PLAIN, STAT_SHARDED };
+
+struct sdr_stat {
+    const char* service;
+    const char* name;
+    int kind;
+    const uint64_t* value;
+    const struct sdr_counter* counter;
+};
+
+struct sdr_histogram_shard {
+    uint64_t buckets[SDR_BUCKETS];
+    uint64_t sum;
+    uint64_t max;
+} __attribute__((aligned(SDR_CACHE_LINE)));
+
+struct sdr_histogram {
+    const char* service;
+    const char* stage;
+    struct sdr_histogram_shard shards[SDR_METRIC_SHARDS];
+};
+
+// One client reading the dump; written to as its socket takes it
+struct sdr_stats_client {
+    struct sdr_handler handler;
+    int fd;
+    char* text;
+    size_t length;
+    size_t sent;
+};
+
+struct sdr_stat sdr_stats[SDR_MAX_STATS];
+int sdr_stat_count = 0;
+struct sdr_histogram* sdr_histograms[SDR_MAX_HISTOGRAMS];
+int sdr_histogram_count = 0;
+
+// Threads take shards in the order they first record something
+__thread int sdr_thread_shard = -1;
+unsigned sdr_shards_taken = 0;
+
+int sdr_stats_fd = -1;
+char sdr_stats_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+struct sdr_handler sdr_stats_listener;
+
+int sdr_trace_on = 0;
+pthread_mutex_t sdr_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+uint64_t sdr_trace_credit = 0;  // ns of allowance, SDR_TRACE_RATE lines per second
+uint64_t sdr_trace_refilled = 0;
+uint64_t sdr_trace_dropped = 0;
+
+int sdr_metric_shard(void) {
+    if (sdr_thread_shard == -1) {
+        sdr_thread_shard =
+            __atomic_fetch_add(&sdr_shards_taken, 1, __ATOMIC_RELAXED) % SDR_METRIC_SHARDS;
+    }
+    return sdr_thread_shard;
+}
+
+void sdr_counter_add(struct sdr_counter* counter, uint64_t n) {
+    __atomic_fetch_add(&counter->shards[sdr_metric_shard()].value, n, __ATOMIC_RELAXED);
+}
+
+uint64_t sdr_counter_read(const struct sdr_counter* counter) {
+    uint64_t total = 0;
+    for (int s = 0; s < SDR_METRIC_SHARDS; s++) {
+        total += __atomic_load_n(&counter->shards[s].value, __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+uint64_t sdr_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int sdr_bucket_of(uint64_t ns) {
+    if (ns < SDR_SUB_BUCKETS) {
+        return (int)ns;
+    }
+    int top = 63 - __builtin_clzll(ns);
+    if (top > SDR_TOP_BIT) {
+        return SDR_BUCKETS - 1;
+    }
+    int shift = top - SDR_SUB_BUCKET_BITS;
+    return (shift + 1) * SDR_SUB_BUCKETS + (int)((ns >> shift) & (SDR_SUB_BUCKETS - 1));
+}
+
+// The first value past bucket
+uint64_t sdr_bucket_end(int bucket) {
+    if (bucket < SDR_SUB_BUCKETS) {
+        return bucket + 1;
+    }
+    int shift = bucket / SDR_SUB_BUCKETS - 1;
+    return (uint64_t)(SDR_SUB_BUCKETS + bucket % SDR_SUB_BUCKETS + 1) << shift;
+}
+
+void sdr_histogram_record(struct sdr_histogram* histogram, uint64_t ns) {
+    struct sdr_histogram_shard* shard = &histogram->shards[sdr_metric_shard()];
+    __atomic_fetch_add(&shard->buckets[sdr_bucket_of(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shard->sum, ns, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&shard->max, __ATOMIC_RELAXED);
+    while (ns > max &&
+           !__atomic_compare_exchange_n(&shard->max, &max, ns, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+    }
+}
+
+void sdr_histogram_since(struct sdr_histogram* histogram, uint64_t start) {
+    sdr_histogram_record(histogram, sdr_now_ns() - start);
+}
+
+// Add the shards up into buckets; returns the sample count
+uint64_t sdr_histogram_merge(const struct sdr_histogram* histogram, uint64_t* buckets,
+                             uint64_t* sum, uint64_t* max) {
+    uint64_t count = 0;
+    memset(buckets, 0, SDR_BUCKETS * sizeof(*buckets));
+    *sum = 0;
+    *max = 0;
+    for (int s = 0; s < SDR_METRIC_SHARDS; s++) {
+        const struct sdr_histogram_shard* shard = &histogram->shards[s];
+        for (int b = 0; b < SDR_BUCKETS; b++) {
+            uint64_t n = __atomic_load_n(&shard->buckets[b], __ATOMIC_RELAXED);
+            buckets[b] += n;
+            count += n;
+        }
+        *sum += __atomic_load_n(&shard->sum, __ATOMIC_RELAXED);
+        uint64_t shard_max = __atomic_load_n(&shard->max, __ATOMIC_RELAXED);
+        *max = shard_max > *max ? shard_max : *max;
+    }
+    return count;
+}
+
+uint64_t sdr_quantile_of(const uint64_t* buckets, uint64_t count, uint64_t max, double q) {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * count + 0.5);
+    rank = rank ? rank : 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < SDR_BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen >= rank) {
+            uint64_t end = sdr_bucket_end(b) - 1;
+            return end < max ? end : max;
+        }
+    }
+    return max;
+}
+
+uint64_t sdr_histogram_quantile(const struct sdr_histogram* histogram, double q) {
+    uint64_t buckets[SDR_BUCKETS], sum, max;
+    uint64_t count = sdr_histogram_merge(histogram, buckets, &sum, &max);
+    return sdr_quantile_of(buckets, count, max, q);
+}
+
+void sdr_stat_add(const char* service, const char* name, int kind, const uint64_t* value,
+                  const struct sdr_counter* counter) {
+    if (sdr_stat_count == SDR_MAX_STATS) {
+        fprintf(stderr, "Stats registry full; %s.%s not registered\n", service, name);
+        return;
+    }
+    sdr_stats[sdr_stat_count].service = service;
+    sdr_stats[sdr_stat_count].name = name;
+    sdr_stats[sdr_stat_count].kind = kind;
+    sdr_stats[sdr_stat_count].value = value;
+    sdr_stats[sdr_stat_count].counter = counter;
+    sdr_stat_count++;
+}
+
+void sdr_stat_register(const char* service, const char* name, const uint64_t* value) {
+    sdr_stat_add(service, name, STAT_PLAIN, value, NULL);
+}
+
+void sdr_counter_register(const char* service, const char* name, struct sdr_counter* counter) {
+    sdr_stat_add(service, name, STAT_SHARDED, NULL, counter);
+}
+
+struct sdr_histogram* sdr_histogram_register(const char* service, const char* stage) {
+    if (sdr_histogram_count == SDR_MAX_HISTOGRAMS) {
+        fprintf(stderr, "Too many histograms; %s.%s not registered\n", service, stage);
+        exit(1);
+    }
+    struct sdr_histogram* histogram;
+    if (posix_memalign((void**)&histogram, SDR_CACHE_LINE, sizeof(*histogram)) != 0) {
+        fprintf(stderr, "No memory for histogram %s.%s\n", service, stage);
+        exit(1);
+    }
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->service = service;
+    histogram->stage = stage;
+    sdr_histograms[sdr_histogram_count++] = histogram;
+    return histogram;
+}
+
+uint64_t sdr_stat_value(const struct sdr_stat* stat) {
+    if (stat->kind == STAT_SHARDED) {
+        return sdr_counter_read(stat->counter);
+    }
+    return __atomic_load_n(stat->value, __ATOMIC_RELAXED);
+}
+
+void sdr_stats_print(void) {
+    printf("\n--- stats ---\n");
+    for (int i = 0; i < sdr_stat_count; i++) {
+        printf("%s.%s %llu\n", sdr_stats[i].service, sdr_stats[i].name,
+               (unsigned long long)sdr_stat_value(&sdr_stats[i]));
+    }
+    for (int i = 0; i < sdr_histogram_count; i++) {
+        const struct sdr_histogram* histogram = sdr_histograms[i];
+        uint64_t buckets[SDR_BUCKETS], sum, max;
+        uint64_t count = sdr_histogram_merge(histogram, buckets, &sum, &max);
+        if (count == 0) {
+            continue;
+        }
+        printf("%s.%s_ns count %llu p50 %llu p99 %llu p999 %llu max %llu\n", histogram->service,
+               histogram->stage, (unsigned long long)count,
+               (unsigned long long)sdr_quantile_of(buckets, count, max, 0.5),
+               (unsigned long long)sdr_quantile_of(buckets, count, max, 0.99),
+               (unsigned long long)sdr_quantile_of(buckets, count, max, 0.999),
+               (unsigned long long)max);
+    }
+    fflush(stdout);
+}
+
+// Everything in the registry in Prometheus text format, for the stats socket
+void sdr_stats_write_prometheus(FILE* out) {
+    for (int i = 0; i < sdr_stat_count; i++) {
+        fprintf(out, "# TYPE sdr_%s_%s_total counter\n", sdr_stats[i].service, sdr_stats[i].name);
+        fprintf(out, "sdr_%s_%s_total %llu\n", sdr_stats[i].service, sdr_stats[i].name,
+                (unsigned long long)sdr_stat_value(&sdr_stats[i]));
+    }
+    if (sdr_histogram_count == 0) {
+        return;
+    }
+    fprintf(out, "# HELP sdr_stage_seconds Time spent in each stage of a service's hot path\n");
+    fprintf(out, "# TYPE sdr_stage_seconds histogram\n");
+    for (int i = 0; i < sdr_histogram_count; i++) {
+        const struct sdr_histogram* histogram = sdr_histograms[i];
+        uint64_t buckets[SDR_BUCKETS], sum, max;
+        uint64_t count = sdr_histogram_merge(histogram, buckets, &sum, &max);
+        uint64_t below = 0;
+        int b = 0;
+        // Powers of two are bucket edges, so each line is exact
+        for (int bit = SDR_EXPORT_LOW_BIT; bit <= SDR_EXPORT_HIGH_BIT; bit++) {
+            for (; b < SDR_BUCKETS && sdr_bucket_end(b) <= (1ULL << bit); b++) {
+                below += buckets[b];
+            }
+            fprintf(out, "sdr_stage_seconds_bucket{service=\"%s\",stage=\"%s\",le=\"%.9g\"} %llu\n",
+                    histogram->service, histogram->stage, (double)(1ULL << bit) / 1e9,
+                    (unsigned long long)below);
+        }
+        fprintf(out, "sdr_stage_seconds_bucket{service=\"%s\",stage=\"%s\",le=\"+Inf\"} %llu\n",
+                histogram->service, histogram->stage, (unsigned long long)count);
+        fprintf(out, "sdr_stage_seconds_sum{service=\"%s\",stage=\"%s\"} %.9f\n",
+                histogram->service, histogram->stage, sum / 1e9);
+        fprintf(out, "sdr_stage_seconds_count{service=\"%s\",stage=\"%s\"} %llu\n",
+                histogram->service, histogram->stage, (unsigned long long)count);
+    }
+}
+
+void sdr_stats_client_close(struct sdr_stats_client* client) {
+    sdr_loop_remove(client->fd);
+    close(client->fd);
+    free(client->text);
+    free(client);
+}
+
+// Send what the socket takes; returns 0 once the client is done with
+int sdr_stats_client_send(struct sdr_stats_client* client) {
+    while (client->sent < client->length) {
+        ssize_t n = send(client->fd, client->text + client->sent, client->length - client->sent,
+                         MSG_NOSIGNAL);
+        if (n == -1) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        client->sent += n;
+    }
+    return 0;
+}
+
+void sdr_stats_client_event(struct sdr_handler* handler, uint32_t events) {
+    struct sdr_stats_client* client = (struct sdr_stats_client*)handler;
+    if ((events & (EPOLLERR | EPOLLHUP)) || !sdr_stats_client_send(client)) {
+        sdr_stats_client_close(client);
+    }
+}
+
+void sdr_stats_listener_event(struct sdr_handler* handler, uint32_t events) {
+    (void)handler;
+    (void)events;
+    int fd;
+    while ((fd = accept4(sdr_stats_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        struct sdr_stats_client* client = calloc(1, sizeof(*client));
+        FILE* out = client ? open_memstream(&client->text, &client->length) : NULL;
+        if (!out) {
+            free(client);
+            close(fd);
+            continue;
+        }
+        sdr_stats_write_prometheus(out);
+        fclose(out);
+        client->fd = fd;
+        client->handler.on_event = sdr_stats_client_event;
+        client->handler.qos_class = SDR_CLASS_CONTROL;
+        // Most dumps fit the socket buffer and go at once
+        if (!sdr_stats_client_send(client)) {
+            close(fd);
+            free(client->text);
+            free(client);
+        } else if (sdr_loop_add(fd, EPOLLOUT, &client->handler) == -1) {
+            perror("epoll_ctl");
+            close(fd);
+            free(client->text);
+            free(client);
+        }
+    }
+}
+
+int sdr_stats_serve(const char* path) {
+    struct sockaddr_un addr;
+
+    sdr_stats_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sdr_stats_fd == -1) {
+        perror("stats socket");
+        return -1;
+    }
+    unlink(path);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (bind(sdr_stats_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        listen(sdr_stats_fd, SOMAXCONN) == -1) {
+        perror("stats socket");
+        close(sdr_stats_fd);
+        sdr_stats_fd = -1;
+        unlink(path);
+        return -1;
+    }
+    sdr_stats_listener.on_event = sdr_stats_listener_event;
+    sdr_stats_listener.qos_class = SDR_CLASS_CONTROL;
+    if (sdr_loop_add(sdr_stats_fd, EPOLLIN, &sdr_stats_listener) == -1) {
+        perror("epoll_ctl");
+        close(sdr_stats_fd);
+        sdr_stats_fd = -1;
+        unlink(path);
+        return -1;
+    }
+    strncpy(sdr_stats_path, path, sizeof(sdr_stats_path) - 1);
+    printf("Stats on %s\n", path);
+    return 0;
+}
+
+void sdr_stats_stop(void) {
+    if (sdr_stats_fd != -1) {
+        close(sdr_stats_fd);
+        unlink(sdr_stats_path);
+        sdr_stats_fd = -1;
+    }
+}
+
+void sdr_trace_init(void) {
+    const char* trace = getenv("SDR_TRACE");
+    sdr_trace_on = trace && strcmp(trace, "0") != 0;
+}
+
+void sdr_trace_toggle(void) {
+    int on = !__atomic_load_n(&sdr_trace_on, __ATOMIC_RELAXED);
+    __atomic_store_n(&sdr_trace_on, on, __ATOMIC_RELAXED);
+    printf("Tracing %s\n", on ? "on" : "off");
+    fflush(stdout);
+}
+
+void sdr_trace(const char* format, ...) {
+    const uint64_t line_cost = 1000000000ULL / SDR_TRACE_RATE;
+    uint64_t now = sdr_now_ns();
+    va_list args;
+
+    pthread_mutex_lock(&sdr_trace_lock);
+    if (sdr_trace_refilled == 0) {
+        sdr_trace_credit = SDR_TRACE_BURST * line_cost;
+    } else {
+        sdr_trace_credit += now - sdr_trace_refilled;
+        if (sdr_trace_credit > SDR_TRACE_BURST * line_cost) {
+            sdr_trace_credit = SDR_TRACE_BURST * line_cost;
+        }
+    }
+    sdr_trace_refilled = now;
+    if (sdr_trace_credit < line_cost) {
+        sdr_trace_dropped++;
+        pthread_mutex_unlock(&sdr_trace_lock);
+        return;
+    }
+    sdr_trace_credit -= line_cost;
+    if (sdr_trace_dropped) {
+        printf("(%llu trace lines dropped)\n", (unsigned long long)sdr_trace_dropped);
+        sdr_trace_dropped = 0;
+    }
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    pthread_mutex_unlock(&sdr_trace_lock);
+}
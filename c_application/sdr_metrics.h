@@ -0,0 +1,73 @@
+#ifndef SDR_METRICS_H
+#define SDR_METRICS_H
+
+#include <stdint.h>
+
+// What the servers count and time, without logging a line per frame.
+//
+// Counters and latency histograms are split into shards, one per thread as
+// far as SDR_METRIC_SHARDS goes, so threads bumping the same metric do not
+// fight over a cache line; readers add the shards up. Everything is read
+// with relaxed atomic loads, so a dump never stops the threads writing.
+//
+// The registry is dumped by SIGUSR1 and served in Prometheus text format on
+// a Unix socket (see sdr_stats_serve). Per-frame detail goes through
+// SDR_TRACE, which is off unless SDR_TRACE=1 is set or SIGUSR2 turns it on,
+// and is rate limited when on.
+
+#define SDR_METRIC_SHARDS 16
+#define SDR_CACHE_LINE 64
+
+// A counter any thread can add to
+struct sdr_counter {
+    struct {
+        uint64_t value;
+        char pad[SDR_CACHE_LINE - sizeof(uint64_t)];
+    } shards[SDR_METRIC_SHARDS];
+};
+
+void sdr_counter_add(struct sdr_counter* counter, uint64_t n);
+uint64_t sdr_counter_read(const struct sdr_counter* counter);
+
+// HDR-style latency histogram of nanosecond values: every power of two is
+// split into 8 linear buckets, so any value is known to within 12.5% from a
+// nanosecond up to about 18 minutes, and percentiles come out at that
+// precision however the samples are spread
+struct sdr_histogram;
+
+uint64_t sdr_now_ns(void);
+void sdr_histogram_record(struct sdr_histogram* histogram, uint64_t ns);
+// Record the time since start, a value from sdr_now_ns()
+void sdr_histogram_since(struct sdr_histogram* histogram, uint64_t start);
+// The value below which fraction q (0 to 1) of the samples fall, in ns
+uint64_t sdr_histogram_quantile(const struct sdr_histogram* histogram, double q);
+
+// Registration, once at service start. value is a plain counter the
+// service updates itself; it is read atomically, so any thread may.
+void sdr_stat_register(const char* service, const char* name, const uint64_t* value);
+void sdr_counter_register(const char* service, const char* name, struct sdr_counter* counter);
+// A histogram of how long one stage of the service takes (accept, recv,
+// parse, write, ack). Exits if it cannot be allocated.
+struct sdr_histogram* sdr_histogram_register(const char* service, const char* stage);
+
+void sdr_stats_print(void);
+
+// Serve the Prometheus text dump to anyone who connects to path; the
+// socket is listed on the event loop, so call after sdr_loop_init()
+int sdr_stats_serve(const char* path);
+void sdr_stats_stop(void);
+
+// Tracing
+extern int sdr_trace_on;
+#define SDR_TRACE(...)                                        \
+    do {                                                      \
+        if (__atomic_load_n(&sdr_trace_on, __ATOMIC_RELAXED)) { \
+            sdr_trace(__VA_ARGS__);                           \
+        }                                                     \
+    } while (0)
+
+void sdr_trace_init(void);
+void sdr_trace_toggle(void);
+void sdr_trace(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
@@ -0,0 +1,175 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "sdr_qos.h"
+#include "sdr_metrics.h"
+
+#define SDR_QOS_BURST_NS 100000000ULL  // A bucket holds 100 ms of its rate
+
+struct sdr_class_config {
+    const char* name;
+    long quantum;  // Bytes per loop iteration; 0 is unlimited
+    int nice;      // Of the class's own threads
+};
+
+// A byte rate shared by every thread of a class, kept as a virtual clock:
+// each caller books the time its bytes take at the rate, after everything
+// booked before it, and sleeps only until its own booking is within the
+// burst of now. However many threads are over, the class gets its rate.
+struct sdr_bucket {
+    pthread_mutex_t lock;
+    uint64_t rate;       // Bytes per second; 0 is unlimited
+    uint64_t next_free;  // When everything booked so far has gone at the rate
+};
+
+struct sdr_class_config sdr_classes[SDR_CLASSES] = {
+    {"voice", 0, 0},
+    {"control", 64 * 1024, 0},
+    {"video", 256 * 1024, 5},
+    {"file", 64 * 1024, 10},
+};
+struct sdr_bucket sdr_buckets[SDR_CLASSES];
+long sdr_deficits[SDR_CLASSES];
+struct sdr_histogram* sdr_class_waits[SDR_CLASSES];
+char sdr_class_wait_names[SDR_CLASSES][32];
+
+const char* sdr_class_name(int qos_class) {
+    return sdr_classes[qos_class].name;
+}
+
+// A byte count with an optional K, M or G suffix; -1 if it is not one
+long long sdr_qos_parse_size(const char* text, const char** end) {
+    char* rest;
+    errno = 0;
+    long long value = strtoll(text, &rest, 10);
+    if (rest == text || errno || value < 0) {
+        return -1;
+    }
+    switch (*rest) {
+    case 'G': case 'g': value *= 1024;  // Fall through
+    case 'M': case 'm': value *= 1024;  // Fall through
+    case 'K': case 'k': value *= 1024; rest++; break;
+    default: break;
+    }
+    *end = rest;
+    return value;
+}
+
+// One class=rate[/quantum] entry of SDR_QOS; -1 if it makes no sense
+int sdr_qos_parse_entry(const char* entry) {
+    const char* equals = strchr(entry, '=');
+    if (!equals) {
+        return -1;
+    }
+    int qos_class = -1;
+    for (int c = 0; c < SDR_CLASSES; c++) {
+        if (strlen(sdr_classes[c].name) == (size_t)(equals - entry) &&
+            strncasecmp(entry, sdr_classes[c].name, equals - entry) == 0) {
+            qos_class = c;
+        }
+    }
+    if (qos_class == -1 || qos_class == SDR_CLASS_VOICE) {
+        return -1;
+    }
+    const char* p = equals + 1;
+    long long rate = sdr_buckets[qos_class].rate;
+    long long quantum = sdr_classes[qos_class].quantum;
+    if (*p != '/' && (rate = sdr_qos_parse_size(p, &p)) == -1) {
+        return -1;
+    }
+    if (*p == '/' && ((quantum = sdr_qos_parse_size(p + 1, &p)) == -1)) {
+        return -1;
+    }
+    if (*p) {
+        return -1;
+    }
+    sdr_buckets[qos_class].rate = rate;
+    sdr_classes[qos_class].quantum = quantum;
+    return 0;
+}
+
+void sdr_qos_init(void) {
+    const char* config = getenv("SDR_QOS");
+
+    for (int c = 0; c < SDR_CLASSES; c++) {
+        pthread_mutex_init(&sdr_buckets[c].lock, NULL);
+    }
+    if (config) {
+        char* copy = strdup(config);
+        char* save = NULL;
+        for (char* entry = strtok_r(copy, ",", &save); entry; entry = strtok_r(NULL, ",", &save)) {
+            if (sdr_qos_parse_entry(entry) == -1) {
+                fprintf(stderr, "SDR_QOS entry %s not understood; ignored\n", entry);
+            }
+        }
+        free(copy);
+        for (int c = SDR_CLASS_CONTROL; c < SDR_CLASSES; c++) {
+            printf("QoS %s: %llu bytes/s%s, %ld bytes per loop iteration%s\n", sdr_classes[c].name,
+                   (unsigned long long)sdr_buckets[c].rate, sdr_buckets[c].rate ? "" : " (unlimited)",
+                   sdr_classes[c].quantum, sdr_classes[c].quantum ? "" : " (unlimited)");
+        }
+    }
+
+    for (int c = 0; c < SDR_CLASSES; c++) {
+        snprintf(sdr_class_wait_names[c], sizeof(sdr_class_wait_names[c]), "%s_wait",
+                 sdr_classes[c].name);
+        sdr_class_waits[c] = sdr_histogram_register("qos", sdr_class_wait_names[c]);
+        sdr_buckets[c].next_free = sdr_now_ns();
+    }
+}
+
+void sdr_qos_refill(void) {
+    for (int c = 0; c < SDR_CLASSES; c++) {
+        // Quantum left over is not saved up, but an overdraft is paid back
+        sdr_deficits[c] = (sdr_deficits[c] < 0 ? sdr_deficits[c] : 0) + sdr_classes[c].quantum;
+    }
+}
+
+int sdr_qos_budget(int qos_class) {
+    return sdr_classes[qos_class].quantum == 0 || sdr_deficits[qos_class] > 0;
+}
+
+void sdr_qos_charge(int qos_class, size_t bytes) {
+    sdr_deficits[qos_class] -= bytes;
+}
+
+void sdr_qos_throttle(int qos_class, size_t bytes) {
+    struct sdr_bucket* bucket = &sdr_buckets[qos_class];
+    if (bucket->rate == 0) {
+        return;
+    }
+
+    uint64_t now = sdr_now_ns();
+    uint64_t cost = (uint64_t)bytes * 1000000000ULL / bucket->rate;
+    pthread_mutex_lock(&bucket->lock);
+    // An idle class starts again from now; the burst is the leeway below
+    uint64_t start = bucket->next_free > now ? bucket->next_free : now;
+    bucket->next_free = start + cost;
+    uint64_t due = bucket->next_free;
+    pthread_mutex_unlock(&bucket->lock);
+
+    if (due > now + SDR_QOS_BURST_NS) {
+        uint64_t wait = due - now - SDR_QOS_BURST_NS;
+        struct timespec ts = {wait / 1000000000ULL, wait % 1000000000ULL};
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+        }
+        sdr_qos_waited(qos_class, now);
+    }
+}
+
+void sdr_qos_waited(int qos_class, uint64_t since) {
+    sdr_histogram_since(sdr_class_waits[qos_class], since);
+}
+
+void sdr_qos_thread(int qos_class) {
+    // Per thread on Linux; raising it needs no privilege
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), sdr_classes[qos_class].nice);
+}
@@ -0,0 +1,52 @@
+#ifndef SDR_QOS_H
+#define SDR_QOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Traffic classes shared by all the servers, so a file upload or a video
+// stream cannot starve the 100 ms voice cadence.
+//
+// On the event loop, each batch of ready handlers runs in class order, and
+// every class but voice gets a quantum of bytes per loop iteration (deficit
+// round robin): a handler stops reading once its class has spent the
+// quantum and picks up where it left off on the next iteration, after any
+// voice that came in meanwhile. Work a class does on its own threads (file
+// transfers, video recording) runs at a lower CPU priority and can be held
+// to a rate by a token bucket.
+//
+// Rates and quanta are set with SDR_QOS, a comma separated list of
+// class=rate[/quantum] in bytes, with K, M or G suffixes:
+//   SDR_QOS=file=20M,video=8M/512K
+// A rate of 0, the default, leaves a class unlimited. How long each class
+// waited for the loop, the file queue or its bucket is in the stats as
+// qos.<class>_wait.
+
+enum sdr_class {
+    SDR_CLASS_VOICE,    // Highest priority; never limited
+    SDR_CLASS_CONTROL,  // Messages, stats
+    SDR_CLASS_VIDEO,
+    SDR_CLASS_FILE,
+    SDR_CLASSES
+};
+
+// Call from sdr_loop_init()
+void sdr_qos_init(void);
+const char* sdr_class_name(int qos_class);
+
+// Loop thread only. Start a loop iteration: top up every class's quantum.
+void sdr_qos_refill(void);
+// Whether the class has quantum left this iteration
+int sdr_qos_budget(int qos_class);
+// Bytes a handler of the class has just moved
+void sdr_qos_charge(int qos_class, size_t bytes);
+
+// Any thread. Count bytes against the class's rate, sleeping while it is
+// over; the sleep counts as waiting.
+void sdr_qos_throttle(int qos_class, size_t bytes);
+// Record a wait of the class that started at since (sdr_now_ns())
+void sdr_qos_waited(int qos_class, uint64_t since);
+// Run the calling thread at the class's CPU priority
+void sdr_qos_thread(int qos_class);
+
+#endif
@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "sdr_uring.h"
+
+int sdr_uring_setup(unsigned entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+int sdr_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+int sdr_uring_register(int fd, unsigned opcode, const void* arg, unsigned count) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+int sdr_uring_init(struct sdr_uring* ring, unsigned entries, unsigned cq_entries) {
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    if (cq_entries) {
+        params.flags |= IORING_SETUP_CQSIZE;
+        params.cq_entries = cq_entries;
+    }
+    ring->fd = sdr_uring_setup(entries, &params);
+    if (ring->fd == -1) {
+        return -1;
+    }
+
+    // Three mappings work on every kernel with io_uring; newer ones would
+    // share the first two
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        int saved = errno;
+        sdr_uring_exit(ring);
+        errno = saved;
+        return -1;
+    }
+
+    char* sq = ring->sq_map;
+    char* cq = ring->cq_map;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_queued = *ring->sq_tail;
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+void sdr_uring_exit(struct sdr_uring* ring) {
+    if (ring->sq_map && ring->sq_map != MAP_FAILED) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    if (ring->cq_map && ring->cq_map != MAP_FAILED) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sqes && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->fd != -1) {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+struct io_uring_sqe* sdr_uring_sqe(struct sdr_uring* ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_queued - head == ring->sq_entries) {
+        return NULL;
+    }
+    unsigned index = ring->sq_queued & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_queued++;
+    return sqe;
+}
+
+int sdr_uring_submit(struct sdr_uring* ring, unsigned wait) {
+    // Publishing the tail hands the kernel every entry filled in before it
+    __atomic_store_n(ring->sq_tail, ring->sq_queued, __ATOMIC_RELEASE);
+    unsigned pending = ring->sq_queued - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (pending == 0 && wait == 0) {
+        return 0;
+    }
+    return sdr_uring_enter(ring->fd, pending, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+}
+
+struct io_uring_cqe* sdr_uring_peek(struct sdr_uring* ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+struct io_uring_cqe* sdr_uring_wait(struct sdr_uring* ring) {
+    while (1) {
+        struct io_uring_cqe* cqe = sdr_uring_peek(ring);
+        unsigned unsubmitted = ring->sq_queued - *ring->sq_tail;
+        if (cqe && unsubmitted == 0) {
+            return cqe;
+        }
+        if (sdr_uring_submit(ring, cqe ? 0 : 1) == -1 && errno != EINTR && errno != EBUSY) {
+            return NULL;
+        }
+        if (cqe) {
+            return cqe;
+        }
+    }
+}
+
+void sdr_uring_seen(struct sdr_uring* ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int sdr_uring_register_buffers(struct sdr_uring* ring, const struct iovec* buffers,
+                               unsigned count) {
+    return sdr_uring_register(ring->fd, IORING_REGISTER_BUFFERS, buffers, count);
+}
+
+int sdr_uring_register_files(struct sdr_uring* ring, const int* fds, unsigned count) {
+    return sdr_uring_register(ring->fd, IORING_REGISTER_FILES, fds, count);
+}
@@ -0,0 +1,65 @@
+#ifndef SDR_URING_H
+#define SDR_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// A minimal io_uring, set up and driven with the raw system calls so the
+// servers need nothing beyond the kernel headers. Callers fill in the
+// io_uring_sqe fields themselves; this only keeps the queues.
+//
+// Not thread safe: a ring belongs to one thread, the event loop's or a
+// worker's.
+
+struct sdr_uring {
+    int fd;
+    // Submission queue, shared with the kernel
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe* sqes;
+    unsigned sq_queued;  // Our tail: entries handed out, published at submit
+    // Completion queue
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    // Mappings, for teardown
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map;
+    size_t cq_map_size;
+    size_t sqes_size;
+};
+
+// Set up a ring with at least entries submission slots and, if cq_entries is
+// not 0, that many completion slots. Returns -1 with errno set and nothing
+// printed, so callers can fall back to their other path quietly.
+int sdr_uring_init(struct sdr_uring* ring, unsigned entries, unsigned cq_entries);
+void sdr_uring_exit(struct sdr_uring* ring);
+
+// A cleared submission entry, or NULL if every slot is queued but not yet
+// submitted
+struct io_uring_sqe* sdr_uring_sqe(struct sdr_uring* ring);
+// Submit everything queued and wait for at least wait completions. Returns
+// -1 with errno set (EINTR included) on failure.
+int sdr_uring_submit(struct sdr_uring* ring, unsigned wait);
+// The oldest completion not yet seen, or NULL
+struct io_uring_cqe* sdr_uring_peek(struct sdr_uring* ring);
+// Submit anything queued, then wait for and return the oldest completion.
+// NULL only if the ring itself has failed.
+struct io_uring_cqe* sdr_uring_wait(struct sdr_uring* ring);
+// Hand the completion returned by peek or wait back to the kernel
+void sdr_uring_seen(struct sdr_uring* ring);
+
+// Registered buffers, for IORING_OP_READ_FIXED and IORING_OP_WRITE_FIXED
+int sdr_uring_register_buffers(struct sdr_uring* ring, const struct iovec* buffers,
+                               unsigned count);
+// Fixed file table; -1 leaves a slot empty for IORING_OP_FILES_UPDATE to fill
+int sdr_uring_register_files(struct sdr_uring* ring, const int* fds, unsigned count);
+
+#endif
@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_ring.h"
+
+// The tail is stored with plain atomic stores, and the other side reads the
+// header as little endian
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "shm_ring assumes a little-endian host"
+#endif
+
+#define SHM_RING_MIN_CAPACITY 4096
+#define SHM_RING_MAX_CAPACITY (1ULL << 32)
+
+unsigned int shm_ring_created = 0;  // Keeps this process's ring names apart
+
+uint64_t shm_ring_record_size(uint32_t len) {
+    return ((uint64_t)SHM_RING_RECORD_HEADER + len + 7) & ~7ULL;
+}
+
+uint64_t* shm_ring_tail_word(const struct shm_ring* ring) {
+    return (uint64_t*)(ring->map + SHM_RING_TAIL_OFFSET);
+}
+
+// Populated up front, so the first lap round the ring does not take a page
+// fault every 4 KiB in both processes
+int shm_ring_map(struct shm_ring* ring) {
+    ring->map = mmap(NULL, SHM_RING_HEADER_SIZE + ring->capacity, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring->fd, 0);
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        perror("mmap");
+        return -1;
+    }
+    return 0;
+}
+
+int shm_ring_create(struct shm_ring* ring, const char* name, uint64_t capacity) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    if (capacity > SHM_RING_MAX_CAPACITY) {
+        fprintf(stderr, "Shared memory ring of %llu bytes is too large\n",
+                (unsigned long long)capacity);
+        return -1;
+    }
+    ring->capacity = SHM_RING_MIN_CAPACITY;
+    while (ring->capacity < capacity) {
+        ring->capacity <<= 1;
+    }
+
+    snprintf(ring->path, sizeof(ring->path), "/dev/shm/sdr_%s_%d_%u", name, (int)getpid(),
+             shm_ring_created++);
+    ring->fd = open(ring->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (ring->fd == -1) {
+        perror(ring->path);
+        ring->path[0] = '\0';
+        return -1;
+    }
+    if (ftruncate(ring->fd, SHM_RING_HEADER_SIZE + ring->capacity) == -1 ||
+        shm_ring_map(ring) == -1) {
+        perror("shared memory ring");
+        shm_ring_close(ring);
+        return -1;
+    }
+
+    uint32_t magic = SHM_RING_MAGIC;
+    uint32_t version = SHM_RING_VERSION;
+    memcpy(ring->map, &magic, 4);
+    memcpy(ring->map + 4, &version, 4);
+    memcpy(ring->map + 8, &ring->capacity, 8);
+    return 0;
+}
+
+int shm_ring_open(struct shm_ring* ring, const char* path) {
+    struct stat st;
+    uint32_t magic, version;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = open(path, O_RDWR | O_CLOEXEC);
+    if (ring->fd == -1) {
+        perror(path);
+        return -1;
+    }
+    unsigned char header[16];
+    if (fstat(ring->fd, &st) == -1 || pread(ring->fd, header, sizeof(header), 0) != sizeof(header)) {
+        perror(path);
+        shm_ring_close(ring);
+        return -1;
+    }
+    memcpy(&magic, header, 4);
+    memcpy(&version, header + 4, 4);
+    memcpy(&ring->capacity, header + 8, 8);
+    if (magic != SHM_RING_MAGIC || version != SHM_RING_VERSION ||
+        (uint64_t)st.st_size != SHM_RING_HEADER_SIZE + ring->capacity) {
+        fprintf(stderr, "%s is not a shared memory ring\n", path);
+        shm_ring_close(ring);
+        return -1;
+    }
+    if (shm_ring_map(ring) == -1) {
+        shm_ring_close(ring);
+        return -1;
+    }
+    return 0;
+}
+
+void shm_ring_unlink(struct shm_ring* ring) {
+    if (ring->path[0]) {
+        unlink(ring->path);
+        ring->path[0] = '\0';
+    }
+}
+
+void shm_ring_close(struct shm_ring* ring) {
+    shm_ring_unlink(ring);
+    if (ring->map) {
+        munmap(ring->map, SHM_RING_HEADER_SIZE + ring->capacity);
+        ring->map = NULL;
+    }
+    if (ring->fd != -1) {
+        close(ring->fd);
+        ring->fd = -1;
+    }
+}
+
+int shm_ring_write(struct shm_ring* ring, const void* data, uint32_t len) {
+    uint64_t size = shm_ring_record_size(len);
+    uint64_t offset = ring->head & (ring->capacity - 1);
+    uint64_t skip = offset + size > ring->capacity ? ring->capacity - offset : 0;
+    if (skip + size > ring->capacity) {
+        return -1;
+    }
+    if (ring->head + skip + size - ring->tail > ring->capacity) {
+        // Only look at the consumer's cache line when the last tail seen is
+        // not enough
+        ring->tail = __atomic_load_n(shm_ring_tail_word(ring), __ATOMIC_ACQUIRE);
+        if (ring->head + skip + size - ring->tail > ring->capacity) {
+            return -1;
+        }
+    }
+
+    unsigned char* area = ring->map + SHM_RING_HEADER_SIZE;
+    if (skip) {
+        uint32_t wrap = SHM_RING_WRAP;
+        memcpy(area + offset, &wrap, 4);
+        offset = 0;
+    }
+    memcpy(area + offset, &len, 4);
+    memcpy(area + offset + SHM_RING_RECORD_HEADER, data, len);
+    ring->head += skip + size;
+    return 0;
+}
+
+int shm_ring_valid_head(const struct shm_ring* ring, uint64_t head) {
+    return head >= ring->tail && head - ring->tail <= ring->capacity && (head & 7) == 0;
+}
+
+int shm_ring_read(struct shm_ring* ring, uint64_t head, const unsigned char** data, uint32_t* len) {
+    const unsigned char* area = ring->map + SHM_RING_HEADER_SIZE;
+
+    while (ring->tail < head) {
+        uint64_t offset = ring->tail & (ring->capacity - 1);
+        uint32_t length;
+        memcpy(&length, area + offset, 4);
+        if (length == SHM_RING_WRAP) {
+            if (ring->tail + (ring->capacity - offset) > head) {
+                return -1;
+            }
+            ring->tail += ring->capacity - offset;
+            continue;
+        }
+        uint64_t size = shm_ring_record_size(length);
+        if (offset + size > ring->capacity || ring->tail + size > head) {
+            return -1;
+        }
+        *data = area + offset + SHM_RING_RECORD_HEADER;
+        *len = length;
+        ring->tail += size;
+        return 1;
+    }
+    return 0;
+}
+
+void shm_ring_publish_tail(struct shm_ring* ring) {
+    __atomic_store_n(shm_ring_tail_word(ring), ring->tail, __ATOMIC_RELEASE);
+}
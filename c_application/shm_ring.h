@@ -0,0 +1,70 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Single-producer single-consumer ring of variable-length records in shared
+// memory, so a client can hand frames to a server without copying them
+// through a socket. The server (the consumer) creates it as a file in
+// /dev/shm, sends the client its path over the service's socket and unlinks
+// the name once the client has rung the first doorbell.
+//
+// Layout, little endian: a 4 KiB header page, then the data area.
+//   0   magic "SDRR", u32 version, u64 capacity of the data area
+//   64  u64 tail: bytes consumed so far, advanced by the consumer
+// A record is a u32 payload length and the payload, padded to 8 bytes. One
+// that would run past the end of the data area goes at the front instead,
+// after a length of SHM_RING_WRAP where it would have started.
+//
+// The producer keeps its head to itself. After writing records it sends the
+// new head as a doorbell on the socket, so the consumer never reads a head
+// the producer is still writing, and ring records stay in order with
+// anything sent on the socket itself. The Node backend cannot map memory and
+// writes the file with pwrite(), which is why the producer's side of the
+// protocol needs nothing more than that.
+
+#define SHM_RING_MAGIC 0x52524453  // "SDRR"
+#define SHM_RING_VERSION 1
+#define SHM_RING_HEADER_SIZE 4096
+#define SHM_RING_TAIL_OFFSET 64
+#define SHM_RING_RECORD_HEADER 4
+#define SHM_RING_WRAP 0xFFFFFFFFu
+#define SHM_RING_PATH_MAX 64
+
+struct shm_ring {
+    int fd;
+    unsigned char* map;
+    uint64_t capacity;    // Data area size, a power of two
+    uint64_t head;        // Producer: where the next record goes
+    uint64_t tail;        // Consumer: the next record; producer: last tail read
+    char path[SHM_RING_PATH_MAX];  // Empty once unlinked
+};
+
+// Consumer: create a ring of at least capacity bytes at
+// /dev/shm/sdr_<name>_<pid>_<n>. Returns -1 on failure, having said why.
+int shm_ring_create(struct shm_ring* ring, const char* name, uint64_t capacity);
+// Producer: map a ring the consumer created
+int shm_ring_open(struct shm_ring* ring, const char* path);
+// Remove the name; the mapping lives on until both sides close it
+void shm_ring_unlink(struct shm_ring* ring);
+// Unmap, and unlink if that has not happened yet
+void shm_ring_close(struct shm_ring* ring);
+
+// Producer: append one record. Returns -1 when it does not fit until the
+// consumer frees more room; ring->head is then the doorbell to send.
+int shm_ring_write(struct shm_ring* ring, const void* data, uint32_t len);
+
+// Consumer: a doorbell's head is acceptable if it is ahead of the tail by no
+// more than the ring holds
+int shm_ring_valid_head(const struct shm_ring* ring, uint64_t head);
+// Consumer: take the next record before head. Returns 1 with data and len
+// set, 0 when the tail has reached head, -1 if the producer wrote a record
+// that does not fit the ring. The record stays valid until the tail is
+// published.
+int shm_ring_read(struct shm_ring* ring, uint64_t head, const unsigned char** data, uint32_t* len);
+// Consumer: hand the space taken by every record read so far back to the
+// producer
+void shm_ring_publish_tail(struct shm_ring* ring);
+
+#endif
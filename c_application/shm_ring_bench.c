@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "shm_ring.h"
+
+// Benchmark for moving frames from a client process to a server: a Unix
+// stream socket, as every client used to, against a shared memory ring with
+// doorbells on the socket, written with pwrite() as the Node backend does or
+// through the mapping as a C client would. The server side copies each frame
+// into its own buffer, as video_server does into its frame pool.
+// Reports throughput, CPU time of both processes per frame, and the round
+// trip of one frame and its acknowledgement: a byte on the socket, or the
+// new tail on the ring.
+// Usage: ./shm_ring_bench [MiB per run]
+
+#define DEFAULT_MIB 256
+#define RING_SIZE (4 * 1024 * 1024)  // video_server's default
+#define ROUND_TRIPS 200
+
+enum { VIA_SOCKET, VIA_RING_PWRITE, VIA_RING_MMAP, TRANSPORTS };
+const char* transport_names[TRANSPORTS] = {"socket", "ring+pwrite", "ring+mmap"};
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double cpu_seconds(int who) {
+    struct rusage usage;
+    getrusage(who, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+void write_all(int fd, const void* data, size_t len) {
+    const char* p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) {
+            perror("write");
+            exit(1);
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+void read_all(int fd, void* data, size_t len) {
+    char* p = data;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0) {
+            perror("read");
+            exit(1);
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+// The producer side of the ring as shm_ring.js has it: records and the wrap
+// marker go in with pwrite(), never through a mapping
+int ring_pwrite(struct shm_ring* ring, const void* data, uint32_t len) {
+    uint64_t size = ((uint64_t)SHM_RING_RECORD_HEADER + len + 7) & ~7ULL;
+    uint64_t offset = ring->head & (ring->capacity - 1);
+    uint64_t skip = offset + size > ring->capacity ? ring->capacity - offset : 0;
+    if (ring->head + skip + size - ring->tail > ring->capacity) {
+        return -1;
+    }
+    if (skip) {
+        uint32_t wrap = SHM_RING_WRAP;
+        pwrite(ring->fd, &wrap, 4, SHM_RING_HEADER_SIZE + offset);
+        offset = 0;
+    }
+    struct iovec iov[2] = {{&len, 4}, {(void*)data, len}};
+    if (pwritev(ring->fd, iov, 2, SHM_RING_HEADER_SIZE + offset) != (ssize_t)(4 + len)) {
+        perror("pwritev");
+        exit(1);
+    }
+    ring->head += skip + size;
+    return 0;
+}
+
+// Client process: send frames, and with round_trip wait for each to be
+// acknowledged and report the fastest round trip at the end. When the ring is
+// full it waits for the server to report its tail.
+void produce(int transport, int sock, const char* path, size_t frame_size, long frames,
+             int round_trip) {
+    unsigned char* frame = malloc(frame_size);
+    struct shm_ring ring;
+    double best_trip = 1e30;
+    memset(frame, 0x5A, frame_size);
+    if (transport != VIA_SOCKET && shm_ring_open(&ring, path) == -1) {
+        exit(1);
+    }
+
+    for (long n = 0; n < frames; n++) {
+        double start = now_seconds();
+        if (transport == VIA_SOCKET) {
+            uint32_t len = frame_size;
+            write_all(sock, &len, 4);
+            write_all(sock, frame, frame_size);
+        } else {
+            while ((transport == VIA_RING_PWRITE ? ring_pwrite(&ring, frame, frame_size)
+                                                 : shm_ring_write(&ring, frame, frame_size)) == -1) {
+                read_all(sock, &ring.tail, 8);
+            }
+            write_all(sock, &ring.head, 8);
+            if (round_trip) {
+                read_all(sock, &ring.tail, 8);
+            }
+            // Take any tails already reported without waiting for more
+            uint64_t tail;
+            while (!round_trip && recv(sock, &tail, 8, MSG_DONTWAIT) == 8) {
+                ring.tail = tail;
+            }
+        }
+        if (round_trip) {
+            if (transport == VIA_SOCKET) {
+                char answer;
+                read_all(sock, &answer, 1);
+            }
+            double trip = now_seconds() - start;
+            best_trip = trip < best_trip ? trip : best_trip;
+        }
+    }
+    if (round_trip) {
+        write_all(sock, &best_trip, sizeof(best_trip));
+    }
+    if (transport != VIA_SOCKET) {
+        shm_ring_close(&ring);
+    }
+    free(frame);
+}
+
+// Server process: take every frame into buffer. Returns the client's best
+// round trip if it was timing them.
+double consume(int transport, int sock, struct shm_ring* ring, unsigned char* buffer,
+               long frames, int round_trip) {
+    long got = 0;
+    while (got < frames) {
+        if (transport == VIA_SOCKET) {
+            uint32_t len;
+            read_all(sock, &len, 4);
+            read_all(sock, buffer, len);
+            got++;
+        } else {
+            uint64_t head;
+            const unsigned char* data;
+            uint32_t len;
+            read_all(sock, &head, 8);
+            shm_ring_unlink(ring);  // The client has it open by now
+            while (shm_ring_read(ring, head, &data, &len) == 1) {
+                memcpy(buffer, data, len);
+                got++;
+            }
+            shm_ring_publish_tail(ring);
+            // The client may be gone once it has sent the last frame
+            send(sock, &ring->tail, 8, MSG_NOSIGNAL);
+        }
+        if (round_trip && transport == VIA_SOCKET) {
+            write_all(sock, "", 1);
+        }
+    }
+    double best_trip = 0;
+    if (round_trip) {
+        read_all(sock, &best_trip, sizeof(best_trip));
+    }
+    return best_trip;
+}
+
+// Run one transport and frame size: wall seconds and CPU seconds of both
+// processes, or with round_trip the fastest round trip
+void run(int transport, size_t frame_size, long frames, int round_trip, double* wall, double* cpu,
+         double* trip) {
+    int socks[2];
+    struct shm_ring ring;
+    unsigned char* buffer = malloc(frame_size);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == -1) {
+        perror("socketpair");
+        exit(1);
+    }
+    if (transport != VIA_SOCKET && shm_ring_create(&ring, "bench", RING_SIZE) == -1) {
+        exit(1);
+    }
+
+    double cpu_start = cpu_seconds(RUSAGE_SELF) + cpu_seconds(RUSAGE_CHILDREN);
+    double start = now_seconds();
+    pid_t child = fork();
+    if (child == 0) {
+        close(socks[0]);
+        produce(transport, socks[1], transport != VIA_SOCKET ? ring.path : NULL, frame_size,
+                frames, round_trip);
+        _exit(0);
+    }
+    close(socks[1]);
+    *trip = consume(transport, socks[0], &ring, buffer, frames, round_trip);
+    waitpid(child, NULL, 0);
+    *wall = now_seconds() - start;
+    *cpu = cpu_seconds(RUSAGE_SELF) + cpu_seconds(RUSAGE_CHILDREN) - cpu_start;
+
+    if (transport != VIA_SOCKET) {
+        shm_ring_close(&ring);
+    }
+    close(socks[0]);
+    free(buffer);
+}
+
+int main(int argc, char* argv[]) {
+    long mib = argc > 1 ? atol(argv[1]) : DEFAULT_MIB;
+    if (mib < 1) {
+        fprintf(stderr, "Usage: %s [MiB per run]\n", argv[0]);
+        exit(1);
+    }
+
+    // A 100 ms call frame, then video frames from small to the largest
+    // video_server pools
+    size_t sizes[] = {1607, 64 * 1024, 1024 * 1024, 4 * 1024 * 1024};
+    int size_count = sizeof(sizes) / sizeof(sizes[0]);
+
+    printf("%ld MiB per run; round trip is one frame and its acknowledgement, best of %d\n",
+           mib, ROUND_TRIPS);
+    printf("%-12s %10s %10s %14s %14s\n", "transport", "frame", "MiB/s", "CPU us/frame",
+           "round trip us");
+    for (int s = 0; s < size_count; s++) {
+        long frames = mib * 1024 * 1024 / sizes[s];
+        for (int t = 0; t < TRANSPORTS; t++) {
+            double wall, cpu, trip, unused;
+            run(t, sizes[s], frames, 0, &wall, &cpu, &unused);
+            run(t, sizes[s], ROUND_TRIPS, 1, &unused, &unused, &trip);
+            printf("%-12s %10zu %10.0f %14.1f %14.1f\n", transport_names[t], sizes[s],
+                   mib / wall, cpu * 1e6 / frames, trip * 1e6);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include <string.h>
+#include "topology.h"
+
+int topology_link_valid(int a, int b) {
+    return a >= 0 && a < TOPOLOGY_NODES && b >= 0 && b < TOPOLOGY_NODES && a != b;
+}
+
+void topology_init(struct topology* topology, int self) {
+    memset(topology, 0, sizeof(*topology));
+    topology->self = self;
+    topology_recompute(topology);
+    topology->recomputes = 0;
+}
+
+void topology_recompute(struct topology* topology) {
+    int self = topology->self;
+    struct node_set visited = {{0, 0}};
+    struct node_set frontier = {{0, 0}};
+
+    memset(topology->next_hop, TOPOLOGY_NO_ROUTE, sizeof(topology->next_hop));
+    memset(topology->hops, TOPOLOGY_NO_ROUTE, sizeof(topology->hops));
+    memset(topology->parent, TOPOLOGY_NO_ROUTE, sizeof(topology->parent));
+    topology->next_hop[self] = self;
+    topology->hops[self] = 0;
+    topology->parent[self] = self;
+    node_set_add(&visited, self);
+    node_set_add(&frontier, self);
+
+    for (int level = 1; frontier.bits[0] | frontier.bits[1]; level++) {
+        // Everything one hop from the frontier that has not been seen yet
+        struct node_set next = {{0, 0}};
+        for (int w = 0; w < 2; w++) {
+            for (uint64_t word = frontier.bits[w]; word; word &= word - 1) {
+                int u = w * 64 + __builtin_ctzll(word);
+                next.bits[0] |= topology->neighbors[u].bits[0];
+                next.bits[1] |= topology->neighbors[u].bits[1];
+            }
+        }
+        next.bits[0] &= ~visited.bits[0];
+        next.bits[1] &= ~visited.bits[1];
+
+        for (int w = 0; w < 2; w++) {
+            for (uint64_t word = next.bits[w]; word; word &= word - 1) {
+                int v = w * 64 + __builtin_ctzll(word);
+                topology->hops[v] = level;
+                if (level == 1) {
+                    topology->parent[v] = self;
+                    topology->next_hop[v] = v;
+                    continue;
+                }
+                // Any frontier neighbor is a shortest way in; take the lowest
+                uint64_t low = topology->neighbors[v].bits[0] & frontier.bits[0];
+                int p = low ? __builtin_ctzll(low)
+                            : 64 + __builtin_ctzll(topology->neighbors[v].bits[1] & frontier.bits[1]);
+                topology->parent[v] = p;
+                topology->next_hop[v] = topology->next_hop[p];
+            }
+        }
+        visited.bits[0] |= next.bits[0];
+        visited.bits[1] |= next.bits[1];
+        frontier = next;
+    }
+    topology->recomputes++;
+}
+
+// Add or drop the link without searching. Returns whether the routes need
+// a search now, judged against the routes as they stand.
+int topology_add_link(struct topology* topology, int a, int b) {
+    if (node_set_has(&topology->neighbors[a], b)) {
+        return 0;
+    }
+    node_set_add(&topology->neighbors[a], b);
+    node_set_add(&topology->neighbors[b], a);
+    node_set_add(&topology->seen, a);
+    node_set_add(&topology->seen, b);
+    topology->changes++;
+    topology->known = 1;
+
+    int ha = topology->hops[a];
+    int hb = topology->hops[b];
+    if (ha == TOPOLOGY_NO_ROUTE && hb == TOPOLOGY_NO_ROUTE) {
+        return 0;  // Joins two parts this node cannot reach
+    }
+    if (ha == TOPOLOGY_NO_ROUTE || hb == TOPOLOGY_NO_ROUTE) {
+        return 1;  // Brings a part into reach
+    }
+    // A shortcut only if it skips at least one hop
+    return ha - hb > 1 || hb - ha > 1;
+}
+
+int topology_remove_link(struct topology* topology, int a, int b) {
+    if (!node_set_has(&topology->neighbors[a], b)) {
+        return 0;
+    }
+    node_set_remove(&topology->neighbors[a], b);
+    node_set_remove(&topology->neighbors[b], a);
+    topology->changes++;
+
+    // Only links on the shortest-path tree carry any route
+    return (topology->parent[b] == a && topology->hops[b] != TOPOLOGY_NO_ROUTE) ||
+           (topology->parent[a] == b && topology->hops[a] != TOPOLOGY_NO_ROUTE);
+}
+
+int topology_link_up(struct topology* topology, int a, int b) {
+    if (!topology_link_valid(a, b)) {
+        return -1;
+    }
+    if (topology_add_link(topology, a, b)) {
+        topology_recompute(topology);
+        return 1;
+    }
+    return 0;
+}
+
+int topology_link_down(struct topology* topology, int a, int b) {
+    if (!topology_link_valid(a, b)) {
+        return -1;
+    }
+    if (topology_remove_link(topology, a, b)) {
+        topology_recompute(topology);
+        return 1;
+    }
+    return 0;
+}
+
+int topology_set_neighbors(struct topology* topology, int node, const struct node_set* neighbors) {
+    if (node < 0 || node >= TOPOLOGY_NODES) {
+        return -1;
+    }
+    // Once one change needs a search the rest cannot make it unnecessary;
+    // until then the routes are still right, so each change is judged on them
+    int stale = 0;
+    for (int v = 0; v < TOPOLOGY_NODES; v++) {
+        if (v == node) {
+            continue;
+        }
+        int wanted = node_set_has(neighbors, v);
+        if (wanted == node_set_has(&topology->neighbors[node], v)) {
+            continue;
+        }
+        int needs = wanted ? topology_add_link(topology, node, v) : topology_remove_link(topology, node, v);
+        stale = stale || needs;
+    }
+    node_set_add(&topology->seen, node);
+    topology->known = 1;
+    if (stale) {
+        topology_recompute(topology);
+        return 1;
+    }
+    return 0;
+}
+
+int topology_next_hop(const struct topology* topology, int destination) {
+    if (destination < 0 || destination >= TOPOLOGY_NODES) {
+        return -1;
+    }
+    if (!topology->known) {
+        return destination;
+    }
+    if (topology->hops[destination] == TOPOLOGY_NO_ROUTE) {
+        return -1;
+    }
+    return topology->next_hop[destination];
+}
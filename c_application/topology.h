@@ -0,0 +1,68 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stdint.h>
+
+// Neighbor table and routes for the 128-node MANET. Each node's neighbors
+// are a 128-bit set, so the whole table is 2 KiB, and routes from this node
+// come from a breadth-first search that expands a whole level at a time by
+// OR-ing neighbor sets: a few hundred word operations for the full network.
+//
+// Links are symmetric and every hop costs the same, so shortest paths are
+// fewest hops. A change only triggers a search if it can change one: a link
+// that comes up between nodes already at the same or adjacent distances, or
+// goes down off the shortest-path tree, leaves every route as it was.
+//
+// Not thread safe; msg_server uses it from the event loop.
+
+#define TOPOLOGY_NODES 128
+#define TOPOLOGY_NO_ROUTE 0xFF
+
+struct node_set {
+    uint64_t bits[2];
+};
+
+struct topology {
+    int self;
+    struct node_set neighbors[TOPOLOGY_NODES];
+    // Routes from self: the first hop and the hop count to each node, and
+    // the node before it on the path. TOPOLOGY_NO_ROUTE where unreachable.
+    uint8_t next_hop[TOPOLOGY_NODES];
+    uint8_t hops[TOPOLOGY_NODES];
+    uint8_t parent[TOPOLOGY_NODES];
+    int known;  // Any link was ever reported
+    struct node_set seen;  // Every node ever reported, by itself or as a neighbor
+    uint64_t changes;     // Links that came up or went down
+    uint64_t recomputes;  // Searches those changes needed
+};
+
+void topology_init(struct topology* topology, int self);
+
+// Returns 1 if routes were recomputed, 0 if the change could not affect them,
+// -1 if a node is out of range
+int topology_link_up(struct topology* topology, int a, int b);
+int topology_link_down(struct topology* topology, int a, int b);
+// Replace everything known about node's links with neighbors, as a HELLO
+// from it would. Same return values; at most one search for the lot.
+int topology_set_neighbors(struct topology* topology, int node, const struct node_set* neighbors);
+
+// The neighbor to hand traffic for destination to, or -1 if there is no
+// route. Until any link has been reported every node counts as a neighbor.
+int topology_next_hop(const struct topology* topology, int destination);
+
+// The search itself, for topology_bench
+void topology_recompute(struct topology* topology);
+
+static inline int node_set_has(const struct node_set* set, int node) {
+    return (set->bits[node >> 6] >> (node & 63)) & 1;
+}
+
+static inline void node_set_add(struct node_set* set, int node) {
+    set->bits[node >> 6] |= 1ULL << (node & 63);
+}
+
+static inline void node_set_remove(struct node_set* set, int node) {
+    set->bits[node >> 6] &= ~(1ULL << (node & 63));
+}
+
+#endif
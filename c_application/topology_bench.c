@@ -0,0 +1,257 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "topology.h"
+
+// Route churn under node mobility: 128 nodes move about a square by random
+// waypoint, links come and go as they pass in and out of radio range, and
+// every change goes to the topology table as it would from a HELLO. Each
+// change is timed with the search it needed, if any, and the same churn is
+// run again with a full search after every change to compare.
+// Usage: ./topology_bench [steps] [range]
+
+#define AREA 1000.0        // Side of the square, in metres
+#define DEFAULT_RANGE 150  // About 9 neighbors each on average
+#define DEFAULT_STEPS 2000 // One second each
+#define MAX_SPEED 20.0     // Metres per second
+#define VERIFY_EVERY 50    // Steps between checks against a plain search
+
+struct node {
+    double x, y;
+    double to_x, to_y;
+    double speed;
+};
+
+struct node nodes[TOPOLOGY_NODES];
+unsigned char linked[TOPOLOGY_NODES][TOPOLOGY_NODES];
+uint32_t* samples;
+size_t sample_count;
+size_t sample_cap;
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+double uniform(double limit) {
+    return rand() / (RAND_MAX + 1.0) * limit;
+}
+
+void pick_waypoint(struct node* n) {
+    n->to_x = uniform(AREA);
+    n->to_y = uniform(AREA);
+    n->speed = 1.0 + uniform(MAX_SPEED - 1.0);
+}
+
+void place_nodes(void) {
+    srand(1);
+    for (int i = 0; i < TOPOLOGY_NODES; i++) {
+        nodes[i].x = uniform(AREA);
+        nodes[i].y = uniform(AREA);
+        pick_waypoint(&nodes[i]);
+    }
+    memset(linked, 0, sizeof(linked));
+}
+
+void move_nodes(void) {
+    for (int i = 0; i < TOPOLOGY_NODES; i++) {
+        struct node* n = &nodes[i];
+        double dx = n->to_x - n->x;
+        double dy = n->to_y - n->y;
+        double left = sqrt(dx * dx + dy * dy);
+        if (left <= n->speed) {
+            n->x = n->to_x;
+            n->y = n->to_y;
+            pick_waypoint(n);
+        } else {
+            n->x += dx / left * n->speed;
+            n->y += dy / left * n->speed;
+        }
+    }
+}
+
+void add_sample(uint64_t ns) {
+    if (sample_count == sample_cap) {
+        sample_cap = sample_cap ? sample_cap * 2 : 65536;
+        samples = realloc(samples, sample_cap * sizeof(*samples));
+        if (!samples) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    samples[sample_count++] = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+}
+
+int compare_samples(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Hop counts from source one node at a time, to check the bitset search
+void plain_search(int source, int* hops) {
+    int queue[TOPOLOGY_NODES];
+    int head = 0, tail = 0;
+    for (int i = 0; i < TOPOLOGY_NODES; i++) {
+        hops[i] = -1;
+    }
+    hops[source] = 0;
+    queue[tail++] = source;
+    while (head < tail) {
+        int u = queue[head++];
+        for (int v = 0; v < TOPOLOGY_NODES; v++) {
+            if (linked[u][v] && hops[v] == -1) {
+                hops[v] = hops[u] + 1;
+                queue[tail++] = v;
+            }
+        }
+    }
+}
+
+// Every route must be as short as a plain search says, and its first hop a
+// neighbor that really is one hop closer
+int verify(const struct topology* topology) {
+    int hops[TOPOLOGY_NODES];
+    int from_hop[TOPOLOGY_NODES];
+    plain_search(topology->self, hops);
+    for (int d = 0; d < TOPOLOGY_NODES; d++) {
+        int expected = hops[d] == -1 ? TOPOLOGY_NO_ROUTE : hops[d];
+        if (topology->hops[d] != expected) {
+            fprintf(stderr, "node %d: %d hops, expected %d\n", d, topology->hops[d], expected);
+            return -1;
+        }
+        if (hops[d] <= 0) {
+            continue;
+        }
+        int first = topology_next_hop(topology, d);
+        if (first < 0 || !linked[topology->self][first]) {
+            fprintf(stderr, "node %d: first hop %d is not a neighbor\n", d, first);
+            return -1;
+        }
+        plain_search(first, from_hop);
+        if (from_hop[d] != hops[d] - 1) {
+            fprintf(stderr, "node %d: first hop %d is not on a shortest path\n", d, first);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Runs the churn; full searches after every change instead of only when one
+// can matter if full is set. Returns -1 if a route came out wrong.
+int run(int steps, double range, int full, uint64_t* searches) {
+    struct topology topology;
+    topology_init(&topology, 0);
+    place_nodes();
+    sample_count = 0;
+
+    for (int step = 0; step < steps; step++) {
+        move_nodes();
+        for (int a = 0; a < TOPOLOGY_NODES; a++) {
+            for (int b = a + 1; b < TOPOLOGY_NODES; b++) {
+                double dx = nodes[a].x - nodes[b].x;
+                double dy = nodes[a].y - nodes[b].y;
+                int in_range = dx * dx + dy * dy <= range * range;
+                if (in_range == linked[a][b]) {
+                    continue;
+                }
+                linked[a][b] = linked[b][a] = in_range;
+
+                uint64_t start = now_ns();
+                if (full) {
+                    if (in_range) {
+                        node_set_add(&topology.neighbors[a], b);
+                        node_set_add(&topology.neighbors[b], a);
+                    } else {
+                        node_set_remove(&topology.neighbors[a], b);
+                        node_set_remove(&topology.neighbors[b], a);
+                    }
+                    topology_recompute(&topology);
+                } else if (in_range) {
+                    topology_link_up(&topology, a, b);
+                } else {
+                    topology_link_down(&topology, a, b);
+                }
+                add_sample(now_ns() - start);
+            }
+        }
+        if (!full && step % VERIFY_EVERY == 0 && verify(&topology) == -1) {
+            return -1;
+        }
+    }
+    if (!full && verify(&topology) == -1) {
+        return -1;
+    }
+    *searches = topology.recomputes;
+    return 0;
+}
+
+void report(const char* label, uint64_t searches) {
+    double total = 0;
+    for (size_t i = 0; i < sample_count; i++) {
+        total += samples[i];
+    }
+    qsort(samples, sample_count, sizeof(*samples), compare_samples);
+    printf("%-12s %9zu %9llu %9.0f %9u %9u %9u\n", label, sample_count, (unsigned long long)searches,
+           total / sample_count, samples[sample_count / 2], samples[sample_count * 99 / 100],
+           samples[sample_count - 1]);
+}
+
+int main(int argc, char* argv[]) {
+    int steps = argc > 1 ? atoi(argv[1]) : DEFAULT_STEPS;
+    double range = argc > 2 ? atof(argv[2]) : DEFAULT_RANGE;
+    uint64_t searches = 0;
+
+    if (steps <= 0 || range <= 0) {
+        fprintf(stderr, "Usage: %s [steps] [range]\n", argv[0]);
+        return 1;
+    }
+
+    // One search over the network as it stands at the end of a run
+    struct topology topology;
+    topology_init(&topology, 0);
+    place_nodes();
+    for (int step = 0; step < steps; step++) {
+        move_nodes();
+    }
+    int links = 0;
+    for (int a = 0; a < TOPOLOGY_NODES; a++) {
+        for (int b = a + 1; b < TOPOLOGY_NODES; b++) {
+            double dx = nodes[a].x - nodes[b].x;
+            double dy = nodes[a].y - nodes[b].y;
+            if (dx * dx + dy * dy <= range * range) {
+                topology_link_up(&topology, a, b);
+                links++;
+            }
+        }
+    }
+    int reachable = 0;
+    for (int d = 0; d < TOPOLOGY_NODES; d++) {
+        reachable += topology.hops[d] != TOPOLOGY_NO_ROUTE;
+    }
+    int rounds = 100000;
+    uint64_t start = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        topology_recompute(&topology);
+        __asm__ __volatile__("" : : "r"(&topology) : "memory");
+    }
+    printf("%d nodes, %d links, %d reachable from node 0; one search %.0f ns\n\n", TOPOLOGY_NODES,
+           links, reachable, (double)(now_ns() - start) / rounds);
+
+    printf("%d steps of random waypoint mobility, range %.0f m in %.0f m square\n", steps, range, AREA);
+    printf("%-12s %9s %9s %9s %9s %9s %9s\n", "", "changes", "searches", "mean ns", "p50 ns", "p99 ns",
+           "max ns");
+    if (run(steps, range, 0, &searches) == -1) {
+        fprintf(stderr, "routes wrong\n");
+        return 1;
+    }
+    report("incremental", searches);
+    run(steps, range, 1, &searches);
+    report("full", searches);
+    free(samples);
+    return 0;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,11 +12,51 @@
 #include <arpa/inet.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <time.h>
+#include "sdr_loop.h"
+#include "shm_ring.h"
 
 #define SOCKET_PATH "/tmp/video_socket"
 #define PIPE_PATH "/tmp/video_pipe"
-#define WEBM_FILE "/tmp/video_stream.webm"
-#define BUFFER_SIZE 1048576  // 1MB buffer for video data
+#define WEBM_FILE "/tmp/video_stream.webm"          // Recording of stream 0
+#define WEBM_STREAM_FILE "/tmp/video_stream_%u.webm"  // ... and of any other stream
+#define FRAME_CLASSES 5        // Pooled frame sizes: 16K, 64K, 256K, 1M, 4M
+#define MIN_FRAME_CLASS_SHIFT 14
+#define FRAME_POOL_PREALLOC 8  // Frames per class allocated at startup
+#define FRAME_POOL_RETAIN 64   // Idle frames kept per class before freeing
+#define DEFAULT_MAX_FRAME_SIZE (16 * 1024 * 1024)
+#define DEFAULT_RING_DEPTH 64  // Frames queued between receive and disk
+#define MAX_RING_DEPTH 4096
+#define WRITE_BATCH 64         // Frames per writev(), well under IOV_MAX
+#define STATS_INTERVAL 5       // Seconds between stream statistics lines
+#define DEFAULT_LIVE_PORT 8090
+#define LIVE_PATH "/live.webm"           // Stream 0, as before sessions had IDs
+#define LIVE_STREAM_PATH "/live/%u.webm"
+#define SESSION_MAGIC "\xFFVSH"           // Never a plausible legacy frame length
+#define SESSION_HEADER_SIZE 8            // Magic, version, flags, stream ID
+#define SESSION_VERSION 1
+#define SESSION_FLAG_SHM_RING 0x01       // Client would rather send frames through shared memory
+#define SESSION_REPLY_SIZE (SESSION_HEADER_SIZE + SHM_RING_PATH_MAX)
+#define RING_DOORBELL "\xFF\xFF\xFF\xFF"  // In place of a frame length: frames are in the ring
+#define DOORBELL_SIZE 12                 // Marker, then the ring's head (u64 big endian)
+#define DEFAULT_SHM_RING_SIZE (4 * 1024 * 1024)  // Small enough to stay in cache
+#define MAX_STREAMS 256        // Stream IDs with a live window, kept for the process lifetime
+#define MAX_SESSIONS 256       // Connected clients, including ones yet to send a header
+#define SESSION_READ_BUDGET 16 // Frames read from one client before servicing the others
+#define LIVE_MAX_FRAMES 1024   // Recent frames kept in memory for viewers
+#define DEFAULT_LIVE_WINDOW (16 * 1024 * 1024)
+#define MAX_INIT_SEGMENT (1024 * 1024)
+#define LIVE_MAX_LAG_BYTES (2 * 1024 * 1024)  // Viewers further behind skip ahead
+#define EBML_MAX_DEPTH 8
+#define CLUSTER_INDEX_SIZE 256
+#define SUBSCRIBER_QUEUE 32    // Chunks queued per viewer, sent with one writev()
+#define MAX_REQUEST_SIZE 2048
+#define MAX_EVENTS 64
 
 // Colors for output
 #define RED     "\x1b[31m"
@@ -24,8 +65,257 @@
 #define BLUE    "\x1b[34m"
 #define RESET   "\x1b[0m"
 
-volatile int running = 1;
-FILE* webm_file = NULL;
+int video_server_fd = -1;
+struct sdr_handler video_listener;
+uint64_t video_sessions_accepted = 0;
+uint64_t video_frames_received = 0;
+uint64_t video_ring_frames = 0;
+struct sdr_counter video_bytes_recorded;  // Added to by every writer thread
+struct sdr_histogram* video_accept_time;
+struct sdr_histogram* video_recv_time;
+struct sdr_histogram* video_parse_time;  // A frame through recording and live fan-out
+struct sdr_histogram* video_write_time;  // One batch to disk
+unsigned int ring_depth = DEFAULT_RING_DEPTH;
+int record_to_disk = 0;  // --record: also write each stream to disk
+int live_port = DEFAULT_LIVE_PORT;
+size_t max_frame_size = DEFAULT_MAX_FRAME_SIZE;  // --max-frame-size
+size_t live_window = DEFAULT_LIVE_WINDOW;        // --live-window, per stream
+size_t shm_ring_size = DEFAULT_SHM_RING_SIZE;    // --shm-ring-size, per session; 0 for none
+
+// One received frame. It is shared read-only by the disk writer and every
+// viewer, and goes back to the pool when the last of them drops its reference.
+struct frame {
+    int refs;
+    int size_class;            // -1 for frames too big for any pool class
+    size_t len;
+    uint64_t stream_offset;    // Position of data[0] in the session's stream
+    struct frame* next_free;
+    char data[];
+};
+
+// Recycled frames of one size. Only the receive thread allocates, while any
+// thread may release, so a Treiber stack with a single popper is safe from
+// ABA: nobody else can remove the top between its load and its CAS.
+struct frame_class {
+    size_t capacity;
+    struct frame* free_list;
+    int idle;                  // Frames on free_list (approximate)
+    uint64_t reused;
+    uint64_t allocated;        // Pool misses that went to malloc
+};
+
+struct frame_class frame_pool[FRAME_CLASSES];
+uint64_t large_frames = 0;
+
+// Single-producer/single-consumer ring of frames between the receive thread
+// and the writer thread, so a slow disk never pushes back on the socket.
+// When the ring is full the producer drops the oldest queued frame. Both
+// sides therefore claim frames by advancing head with a CAS; a stale claim
+// simply fails and is retried, and neither side ever takes a lock.
+struct frame_ring {
+    struct frame** slots;
+    unsigned int depth;
+    uint64_t head;             // Next frame to write; CAS by both sides
+    uint64_t tail;             // Next free slot; producer only
+    int closed;                // Producer finished; drain and exit
+    int writer_sleeping;       // Writer is (about to be) blocked on wakeup_fd
+    int wakeup_fd;             // eventfd the producer kicks when the writer sleeps
+
+    // Statistics. Producer side:
+    uint64_t frames_queued;
+    uint64_t frames_dropped;
+    uint64_t high_water;       // Most frames ever waiting at once
+    // Writer side:
+    uint64_t frames_written;
+    uint64_t bytes_written;
+    int write_failed;
+};
+
+// Disk writer for one client session. The writer thread owns it once the
+// session closes the ring: it drains, reports and frees it without making the
+// receive loop wait on the disk.
+struct stream_writer {
+    struct frame_ring ring;
+    int fd;
+    unsigned int stream_id;
+    pthread_t thread;
+};
+
+// Matroska/WebM element IDs the live path cares about
+#define EBML_ID_HEADER 0x1A45DFA3
+#define MKV_ID_SEGMENT 0x18538067
+#define MKV_ID_SEEK_HEAD 0x114D9B74
+#define MKV_ID_INFO 0x1549A966
+#define MKV_ID_TIMECODE_SCALE 0x2AD7B1
+#define MKV_ID_TRACKS 0x1654AE6B
+#define MKV_ID_CUES 0x1C53BB6B
+#define MKV_ID_TAGS 0x1254C367
+#define MKV_ID_CHAPTERS 0x1043A770
+#define MKV_ID_ATTACHMENTS 0x1941A469
+#define MKV_ID_CLUSTER 0x1F43B675
+#define MKV_ID_CLUSTER_TIMECODE 0xE7
+#define MKV_ID_SIMPLE_BLOCK 0xA3
+#define MKV_ID_BLOCK_GROUP 0xA0
+#define MKV_ID_BLOCK 0xA1
+#define MKV_ID_REFERENCE_BLOCK 0xFB
+#define EBML_UNKNOWN_SIZE UINT64_MAX
+
+enum webm_state {
+    WEBM_ID,                   // Reading an element ID
+    WEBM_SIZE,                 // Reading its size
+    WEBM_VALUE,                // Collecting the first bytes of a body we decode
+    WEBM_SKIP,                 // Passing over the rest of a body
+    WEBM_ERROR                 // Not WebM, or an element we cannot step over
+};
+
+struct ebml_level {
+    uint32_t id;
+    uint64_t end;              // Stream offset where it ends, or EBML_UNKNOWN_SIZE
+};
+
+// Incremental EBML reader. It is fed the stream in whatever pieces arrive,
+// keeps only the few header bytes it is decoding, and never allocates.
+struct webm_parser {
+    enum webm_state state;
+    uint64_t offset;           // Stream bytes consumed so far
+    uint64_t element_start;    // Offset of the current element's ID
+    uint32_t id;
+    uint64_t size;
+    int size_all_ones;
+    int need;                  // Bytes still to read for the ID or size
+    unsigned char value[8];
+    int value_len;
+    int value_need;
+    uint64_t remaining;        // Body bytes left to skip
+    struct ebml_level stack[EBML_MAX_DEPTH];
+    int depth;
+    uint64_t timecode_scale;   // Nanoseconds per timecode tick
+    int group_has_reference;   // Current BlockGroup depends on another frame
+};
+
+// What the parser learned about one Cluster
+struct cluster_entry {
+    uint64_t offset;           // Stream offset of the Cluster ID
+    uint64_t bytes;            // Set once the next Cluster starts
+    int64_t timecode_ms;       // -1 until the Timecode element is seen
+    int keyframe;              // First block is a keyframe: viewers can start here
+    int blocks;
+    uint64_t arrival_ns;       // When its first byte arrived
+};
+
+// Recent clusters of the current stream, owned by the receive thread
+struct cluster_index {
+    struct cluster_entry entries[CLUSTER_INDEX_SIZE];
+    uint64_t count;            // Clusters seen; entries[(count - 1) % SIZE] is newest
+    uint64_t keyframe_clusters;
+    int have_first_cluster;
+    uint64_t first_cluster_offset;  // End of the init segment
+    int have_keyframe;
+    uint64_t keyframe_offset;  // Latest Cluster that starts with a keyframe
+    int have_base;
+    int64_t base_timecode_ms;  // First timecode and its arrival time, the
+    uint64_t base_arrival_ns;  // reference for arrival lag
+    // Figures for the last complete cluster
+    uint64_t last_bytes;
+    int64_t last_duration_ms;
+    int64_t last_lag_ms;       // Arrived this much later than its timecode implies
+};
+
+// One stream as viewers see it: the WebM init segment (everything before the
+// first Cluster) followed by a bounded window of recent frames. The receive
+// thread appends under the lock; the fan-out thread copies out frame
+// references under the lock and sends without it.
+struct live_stream {
+    pthread_mutex_t lock;
+    unsigned int id;           // Stream ID from the session header
+    uint64_t session;          // Bumped for every new client session
+    int active;                // A client is currently streaming
+    struct frame* init;        // NULL until the first Cluster has been seen
+    struct frame* frames[LIVE_MAX_FRAMES];
+    uint64_t first_seq;        // Sequence number of frames[first_seq % LIVE_MAX_FRAMES]
+    uint64_t next_seq;
+    uint64_t next_offset;      // Stream offset just past the newest frame
+    size_t bytes;
+    uint64_t join_seq;         // Latest Cluster start; where new viewers begin
+    size_t join_offset;
+    int have_join;             // Set once a Cluster starting with a keyframe is seen
+    int viewers;               // Connected HTTP clients, for stats
+
+    // Receive thread only: the init segment being assembled and the parse of
+    // the current session's stream
+    struct frame* init_pending;
+    struct webm_parser parser;
+    struct cluster_index clusters;
+    int disabled;              // Stream is not WebM; viewers get nothing
+    struct video_session* owner;  // Session currently feeding this stream
+    pid_t player;              // VLC started for this stream, 0 if none
+};
+
+// One connected client. Frames are read without blocking as they arrive, so
+// a slow or stalled client never holds up the others.
+struct video_session {
+    struct sdr_handler handler;
+    int fd;
+    int closed;                // Ended during this epoll batch; freed after it
+    struct live_stream* stream;  // NULL until the session header is read
+    unsigned char header[DOORBELL_SIZE];  // Session header, frame length or doorbell
+    size_t header_len;
+    struct shm_ring ring;      // Frames from the client, if it asked for a ring
+    int ring_open;
+    struct frame* frame;       // Frame being received
+    size_t frame_got;
+    uint64_t frames_received;
+    time_t last_stats;
+    struct stream_writer* recorder;
+    struct video_session* next;
+};
+
+// One queued piece of a viewer's response: a slice of a shared frame, or a
+// static string such as the HTTP header. Sliced frames go out as HTTP chunks.
+struct out_chunk {
+    struct frame* frame;
+    const char* data;
+    size_t len;
+    char head[20];             // "<hex length>\r\n" when chunked
+    int head_len;
+    int trailer;               // Append "\r\n" after the data
+};
+
+// An HTTP viewer, owned by the fan-out thread
+struct subscriber {
+    int fd;
+    int streaming;             // Request parsed and response started
+    int chunked;               // HTTP/1.1 chunked transfer encoding
+    int finished;              // Final chunk queued; close once sent
+    int closed;                // Retired; freed once the event batch is through
+    char request[MAX_REQUEST_SIZE];
+    size_t request_len;
+    uint64_t session;
+    uint64_t seq;              // Next frame to queue
+    size_t offset;             // ... and where in it to start
+    struct live_stream* stream;  // NULL for requests that get a 404
+    struct out_chunk queue[SUBSCRIBER_QUEUE];
+    int queue_head;
+    int queue_count;
+    size_t sent;               // Bytes of the first queued chunk already sent
+    struct subscriber* next;
+};
+
+// Streams are created on first use by a client or a viewer and never freed,
+// so both threads can hold on to them without reference counts
+struct live_stream* streams[MAX_STREAMS];
+int stream_count = 0;
+pthread_mutex_t streams_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct video_session* sessions = NULL;
+struct video_session* retired_sessions = NULL;
+int session_count = 0;
+int recorders_running = 0;     // Writer threads still draining to disk
+
+int live_wakeup_fd = -1;       // Tells the fan-out thread there is new data
+struct subscriber* subscribers = NULL;
+struct subscriber* retired_subscribers = NULL;
+int live_listen_fd = -1;
 
 void print_info(const char* message) {
     printf(BLUE "[INFO]" RESET " %s\n", message);
@@ -42,228 +332,1742 @@ void print_success(const char* message) {
     fflush(stdout);
 }
 
-void signal_handler(int sig) {
-    if (sig == SIGINT || sig == SIGTERM) {
-        print_info("Received shutdown signal");
-        running = 0;
-        if (webm_file) {
-            fclose(webm_file);
-            webm_file = NULL;
-        }
-        // Kill any running VLC processes
-        system("pkill -f 'vlc.*video_stream.webm'");
+// Path viewers use for a stream; stream 0 keeps the original URL
+void live_stream_path(unsigned int id, char* path, size_t size) {
+    if (id == 0) {
+        snprintf(path, size, LIVE_PATH);
+    } else {
+        snprintf(path, size, LIVE_STREAM_PATH, id);
     }
 }
 
-void stop_vlc_player() {
-    print_info("Stopping any existing VLC players...");
-    // Kill VLC processes playing our video file
-    system("pkill -f 'vlc.*video_stream.webm'");
-    sleep(1); // Give time for processes to terminate
+// Stop the players this server started, and only those
+void stop_vlc_players(void) {
+    for (int i = 0; i < stream_count; i++) {
+        if (streams[i]->player > 0) {
+            kill(streams[i]->player, SIGTERM);
+            waitpid(streams[i]->player, NULL, 0);
+            streams[i]->player = 0;
+        }
+    }
 }
 
-void start_vlc_player() {
-    print_info("Starting VLC player for video stream...");
+// Start VLC on a stream unless the one started earlier is still running. With
+// --input-repeat it reconnects by itself when the stream's next session begins.
+void start_vlc_player(struct live_stream* stream) {
+    char path[64];
+    char url[96];
+
+    if (stream->player > 0 && waitpid(stream->player, NULL, WNOHANG) == 0) {
+        return;
+    }
+    live_stream_path(stream->id, path, sizeof(path));
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d%s", live_port, path);
+    printf(BLUE "[INFO]" RESET " Starting VLC player for %s\n", url);
+    fflush(stdout);
     
-    // Start VLC in the background to play the WebM file continuously
-    if (fork() == 0) {
-        // Child process - start VLC
+    // Start VLC in the background on the in-memory live stream
+    stream->player = fork();
+    if (stream->player == 0) {
+        // Child process - start VLC with the shutdown signals unblocked again
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        signal(SIGPIPE, SIG_DFL);
         execl("/usr/bin/vlc", "vlc", 
-              WEBM_FILE,
+              url,
               "--intf", "qt",
               "--no-video-title-show",
-              "--file-caching=100",
               "--network-caching=100",
               "--live-caching=100",
               "--input-repeat=999999",
-              "--loop",
               (char*)NULL);
         
         // If execl fails, try with different path
         execl("/bin/vlc", "vlc", 
-              WEBM_FILE,
+              url,
               "--intf", "qt",
               "--no-video-title-show",
-              "--file-caching=100",
               "--network-caching=100",
               "--live-caching=100",
               "--input-repeat=999999",
-              "--loop",
               (char*)NULL);
         
         print_error("Failed to start VLC");
-        exit(1);
+        _exit(1);
+    }
+    if (stream->player == -1) {
+        perror("fork");
+        stream->player = 0;
     }
 }
 
-int main() {
-    int server_socket, client_socket;
-    struct sockaddr_un server_addr;
-    char buffer[BUFFER_SIZE];
-    uint32_t frame_length;
-    ssize_t bytes_received;
+// Set up the size classes and allocate the frames they start with, so the
+// first seconds of a stream do not go to malloc either
+void frame_pool_init(void) {
+    for (int c = 0; c < FRAME_CLASSES; c++) {
+        frame_pool[c].capacity = (size_t)1 << (MIN_FRAME_CLASS_SHIFT + 2 * c);
+        for (int i = 0; i < FRAME_POOL_PREALLOC; i++) {
+            struct frame* frame = malloc(sizeof(struct frame) + frame_pool[c].capacity);
+            if (!frame) {
+                break;
+            }
+            frame->size_class = c;
+            frame->next_free = frame_pool[c].free_list;
+            frame_pool[c].free_list = frame;
+            frame_pool[c].idle++;
+        }
+    }
+}
 
-    // Set up signal handlers
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+// Get a frame with room for len bytes: recycled from the smallest class that
+// fits, or malloc'd when that class is empty or len exceeds every class
+struct frame* frame_alloc(size_t len) {
+    struct frame* frame = NULL;
+    int c = 0;
 
-    print_info("Starting MANET Video Server...");
+    while (c < FRAME_CLASSES && frame_pool[c].capacity < len) {
+        c++;
+    }
+    if (c == FRAME_CLASSES) {
+        frame = malloc(sizeof(struct frame) + len);
+        c = -1;
+        large_frames++;
+    } else {
+        struct frame_class* pool = &frame_pool[c];
+        frame = __atomic_load_n(&pool->free_list, __ATOMIC_ACQUIRE);
+        while (frame && !__atomic_compare_exchange_n(&pool->free_list, &frame, frame->next_free, 0,
+                                                     __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        }
+        if (frame) {
+            __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_RELAXED);
+            pool->reused++;
+        } else {
+            frame = malloc(sizeof(struct frame) + pool->capacity);
+            pool->allocated++;
+        }
+    }
+    if (frame) {
+        frame->refs = 1;
+        frame->size_class = c;
+        frame->len = len;
+    }
+    return frame;
+}
 
-    // Remove old WebM file if it exists
-    unlink(WEBM_FILE);
+void frame_ref(struct frame* frame) {
+    __atomic_add_fetch(&frame->refs, 1, __ATOMIC_RELAXED);
+}
 
-    // Create Unix Domain Socket
-    server_socket = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (server_socket == -1) {
-        print_error("Failed to create socket");
-        perror("socket");
-        return 1;
+void frame_unref(struct frame* frame) {
+    if (!frame || __atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    if (frame->size_class < 0) {
+        free(frame);
+        return;
+    }
+    struct frame_class* pool = &frame_pool[frame->size_class];
+    if (__atomic_add_fetch(&pool->idle, 1, __ATOMIC_RELAXED) > FRAME_POOL_RETAIN) {
+        __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_RELAXED);
+        free(frame);
+        return;
+    }
+    frame->next_free = __atomic_load_n(&pool->free_list, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&pool->free_list, &frame->next_free, frame, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
     }
+}
 
-    // Remove existing socket file
-    unlink(SOCKET_PATH);
+int ring_init(struct frame_ring* ring, unsigned int depth) {
+    memset(ring, 0, sizeof(*ring));
+    ring->slots = calloc(depth, sizeof(struct frame*));
+    ring->depth = depth;
+    ring->wakeup_fd = eventfd(0, EFD_CLOEXEC);
+    if (!ring->slots || ring->wakeup_fd == -1) {
+        free(ring->slots);
+        return -1;
+    }
+    return 0;
+}
 
-    // Set up socket address
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sun_family = AF_UNIX;
-    strcpy(server_addr.sun_path, SOCKET_PATH);
+void ring_destroy(struct frame_ring* ring) {
+    for (uint64_t i = ring->head; i < ring->tail; i++) {
+        frame_unref(ring->slots[i % ring->depth]);
+    }
+    free(ring->slots);
+    close(ring->wakeup_fd);
+}
 
-    // Bind socket
-    if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
-        print_error("Failed to bind socket");
-        perror("bind");
-        close(server_socket);
-        return 1;
+void ring_wake_writer(struct frame_ring* ring) {
+    if (__atomic_load_n(&ring->writer_sleeping, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        write(ring->wakeup_fd, &one, sizeof(one));
     }
+}
 
-    // Listen for connections
-    if (listen(server_socket, 1) == -1) {
-        print_error("Failed to listen on socket");
-        perror("listen");
-        close(server_socket);
-        unlink(SOCKET_PATH);
-        return 1;
+// Producer: queue a frame, dropping the oldest queued frame if the ring is full
+void ring_push(struct frame_ring* ring, struct frame* frame) {
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    while (tail - head == ring->depth) {
+        struct frame* oldest = __atomic_load_n(&ring->slots[head % ring->depth], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&ring->head, &head, head + 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            frame_unref(oldest);
+            ring->frames_dropped++;
+            head++;
+        }
+        // On failure head was reloaded: the writer freed some slots
     }
 
-    print_success("Video server listening on " SOCKET_PATH);
-    print_info("Waiting for video client connection...");
+    __atomic_store_n(&ring->slots[tail % ring->depth], frame, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+    ring->frames_queued++;
+    if (tail + 1 - head > ring->high_water) {
+        ring->high_water = tail + 1 - head;
+    }
+    ring_wake_writer(ring);
+}
 
-    while (running) {
-        // Accept client connection
-        client_socket = accept(server_socket, NULL, NULL);
-        if (client_socket == -1) {
-            if (running) {
-                print_error("Failed to accept connection");
-                perror("accept");
+// Producer: no more frames; the writer drains what is queued and exits
+void ring_close(struct frame_ring* ring) {
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+    uint64_t one = 1;
+    write(ring->wakeup_fd, &one, sizeof(one));
+}
+
+// Consumer: claim up to max queued frames, oldest first. Blocks while the
+// ring is empty; returns 0 once it is closed and drained.
+int ring_pop_batch(struct frame_ring* ring, struct frame** batch, int max) {
+    while (1) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        if (head != tail) {
+            int count = tail - head < (uint64_t)max ? (int)(tail - head) : max;
+            for (int i = 0; i < count; i++) {
+                batch[i] = __atomic_load_n(&ring->slots[(head + i) % ring->depth], __ATOMIC_RELAXED);
+            }
+            // Fails if the producer dropped the oldest frame meanwhile
+            if (__atomic_compare_exchange_n(&ring->head, &head, head + count, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return count;
             }
             continue;
         }
+        if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
 
-        print_success("Video client connected");
-        
-        // Stop any existing VLC players
-        stop_vlc_player();
-        
-        // Remove old WebM file and create fresh one
-        unlink(WEBM_FILE);
-        if (webm_file) {
-            fclose(webm_file);
-        }
-        webm_file = fopen(WEBM_FILE, "wb");
-        if (!webm_file) {
-            print_error("Failed to create fresh WebM file");
-            perror("fopen");
-            close(client_socket);
-            continue;
+        // Announce the sleep, then re-check so a push in between is not missed
+        __atomic_store_n(&ring->writer_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head &&
+            !__atomic_load_n(&ring->closed, __ATOMIC_SEQ_CST)) {
+            uint64_t count;
+            read(ring->wakeup_fd, &count, sizeof(count));
         }
-        print_success("Fresh WebM file created for new session");
-        
-        // Start VLC player for the new session
-        start_vlc_player();
-        sleep(2); // Give VLC time to start
-
-        // Process video frames
-        int frame_count = 0;
-        while (running) {
-            // Read frame length (4 bytes, big endian)
-            bytes_received = recv(client_socket, &frame_length, sizeof(frame_length), MSG_WAITALL);
-            if (bytes_received <= 0) {
-                if (bytes_received == 0) {
-                    print_info("Client disconnected");
-                } else {
-                    print_error("Failed to receive frame length");
-                }
-                break;
+        __atomic_store_n(&ring->writer_sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+}
+
+// Write a batch of frames with as few writev() calls as the kernel allows
+int write_frames(int fd, struct frame** frames, int count) {
+    struct iovec iov[WRITE_BATCH];
+    int first = 0;
+
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = frames[i]->data;
+        iov[i].iov_len = frames[i]->len;
+    }
+    while (first < count) {
+        ssize_t n = writev(fd, iov + first, count - first);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
             }
+            return -1;
+        }
+        while (first < count && (size_t)n >= iov[first].iov_len) {
+            n -= iov[first].iov_len;
+            first++;
+        }
+        if (first < count) {
+            iov[first].iov_base = (char*)iov[first].iov_base + n;
+            iov[first].iov_len -= n;
+        }
+    }
+    return 0;
+}
 
-            // Convert from network byte order
-            frame_length = ntohl(frame_length);
+// Writer thread: drain the ring to disk in batches. Once the session has
+// closed the ring and everything is written, report and clean up.
+void* writer_thread(void* arg) {
+    struct stream_writer* writer = arg;
+    struct frame_ring* ring = &writer->ring;
+    struct frame* batch[WRITE_BATCH];
+    int count;
 
-            if (frame_length > BUFFER_SIZE) {
-                print_error("Frame size too large");
-                break;
+    sdr_qos_thread(SDR_CLASS_VIDEO);
+    while ((count = ring_pop_batch(ring, batch, WRITE_BATCH)) > 0) {
+        if (!ring->write_failed) {
+            // Frames back up in the ring, and are dropped from it, while
+            // the video class is over its rate
+            size_t batch_bytes = 0;
+            for (int i = 0; i < count; i++) {
+                batch_bytes += batch[i]->len;
+            }
+            sdr_qos_throttle(SDR_CLASS_VIDEO, batch_bytes);
+            uint64_t start = sdr_now_ns();
+            if (write_frames(writer->fd, batch, count) == -1) {
+                printf(RED "[ERROR]" RESET " Failed to write stream %u to disk; recording stopped\n",
+                       writer->stream_id);
+                fflush(stdout);
+                perror("writev");
+                ring->write_failed = 1;
+            } else {
+                sdr_histogram_since(video_write_time, start);
+                ring->bytes_written += batch_bytes;
+                ring->frames_written += count;
+                sdr_counter_add(&video_bytes_recorded, batch_bytes);
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            frame_unref(batch[i]);
+        }
+    }
+
+    printf(BLUE "[INFO]" RESET " Recording of stream %u closed: %llu frames (%llu bytes) written, "
+           "%llu dropped\n", writer->stream_id, (unsigned long long)ring->frames_written,
+           (unsigned long long)ring->bytes_written, (unsigned long long)ring->frames_dropped);
+    fflush(stdout);
+    ring_destroy(ring);
+    close(writer->fd);
+    free(writer);
+    __atomic_sub_fetch(&recorders_running, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+// Create a fresh recording file for the stream and start draining frames into it
+struct stream_writer* writer_start(unsigned int stream_id) {
+    char path[64];
+    struct stream_writer* writer = calloc(1, sizeof(*writer));
+    if (!writer) {
+        print_error("Failed to start WebM writer");
+        return NULL;
+    }
+    writer->stream_id = stream_id;
+    if (stream_id == 0) {
+        snprintf(path, sizeof(path), WEBM_FILE);
+    } else {
+        snprintf(path, sizeof(path), WEBM_STREAM_FILE, stream_id);
+    }
+
+    // Unlinking first leaves a previous session's writer draining into the
+    // old file instead of interleaving with this one
+    unlink(path);
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (writer->fd == -1) {
+        print_error("Failed to create fresh WebM file");
+        perror("open");
+        free(writer);
+        return NULL;
+    }
+    if (ring_init(&writer->ring, ring_depth) == -1) {
+        print_error("Failed to start WebM writer");
+        close(writer->fd);
+        free(writer);
+        return NULL;
+    }
+    __atomic_add_fetch(&recorders_running, 1, __ATOMIC_SEQ_CST);
+    if (pthread_create(&writer->thread, NULL, writer_thread, writer) != 0) {
+        print_error("Failed to start WebM writer");
+        __atomic_sub_fetch(&recorders_running, 1, __ATOMIC_SEQ_CST);
+        ring_destroy(&writer->ring);
+        close(writer->fd);
+        free(writer);
+        return NULL;
+    }
+    pthread_detach(writer->thread);
+    printf(GREEN "[SUCCESS]" RESET " Recording stream %u to %s\n", stream_id, path);
+    fflush(stdout);
+    return writer;
+}
+
+void print_stream_stats(struct video_session* session) {
+    struct live_stream* stream = session->stream;
+    struct cluster_index* clusters = &stream->clusters;
+
+    printf(BLUE "[INFO]" RESET " Stream %u: %llu frames received, %d viewers", stream->id,
+           (unsigned long long)session->frames_received,
+           __atomic_load_n(&stream->viewers, __ATOMIC_RELAXED));
+    if (clusters->count) {
+        printf("; %llu clusters (%llu keyframe), last %llu bytes",
+               (unsigned long long)clusters->count,
+               (unsigned long long)clusters->keyframe_clusters,
+               (unsigned long long)clusters->last_bytes);
+        if (clusters->last_duration_ms > 0) {
+            printf(" over %lld ms = %llu kbit/s",
+                   (long long)clusters->last_duration_ms,
+                   (unsigned long long)(clusters->last_bytes * 8 / clusters->last_duration_ms));
+        }
+        printf(", arrival lag %lld ms", (long long)clusters->last_lag_ms);
+    }
+    if (session->recorder) {
+        struct frame_ring* ring = &session->recorder->ring;
+        printf("; recording %llu written (%llu bytes), %llu dropped, queue high water %llu/%u",
+               (unsigned long long)__atomic_load_n(&ring->frames_written, __ATOMIC_RELAXED),
+               (unsigned long long)__atomic_load_n(&ring->bytes_written, __ATOMIC_RELAXED),
+               (unsigned long long)ring->frames_dropped,
+               (unsigned long long)ring->high_water, ring->depth);
+    }
+    uint64_t reused = 0;
+    uint64_t allocated = 0;
+    for (int c = 0; c < FRAME_CLASSES; c++) {
+        reused += frame_pool[c].reused;
+        allocated += frame_pool[c].allocated;
+    }
+    printf("; buffers %llu reused, %llu allocated, %llu oversized\n",
+           (unsigned long long)reused, (unsigned long long)allocated,
+           (unsigned long long)large_frames);
+    fflush(stdout);
+}
+
+// Viewers reach the stream over plain HTTP so any player can open it
+const char LIVE_RESPONSE_CHUNKED[] =
+    "HTTP/1.1 200 OK\r\nContent-Type: video/webm\r\nTransfer-Encoding: chunked\r\n"
+    "Cache-Control: no-cache\r\nConnection: close\r\n\r\n";
+const char LIVE_RESPONSE_PLAIN[] =
+    "HTTP/1.0 200 OK\r\nContent-Type: video/webm\r\nCache-Control: no-cache\r\n"
+    "Connection: close\r\n\r\n";
+const char LIVE_NOT_FOUND[] =
+    "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+const char LIVE_LAST_CHUNK[] = "0\r\n\r\n";
+
+void webm_parser_init(struct webm_parser* parser) {
+    memset(parser, 0, sizeof(*parser));
+    parser->state = WEBM_ID;
+    parser->timecode_scale = 1000000;  // Matroska default: milliseconds
+}
+
+void cluster_index_init(struct cluster_index* index) {
+    memset(index, 0, sizeof(*index));
+}
+
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct cluster_entry* cluster_newest(struct cluster_index* index) {
+    return index->count ? &index->entries[(index->count - 1) % CLUSTER_INDEX_SIZE] : NULL;
+}
+
+void cluster_start(struct cluster_index* index, uint64_t offset, uint64_t now) {
+    struct cluster_entry* prev = cluster_newest(index);
+    if (prev) {
+        prev->bytes = offset - prev->offset;
+        index->last_bytes = prev->bytes;
+    }
+    struct cluster_entry* entry = &index->entries[index->count % CLUSTER_INDEX_SIZE];
+    memset(entry, 0, sizeof(*entry));
+    entry->offset = offset;
+    entry->timecode_ms = -1;
+    entry->arrival_ns = now;
+    index->count++;
+    if (!index->have_first_cluster) {
+        index->have_first_cluster = 1;
+        index->first_cluster_offset = offset;
+    }
+}
+
+void cluster_timecode(struct cluster_index* index, struct webm_parser* parser, uint64_t ticks) {
+    struct cluster_entry* entry = cluster_newest(index);
+    if (!entry) {
+        return;
+    }
+    entry->timecode_ms = (int64_t)(ticks * parser->timecode_scale / 1000000);
+    if (!index->have_base) {
+        index->have_base = 1;
+        index->base_timecode_ms = entry->timecode_ms;
+        index->base_arrival_ns = entry->arrival_ns;
+    }
+    int64_t wall_ms = (int64_t)((entry->arrival_ns - index->base_arrival_ns) / 1000000);
+    index->last_lag_ms = wall_ms - (entry->timecode_ms - index->base_timecode_ms);
+
+    if (index->count >= 2) {
+        struct cluster_entry* prev = &index->entries[(index->count - 2) % CLUSTER_INDEX_SIZE];
+        if (prev->timecode_ms >= 0) {
+            index->last_duration_ms = entry->timecode_ms - prev->timecode_ms;
+        }
+    }
+}
+
+void cluster_block(struct cluster_index* index, int keyframe) {
+    struct cluster_entry* entry = cluster_newest(index);
+    if (!entry) {
+        return;
+    }
+    if (entry->blocks++ == 0 && keyframe) {
+        entry->keyframe = 1;
+        index->keyframe_clusters++;
+        index->have_keyframe = 1;
+        index->keyframe_offset = entry->offset;
+    }
+}
+
+// Length of an EBML variable-size integer from its first byte, 0 if invalid
+int ebml_vint_length(unsigned char first, int max) {
+    for (int len = 1; len <= max; len++) {
+        if (first & (0x80 >> (len - 1))) {
+            return len;
+        }
+    }
+    return 0;
+}
+
+// Masters we descend into, each only where it belongs
+int webm_is_master(uint32_t id, uint32_t parent) {
+    switch (id) {
+    case MKV_ID_SEGMENT:
+        return parent == 0;
+    case MKV_ID_INFO:
+    case MKV_ID_CLUSTER:
+        return parent == MKV_ID_SEGMENT;
+    case MKV_ID_BLOCK_GROUP:
+        return parent == MKV_ID_CLUSTER;
+    default:
+        return 0;
+    }
+}
+
+// Top-level Segment children; one of these ends an unknown-size Cluster
+int webm_is_level1(uint32_t id) {
+    return id == MKV_ID_CLUSTER || id == MKV_ID_SEEK_HEAD || id == MKV_ID_INFO ||
+           id == MKV_ID_TRACKS || id == MKV_ID_CUES || id == MKV_ID_TAGS ||
+           id == MKV_ID_CHAPTERS || id == MKV_ID_ATTACHMENTS;
+}
+
+void webm_pop(struct webm_parser* parser, struct cluster_index* index) {
+    struct ebml_level* level = &parser->stack[--parser->depth];
+    if (level->id == MKV_ID_BLOCK_GROUP) {
+        cluster_block(index, !parser->group_has_reference);
+    }
+}
+
+// Close known-size masters that end at the current offset
+void webm_close_finished(struct webm_parser* parser, struct cluster_index* index) {
+    while (parser->depth > 0 && parser->stack[parser->depth - 1].end != EBML_UNKNOWN_SIZE &&
+           parser->offset >= parser->stack[parser->depth - 1].end) {
+        webm_pop(parser, index);
+    }
+}
+
+// A full element header has been read; decide what to do with its body
+void webm_element(struct webm_parser* parser, struct cluster_index* index, uint64_t now) {
+    uint32_t id = parser->id;
+
+    // Unknown-size masters end where an element that cannot be their child begins
+    while (parser->depth > 0 && parser->stack[parser->depth - 1].end == EBML_UNKNOWN_SIZE) {
+        uint32_t top = parser->stack[parser->depth - 1].id;
+        if ((top == MKV_ID_CLUSTER && webm_is_level1(id)) || id == EBML_ID_HEADER) {
+            webm_pop(parser, index);
+        } else {
+            break;
+        }
+    }
+
+    uint32_t parent = parser->depth ? parser->stack[parser->depth - 1].id : 0;
+    int in_cluster = parent == MKV_ID_CLUSTER;
+
+    if (webm_is_master(id, parent) && parser->depth < EBML_MAX_DEPTH) {
+        struct ebml_level* level = &parser->stack[parser->depth++];
+        level->id = id;
+        level->end = parser->size == EBML_UNKNOWN_SIZE ? EBML_UNKNOWN_SIZE
+                                                       : parser->offset + parser->size;
+        if (id == MKV_ID_CLUSTER) {
+            cluster_start(index, parser->element_start, now);
+        } else if (id == MKV_ID_BLOCK_GROUP) {
+            parser->group_has_reference = 0;
+        }
+        parser->state = WEBM_ID;
+        parser->need = 0;
+        webm_close_finished(parser, index);
+        return;
+    }
+    if (parser->size == EBML_UNKNOWN_SIZE) {
+        parser->state = WEBM_ERROR;  // Cannot tell where it ends
+        return;
+    }
+
+    parser->value_len = 0;
+    parser->value_need = 0;
+    if ((id == MKV_ID_TIMECODE_SCALE && parent == MKV_ID_INFO) ||
+        (id == MKV_ID_CLUSTER_TIMECODE && in_cluster)) {
+        parser->value_need = parser->size <= 8 ? (int)parser->size : 0;
+    } else if ((id == MKV_ID_SIMPLE_BLOCK && in_cluster) ||
+               (id == MKV_ID_BLOCK && parent == MKV_ID_BLOCK_GROUP)) {
+        // Track number, 16-bit relative timecode, flags
+        parser->value_need = parser->size < 8 ? (int)parser->size : 8;
+    } else if (id == MKV_ID_REFERENCE_BLOCK && parent == MKV_ID_BLOCK_GROUP) {
+        parser->group_has_reference = 1;
+    }
+    parser->remaining = parser->size - parser->value_need;
+    parser->state = parser->value_need ? WEBM_VALUE : WEBM_SKIP;
+}
+
+// The first value_need bytes of a decoded element are in value
+void webm_value(struct webm_parser* parser, struct cluster_index* index) {
+    uint64_t number = 0;
+    for (int i = 0; i < parser->value_len; i++) {
+        number = (number << 8) | parser->value[i];
+    }
+
+    switch (parser->id) {
+    case MKV_ID_TIMECODE_SCALE:
+        if (number) {
+            parser->timecode_scale = number;
+        }
+        break;
+    case MKV_ID_CLUSTER_TIMECODE:
+        cluster_timecode(index, parser, number);
+        break;
+    case MKV_ID_SIMPLE_BLOCK: {
+        int track_len = ebml_vint_length(parser->value[0], 4);
+        if (track_len && parser->value_len >= track_len + 3) {
+            cluster_block(index, (parser->value[track_len + 2] & 0x80) != 0);
+        }
+        break;
+    }
+    default:
+        break;  // Blocks in a BlockGroup are counted when the group closes
+    }
+}
+
+// Feed the next piece of the stream
+void webm_parse(struct webm_parser* parser, struct cluster_index* index,
+                const unsigned char* data, size_t len, uint64_t now) {
+    const unsigned char* end = data + len;
+
+    while (data < end && parser->state != WEBM_ERROR) {
+        switch (parser->state) {
+        case WEBM_ID:
+            if (parser->need == 0) {
+                parser->element_start = parser->offset;
+                parser->need = ebml_vint_length(*data, 4);
+                if (parser->need == 0) {
+                    parser->state = WEBM_ERROR;
+                    break;
+                }
+                parser->id = 0;
+            }
+            parser->id = (parser->id << 8) | *data++;
+            parser->offset++;
+            if (--parser->need == 0) {
+                parser->state = WEBM_SIZE;
             }
+            break;
 
-            // Read frame data
-            size_t total_received = 0;
-            while (total_received < frame_length && running) {
-                bytes_received = recv(client_socket, buffer + total_received, 
-                                    frame_length - total_received, 0);
-                if (bytes_received <= 0) {
-                    print_error("Failed to receive frame data");
+        case WEBM_SIZE:
+            if (parser->need == 0) {
+                parser->need = ebml_vint_length(*data, 8);
+                if (parser->need == 0) {
+                    parser->state = WEBM_ERROR;
                     break;
                 }
-                total_received += bytes_received;
+                parser->size = *data & (0xFF >> parser->need);
+                // All value bits set means "unknown size"
+                parser->size_all_ones = parser->size == (uint64_t)(0xFF >> parser->need);
+            } else {
+                parser->size = (parser->size << 8) | *data;
+                parser->size_all_ones &= *data == 0xFF;
+            }
+            data++;
+            parser->offset++;
+            if (--parser->need == 0) {
+                if (parser->size_all_ones) {
+                    parser->size = EBML_UNKNOWN_SIZE;
+                }
+                webm_element(parser, index, now);
             }
+            break;
 
-            if (total_received != frame_length) {
-                print_error("Incomplete frame received");
-                break;
+        case WEBM_VALUE:
+            parser->value[parser->value_len++] = *data++;
+            parser->offset++;
+            if (parser->value_len == parser->value_need) {
+                webm_value(parser, index);
+                parser->state = parser->remaining ? WEBM_SKIP : WEBM_ID;
+                if (!parser->remaining) {
+                    webm_close_finished(parser, index);
+                }
+            }
+            break;
+
+        case WEBM_SKIP: {
+            size_t take = (size_t)(end - data) < parser->remaining ? (size_t)(end - data)
+                                                                  : parser->remaining;
+            data += take;
+            parser->offset += take;
+            parser->remaining -= take;
+            if (parser->remaining == 0) {
+                parser->state = WEBM_ID;
+                webm_close_finished(parser, index);
             }
+            break;
+        }
+
+        case WEBM_ERROR:
+            break;
+        }
+    }
+}
+
+void live_wake(void) {
+    uint64_t one = 1;
+    write(live_wakeup_fd, &one, sizeof(one));
+}
+
+// Find the live window for a stream ID, creating it if create is set.
+// Returns NULL when it does not exist or MAX_STREAMS are already in use.
+struct live_stream* stream_get(unsigned int id, int create) {
+    struct live_stream* stream = NULL;
+
+    pthread_mutex_lock(&streams_lock);
+    for (int i = 0; i < stream_count; i++) {
+        if (streams[i]->id == id) {
+            stream = streams[i];
+            break;
+        }
+    }
+    if (!stream && create && stream_count < MAX_STREAMS) {
+        stream = calloc(1, sizeof(*stream));
+        if (stream) {
+            pthread_mutex_init(&stream->lock, NULL);
+            stream->id = id;
+            streams[stream_count++] = stream;
+        }
+    }
+    pthread_mutex_unlock(&streams_lock);
+    return stream;
+}
+
+// Drop every buffered frame. Called with stream->lock held.
+void live_clear(struct live_stream* stream) {
+    for (uint64_t seq = stream->first_seq; seq < stream->next_seq; seq++) {
+        frame_unref(stream->frames[seq % LIVE_MAX_FRAMES]);
+    }
+    stream->first_seq = stream->next_seq;
+    stream->bytes = 0;
+    stream->have_join = 0;
+    frame_unref(stream->init);
+    stream->init = NULL;
+}
+
+// A new client session replaces whatever the stream had buffered
+void live_begin(struct live_stream* stream) {
+    pthread_mutex_lock(&stream->lock);
+    live_clear(stream);
+    stream->session++;
+    stream->active = 1;
+    stream->next_offset = 0;
+    pthread_mutex_unlock(&stream->lock);
+    frame_unref(stream->init_pending);
+    stream->init_pending = NULL;
+    webm_parser_init(&stream->parser);
+    cluster_index_init(&stream->clusters);
+    stream->disabled = 0;
+    live_wake();
+}
 
-            printf(BLUE "[INFO]" RESET " Received video frame #%d of size %u bytes\n", 
-                   ++frame_count, frame_length);
+// Viewers finish what they have queued, then get the end of the response
+void live_end(struct live_stream* stream) {
+    pthread_mutex_lock(&stream->lock);
+    stream->active = 0;
+    pthread_mutex_unlock(&stream->lock);
+    live_wake();
+}
+
+// Grow the stream's pending init segment by len bytes of data
+int init_append(struct live_stream* stream, const char* data, size_t len) {
+    size_t have = stream->init_pending ? stream->init_pending->len : 0;
+    struct frame* grown = frame_alloc(have + len);
+    if (!grown) {
+        return -1;
+    }
+    if (have) {
+        memcpy(grown->data, stream->init_pending->data, have);
+    }
+    memcpy(grown->data + have, data, len);
+    frame_unref(stream->init_pending);
+    stream->init_pending = grown;
+    return 0;
+}
+
+// Add a frame to the window. Called with stream->lock held.
+void live_store(struct live_stream* stream, struct frame* frame) {
+    while (stream->next_seq - stream->first_seq == LIVE_MAX_FRAMES ||
+           (stream->bytes + frame->len > live_window && stream->first_seq < stream->next_seq)) {
+        struct frame* oldest = stream->frames[stream->first_seq % LIVE_MAX_FRAMES];
+        stream->bytes -= oldest->len;
+        frame_unref(oldest);
+        stream->first_seq++;
+    }
+    stream->frames[stream->next_seq % LIVE_MAX_FRAMES] = frame;
+    stream->bytes += frame->len;
+    stream->next_seq++;
+    stream->next_offset = frame->stream_offset + frame->len;
+}
+
+// Point new viewers at the stream offset of a keyframe Cluster, if that part
+// of the stream is still in the window. Called with stream->lock held.
+void live_set_join(struct live_stream* stream, uint64_t offset) {
+    for (uint64_t seq = stream->next_seq; seq > stream->first_seq; seq--) {
+        struct frame* frame = stream->frames[(seq - 1) % LIVE_MAX_FRAMES];
+        if (frame->stream_offset <= offset) {
+            if (offset < frame->stream_offset + frame->len) {
+                stream->join_seq = seq - 1;
+                stream->join_offset = offset - frame->stream_offset;
+                stream->have_join = 1;
+            }
+            return;
+        }
+    }
+}
+
+// Add a received frame to the stream's live window. Takes over the caller's
+// reference.
+void live_append(struct live_stream* stream, struct frame* frame) {
+    struct cluster_index* clusters = &stream->clusters;
+    uint64_t keyframes_before = clusters->keyframe_clusters;
+    uint64_t frame_offset = stream->parser.offset;
+    struct frame* carry = NULL;
+
+    frame->stream_offset = frame_offset;
+    webm_parse(&stream->parser, clusters, (const unsigned char*)frame->data, frame->len,
+               monotonic_ns());
+
+    // stream->init only changes on this thread, so it can be read unlocked
+    if (!stream->init) {
+        if (!clusters->have_first_cluster) {
+            if (!stream->disabled && (stream->parser.state == WEBM_ERROR ||
+                (stream->init_pending ? stream->init_pending->len : 0) + frame->len >
+                    MAX_INIT_SEGMENT)) {
+                printf(RED "[ERROR]" RESET " No WebM clusters found in stream %u; "
+                       "live view disabled\n", stream->id);
+                fflush(stdout);
+                stream->disabled = 1;
+            }
+            if (!stream->disabled) {
+                init_append(stream, frame->data, frame->len);
+            }
+            frame_unref(frame);
+            return;
+        }
+
+        uint64_t split = clusters->first_cluster_offset;
+        if (split >= frame_offset) {
+            init_append(stream, frame->data, split - frame_offset);
+        } else if (stream->init_pending) {
+            // The Cluster ID straddled the previous frame; hand its start
+            // back to the stream instead of the init segment
+            size_t keep = split;
+            carry = frame_alloc(stream->init_pending->len - keep);
+            if (carry) {
+                memcpy(carry->data, stream->init_pending->data + keep, carry->len);
+                carry->stream_offset = split;
+            }
+            stream->init_pending->len = keep;
+        }
+        if (!stream->init_pending) {
+            init_append(stream, "", 0);
+        }
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    if (!stream->init) {
+        stream->init = stream->init_pending;
+        stream->init_pending = NULL;
+    }
+    if (carry) {
+        live_store(stream, carry);
+    }
+    live_store(stream, frame);
+    if (clusters->keyframe_clusters != keyframes_before) {
+        live_set_join(stream, clusters->keyframe_offset);
+    }
+    pthread_mutex_unlock(&stream->lock);
+    live_wake();
+}
 
-            // Write frame to WebM file
-            if (fwrite(buffer, 1, frame_length, webm_file) != frame_length) {
-                print_error("Failed to write to WebM file");
-                perror("fwrite");
+// Queue a piece of the response. Frame slices become HTTP chunks.
+void subscriber_queue(struct subscriber* sub, struct frame* frame, const char* data, size_t len) {
+    struct out_chunk* chunk = &sub->queue[(sub->queue_head + sub->queue_count) % SUBSCRIBER_QUEUE];
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->frame = frame;
+    chunk->data = data;
+    chunk->len = len;
+    if (frame) {
+        frame_ref(frame);
+        if (sub->chunked) {
+            chunk->head_len = snprintf(chunk->head, sizeof(chunk->head), "%zx\r\n", len);
+            chunk->trailer = 1;
+        }
+    }
+    sub->queue_count++;
+}
+
+// Top up a viewer's queue from its stream's live window. Called with
+// stream->lock held.
+void subscriber_fill(struct subscriber* sub) {
+    struct live_stream* stream = sub->stream;
+    if (!sub->streaming || sub->finished || !stream) {
+        return;
+    }
+
+    if (sub->session == 0) {
+        // Waiting for a stream; join at the most recent Cluster
+        if (!stream->active || !stream->init || !stream->have_join || stream->join_seq < stream->first_seq) {
+            return;
+        }
+        sub->session = stream->session;
+        sub->seq = stream->join_seq;
+        sub->offset = stream->join_offset;
+        subscriber_queue(sub, stream->init, stream->init->data, stream->init->len);
+    } else if (sub->session == stream->session &&
+               (sub->seq < stream->first_seq ||
+                (sub->seq < stream->next_seq && stream->have_join && stream->join_seq > sub->seq &&
+                 stream->next_offset - stream->frames[sub->seq % LIVE_MAX_FRAMES]->stream_offset >
+                     LIVE_MAX_LAG_BYTES))) {
+        // Fell out of the window or too far behind live; skip ahead to the
+        // latest keyframe Cluster
+        if (!stream->have_join || stream->join_seq < stream->first_seq) {
+            return;
+        }
+        printf(BLUE "[INFO]" RESET " Viewer of stream %u fell behind, skipping %llu frames\n",
+               stream->id, (unsigned long long)(stream->join_seq - sub->seq));
+        fflush(stdout);
+        sub->seq = stream->join_seq;
+        sub->offset = stream->join_offset;
+    }
+
+    if (sub->session == stream->session) {
+        while (sub->queue_count < SUBSCRIBER_QUEUE - 1 && sub->seq < stream->next_seq) {
+            struct frame* frame = stream->frames[sub->seq % LIVE_MAX_FRAMES];
+            subscriber_queue(sub, frame, frame->data + sub->offset, frame->len - sub->offset);
+            sub->seq++;
+            sub->offset = 0;
+        }
+        if (stream->active || sub->seq < stream->next_seq) {
+            return;
+        }
+    }
+
+    // This viewer's session is over; end the response
+    if (sub->chunked) {
+        subscriber_queue(sub, NULL, LIVE_LAST_CHUNK, sizeof(LIVE_LAST_CHUNK) - 1);
+    }
+    sub->finished = 1;
+}
+
+// Send as much of the queue as the socket takes, straight from the shared
+// frames. Returns -1 when the viewer should be dropped.
+int subscriber_send(struct subscriber* sub) {
+    while (sub->queue_count > 0) {
+        struct iovec iov[SUBSCRIBER_QUEUE * 3];
+        int iov_count = 0;
+        size_t skip = sub->sent;
+
+        for (int i = 0; i < sub->queue_count; i++) {
+            struct out_chunk* chunk = &sub->queue[(sub->queue_head + i) % SUBSCRIBER_QUEUE];
+            const char* parts[3] = {chunk->head, chunk->data, "\r\n"};
+            size_t lens[3] = {chunk->head_len, chunk->len, chunk->trailer ? 2 : 0};
+            for (int j = 0; j < 3; j++) {
+                if (skip >= lens[j]) {
+                    skip -= lens[j];
+                    continue;
+                }
+                iov[iov_count].iov_base = (char*)parts[j] + skip;
+                iov[iov_count].iov_len = lens[j] - skip;
+                iov_count++;
+                skip = 0;
+            }
+        }
+
+        struct msghdr msg = {0};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+        ssize_t n = sendmsg(sub->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN ? 0 : -1;
+        }
+
+        size_t done = sub->sent + n;
+        while (sub->queue_count > 0) {
+            struct out_chunk* chunk = &sub->queue[sub->queue_head];
+            size_t total = chunk->head_len + chunk->len + (chunk->trailer ? 2 : 0);
+            if (done < total) {
                 break;
             }
-            
-            // Flush to ensure data is written immediately
-            fflush(webm_file);
+            done -= total;
+            frame_unref(chunk->frame);
+            sub->queue_head = (sub->queue_head + 1) % SUBSCRIBER_QUEUE;
+            sub->queue_count--;
+        }
+        sub->sent = done;
+
+        if (sub->queue_count == 0 && !sub->finished && sub->stream) {
+            pthread_mutex_lock(&sub->stream->lock);
+            subscriber_fill(sub);
+            pthread_mutex_unlock(&sub->stream->lock);
+        }
+    }
+    return sub->finished ? -1 : 0;
+}
+
+void subscriber_close(int epoll_fd, struct subscriber* sub) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sub->fd, NULL);
+    close(sub->fd);
+    while (sub->queue_count > 0) {
+        frame_unref(sub->queue[sub->queue_head].frame);
+        sub->queue_head = (sub->queue_head + 1) % SUBSCRIBER_QUEUE;
+        sub->queue_count--;
+    }
+    for (struct subscriber** p = &subscribers; *p; p = &(*p)->next) {
+        if (*p == sub) {
+            *p = sub->next;
+            break;
+        }
+    }
+    if (sub->stream) {
+        __atomic_sub_fetch(&sub->stream->viewers, 1, __ATOMIC_RELAXED);
+        printf(BLUE "[INFO]" RESET " Viewer of stream %u disconnected\n", sub->stream->id);
+        fflush(stdout);
+    }
+    sub->closed = 1;
+    sub->next = retired_subscribers;
+    retired_subscribers = sub;
+}
+
+// Viewers closed during a batch may still have had events in it, like
+// sessions in free_retired_sessions
+void free_retired_subscribers(void) {
+    while (retired_subscribers) {
+        struct subscriber* sub = retired_subscribers;
+        retired_subscribers = sub->next;
+        free(sub);
+    }
+}
+
+// Push pending data to one viewer and wait for writability only while the
+// socket is full
+void subscriber_service(int epoll_fd, struct subscriber* sub) {
+    if (sub->queue_count == 0 && sub->stream) {
+        pthread_mutex_lock(&sub->stream->lock);
+        subscriber_fill(sub);
+        pthread_mutex_unlock(&sub->stream->lock);
+    }
+    if (subscriber_send(sub) == -1) {
+        subscriber_close(epoll_fd, sub);
+        return;
+    }
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLRDHUP | (sub->queue_count > 0 ? EPOLLOUT : 0);
+    ev.data.ptr = sub;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sub->fd, &ev);
+}
+
+// Read the viewer's HTTP request; anything after it is ignored
+int subscriber_read(struct subscriber* sub) {
+    char discard[512];
+    while (1) {
+        char* dst = discard;
+        size_t room = sizeof(discard);
+        if (!sub->streaming) {
+            dst = sub->request + sub->request_len;
+            room = sizeof(sub->request) - 1 - sub->request_len;
+            if (room == 0) {
+                return -1;
+            }
+        }
+        ssize_t n = recv(sub->fd, dst, room, MSG_DONTWAIT);
+        if (n == 0) {
+            return -1;
+        }
+        if (n == -1) {
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+        }
+        if (sub->streaming) {
+            continue;
+        }
+        sub->request_len += n;
+        sub->request[sub->request_len] = '\0';
+        if (!strstr(sub->request, "\r\n\r\n")) {
+            continue;
+        }
 
-            printf(BLUE "[INFO]" RESET " Written to %s (total frames: %d)\n", 
-                   WEBM_FILE, frame_count);
+        // "/" and LIVE_PATH are stream 0, which viewers may open before any
+        // client connects, as they always could. LIVE_STREAM_PATH names any
+        // other stream a client has opened: only sessions take stream slots,
+        // or viewers probing IDs could use them all up.
+        char path[256];
+        char expected[64];
+        int minor = 1;
+        unsigned int id = 0;
+        struct live_stream* stream = NULL;
+        if (sscanf(sub->request, "GET %255s HTTP/1.%d", path, &minor) >= 1) {
+            if (strcmp(path, LIVE_PATH) == 0 || strcmp(path, "/") == 0) {
+                stream = stream_get(0, 1);
+            } else if (sscanf(path, LIVE_STREAM_PATH, &id) == 1 && id <= UINT16_MAX) {
+                // Only the canonical spelling, so each stream has one URL
+                live_stream_path(id, expected, sizeof(expected));
+                if (strcmp(path, expected) == 0) {
+                    stream = stream_get(id, 0);
+                }
+            }
+        }
+        if (!stream) {
+            subscriber_queue(sub, NULL, LIVE_NOT_FOUND, sizeof(LIVE_NOT_FOUND) - 1);
+            sub->streaming = 1;
+            sub->finished = 1;
+            continue;
+        }
+        sub->stream = stream;
+        sub->streaming = 1;
+        sub->chunked = minor >= 1;
+        if (sub->chunked) {
+            subscriber_queue(sub, NULL, LIVE_RESPONSE_CHUNKED, sizeof(LIVE_RESPONSE_CHUNKED) - 1);
+        } else {
+            subscriber_queue(sub, NULL, LIVE_RESPONSE_PLAIN, sizeof(LIVE_RESPONSE_PLAIN) - 1);
+        }
+        __atomic_add_fetch(&stream->viewers, 1, __ATOMIC_RELAXED);
+        printf(BLUE "[INFO]" RESET " Viewer connected to stream %u\n", stream->id);
+        fflush(stdout);
+    }
+}
+
+void accept_subscribers(int epoll_fd) {
+    while (1) {
+        int fd = accept4(live_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EINTR) {
+                perror("accept viewer");
+            }
+            return;
+        }
+        struct subscriber* sub = calloc(1, sizeof(*sub));
+        if (!sub) {
+            close(fd);
+            continue;
+        }
+        sub->fd = fd;
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = sub;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            close(fd);
+            free(sub);
+            continue;
+        }
+        sub->next = subscribers;
+        subscribers = sub;
+    }
+}
+
+// Fan-out thread: serves every stream's live window to its viewers. Nothing
+// here ever waits on a viewer, so a slow one only falls behind itself.
+void* live_thread(void* arg) {
+    (void)arg;
+    struct epoll_event events[MAX_EVENTS];
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {0};
+
+    sdr_qos_thread(SDR_CLASS_VIDEO);
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = &live_listen_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, live_listen_fd, &ev);
+    ev.data.ptr = &live_wakeup_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, live_wakeup_fd, &ev);
+
+    while (1) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            return NULL;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == &live_listen_fd) {
+                accept_subscribers(epoll_fd);
+            } else if (events[i].data.ptr == &live_wakeup_fd) {
+                uint64_t count;
+                read(live_wakeup_fd, &count, sizeof(count));
+                struct subscriber* sub = subscribers;
+                while (sub) {
+                    struct subscriber* next = sub->next;
+                    subscriber_service(epoll_fd, sub);
+                    sub = next;
+                }
+            } else {
+                struct subscriber* sub = events[i].data.ptr;
+                if (sub->closed) {
+                    continue;
+                }
+                if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) &&
+                    subscriber_read(sub) == -1) {
+                    subscriber_close(epoll_fd, sub);
+                    continue;
+                }
+                if (sub->streaming) {
+                    subscriber_service(epoll_fd, sub);
+                }
+            }
+        }
+        free_retired_subscribers();
+    }
+    return NULL;
+}
+
+// Listen for viewers on localhost and start the fan-out thread
+int start_live_server(void) {
+    struct sockaddr_in addr;
+    pthread_t thread;
+    int one = 1;
+
+    live_wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    live_listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (live_wakeup_fd == -1 || live_listen_fd == -1) {
+        perror("live socket");
+        return -1;
+    }
+    setsockopt(live_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(live_port);
+    if (bind(live_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        listen(live_listen_fd, SOMAXCONN) == -1) {
+        perror("live bind/listen");
+        return -1;
+    }
+    if (pthread_create(&thread, NULL, live_thread, NULL) != 0) {
+        perror("pthread_create");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+// End a client session. Its stream stays, so viewers wait for the next one.
+// The session is only unlinked here and freed after the current epoll batch,
+// which may still hold events for it.
+void session_close(struct video_session* session) {
+    sdr_loop_remove(session->fd);
+    close(session->fd);
+    frame_unref(session->frame);
+    session->frame = NULL;
+    if (session->ring_open) {
+        shm_ring_close(&session->ring);
+        session->ring_open = 0;
+    }
+
+    struct live_stream* stream = session->stream;
+    if (stream) {
+        live_end(stream);
+        stream->owner = NULL;
+        print_stream_stats(session);
+        if (session->recorder) {
+            // The writer drains what is queued and cleans up on its own
+            ring_close(&session->recorder->ring);
+            session->recorder = NULL;
+        }
+        printf(BLUE "[INFO]" RESET " Stream %u session ended\n", stream->id);
+        fflush(stdout);
+    }
+
+    for (struct video_session** p = &sessions; *p; p = &(*p)->next) {
+        if (*p == session) {
+            *p = session->next;
+            break;
+        }
+    }
+    session->closed = 1;
+    session->next = retired_sessions;
+    retired_sessions = session;
+    session_count--;
+}
+
+// The session header named its stream: take the stream over and start
+// feeding it. A reconnecting source replaces its own previous session; other
+// streams are never touched.
+int session_attach(struct video_session* session, unsigned int id) {
+    struct live_stream* stream = stream_get(id, 1);
+    if (!stream) {
+        printf(RED "[ERROR]" RESET " Cannot open stream %u: %d streams already in use\n",
+               id, MAX_STREAMS);
+        fflush(stdout);
+        return -1;
+    }
+    if (stream->owner) {
+        printf(BLUE "[INFO]" RESET " Stream %u reconnected; ending its previous session\n", id);
+        fflush(stdout);
+        session_close(stream->owner);
+    }
+
+    if (record_to_disk) {
+        session->recorder = writer_start(id);
+        if (!session->recorder) {
+            return -1;
+        }
+    }
+    session->stream = stream;
+    stream->owner = session;
+    session->last_stats = time(NULL);
+    live_begin(stream);
+    printf(GREEN "[SUCCESS]" RESET " Video client streaming as stream %u\n", id);
+    fflush(stdout);
+
+    // Start VLC player for the stream unless one is already watching it
+    start_vlc_player(stream);
+    return 0;
+}
+
+// The client asked to send its frames through a shared memory ring. The
+// reply echoes its session header with the ring's path after it, or with the
+// flag cleared and no path if it should stay on the socket. Frames too big
+// for the ring still come over the socket, and doorbells keep the two in
+// order.
+int session_offer_ring(struct video_session* session, unsigned int id) {
+    unsigned char reply[SESSION_REPLY_SIZE] = {0};
+
+    memcpy(reply, SESSION_MAGIC, 4);
+    reply[4] = SESSION_VERSION;
+    reply[6] = id >> 8;
+    reply[7] = id & 0xFF;
+    if (shm_ring_size > 0 && shm_ring_create(&session->ring, "video", shm_ring_size) == 0) {
+        session->ring_open = 1;
+        reply[5] = SESSION_FLAG_SHM_RING;
+        memcpy(reply + SESSION_HEADER_SIZE, session->ring.path, strlen(session->ring.path));
+    }
+    if (send(session->fd, reply, sizeof(reply), MSG_NOSIGNAL | MSG_DONTWAIT) != sizeof(reply)) {
+        print_error("Failed to answer session header");
+        return -1;
+    }
+    if (session->ring_open) {
+        printf(BLUE "[INFO]" RESET " Stream %u sends frames through %s\n", id, session->ring.path);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+void session_frame(struct video_session* session) {
+    struct frame* frame = session->frame;
+    uint64_t start = sdr_now_ns();
+    session->frame = NULL;
+
+    if (session->recorder) {
+        frame_ref(frame);
+        ring_push(&session->recorder->ring, frame);
+    }
+    live_append(session->stream, frame);
+    session->frames_received++;
+    video_frames_received++;
+    sdr_histogram_since(video_parse_time, start);
+
+    if (time(NULL) - session->last_stats >= STATS_INTERVAL) {
+        print_stream_stats(session);
+        session->last_stats = time(NULL);
+    }
+}
+
+// A doorbell: the client has written frames into the ring up to head. Each
+// is copied straight from the shared mapping into a pooled frame. Returns the
+// number of frames, or -1 when the session should end.
+int session_drain_ring(struct video_session* session, uint64_t head) {
+    const unsigned char* data;
+    uint32_t len;
+    int frames = 0;
+    int got;
+
+    if (!shm_ring_valid_head(&session->ring, head)) {
+        print_error("Doorbell beyond the end of the shared memory ring");
+        return -1;
+    }
+    // The client has the ring open by now, so nothing else needs the name
+    shm_ring_unlink(&session->ring);
+
+    while ((got = shm_ring_read(&session->ring, head, &data, &len)) == 1) {
+        if (len > max_frame_size) {
+            printf(RED "[ERROR]" RESET " Frame of %u bytes exceeds --max-frame-size %zu\n",
+                   len, max_frame_size);
             fflush(stdout);
+            return -1;
         }
+        session->frame = frame_alloc(len);
+        if (!session->frame) {
+            print_error("Out of memory for video frame");
+            return -1;
+        }
+        memcpy(session->frame->data, data, len);
+        session_frame(session);
+        sdr_qos_charge(SDR_CLASS_VIDEO, len);
+        video_ring_frames++;
+        frames++;
+    }
+    shm_ring_publish_tail(&session->ring);
+    if (got == -1) {
+        print_error("Malformed record in shared memory ring");
+        return -1;
+    }
+    return frames;
+}
 
-        // Close client socket
-        close(client_socket);
-        
-        // Close WebM file but don't delete it yet (VLC might still be playing)
-        if (webm_file) {
-            fclose(webm_file);
-            webm_file = NULL;
+// Read whatever the client has sent, up to SESSION_READ_BUDGET frames or
+// the end of the video class's quantum for this loop iteration.
+// Returns -1 when the session should end.
+int session_read(struct video_session* session) {
+    int frames = 0;
+
+    while (frames < SESSION_READ_BUDGET && sdr_qos_budget(SDR_CLASS_VIDEO)) {
+        char* dst;
+        size_t want;
+
+        if (session->frame) {
+            dst = session->frame->data + session->frame_got;
+            want = session->frame->len - session->frame_got;
+        } else {
+            // A frame length, or the session header or a doorbell once its
+            // first four bytes said which
+            size_t size = 4;
+            if (session->header_len >= 4) {
+                size = session->stream ? DOORBELL_SIZE : SESSION_HEADER_SIZE;
+            }
+            dst = (char*)session->header + session->header_len;
+            want = size - session->header_len;
         }
-        
-        print_info("Client session ended");
+
+        if (want > 0) {
+            uint64_t start = sdr_now_ns();
+            ssize_t n = recv(session->fd, dst, want, 0);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n == -1 && errno == EAGAIN) {
+                return 0;
+            }
+            if (n <= 0) {
+                if (session->frame) {
+                    print_error("Incomplete frame received");
+                } else if (n == 0) {
+                    print_info("Client disconnected");
+                } else {
+                    print_error("Failed to receive frame length");
+                }
+                return -1;
+            }
+            sdr_histogram_since(video_recv_time, start);
+            sdr_qos_charge(SDR_CLASS_VIDEO, n);
+            if (session->frame) {
+                session->frame_got += n;
+            } else {
+                session->header_len += n;
+            }
+            if ((size_t)n < want) {
+                continue;
+            }
+        }
+
+        if (session->frame) {
+            session_frame(session);
+            frames++;
+            continue;
+        }
+
+        if (!session->stream) {
+            if (session->header_len == 4 && memcmp(session->header, SESSION_MAGIC, 4) == 0) {
+                continue;  // Read the rest of the session header
+            }
+            if (session->header_len == SESSION_HEADER_SIZE) {
+                if (session->header[4] != SESSION_VERSION) {
+                    printf(RED "[ERROR]" RESET " Unsupported session header version %u\n",
+                           session->header[4]);
+                    fflush(stdout);
+                    return -1;
+                }
+                unsigned int id = (unsigned int)session->header[6] << 8 | session->header[7];
+                int wants_ring = session->header[5] & SESSION_FLAG_SHM_RING;
+                session->header_len = 0;
+                if (session_attach(session, id) == -1 ||
+                    (wants_ring && session_offer_ring(session, id) == -1)) {
+                    return -1;
+                }
+                continue;
+            }
+            // No header: a client from before stream IDs, whose first four
+            // bytes are already a frame length. It feeds stream 0.
+            if (session_attach(session, 0) == -1) {
+                return -1;
+            }
+        }
+
+        if (session->ring_open && memcmp(session->header, RING_DOORBELL, 4) == 0) {
+            if (session->header_len < DOORBELL_SIZE) {
+                continue;  // Read the head it carries
+            }
+            uint64_t head = 0;
+            for (int i = 4; i < DOORBELL_SIZE; i++) {
+                head = head << 8 | session->header[i];
+            }
+            session->header_len = 0;
+            int drained = session_drain_ring(session, head);
+            if (drained == -1) {
+                return -1;
+            }
+            frames += drained;
+            continue;
+        }
+
+        // Frame length (4 bytes, big endian)
+        uint32_t frame_length;
+        memcpy(&frame_length, session->header, sizeof(frame_length));
+        frame_length = ntohl(frame_length);
+        session->header_len = 0;
+
+        if (frame_length > max_frame_size) {
+            printf(RED "[ERROR]" RESET " Frame of %u bytes exceeds --max-frame-size %zu\n",
+                   frame_length, max_frame_size);
+            fflush(stdout);
+            return -1;
+        }
+        session->frame = frame_alloc(frame_length);
+        if (!session->frame) {
+            print_error("Out of memory for video frame");
+            return -1;
+        }
+        session->frame_got = 0;
+    }
+    return 0;
+}
+
+void session_event(struct sdr_handler* handler, uint32_t events) {
+    struct video_session* session = (struct video_session*)handler;
+    (void)events;
+    if (!session->closed && session_read(session) == -1) {
+        session_close(session);
+    }
+}
+
+void accept_sessions(void) {
+    while (1) {
+        uint64_t start = sdr_now_ns();
+        int fd = accept4(video_server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EINTR) {
+                print_error("Failed to accept connection");
+                perror("accept");
+            }
+            return;
+        }
+        if (session_count >= MAX_SESSIONS) {
+            print_error("Too many video clients; connection refused");
+            close(fd);
+            continue;
+        }
+        struct video_session* session = calloc(1, sizeof(*session));
+        if (!session) {
+            close(fd);
+            continue;
+        }
+        session->handler.on_event = session_event;
+        session->handler.qos_class = SDR_CLASS_VIDEO;
+        session->fd = fd;
+        if (sdr_loop_add(fd, EPOLLIN | EPOLLRDHUP, &session->handler) == -1) {
+            close(fd);
+            free(session);
+            continue;
+        }
+        session->next = sessions;
+        sessions = session;
+        session_count++;
+        video_sessions_accepted++;
+        sdr_histogram_since(video_accept_time, start);
+        print_success("Video client connected");
+    }
+}
+
+void video_listener_event(struct sdr_handler* handler, uint32_t events) {
+    (void)handler;
+    (void)events;
+    accept_sessions();
+}
+
+// Sessions closed during a batch may still have had events in it; they are
+// freed once the whole batch is through
+void free_retired_sessions(void) {
+    while (retired_sessions) {
+        struct video_session* session = retired_sessions;
+        retired_sessions = session->next;
+        free(session);
     }
+}
+
+int video_service_start(int argc, char* argv[]) {
+    struct sockaddr_un server_addr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--ring-depth") == 0 && i + 1 < argc) {
+            int depth = atoi(argv[++i]);
+            if (depth < 2 || depth > MAX_RING_DEPTH) {
+                fprintf(stderr, "--ring-depth must be between 2 and %d\n", MAX_RING_DEPTH);
+                return -1;
+            }
+            ring_depth = depth;
+        } else if (strcmp(argv[i], "--max-frame-size") == 0 && i + 1 < argc) {
+            long size = atol(argv[++i]);
+            if (size < 1 || size > UINT32_MAX) {
+                fprintf(stderr, "--max-frame-size must be between 1 and %u bytes\n", UINT32_MAX);
+                return -1;
+            }
+            max_frame_size = size;
+        } else if (strcmp(argv[i], "--live-window") == 0 && i + 1 < argc) {
+            long size = atol(argv[++i]);
+            if (size < 1) {
+                fprintf(stderr, "--live-window must be a positive number of bytes\n");
+                return -1;
+            }
+            live_window = size;
+        } else if (strcmp(argv[i], "--shm-ring-size") == 0 && i + 1 < argc) {
+            long size = atol(argv[++i]);
+            if (size < 0 || size > UINT32_MAX) {
+                fprintf(stderr, "--shm-ring-size must be between 0 (no rings) and %u bytes\n",
+                        UINT32_MAX);
+                return -1;
+            }
+            shm_ring_size = size;
+        } else if (strcmp(argv[i], "--record") == 0) {
+            record_to_disk = 1;
+        } else if (strcmp(argv[i], "--live-port") == 0 && i + 1 < argc) {
+            live_port = atoi(argv[++i]);
+            if (live_port < 1 || live_port > 65535) {
+                fprintf(stderr, "--live-port must be between 1 and 65535\n");
+                return -1;
+            }
+        } else {
+            fprintf(stderr, "Usage: %s [--record] [--ring-depth N] [--live-port PORT] "
+                    "[--max-frame-size BYTES] [--live-window BYTES] [--shm-ring-size BYTES]\n", argv[0]);
+            return -1;
+        }
+    }
+
+    print_info("Starting MANET Video Server...");
+    frame_pool_init();
+
+    // Create Unix Domain Socket
+    video_server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (video_server_fd == -1) {
+        print_error("Failed to create socket");
+        perror("socket");
+        return -1;
+    }
+
+    // Remove existing socket file
+    unlink(SOCKET_PATH);
+
+    // Set up socket address
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sun_family = AF_UNIX;
+    strcpy(server_addr.sun_path, SOCKET_PATH);
+
+    // Bind socket
+    if (bind(video_server_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+        print_error("Failed to bind socket");
+        perror("bind");
+        close(video_server_fd);
+        return -1;
+    }
+
+    // Listen for connections
+    if (listen(video_server_fd, SOMAXCONN) == -1) {
+        print_error("Failed to listen on socket");
+        perror("listen");
+        close(video_server_fd);
+        unlink(SOCKET_PATH);
+        return -1;
+    }
+
+    if (start_live_server() == -1) {
+        print_error("Failed to start live stream server");
+        close(video_server_fd);
+        unlink(SOCKET_PATH);
+        return -1;
+    }
+
+    // Every client is served from the event loop's thread. Only it allocates
+    // frames, which keeps the frame pool single-consumer; the writer and
+    // fan-out threads take the frames from there.
+    video_listener.on_event = video_listener_event;
+    video_listener.qos_class = SDR_CLASS_VIDEO;
+    if (sdr_loop_add(video_server_fd, EPOLLIN, &video_listener) == -1) {
+        perror("epoll");
+        close(video_server_fd);
+        unlink(SOCKET_PATH);
+        return -1;
+    }
+
+    sdr_stat_register("video", "sessions_accepted", &video_sessions_accepted);
+    sdr_stat_register("video", "frames_received", &video_frames_received);
+    sdr_stat_register("video", "ring_frames", &video_ring_frames);
+    sdr_counter_register("video", "bytes_recorded", &video_bytes_recorded);
+    video_accept_time = sdr_histogram_register("video", "accept");
+    video_recv_time = sdr_histogram_register("video", "recv");
+    video_parse_time = sdr_histogram_register("video", "parse");
+    video_write_time = sdr_histogram_register("video", "write");
+
+    print_success("Video server listening on " SOCKET_PATH);
+    printf(BLUE "[INFO]" RESET " Live streams at http://127.0.0.1:%d" LIVE_PATH
+           " (stream 0) and http://127.0.0.1:%d/live/<stream id>.webm\n", live_port, live_port);
+    if (record_to_disk) {
+        print_info("Recording stream 0 to " WEBM_FILE
+                   " and other streams to /tmp/video_stream_<stream id>.webm");
+    }
+    print_info("Waiting for video client connections...");
+    return 0;
+}
+
+void video_service_stop(void) {
+    print_info("Received shutdown signal");
 
     // Cleanup
-    if (webm_file) {
-        fclose(webm_file);
-        webm_file = NULL;
+    while (sessions) {
+        session_close(sessions);
+    }
+    free_retired_sessions();
+    while (__atomic_load_n(&recorders_running, __ATOMIC_SEQ_CST) > 0) {
+        usleep(10000);  // Let recordings reach the disk
     }
-    close(server_socket);
+    close(video_server_fd);
     unlink(SOCKET_PATH);
-    unlink(WEBM_FILE);
     
-    // Stop any running VLC processes
-    stop_vlc_player();
+    // Stop the VLC processes we started
+    stop_vlc_players();
     
     print_success("Video server shutdown complete");
+}
 
-    return 0;
+struct sdr_service video_service = {"video", video_service_start, free_retired_sessions,
+                                    video_service_stop};
+
+#ifndef SDR_DAEMON
+int main(int argc, char* argv[]) {
+    return sdr_service_main(&video_service, argc, argv);
 }
+#endif